@@ -31,11 +31,15 @@ struct md_pkey_spec_t;
 
 #define MD_PKEY_RSA_BITS_MIN       2048
 #define MD_PKEY_RSA_BITS_DEF       2048
+#define MD_PKEY_EC_CURVE_DEF       "P-256"
+#define MD_PKEY_STOCK_MAX          8
 
 /* Minimum age for the HSTS header (RFC 6797), considered appropriate by Mozilla Security */
 #define MD_HSTS_HEADER             "Strict-Transport-Security"
 #define MD_HSTS_MAX_AGE_DEFAULT    15768000
 
+#define MD_MAX_REQUESTS_DEF        8
+
 typedef enum {
     MD_S_UNKNOWN,                   /* MD has not been analysed yet */
     MD_S_INCOMPLETE,                /* MD is missing necessary information, cannot go live */
@@ -68,6 +72,7 @@ typedef enum {
     MD_SG_STAGING,
     MD_SG_ARCHIVE,
     MD_SG_TMP,
+    MD_SG_CACHE,
     MD_SG_COUNT,
 } md_store_group_t;
 
@@ -119,12 +124,14 @@ struct md_t {
 #define MD_KEY_CONTACT          "contact"
 #define MD_KEY_CONTACTS         "contacts"
 #define MD_KEY_CSR              "csr"
+#define MD_KEY_CURVE            "curve"
 #define MD_KEY_DISABLED         "disabled"
 #define MD_KEY_DIR              "dir"
 #define MD_KEY_DOMAIN           "domain"
 #define MD_KEY_DOMAINS          "domains"
 #define MD_KEY_DRIVE_MODE       "drive-mode"
 #define MD_KEY_EXPIRES          "expires"
+#define MD_KEY_FORMAT           "format"
 #define MD_KEY_HTTP             "http"
 #define MD_KEY_HTTPS            "https"
 #define MD_KEY_ID               "id"
@@ -19,7 +19,9 @@
 #include <apr_lib.h>
 #include <apr_strings.h>
 #include <apr_buckets.h>
+#include <apr_date.h>
 #include <apr_hash.h>
+#include <apr_thread_mutex.h>
 #include <apr_uri.h>
 
 #include "md.h"
@@ -84,9 +86,354 @@ static apr_status_t problem_status_get(const char *type) {
     return APR_EGENERAL;
 }
 
+/**************************************************************************************************/
+/* directory cache */
+
+/* The directory of a CA, shared by all md_acme_t instances in the process. */
+typedef struct {
+    const char *url;
+    const char *new_authz;
+    const char *new_cert;
+    const char *new_reg;
+    const char *revoke_cert;
+    const char *etag;
+    const char *last_modified;
+    apr_time_t fetched;
+} acme_dir_t;
+
+#define MD_FN_ACME_DIRS     "acme-dirs.json"
+#define MD_ACME_DIR_TTL     apr_time_from_sec(MD_SECS_PER_DAY)
+
+/* Account setup per CA, serialized among parallel drives in the process. */
+typedef struct {
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+    const char *staged_by;          /* md that staged an account created here, or NULL */
+} acct_setup_t;
+
+static apr_pool_t *dir_pool;
+static apr_hash_t *dirs;
+static apr_hash_t *acct_setups;     /* CA url -> acct_setup_t* */
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *dir_mutex;
+#endif
+
+static apr_status_t dir_cache_cleanup(void *dummy)
+{
+    (void)dummy;
+    dir_pool = NULL;
+    dirs = NULL;
+    acct_setups = NULL;
+#if APR_HAS_THREADS
+    dir_mutex = NULL;
+#endif
+    return APR_SUCCESS;
+}
+
+static apr_status_t dir_cache_init(apr_pool_t *p)
+{
+    apr_status_t rv;
+    
+    if (dir_pool) {
+        return APR_SUCCESS;
+    }
+    if (APR_SUCCESS != (rv = apr_pool_create(&dir_pool, p))) {
+        return rv;
+    }
+    apr_pool_tag(dir_pool, "md_acme_dirs");
+#if APR_HAS_THREADS
+    if (APR_SUCCESS != (rv = apr_thread_mutex_create(&dir_mutex, 
+                                                     APR_THREAD_MUTEX_DEFAULT, dir_pool))) {
+        apr_pool_destroy(dir_pool);
+        dir_pool = NULL;
+        return rv;
+    }
+#endif
+    dirs = apr_hash_make(dir_pool);
+    acct_setups = apr_hash_make(dir_pool);
+    apr_pool_cleanup_register(dir_pool, NULL, dir_cache_cleanup, apr_pool_cleanup_null);
+    return APR_SUCCESS;
+}
+
+static void dir_lock(void)
+{
+#if APR_HAS_THREADS
+    if (dir_mutex) apr_thread_mutex_lock(dir_mutex);
+#endif
+}
+
+static void dir_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (dir_mutex) apr_thread_mutex_unlock(dir_mutex);
+#endif
+}
+
+static acct_setup_t *acct_setup_get(md_acme_t *acme)
+{
+    acct_setup_t *setup = NULL;
+    
+    dir_lock();
+    if (acct_setups 
+        && NULL == (setup = apr_hash_get(acct_setups, acme->url, APR_HASH_KEY_STRING))) {
+        setup = apr_pcalloc(dir_pool, sizeof(*setup));
+#if APR_HAS_THREADS
+        if (APR_SUCCESS != apr_thread_mutex_create(&setup->mutex, 
+                                                   APR_THREAD_MUTEX_DEFAULT, dir_pool)) {
+            setup->mutex = NULL;
+        }
+#endif
+        apr_hash_set(acct_setups, apr_pstrdup(dir_pool, acme->url), APR_HASH_KEY_STRING, setup);
+    }
+    dir_unlock();
+    return setup;
+}
+
+void md_acme_acct_setup_lock(md_acme_t *acme)
+{
+#if APR_HAS_THREADS
+    acct_setup_t *setup = acct_setup_get(acme);
+    if (setup && setup->mutex) apr_thread_mutex_lock(setup->mutex);
+#else
+    (void)acme;
+#endif
+}
+
+void md_acme_acct_setup_unlock(md_acme_t *acme)
+{
+#if APR_HAS_THREADS
+    acct_setup_t *setup = acct_setup_get(acme);
+    if (setup && setup->mutex) apr_thread_mutex_unlock(setup->mutex);
+#else
+    (void)acme;
+#endif
+}
+
+const char *md_acme_acct_staged_by(md_acme_t *acme)
+{
+    acct_setup_t *setup = acct_setup_get(acme);
+    return setup? setup->staged_by : NULL;
+}
+
+void md_acme_acct_set_staged_by(md_acme_t *acme, const char *md_name)
+{
+    acct_setup_t *setup = acct_setup_get(acme);
+    
+    if (setup) {
+        dir_lock();
+        setup->staged_by = md_name? apr_pstrdup(dir_pool, md_name) : NULL;
+        dir_unlock();
+    }
+}
+
+static const char *dir_dups(md_json_t *json, const char *key, apr_pool_t *p)
+{
+    const char *s = md_json_gets(json, key, NULL);
+    return s? apr_pstrdup(p, s) : NULL;
+}
+
+/* Create a directory entry from the JSON the CA sent or we stored. Call with lock held. */
+static acme_dir_t *dir_from_json(const char *url, md_json_t *json)
+{
+    acme_dir_t *dir;
+    const char *s;
+    
+    dir = apr_pcalloc(dir_pool, sizeof(*dir));
+    dir->url = apr_pstrdup(dir_pool, url);
+    dir->new_authz = dir_dups(json, "new-authz", dir_pool);
+    dir->new_cert = dir_dups(json, "new-cert", dir_pool);
+    dir->new_reg = dir_dups(json, "new-reg", dir_pool);
+    dir->revoke_cert = dir_dups(json, "revoke-cert", dir_pool);
+    if (!dir->new_authz || !dir->new_cert || !dir->new_reg || !dir->revoke_cert) {
+        return NULL;
+    }
+    dir->etag = dir_dups(json, "etag", dir_pool);
+    dir->last_modified = dir_dups(json, "last-modified", dir_pool);
+    s = md_json_gets(json, "fetched", NULL);
+    dir->fetched = s? apr_date_parse_rfc(s) : 0;
+    return dir;
+}
+
+static md_json_t *dir_to_json(acme_dir_t *dir, apr_pool_t *p)
+{
+    md_json_t *json = md_json_create(p);
+    char ts[APR_RFC822_DATE_LEN];
+    
+    md_json_sets(dir->new_authz, json, "new-authz", NULL);
+    md_json_sets(dir->new_cert, json, "new-cert", NULL);
+    md_json_sets(dir->new_reg, json, "new-reg", NULL);
+    md_json_sets(dir->revoke_cert, json, "revoke-cert", NULL);
+    if (dir->etag) md_json_sets(dir->etag, json, "etag", NULL);
+    if (dir->last_modified) md_json_sets(dir->last_modified, json, "last-modified", NULL);
+    apr_rfc822_date(ts, dir->fetched);
+    md_json_sets(ts, json, "fetched", NULL);
+    return json;
+}
+
+/* Look up the directory in memory, then in the store. Call with lock held. */
+static acme_dir_t *dir_lookup(md_acme_t *acme)
+{
+    acme_dir_t *dir;
+    md_json_t *json, *jdir;
+    
+    dir = apr_hash_get(dirs, acme->url, APR_HASH_KEY_STRING);
+    if (!dir && acme->store
+        && APR_SUCCESS == md_store_load_json(acme->store, MD_ACME_DIRS_GROUP, MD_ACME_DIRS_NAME, 
+                                             MD_FN_ACME_DIRS, &json, acme->p)
+        && (jdir = md_json_getj(json, acme->url, NULL))
+        && (dir = dir_from_json(acme->url, jdir))) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, acme->p, 
+                      "directory of %s loaded from store", acme->url);
+        apr_hash_set(dirs, dir->url, APR_HASH_KEY_STRING, dir);
+    }
+    return dir;
+}
+
+static void dir_persist(md_acme_t *acme, acme_dir_t *dir)
+{
+    md_json_t *json;
+    apr_status_t rv;
+    
+    if (!acme->store) {
+        return;
+    }
+    if (APR_SUCCESS != md_store_load_json(acme->store, MD_ACME_DIRS_GROUP, MD_ACME_DIRS_NAME, 
+                                          MD_FN_ACME_DIRS, &json, acme->p)) {
+        json = md_json_create(acme->p);
+    }
+    md_json_setj(dir_to_json(dir, acme->p), json, acme->url, NULL);
+    rv = md_store_save_json(acme->store, acme->p, MD_ACME_DIRS_GROUP, MD_ACME_DIRS_NAME, 
+                            MD_FN_ACME_DIRS, json, 0);
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, acme->p, 
+                      "unable to save directory of %s", acme->url);
+    }
+    else {
+        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv, acme->p, "saved directory of %s", 
+                      acme->url);
+    }
+}
+
+static void dir_use(md_acme_t *acme, acme_dir_t *dir)
+{
+    acme->new_authz = dir->new_authz;
+    acme->new_cert = dir->new_cert;
+    acme->new_reg = dir->new_reg;
+    acme->revoke_cert = dir->revoke_cert;
+}
+
+typedef struct {
+    md_acme_t *acme;
+    int status;
+    md_json_t *json;
+    const char *etag;
+    const char *last_modified;
+} dir_fetch_ctx;
+
+static apr_status_t on_dir_response(const md_http_response_t *res)
+{
+    dir_fetch_ctx *ctx = res->req->baton;
+    apr_status_t rv = res->rv;
+    
+    if (APR_SUCCESS != rv) {
+        return rv;
+    }
+    ctx->status = res->status;
+    if (res->status == 200) {
+        const char *s;
+        
+        if (APR_SUCCESS == (rv = md_json_read_http(&ctx->json, ctx->acme->p, res))) {
+            s = apr_table_get(res->headers, "ETag");
+            ctx->etag = s? apr_pstrdup(ctx->acme->p, s) : NULL;
+            s = apr_table_get(res->headers, "Last-Modified");
+            ctx->last_modified = s? apr_pstrdup(ctx->acme->p, s) : NULL;
+        }
+        return rv;
+    }
+    return (res->status == 304)? APR_SUCCESS : APR_EINVAL;
+}
+
+/* Get the CA directory, from the cache if fresh, revalidating it otherwise. */
+static apr_status_t dir_get(md_acme_t *acme)
+{
+    acme_dir_t *dir;
+    apr_table_t *headers;
+    dir_fetch_ctx ctx;
+    apr_time_t now = apr_time_now();
+    apr_status_t rv;
+    long id;
+    
+    if (!dirs) {
+        return APR_ENOENT;
+    }
+    
+    dir_lock();
+    dir = dir_lookup(acme);
+    if (dir && (now - dir->fetched) < MD_ACME_DIR_TTL) {
+        dir_use(acme, dir);
+        dir_unlock();
+        return APR_SUCCESS;
+    }
+    headers = apr_table_make(acme->p, 2);
+    if (dir && dir->etag) {
+        apr_table_setn(headers, "If-None-Match", apr_pstrdup(acme->p, dir->etag));
+    }
+    if (dir && dir->last_modified) {
+        apr_table_setn(headers, "If-Modified-Since", apr_pstrdup(acme->p, dir->last_modified));
+    }
+    dir_unlock();
+    
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, acme->p, "get directory from %s%s", 
+                  acme->url, dir? " (revalidate)" : "");
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.acme = acme;
+    rv = md_http_GET(acme->http, acme->url, headers, on_dir_response, &ctx, &id);
+    if (APR_SUCCESS == rv) {
+        rv = md_http_await(acme->http, id);
+    }
+    
+    dir_lock();
+    if (APR_SUCCESS == rv && ctx.status == 200 && ctx.json) {
+        if (NULL == (dir = dir_from_json(acme->url, ctx.json))) {
+            rv = APR_EINVAL;
+            goto out;
+        }
+        dir->etag = ctx.etag? apr_pstrdup(dir_pool, ctx.etag) : NULL;
+        dir->last_modified = ctx.last_modified? apr_pstrdup(dir_pool, ctx.last_modified) : NULL;
+        dir->fetched = now;
+        apr_hash_set(dirs, dir->url, APR_HASH_KEY_STRING, dir);
+        dir_persist(acme, dir);
+    }
+    else if (APR_SUCCESS == rv && ctx.status == 304 && dir) {
+        dir->fetched = now;
+        dir_persist(acme, dir);
+    }
+    else if (dir) {
+        /* cannot reach the CA, the directory we know is better than nothing */
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, acme->p, 
+                      "revalidating directory of %s failed, using known one", acme->url);
+        rv = APR_SUCCESS;
+    }
+    else if (APR_SUCCESS == rv) {
+        rv = APR_EINVAL;
+    }
+    if (APR_SUCCESS == rv) {
+        dir_use(acme, dir);
+    }
+out:
+    dir_unlock();
+    return rv;
+}
+
 apr_status_t md_acme_init(apr_pool_t *p, const char *base)
 {
+    apr_status_t rv;
+    
     base_product = base;
+    if (APR_SUCCESS != (rv = dir_cache_init(p))) {
+        return rv;
+    }
     return md_crypt_init(p);
 }
 
@@ -116,6 +463,8 @@ apr_status_t md_acme_create(md_acme_t **pacme, apr_pool_t *p, const char *url,
                                     base_product, MOD_MD_VERSION);
     acme->proxy_url = proxy_url? apr_pstrdup(p, proxy_url) : NULL;
     acme->max_retries = 3;
+    acme->nonces = apr_array_make(p, 5, sizeof(const char *));
+    acme->retries = apr_array_make(p, 5, sizeof(md_acme_req_t *));
     
     if (APR_SUCCESS != (rv = apr_uri_parse(p, url, &uri_parsed))) {
         md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "parsing ACME uri: ", url);
@@ -141,6 +490,10 @@ apr_status_t md_acme_setup(md_acme_t *acme)
     }
     md_http_set_response_limit(acme->http, 1024*1024);
     
+    if (!APR_STATUS_IS_ENOENT(rv = dir_get(acme))) {
+        return rv;
+    }
+    
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, acme->p, "get directory from %s", acme->url);
     
     rv = md_acme_get_json(&json, acme, acme->url, acme->p);
@@ -160,38 +513,87 @@ apr_status_t md_acme_setup(md_acme_t *acme)
 /**************************************************************************************************/
 /* acme requests */
 
-static void req_update_nonce(md_acme_t *acme, apr_table_t *hdrs)
+/* Nonces are kept in a pool, filled from every response the server sends. When requests
+ * are sent in a batch, the pool is refilled ahead of time, so that concurrent POSTs 
+ * do not wait for one another to get a fresh nonce. The pool holds at most NONCE_MAX, 
+ * the oldest ones are dropped as they are the first to expire at the server. */
+#define NONCE_MAX               16
+
+static int nonce_low_water(md_acme_t *acme)
 {
-    if (hdrs) {
-        const char *nonce = apr_table_get(hdrs, "Replay-Nonce");
-        if (nonce) {
-            acme->nonce = apr_pstrdup(acme->p, nonce);
-        }
+    if (acme->max_inflight <= 0) {
+        return 4;
     }
+    return (acme->max_inflight < NONCE_MAX)? acme->max_inflight : NONCE_MAX - 1;
 }
 
-static apr_status_t http_update_nonce(const md_http_response_t *res)
+static void nonce_add(md_acme_t *acme, const apr_table_t *hdrs)
 {
-    if (res->headers) {
-        const char *nonce = apr_table_get(res->headers, "Replay-Nonce");
-        if (nonce) {
-            md_acme_t *acme = res->req->baton;
-            acme->nonce = apr_pstrdup(acme->p, nonce);
+    const char *nonce, **nonces;
+    
+    if (hdrs && (nonce = apr_table_get(hdrs, "Replay-Nonce"))) {
+        if (acme->nonces->nelts >= NONCE_MAX) {
+            nonces = (const char **)acme->nonces->elts;
+            memmove(nonces, nonces + 1, (size_t)(acme->nonces->nelts - 1) * sizeof(*nonces));
+            --acme->nonces->nelts;
         }
+        APR_ARRAY_PUSH(acme->nonces, const char *) = apr_pstrdup(acme->p, nonce);
     }
+}
+
+static apr_status_t on_nonce_head(const md_http_response_t *res)
+{
+    md_acme_t *acme = res->req->baton;
+    
+    if (acme->nonce_prefetch > 0) {
+        --acme->nonce_prefetch;
+    }
+    nonce_add(acme, res->headers);
     return res->rv;
 }
 
-static apr_status_t md_acme_new_nonce(md_acme_t *acme)
+static apr_status_t nonce_request(md_acme_t *acme, long *pid)
 {
     apr_status_t rv;
-    long id;
     
-    rv = md_http_HEAD(acme->http, acme->new_reg, NULL, http_update_nonce, acme, &id);
-    md_http_await(acme->http, id);
+    rv = md_http_HEAD(acme->http, acme->new_reg, NULL, on_nonce_head, acme, pid);
+    if (APR_SUCCESS == rv && acme->batching) {
+        ++acme->nonce_prefetch;
+    }
     return rv;
 }
 
+static apr_status_t nonce_get(const char **pnonce, md_acme_t *acme)
+{
+    apr_status_t rv = APR_SUCCESS;
+    long id = -1;
+    int i, missing;
+    
+    if (acme->batching) {
+        /* keep enough nonces coming for the requests in flight */
+        missing = nonce_low_water(acme) + 1 - acme->nonces->nelts - acme->nonce_prefetch;
+        for (i = 0; i < missing && APR_SUCCESS == rv; ++i) {
+            rv = nonce_request(acme, &id);
+        }
+    }
+    if (APR_SUCCESS == rv && apr_is_empty_array(acme->nonces)) {
+        if (id < 0) {
+            rv = nonce_request(acme, &id);
+        }
+        if (APR_SUCCESS == rv) {
+            rv = md_http_await(acme->http, id);
+        }
+    }
+    if (apr_is_empty_array(acme->nonces)) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, acme->p, "no nonce from %s", acme->url);
+        *pnonce = NULL;
+        return (APR_SUCCESS == rv)? APR_EGENERAL : rv;
+    }
+    /* most recent first, older ones are more likely to have expired */
+    *pnonce = *(const char **)apr_array_pop(acme->nonces);
+    return APR_SUCCESS;
+}
+
 static md_acme_req_t *md_acme_req_create(md_acme_t *acme, const char *method, const char *url)
 {
     apr_pool_t *pool;
@@ -313,7 +715,7 @@ static apr_status_t on_response(const md_http_response_t *res)
     }
     
     req->resp_hdrs = apr_table_clone(req->p, res->headers);
-    req_update_nonce(req->acme, res->headers);
+    nonce_add(req->acme, res->headers);
     
     md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv, req->p, "response: %d", res->status);
     if (res->status >= 200 && res->status < 300) {
@@ -354,6 +756,12 @@ static apr_status_t on_response(const md_http_response_t *res)
         }
     }
     else if (APR_EAGAIN == (rv = inspect_problem(req, res))) {
+        if (req->acme->batching && req->max_retries > 0) {
+            /* e.g. badNonce, send again when the batch ends */
+            --req->max_retries;
+            APR_ARRAY_PUSH(req->acme->retries, md_acme_req_t *) = req;
+            return APR_SUCCESS;
+        }
         /* leave req alive */
         return rv;
     }
@@ -367,41 +775,40 @@ static apr_status_t md_acme_req_send(md_acme_req_t *req)
 {
     apr_status_t rv;
     md_acme_t *acme = req->acme;
-    const char *body = NULL;
+    apr_bucket_brigade *body = NULL;
 
     assert(acme->url);
     
     if (strcmp("GET", req->method) && strcmp("HEAD", req->method)) {
+        const char *nonce;
+        
         if (!acme->new_authz) {
             if (APR_SUCCESS != (rv = md_acme_setup(acme))) {
                 return rv;
             }
         }
-        if (!acme->nonce) {
-            if (APR_SUCCESS != (rv = md_acme_new_nonce(acme))) {
-                return rv;
-            }
+        if (APR_SUCCESS != (rv = nonce_get(&nonce, acme))) {
+            return rv;
         }
-        
-        apr_table_set(req->prot_hdrs, "nonce", acme->nonce);
-        acme->nonce = NULL;
+        apr_table_set(req->prot_hdrs, "nonce", nonce);
     }
     
     rv = req->on_init? req->on_init(req, req->baton) : APR_SUCCESS;
     
     if ((rv == APR_SUCCESS) && req->req_json) {
-        body = md_json_writep(req->req_json, req->p, MD_JSON_FMT_INDENT);
-        if (!body) {
-            rv = APR_EINVAL;
-        }
+        /* stream the compact JSON right into the request body */
+        body = apr_brigade_create(req->p, md_http_get_bucket_alloc(acme->http));
+        rv = md_json_writeb(req->req_json, MD_JSON_FMT_COMPACT, body);
     }
 
     if (rv == APR_SUCCESS) {
         long id = 0;
         
         if (body && md_log_is_level(req->p, MD_LOG_TRACE2)) {
+            const char *s = md_json_writep(req->req_json, req->p, MD_JSON_FMT_INDENT);
             md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, req->p, 
-                          "req: POST %s, body:\n%s", req->url, body);
+                          "req: POST %s, body:\n%s", req->url, 
+                          s ? s : "<failed to serialize!>");
         }
         else {
             md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, req->p, 
@@ -411,8 +818,8 @@ static apr_status_t md_acme_req_send(md_acme_req_t *req)
             rv = md_http_GET(req->acme->http, req->url, NULL, on_response, req, &id);
         }
         else if (!strcmp("POST", req->method)) {
-            rv = md_http_POSTd(req->acme->http, req->url, NULL, "application/json",  
-                               body, body? strlen(body) : 0, on_response, req, &id);
+            rv = md_http_POST(req->acme->http, req->url, NULL, "application/json",  
+                              body, on_response, req, &id);
         }
         else if (!strcmp("HEAD", req->method)) {
             rv = md_http_HEAD(req->acme->http, req->url, NULL, on_response, req, &id);
@@ -423,6 +830,10 @@ static apr_status_t md_acme_req_send(md_acme_req_t *req)
             rv = APR_ENOTIMPL;
         }
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, req->p, "req sent");
+        if (acme->batching) {
+            /* response is processed when the batch ends */
+            return rv;
+        }
         md_http_await(acme->http, id);
         
         if (APR_EAGAIN == rv && req->max_retries > 0) {
@@ -480,6 +891,54 @@ apr_status_t md_acme_GET(md_acme_t *acme, const char *url,
     return md_acme_req_send(req);
 }
 
+apr_status_t md_acme_batch_begin(md_acme_t *acme)
+{
+    apr_status_t rv;
+    
+    if (!acme->http && APR_SUCCESS != (rv = md_acme_setup(acme))) {
+        return rv;
+    }
+    acme->batching = 1;
+    acme->nonce_prefetch = 0;
+    md_http_set_max_inflight(acme->http, acme->max_inflight);
+    md_http_set_async(acme->http, 1);
+    return APR_SUCCESS;
+}
+
+apr_status_t md_acme_batch_end(md_acme_t *acme)
+{
+    apr_status_t rv = APR_SUCCESS, rv2;
+    md_acme_req_t *req;
+    apr_array_header_t *retries;
+    int i;
+    
+    while (acme->batching) {
+        rv2 = md_http_await_all(acme->http);
+        if (APR_SUCCESS == rv) {
+            rv = rv2;
+        }
+        if (apr_is_empty_array(acme->retries)) {
+            break;
+        }
+        /* requests that failed with a stale nonce or similar, try them again */
+        retries = apr_array_copy(acme->p, acme->retries);
+        apr_array_clear(acme->retries);
+        for (i = 0; i < retries->nelts; ++i) {
+            req = APR_ARRAY_IDX(retries, i, md_acme_req_t *);
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, req->p, "retry %s", req->url);
+            if (APR_SUCCESS != (rv2 = md_acme_req_send(req)) && APR_SUCCESS == rv) {
+                rv = rv2;
+            }
+        }
+    }
+    if (acme->batching) {
+        md_http_set_async(acme->http, 0);
+        acme->batching = 0;
+        acme->nonce_prefetch = 0;
+    }
+    return rv;
+}
+
 /**************************************************************************************************/
 /* GET JSON */
 
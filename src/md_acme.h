@@ -23,6 +23,7 @@ struct apr_hash_t;
 struct md_http_t;
 struct md_json_t;
 struct md_pkey_t;
+struct md_pkey_spec_t;
 struct md_t;
 struct md_acme_acct_t;
 struct md_proto_t;
@@ -53,6 +54,7 @@ struct md_acme_t {
     const char *proxy_url;
     struct md_acme_acct_t *acct;
     struct md_pkey_t *acct_key;
+    struct md_pkey_spec_t *acct_key_spec; /* key type for new accounts, NULL for RSA default */
     
     const char *new_authz;
     const char *new_cert;
@@ -60,9 +62,14 @@ struct md_acme_t {
     const char *revoke_cert;
     
     struct md_http_t *http;
+    struct md_store_t *store;       /* optional, for persisting the CA directory */
     
-    const char *nonce;
+    struct apr_array_header_t *nonces; /* unused nonces, collected from all responses */
+    int nonce_prefetch;             /* number of requests for new nonces in flight */
     int max_retries;
+    int batching;                   /* != 0 while requests are sent in a batch */
+    int max_inflight;               /* max number of batch requests open at a time, 0 unlimited */
+    struct apr_array_header_t *retries; /* batch requests to send again when the batch ends */
 };
 
 /**
@@ -90,6 +97,11 @@ apr_status_t md_acme_create(md_acme_t **pacme, apr_pool_t *p, const char *url,
  */
 apr_status_t md_acme_setup(md_acme_t *acme);
 
+/* The directories of CAs are persisted in the cache group of the store, where whoever
+ * drives the mds (the watchdog child under httpd) can write them. */
+#define MD_ACME_DIRS_GROUP      MD_SG_CACHE
+#define MD_ACME_DIRS_NAME       "acme"
+
 /**************************************************************************************************/
 /* account handling */
 
@@ -106,8 +118,22 @@ apr_status_t md_acme_acct_load(struct md_acme_acct_t **pacct, struct md_pkey_t *
 apr_status_t md_acme_use_acct(md_acme_t *acme, struct md_store_t *store, 
                               apr_pool_t *p, const char *acct_id);
 
+/**
+ * Use the account staged for the md with the given name.
+ */
 apr_status_t md_acme_use_acct_staged(md_acme_t *acme, struct md_store_t *store, 
-                                     md_t *md, apr_pool_t *p);
+                                     const char *md_name, apr_pool_t *p);
+
+/**
+ * Serialize choosing and creating an account for the CA of acme among the threads
+ * of the process, so that mds driven in parallel do not each register a new account.
+ * While holding the lock, md_acme_acct_staged_by() gives the md that last staged an
+ * account created in this process, which may be shared until it is saved for good.
+ */
+void md_acme_acct_setup_lock(md_acme_t *acme);
+void md_acme_acct_setup_unlock(md_acme_t *acme);
+const char *md_acme_acct_staged_by(md_acme_t *acme);
+void md_acme_acct_set_staged_by(md_acme_t *acme, const char *md_name);
 
 /**
  * Get the local name of the account currently used by the acme instance.
@@ -252,6 +278,20 @@ apr_status_t md_acme_GET(md_acme_t *acme, const char *url,
                          md_acme_req_res_cb *on_res,
                          void *baton);
 
+/**
+ * Start a batch of requests. Until md_acme_batch_end() is called, md_acme_GET()
+ * and md_acme_POST() return once the request has been submitted and their
+ * callbacks are invoked as responses arrive, so that requests run concurrently.
+ * Callbacks therefore need batons that live until the batch has ended.
+ */
+apr_status_t md_acme_batch_begin(md_acme_t *acme);
+
+/**
+ * Wait for all requests of the current batch to be done. Returns APR_SUCCESS
+ * or the first failure reported by a request.
+ */
+apr_status_t md_acme_batch_end(md_acme_t *acme);
+
 /**
  * Retrieve a JSON resource from the ACME server 
  */
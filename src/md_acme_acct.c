@@ -349,8 +349,13 @@ static apr_status_t acct_register(md_acme_t *acme, apr_pool_t *p,
         }
     }
     
-    spec.type = MD_PKEY_TYPE_RSA;
-    spec.params.rsa.bits = MD_ACME_ACCT_PKEY_BITS;
+    if (acme->acct_key_spec && acme->acct_key_spec->type == MD_PKEY_TYPE_EC) {
+        spec = *acme->acct_key_spec;
+    }
+    else {
+        spec.type = MD_PKEY_TYPE_RSA;
+        spec.params.rsa.bits = MD_ACME_ACCT_PKEY_BITS;
+    }
     
     if (APR_SUCCESS == (rv = md_pkey_gen(&pkey, acme->p, &spec))
         && APR_SUCCESS == (rv = acct_make(&acme->acct,  p, acme->url, NULL, contacts))) {
@@ -405,9 +410,11 @@ static apr_status_t acct_valid(md_acme_t *acme, apr_pool_t *p, const apr_table_t
     md_json_getsa(acct->contacts, body, MD_KEY_CONTACT, NULL);
     acct->registration = md_json_clone(acme->p, body);
     
-    body_str = md_json_writep(body, acme->p, MD_JSON_FMT_INDENT);
-    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, acme->p, "validate acct %s: %s", 
-                  acct->url, body_str ? body_str : "<failed to serialize!>");
+    if (md_log_is_level(acme->p, MD_LOG_DEBUG)) {
+        body_str = md_json_writep(body, acme->p, MD_JSON_FMT_INDENT);
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, acme->p, "validate acct %s: %s", 
+                      acct->url, body_str ? body_str : "<failed to serialize!>");
+    }
     
     acct->agreement = md_json_gets(acct->registration, MD_KEY_AGREEMENT, NULL);
     tos_required = md_link_find_relation(hdrs, acme->p, "terms-of-service");
@@ -481,14 +488,14 @@ apr_status_t md_acme_use_acct(md_acme_t *acme, md_store_t *store,
 }
 
 apr_status_t md_acme_use_acct_staged(md_acme_t *acme, struct md_store_t *store, 
-                                     md_t *md, apr_pool_t *p)
+                                     const char *md_name, apr_pool_t *p)
 {
     md_acme_acct_t *acct;
     md_pkey_t *pkey;
     apr_status_t rv;
     
     if (APR_SUCCESS == (rv = md_acme_acct_load(&acct, &pkey, 
-                                               store, MD_SG_STAGING, md->name, acme->p))) {
+                                               store, MD_SG_STAGING, md_name, acme->p))) {
         acme->acct = acct;
         acme->acct_key = pkey;
         rv = acct_validate(acme, NULL, p);
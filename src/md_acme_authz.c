@@ -94,7 +94,7 @@ apr_status_t md_acme_authz_set_remove(md_acme_authz_set_t *set, const char *doma
             int n = i + 1;
             if (n < set->authzs->nelts) {
                 void **elems = (void **)set->authzs->elts;
-                memmove(elems + i, elems + n, (size_t)(set->authzs->nelts - n)); 
+                memmove(elems + i, elems + n, (size_t)(set->authzs->nelts - n) * sizeof(*elems)); 
             }
             --set->authzs->nelts;
             return APR_SUCCESS;
@@ -184,27 +184,51 @@ apr_status_t md_acme_authz_register(struct md_acme_authz_t **pauthz, md_acme_t *
     return rv;
 }
 
-/**************************************************************************************************/
-/* Update an exiosting authorization */
-
-apr_status_t md_acme_authz_update(md_acme_authz_t *authz, md_acme_t *acme, 
-                                  md_store_t *store, apr_pool_t *p)
+apr_status_t md_acme_authz_set_register(md_acme_authz_set_t *set, md_acme_t *acme, 
+                                        md_store_t *store, apr_array_header_t *domains,
+                                        apr_pool_t *p)
 {
-    md_json_t *json;
-    const char *s;
-    apr_status_t rv;
+    authz_req_ctx *ctxs, *ctx;
+    apr_status_t rv, rv2;
+    int i;
     
     (void)store;
-    assert(acme);
-    assert(acme->http);
-    assert(authz);
-    assert(authz->location);
-
-    if (APR_SUCCESS != (rv = md_acme_get_json(&json, acme, authz->location, p))) {
-        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "update authz for %s at %s",
-                      authz->domain, authz->location);
+    if (domains->nelts <= 0) {
+        return APR_SUCCESS;
+    }
+    if (APR_SUCCESS != (rv = md_acme_batch_begin(acme))) {
         return rv;
     }
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "create %d new authz", domains->nelts);
+    ctxs = apr_pcalloc(p, (apr_size_t)domains->nelts * sizeof(*ctxs));
+    for (i = 0; i < domains->nelts; ++i) {
+        ctx = &ctxs[i];
+        authz_req_ctx_init(ctx, acme, APR_ARRAY_IDX(domains, i, const char *), NULL, p);
+        if (APR_SUCCESS != (rv2 = md_acme_POST(acme, acme->new_authz, on_init_authz, 
+                                               authz_created, NULL, ctx))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv2, p, "create authz for %s", ctx->domain);
+        }
+    }
+    rv = md_acme_batch_end(acme);
+    
+    for (i = 0; i < domains->nelts; ++i) {
+        ctx = &ctxs[i];
+        if (ctx->authz) {
+            md_acme_authz_set_add(set, ctx->authz);
+        }
+        else if (APR_SUCCESS == rv) {
+            rv = APR_EGENERAL;
+        }
+    }
+    return rv;
+}
+
+/**************************************************************************************************/
+/* Update an exiosting authorization */
+
+static apr_status_t authz_update_json(md_acme_authz_t *authz, md_json_t *json, apr_pool_t *p)
+{
+    const char *s;
     
     authz->resource = json;
     s = md_json_gets(json, "identifier", "type", NULL);
@@ -228,6 +252,96 @@ apr_status_t md_acme_authz_update(md_acme_authz_t *authz, md_acme_t *acme,
                       "for %s in %s", s, authz->domain, authz->location);
         return APR_EINVAL;
     }
+    return APR_SUCCESS;
+}
+
+apr_status_t md_acme_authz_update(md_acme_authz_t *authz, md_acme_t *acme, 
+                                  md_store_t *store, apr_pool_t *p)
+{
+    md_json_t *json;
+    apr_status_t rv;
+    
+    (void)store;
+    assert(acme);
+    assert(acme->http);
+    assert(authz);
+    assert(authz->location);
+
+    if (APR_SUCCESS != (rv = md_acme_get_json(&json, acme, authz->location, p))) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "update authz for %s at %s",
+                      authz->domain, authz->location);
+        return rv;
+    }
+    return authz_update_json(authz, json, p);
+}
+
+typedef struct {
+    apr_pool_t *p;
+    md_acme_authz_t *authz;
+    apr_status_t rv;
+} authz_update_ctx;
+
+static apr_status_t on_authz_updated(md_acme_t *acme, apr_pool_t *p, const apr_table_t *hdrs, 
+                                     md_json_t *body, void *baton)
+{
+    authz_update_ctx *ctx = baton;
+    
+    (void)acme;
+    (void)p;
+    (void)hdrs;
+    ctx->rv = authz_update_json(ctx->authz, md_json_clone(ctx->p, body), ctx->p);
+    return ctx->rv;
+}
+
+apr_status_t md_acme_authz_set_update(md_acme_authz_set_t *set, md_acme_t *acme, 
+                                      md_store_t *store, apr_array_header_t *failed, 
+                                      apr_pool_t *p)
+{
+    authz_update_ctx *ctxs, *ctx;
+    apr_status_t rv, rv2;
+    int i;
+    
+    (void)store;
+    if (set->authzs->nelts <= 0) {
+        return APR_SUCCESS;
+    }
+    if (APR_SUCCESS != (rv = md_acme_batch_begin(acme))) {
+        return rv;
+    }
+    ctxs = apr_pcalloc(p, (apr_size_t)set->authzs->nelts * sizeof(*ctxs));
+    for (i = 0; i < set->authzs->nelts; ++i) {
+        ctx = &ctxs[i];
+        ctx->p = p;
+        ctx->authz = APR_ARRAY_IDX(set->authzs, i, md_acme_authz_t *);
+        ctx->rv = APR_INCOMPLETE;
+        if (!ctx->authz->location) {
+            ctx->rv = APR_EINVAL;
+        }
+        else if (APR_SUCCESS != (rv = md_acme_GET(acme, ctx->authz->location, NULL, 
+                                                  on_authz_updated, NULL, ctx))) {
+            ctx->rv = rv;
+        }
+    }
+    rv2 = md_acme_batch_end(acme);
+    
+    rv = APR_SUCCESS;
+    for (i = 0; i < set->authzs->nelts; ++i) {
+        ctx = &ctxs[i];
+        if (APR_INCOMPLETE == ctx->rv) {
+            /* no JSON response arrived */
+            ctx->rv = (APR_SUCCESS != rv2)? rv2 : APR_EGENERAL;
+        }
+        if (APR_SUCCESS != ctx->rv) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, ctx->rv, p, "update authz for %s at %s",
+                          ctx->authz->domain, ctx->authz->location);
+            if (failed) {
+                APR_ARRAY_PUSH(failed, md_acme_authz_t *) = ctx->authz;
+            }
+            if (APR_SUCCESS == rv) {
+                rv = ctx->rv;
+            }
+        }
+    }
     return rv;
 }
 
@@ -273,6 +387,18 @@ static apr_status_t authz_http_set(md_acme_t *acme, apr_pool_t *p, const apr_tab
     return APR_SUCCESS;
 }
 
+/* The context needs to outlive the call, the response may arrive in a batch later */
+static apr_status_t authz_notify(md_acme_authz_cha_t *cha, md_acme_authz_t *authz, 
+                                 md_acme_t *acme, apr_pool_t *p)
+{
+    authz_req_ctx *ctx;
+    
+    ctx = apr_palloc(p, sizeof(*ctx));
+    authz_req_ctx_init(ctx, acme, NULL, authz, p);
+    ctx->challenge = cha;
+    return md_acme_POST(acme, cha->uri, on_init_authz_resp, authz_http_set, NULL, ctx);
+}
+
 static apr_status_t setup_key_authz(md_acme_authz_cha_t *cha, md_acme_authz_t *authz,
                                     md_acme_t *acme, apr_pool_t *p, int *pchanged)
 {
@@ -323,13 +449,9 @@ static apr_status_t cha_http_01_setup(md_acme_authz_cha_t *cha, md_acme_authz_t
     }
     
     if (APR_SUCCESS == rv && notify_server) {
-        authz_req_ctx ctx;
-
         /* challenge is setup or was changed from previous data, tell ACME server
          * so it may (re)try verification */        
-        authz_req_ctx_init(&ctx, acme, NULL, authz, p);
-        ctx.challenge = cha;
-        rv = md_acme_POST(acme, cha->uri, on_init_authz_resp, authz_http_set, NULL, &ctx);
+        rv = authz_notify(cha, authz, acme, p);
     }
 out:
     return rv;
@@ -407,13 +529,9 @@ static apr_status_t cha_tls_sni_01_setup(md_acme_authz_cha_t *cha, md_acme_authz
     }
     
     if (APR_SUCCESS == rv && notify_server) {
-        authz_req_ctx ctx;
-
         /* challenge is setup or was changed from previous data, tell ACME server
          * so it may (re)try verification */        
-        authz_req_ctx_init(&ctx, acme, NULL, authz, p);
-        ctx.challenge = cha;
-        rv = md_acme_POST(acme, cha->uri, on_init_authz_resp, authz_http_set, NULL, &ctx);
+        rv = authz_notify(cha, authz, acme, p);
     }
 out:    
     return rv;
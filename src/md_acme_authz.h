@@ -97,6 +97,23 @@ apr_status_t md_acme_authz_set_save(struct md_store_t *store, apr_pool_t *p,
                                     md_store_group_t group, const char *md_name, 
                                     md_acme_authz_set_t *authz_set, int create);
 
+/**
+ * Register new authz for all domains at the ACME server, sending the requests 
+ * concurrently. The authz created are added to the set, even if some fail.
+ */
+apr_status_t md_acme_authz_set_register(md_acme_authz_set_t *set, struct md_acme_t *acme, 
+                                        struct md_store_t *store, 
+                                        struct apr_array_header_t *domains, apr_pool_t *p);
+
+/**
+ * Update the state of all authz in the set from the ACME server, sending the
+ * requests concurrently. Returns the first failure, all authz are updated that can be.
+ * If failed is not NULL, the authz that could not be updated are added to it.
+ */
+apr_status_t md_acme_authz_set_update(md_acme_authz_set_t *set, struct md_acme_t *acme, 
+                                      struct md_store_t *store, 
+                                      struct apr_array_header_t *failed, apr_pool_t *p);
+
 apr_status_t md_acme_authz_set_purge(struct md_store_t *store, md_store_group_t group,
                                      apr_pool_t *p, const char *md_name);
 
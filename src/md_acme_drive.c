@@ -71,17 +71,25 @@ static apr_status_t ad_set_acct(md_proto_driver_t *d)
     md_acme_driver_t *ad = d->baton;
     md_t *md = ad->md;
     apr_status_t rv = APR_SUCCESS;
-    int update = 0, acct_installed = 0;
+    const char *staged_by;
+    int update = 0, acct_installed = 0, locked = 0;
     
     ad->phase = "setup acme";
     if (!ad->acme 
         && APR_SUCCESS != (rv = md_acme_create(&ad->acme, d->p, md->ca_url, d->proxy_url))) {
         goto out;
     }
+    ad->acme->max_inflight = d->max_requests;
+    ad->acme->store = d->store;
 
     ad->phase = "choose account";
+    /* Other mds for the same CA may be driven in parallel, find or create the 
+     * account one at a time */
+    md_acme_acct_setup_lock(ad->acme);
+    locked = 1;
+    
     /* Do we have a staged (modified) account? */
-    if (APR_SUCCESS == (rv = md_acme_use_acct_staged(ad->acme, d->store, md, d->p))) {
+    if (APR_SUCCESS == (rv = md_acme_use_acct_staged(ad->acme, d->store, md->name, d->p))) {
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "re-using staged account");
         md->ca_account = MD_ACME_ACCT_STAGED;
         acct_installed = 1;
@@ -112,6 +120,17 @@ static apr_status_t ad_set_acct(md_proto_driver_t *d)
         }
     }
     
+    if (APR_SUCCESS == rv && !md->ca_account 
+        && (staged_by = md_acme_acct_staged_by(ad->acme)) && strcmp(staged_by, md->name)
+        && APR_SUCCESS == md_acme_use_acct_staged(ad->acme, d->store, staged_by, d->p)
+        && APR_SUCCESS == md_acme_acct_save_staged(ad->acme, d->store, md, d->p)) {
+        /* An account was just created for another md, not saved for good yet */
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: using account staged by %s",
+                      md->name, staged_by);
+        md->ca_account = MD_ACME_ACCT_STAGED;
+        update = 1;
+    }
+    
     if (APR_SUCCESS == rv && !md->ca_account) {
         /* 2.2 No local account exists, create a new one */
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: creating new account", 
@@ -124,15 +143,21 @@ static apr_status_t ad_set_acct(md_proto_driver_t *d)
             goto out;
         }
     
+        /* an MD using EC keys gets an EC account key as well */
+        ad->acme->acct_key_spec = md->pkey_spec;
         if (APR_SUCCESS == (rv = md_acme_create_acct(ad->acme, d->p, md->contacts, 
                                                      md->ca_agreement))
             && APR_SUCCESS == (rv = md_acme_acct_save_staged(ad->acme, d->store, md, d->p))) {
             md->ca_account = MD_ACME_ACCT_STAGED;
+            md_acme_acct_set_staged_by(ad->acme, md->name);
             update = 1;
         }
     }
     
 out:
+    if (locked) {
+        md_acme_acct_setup_unlock(ad->acme);
+    }
     if (APR_SUCCESS == rv) {
         const char *agreement = md_acme_get_agreement(ad->acme);
         /* Persist the account chosen at the md so we use the same on future runs */
@@ -162,7 +187,8 @@ static apr_status_t ad_setup_authz(md_proto_driver_t *d)
     apr_status_t rv;
     md_t *md = ad->md;
     md_acme_authz_t *authz;
-    int i, changed;
+    apr_array_header_t *failed, *missing;
+    int i, changed = 0;
     
     assert(ad->md);
     assert(ad->acme);
@@ -173,6 +199,7 @@ static apr_status_t ad_setup_authz(md_proto_driver_t *d)
      * if an AUTHZ resource is known, check if it is still valid
      * if known AUTHZ resource is not valid, remove, goto 4.1.1
      * if no AUTHZ available, create a new one for the domain, store it
+     * The requests for all domains are sent concurrently.
      */
     rv = md_acme_authz_set_load(d->store, MD_SG_STAGING, md->name, &ad->authz_set, d->p);
     if (!ad->authz_set || APR_STATUS_IS_ENOENT(rv)) {
@@ -186,46 +213,53 @@ static apr_status_t ad_setup_authz(md_proto_driver_t *d)
     }
     
     /* Remove anything we no longer need */
-    for (i = 0; i < ad->authz_set->authzs->nelts; ++i) {
+    for (i = 0; i < ad->authz_set->authzs->nelts;) {
         authz = APR_ARRAY_IDX(ad->authz_set->authzs, i, md_acme_authz_t*);
         if (!md_contains(md, authz->domain, 0)) {
             md_acme_authz_set_remove(ad->authz_set, authz->domain);
             changed = 1;
         }
+        else {
+            ++i;
+        }
+    }
+    
+    /* Check the ones we have, forget those no longer valid */
+    failed = apr_array_make(d->p, 5, sizeof(md_acme_authz_t *));
+    rv = md_acme_authz_set_update(ad->authz_set, ad->acme, d->store, failed, d->p);
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: updated %d authz, %d failed", 
+                  md->name, ad->authz_set->authzs->nelts, failed->nelts);
+    for (i = 0; i < failed->nelts; ++i) {
+        authz = APR_ARRAY_IDX(failed, i, md_acme_authz_t*);
+        md_acme_authz_set_remove(ad->authz_set, authz->domain);
+        changed = 1;
     }
     
     /* Add anything we do not already have */
-    for (i = 0; i < md->domains->nelts && APR_SUCCESS == rv; ++i) {
+    missing = apr_array_make(d->p, 5, sizeof(const char *));
+    for (i = 0; i < md->domains->nelts; ++i) {
         const char *domain = APR_ARRAY_IDX(md->domains, i, const char *);
-        changed = 0;
-        authz = md_acme_authz_set_get(ad->authz_set, domain);
-        if (authz) {
-            /* check valid */
-            rv = md_acme_authz_update(authz, ad->acme, d->store, d->p);
-            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: updated authz for %s", 
-                          md->name, domain);
-            if (APR_SUCCESS != rv) {
-                md_acme_authz_set_remove(ad->authz_set, domain);
-                authz = NULL;
-                changed = 1;
-            }
-        }
-        if (!authz) {
-            /* create new one */
-            rv = md_acme_authz_register(&authz, ad->acme, d->store, domain, d->p);
-            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: created authz for %s", 
-                          md->name, domain);
-            if (APR_SUCCESS == rv) {
-                rv = md_acme_authz_set_add(ad->authz_set, authz);
-                changed = 1;
-            }
+        if (!md_acme_authz_set_get(ad->authz_set, domain)) {
+            APR_ARRAY_PUSH(missing, const char *) = domain;
         }
     }
+    rv = APR_SUCCESS;
+    if (missing->nelts > 0) {
+        rv = md_acme_authz_set_register(ad->authz_set, ad->acme, d->store, missing, d->p);
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: created %d authz", 
+                      md->name, missing->nelts);
+        changed = 1;
+    }
     
     /* Save any changes */
-    if (APR_SUCCESS == rv && changed) {
-        rv = md_acme_authz_set_save(d->store, d->p, MD_SG_STAGING, md->name, ad->authz_set, 0);
-        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv, d->p, "%s: saved", md->name);
+    if (changed) {
+        apr_status_t rv2;
+        
+        rv2 = md_acme_authz_set_save(d->store, d->p, MD_SG_STAGING, md->name, ad->authz_set, 0);
+        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv2, d->p, "%s: saved", md->name);
+        if (APR_SUCCESS == rv) {
+            rv = rv2;
+        }
     }
     
     return rv;
@@ -246,7 +280,7 @@ static apr_status_t ad_setup_authz(md_proto_driver_t *d)
 static apr_status_t ad_start_challenges(md_proto_driver_t *d)
 {
     md_acme_driver_t *ad = d->baton;
-    apr_status_t rv = APR_SUCCESS;
+    apr_status_t rv = APR_SUCCESS, rv2;
     md_acme_authz_t *authz;
     int i, changed = 0;
     
@@ -256,16 +290,20 @@ static apr_status_t ad_start_challenges(md_proto_driver_t *d)
 
     ad->phase = "start challenges";
 
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: check %d AUTHZ", 
+                  ad->md->name, ad->authz_set->authzs->nelts);
+    if (APR_SUCCESS != (rv = md_acme_authz_set_update(ad->authz_set, ad->acme, d->store, 
+                                                      NULL, d->p))) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: check authz", ad->md->name);
+        return rv;
+    }
+    
+    /* respond to all pending challenges, the POSTs go out concurrently */
+    if (APR_SUCCESS != (rv = md_acme_batch_begin(ad->acme))) {
+        return rv;
+    }
     for (i = 0; i < ad->authz_set->authzs->nelts && APR_SUCCESS == rv; ++i) {
         authz = APR_ARRAY_IDX(ad->authz_set->authzs, i, md_acme_authz_t*);
-        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: check AUTHZ for %s", 
-                      ad->md->name, authz->domain);
-        if (APR_SUCCESS != (rv = md_acme_authz_update(authz, ad->acme, d->store, d->p))) {
-            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, d->p, "%s: check authz for %s",
-                          ad->md->name, authz->domain);
-            break;
-        }
-
         switch (authz->state) {
             case MD_ACME_AUTHZ_S_VALID:
                 break;
@@ -284,6 +322,10 @@ static apr_status_t ad_start_challenges(md_proto_driver_t *d)
                 break;
         }
     }
+    rv2 = md_acme_batch_end(ad->acme);
+    if (APR_SUCCESS == rv) {
+        rv = rv2;
+    }
     
     if (APR_SUCCESS == rv && changed) {
         rv = md_acme_authz_set_save(d->store, d->p, MD_SG_STAGING, ad->md->name, ad->authz_set, 0);
@@ -300,11 +342,12 @@ static apr_status_t check_challenges(void *baton, int attempt)
     apr_status_t rv = APR_SUCCESS;
     int i;
     
-    for (i = 0; i < ad->authz_set->authzs->nelts && APR_SUCCESS == rv; ++i) {
-        authz = APR_ARRAY_IDX(ad->authz_set->authzs, i, md_acme_authz_t*);
-        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: check AUTHZ for %s(%d. attempt)", 
-                      ad->md->name, authz->domain, attempt);
-        if (APR_SUCCESS == (rv = md_acme_authz_update(authz, ad->acme, d->store, d->p))) {
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, d->p, "%s: check %d AUTHZ (%d. attempt)", 
+                  ad->md->name, ad->authz_set->authzs->nelts, attempt);
+    if (APR_SUCCESS == (rv = md_acme_authz_set_update(ad->authz_set, ad->acme, d->store, 
+                                                      NULL, d->p))) {
+        for (i = 0; i < ad->authz_set->authzs->nelts && APR_SUCCESS == rv; ++i) {
+            authz = APR_ARRAY_IDX(ad->authz_set->authzs, i, md_acme_authz_t*);
             switch (authz->state) {
                 case MD_ACME_AUTHZ_S_VALID:
                     break;
@@ -719,8 +762,12 @@ static apr_status_t acme_stage(md_proto_driver_t *d)
     }
     
     if (renew) {
-        if (APR_SUCCESS != (rv = md_acme_create(&ad->acme, d->p, d->md->ca_url, d->proxy_url)) 
-            || APR_SUCCESS != (rv = md_acme_setup(ad->acme))) {
+        if (APR_SUCCESS == (rv = md_acme_create(&ad->acme, d->p, d->md->ca_url, d->proxy_url))) {
+            ad->acme->max_inflight = d->max_requests;
+            ad->acme->store = d->store;
+            rv = md_acme_setup(ad->acme);
+        }
+        if (APR_SUCCESS != rv) {
             md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, d->p, "%s: setup ACME(%s)", 
                           d->md->name, d->md->ca_url);
             return rv;
@@ -893,7 +940,7 @@ static apr_status_t acme_driver_stage(md_proto_driver_t *d)
 /**************************************************************************************************/
 /* ACME preload */
 
-static apr_status_t acme_preload(md_store_t *store, md_store_group_t load_group, 
+static apr_status_t acme_preload(md_store_t *store, md_store_txn_t *txn, 
                                  const char *name, const char *proxy_url, apr_pool_t *p) 
 {
     apr_status_t rv;
@@ -908,7 +955,7 @@ static apr_status_t acme_preload(md_store_t *store, md_store_group_t load_group,
      *  1. It's a format check on the input data. 
      *  2. We write back what we read, creating data with our own access permissions
      *  3. We ignore any other accumulated data in STAGING
-     *  4. Once TMP is verified, we can swap/archive groups with a rename
+     *  4. The transaction swaps/archives all of it at once on commit
      *  5. Reading/Writing the data will apply/remove any group specific data encryption.
      *     With the exemption that DOMAINS and TMP must apply the same policy/keys.
      */
@@ -939,13 +986,7 @@ static apr_status_t acme_preload(md_store_t *store, md_store_group_t load_group,
     /* Remove any authz information we have here or in MD_SG_CHALLENGES */
     md_acme_authz_set_purge(store, MD_SG_STAGING, p, name);
 
-    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
-                  "%s: staged data load, purging tmp space", name);
-    rv = md_store_purge(store, p, load_group, name);
-    if (APR_SUCCESS != rv) {
-        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "%s: error purging preload storage", name);
-        return rv;
-    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "%s: staged data load", name);
     
     if (acct) {
         md_acme_t *acme;
@@ -960,29 +1001,20 @@ static apr_status_t acme_preload(md_store_t *store, md_store_group_t load_group,
                       name, acct->id);
     }
     
-    if (APR_SUCCESS != (rv = md_save(store, p, load_group, md, 1))) {
-        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "%s: saving md json", name);
-        return rv;
-    }
-    if (APR_SUCCESS != (rv = md_pubcert_save(store, p, load_group, name, pubcert, 1))) {
-        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "%s: saving cert chain", name);
-        return rv;
-    }
-    if (APR_SUCCESS != (rv = md_pkey_save(store, p, load_group, name, privkey, 1))) {
-        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "%s: saving private key", name);
-        return rv;
-    }
+    md_store_txn_put(txn, MD_FN_MD, MD_SV_JSON, md_to_json(md, p));
+    md_store_txn_put(txn, MD_FN_PUBCERT, MD_SV_CHAIN, pubcert);
+    md_store_txn_put(txn, MD_FN_PRIVKEY, MD_SV_PKEY, privkey);
     
     return rv;
 }
 
-static apr_status_t acme_driver_preload(md_proto_driver_t *d, md_store_group_t group)
+static apr_status_t acme_driver_preload(md_proto_driver_t *d, md_store_txn_t *txn)
 {
     md_acme_driver_t *ad = d->baton;
     apr_status_t rv;
 
     ad->phase = "ACME preload";
-    if (APR_SUCCESS == (rv = acme_preload(d->store, group, d->md->name, d->proxy_url, d->p))) {
+    if (APR_SUCCESS == (rv = acme_preload(d->store, txn, d->md->name, d->proxy_url, d->p))) {
         ad->phase = "preload done";
     }
         
@@ -30,6 +30,7 @@
 #include "md_log.h"
 #include "md_reg.h"
 #include "md_store.h"
+#include "md_store_db.h"
 #include "md_store_fs.h"
 #include "md_util.h"
 #include "md_version.h"
@@ -164,7 +165,13 @@ static apr_status_t cmd_process(md_cmd_ctx *ctx, const md_cmd_t *cmd)
             fprintf(stderr, "need store directory for command: %s\n", cmd->name);
             return APR_EINVAL;
         }
-        if (APR_SUCCESS != (rv = md_store_fs_init(&ctx->store, ctx->p, ctx->base_dir))) {
+        if (APR_SUCCESS == md_util_is_file(ctx->base_dir, ctx->p)) {
+            rv = md_store_db_init(&ctx->store, ctx->p, ctx->base_dir);
+        }
+        else {
+            rv = md_store_fs_init(&ctx->store, ctx->p, ctx->base_dir);
+        }
+        if (APR_SUCCESS != rv) {
             fprintf(stderr, "error %d creating store for: %s\n", rv, ctx->base_dir);
             return APR_EINVAL;
         }
@@ -192,6 +199,7 @@ static apr_status_t cmd_process(md_cmd_ctx *ctx, const md_cmd_t *cmd)
                     ctx->ca_url, ctx->base_dir);
             return rv;
         }
+        ctx->acme->store = ctx->store;
         rv = md_acme_setup(ctx->acme);
         if (rv != APR_SUCCESS) {
             md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, ctx->p, "contacting %s", ctx->ca_url);
@@ -368,7 +376,7 @@ static const md_cmd_t *MainSubCmds[] = {
 
 static apr_getopt_option_t MainOptions [] = {
     { "acme",    'a', 1, "the url of the ACME server directory"},
-    { "dir",     'd', 1, "directory for file data"},
+    { "dir",     'd', 1, "directory for file data, or a single store file"},
     { "help",    'h', 0, "print usage information"},
     { "json",    'j', 0, "produce json output"},
     { "proxy",   'p', 1, "use the HTTP proxy url"},
@@ -28,6 +28,8 @@
 #include "md_log.h"
 #include "md_reg.h"
 #include "md_store.h"
+#include "md_store_db.h"
+#include "md_store_fs.h"
 #include "md_util.h"
 #include "md_version.h"
 #include "md_cmd.h"
@@ -213,6 +215,80 @@ static md_cmd_t UpdateCmd = {
     "update the managed domain <name> in the store"
 };
 
+/**************************************************************************************************/
+/* command: store migrate */
+
+static apr_status_t cmd_migrate(md_cmd_ctx *ctx, const md_cmd_t *cmd)
+{
+    md_store_t *dest;
+    const char *type, *path;
+    apr_status_t rv;
+
+    if (ctx->argc != 2) {
+        return usage(cmd, "needs store type and path");
+    }
+    type = ctx->argv[0];
+    path = ctx->argv[1];
+    
+    if (!strcmp("fs", type)) {
+        rv = md_store_fs_init(&dest, ctx->p, path);
+    }
+    else if (!strcmp("db", type)) {
+        rv = md_store_db_init(&dest, ctx->p, path);
+    }
+    else {
+        return usage(cmd, "store type must be 'fs' or 'db'");
+    }
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, ctx->p, "creating %s store at %s", type, path);
+        return rv;
+    }
+    
+    rv = md_store_copy(dest, ctx->store, ctx->p);
+    md_log_perror(MD_LOG_MARK, (APR_SUCCESS == rv)? MD_LOG_INFO : MD_LOG_ERR, rv, ctx->p, 
+                  "copied store to %s store at %s", type, path);
+    return rv;
+}
+
+static md_cmd_t MigrateCmd = {
+    "migrate", MD_CTX_STORE, 
+    NULL, cmd_migrate, MD_NoOptions, NULL,
+    "migrate fs|db <path>",
+    "copy all data of the store into a new file system (fs) or single file (db) store at <path>"
+};
+
+/**************************************************************************************************/
+/* command: store convert */
+
+static apr_status_t cmd_convert(md_cmd_ctx *ctx, const md_cmd_t *cmd)
+{
+    md_json_fmt_t fmt;
+    apr_status_t rv;
+
+    if (ctx->argc != 1) {
+        return usage(cmd, "needs format");
+    }
+    if (APR_SUCCESS != md_json_fmt_parse(&fmt, ctx->argv[0])) {
+        return usage(cmd, "format must be 'indent', 'compact' or 'msgpack'");
+    }
+    if (APR_SUCCESS == md_util_is_file(ctx->base_dir, ctx->p)) {
+        fprintf(stderr, "a single file store has no format to convert: %s\n", ctx->base_dir);
+        return APR_ENOTIMPL;
+    }
+    
+    rv = md_store_fs_convert(ctx->store, ctx->p, fmt);
+    md_log_perror(MD_LOG_MARK, (APR_SUCCESS == rv)? MD_LOG_INFO : MD_LOG_ERR, rv, ctx->p, 
+                  "converted store at %s to %s", ctx->base_dir, md_json_fmt_name(fmt));
+    return rv;
+}
+
+static md_cmd_t ConvertCmd = {
+    "convert", MD_CTX_STORE, 
+    NULL, cmd_convert, MD_NoOptions, NULL,
+    "convert indent|compact|msgpack",
+    "rewrite all JSON files of the store in the given format, which is used from then on"
+};
+
 /**************************************************************************************************/
 /* command: store */
 
@@ -221,6 +297,8 @@ static const md_cmd_t *StoreSubCmds[] = {
     &RemoveCmd,
     &ListCmd,
     &UpdateCmd,
+    &MigrateCmd,
+    &ConvertCmd,
     NULL
 };
 
@@ -266,6 +266,7 @@ md_t *md_clone(apr_pool_t *p, const md_t *src)
         md->renew_norm = src->renew_norm;
         md->renew_window = src->renew_window;
         md->contacts = md_array_str_clone(p, src->contacts);
+        md->transitive = src->transitive;
         if (src->ca_url) md->ca_url = apr_pstrdup(p, src->ca_url);
         if (src->ca_proto) md->ca_proto = apr_pstrdup(p, src->ca_proto);
         if (src->ca_account) md->ca_account = apr_pstrdup(p, src->ca_account);
@@ -306,120 +307,207 @@ md_t *md_merge(apr_pool_t *p, const md_t *add, const md_t *base)
 /**************************************************************************************************/
 /* format conversion */
 
+static const md_json_path_t P_NAME          = { 1, { MD_KEY_NAME } };
+static const md_json_path_t P_DOMAINS       = { 1, { MD_KEY_DOMAINS } };
+static const md_json_path_t P_CONTACTS      = { 1, { MD_KEY_CONTACTS } };
+static const md_json_path_t P_TRANSITIVE    = { 1, { MD_KEY_TRANSITIVE } };
+static const md_json_path_t P_CA_ACCOUNT    = { 2, { MD_KEY_CA, MD_KEY_ACCOUNT } };
+static const md_json_path_t P_CA_PROTO      = { 2, { MD_KEY_CA, MD_KEY_PROTO } };
+static const md_json_path_t P_CA_URL        = { 2, { MD_KEY_CA, MD_KEY_URL } };
+static const md_json_path_t P_CA_AGREEMENT  = { 2, { MD_KEY_CA, MD_KEY_AGREEMENT } };
+static const md_json_path_t P_CA_CHALLENGES = { 2, { MD_KEY_CA, MD_KEY_CHALLENGES } };
+static const md_json_path_t P_CERT_URL      = { 2, { MD_KEY_CERT, MD_KEY_URL } };
+static const md_json_path_t P_CERT_EXPIRES  = { 2, { MD_KEY_CERT, MD_KEY_EXPIRES } };
+static const md_json_path_t P_CERT_VALID_FROM = { 2, { MD_KEY_CERT, MD_KEY_VALID_FROM } };
+static const md_json_path_t P_PKEY          = { 1, { MD_KEY_PKEY } };
+static const md_json_path_t P_STATE         = { 1, { MD_KEY_STATE } };
+static const md_json_path_t P_DRIVE_MODE    = { 1, { MD_KEY_DRIVE_MODE } };
+static const md_json_path_t P_RENEW_WINDOW  = { 1, { MD_KEY_RENEW_WINDOW } };
+static const md_json_path_t P_RENEW         = { 1, { MD_KEY_RENEW } };
+static const md_json_path_t P_REQUIRE_HTTPS = { 1, { MD_KEY_REQUIRE_HTTPS } };
+static const md_json_path_t P_MUST_STAPLE   = { 1, { MD_KEY_MUST_STAPLE } };
+
 md_json_t *md_to_json(const md_t *md, apr_pool_t *p)
 {
     md_json_t *json = md_json_create(p);
     if (json) {
         apr_array_header_t *domains = md_array_str_compact(p, md->domains, 0);
-        md_json_sets(md->name, json, MD_KEY_NAME, NULL);
-        md_json_setsa(domains, json, MD_KEY_DOMAINS, NULL);
-        md_json_setsa(md->contacts, json, MD_KEY_CONTACTS, NULL);
-        md_json_setl(md->transitive, json, MD_KEY_TRANSITIVE, NULL);
-        md_json_sets(md->ca_account, json, MD_KEY_CA, MD_KEY_ACCOUNT, NULL);
-        md_json_sets(md->ca_proto, json, MD_KEY_CA, MD_KEY_PROTO, NULL);
-        md_json_sets(md->ca_url, json, MD_KEY_CA, MD_KEY_URL, NULL);
-        md_json_sets(md->ca_agreement, json, MD_KEY_CA, MD_KEY_AGREEMENT, NULL);
+        md_json_path_sets(md->name, json, &P_NAME);
+        md_json_path_setsa(domains, json, &P_DOMAINS);
+        md_json_path_setsa(md->contacts, json, &P_CONTACTS);
+        md_json_path_setl(md->transitive, json, &P_TRANSITIVE);
+        md_json_path_sets(md->ca_account, json, &P_CA_ACCOUNT);
+        md_json_path_sets(md->ca_proto, json, &P_CA_PROTO);
+        md_json_path_sets(md->ca_url, json, &P_CA_URL);
+        md_json_path_sets(md->ca_agreement, json, &P_CA_AGREEMENT);
         if (md->cert_url) {
-            md_json_sets(md->cert_url, json, MD_KEY_CERT, MD_KEY_URL, NULL);
+            md_json_path_sets(md->cert_url, json, &P_CERT_URL);
         }
         if (md->pkey_spec) {
-            md_json_setj(md_pkey_spec_to_json(md->pkey_spec, p), json, MD_KEY_PKEY, NULL);
+            md_json_path_setj(md_pkey_spec_to_json(md->pkey_spec, p), json, &P_PKEY);
         }
-        md_json_setl(md->state, json, MD_KEY_STATE, NULL);
-        md_json_setl(md->drive_mode, json, MD_KEY_DRIVE_MODE, NULL);
+        md_json_path_setl(md->state, json, &P_STATE);
+        md_json_path_setl(md->drive_mode, json, &P_DRIVE_MODE);
         if (md->expires > 0) {
             char *ts = apr_pcalloc(p, APR_RFC822_DATE_LEN);
             apr_rfc822_date(ts, md->expires);
-            md_json_sets(ts, json, MD_KEY_CERT, MD_KEY_EXPIRES, NULL);
+            md_json_path_sets(ts, json, &P_CERT_EXPIRES);
         }
         if (md->valid_from > 0) {
             char *ts = apr_pcalloc(p, APR_RFC822_DATE_LEN);
             apr_rfc822_date(ts, md->valid_from);
-            md_json_sets(ts, json, MD_KEY_CERT, MD_KEY_VALID_FROM, NULL);
+            md_json_path_sets(ts, json, &P_CERT_VALID_FROM);
         }
         if (md->renew_norm > 0) {
-            md_json_sets(apr_psprintf(p, "%ld%%", (long)(md->renew_window * 100L / md->renew_norm)), 
-                                      json, MD_KEY_RENEW_WINDOW, NULL);
+            md_json_path_sets(apr_psprintf(p, "%ld%%", (long)(md->renew_window * 100L / md->renew_norm)), 
+                              json, &P_RENEW_WINDOW);
         }
         else {
-            md_json_setl((long)apr_time_sec(md->renew_window), json, MD_KEY_RENEW_WINDOW, NULL);
+            md_json_path_setl((long)apr_time_sec(md->renew_window), json, &P_RENEW_WINDOW);
         }
-        md_json_setb(md_should_renew(md), json, MD_KEY_RENEW, NULL);
+        md_json_path_setb(md_should_renew(md), json, &P_RENEW);
         if (md->ca_challenges && md->ca_challenges->nelts > 0) {
             apr_array_header_t *na;
             na = md_array_str_compact(p, md->ca_challenges, 0);
-            md_json_setsa(na, json, MD_KEY_CA, MD_KEY_CHALLENGES, NULL);
+            md_json_path_setsa(na, json, &P_CA_CHALLENGES);
         }
         switch (md->require_https) {
             case MD_REQUIRE_TEMPORARY:
-                md_json_sets(MD_KEY_TEMPORARY, json, MD_KEY_REQUIRE_HTTPS, NULL);
+                md_json_path_sets(MD_KEY_TEMPORARY, json, &P_REQUIRE_HTTPS);
                 break;
             case MD_REQUIRE_PERMANENT:
-                md_json_sets(MD_KEY_PERMANENT, json, MD_KEY_REQUIRE_HTTPS, NULL);
+                md_json_path_sets(MD_KEY_PERMANENT, json, &P_REQUIRE_HTTPS);
                 break;
             default:
                 break;
         }
-        md_json_setb(md->must_staple > 0, json, MD_KEY_MUST_STAPLE, NULL);
+        md_json_path_setb(md->must_staple > 0, json, &P_MUST_STAPLE);
         return json;
     }
     return NULL;
 }
 
-md_t *md_from_json(md_json_t *json, apr_pool_t *p)
+static apr_status_t md_state_from_json(void *target, md_json_t *value, apr_pool_t *p)
+{
+    (void)p;
+    ((md_t *)target)->state = (md_state_t)md_json_getl(value, NULL);
+    return APR_SUCCESS;
+}
+
+static apr_status_t md_pkey_from_json(void *target, md_json_t *value, apr_pool_t *p)
+{
+    if (md_json_has_key(value, MD_KEY_TYPE, NULL)) {
+        ((md_t *)target)->pkey_spec = md_pkey_spec_from_json(value, p);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t md_expires_from_json(void *target, md_json_t *value, apr_pool_t *p)
 {
+    const char *s = md_json_gets(value, NULL);
+    (void)p;
+    if (s && *s) {
+        ((md_t *)target)->expires = apr_date_parse_rfc(s);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t md_valid_from_json(void *target, md_json_t *value, apr_pool_t *p)
+{
+    const char *s = md_json_gets(value, NULL);
+    (void)p;
+    if (s && *s) {
+        ((md_t *)target)->valid_from = apr_date_parse_rfc(s);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t md_renew_window_from_json(void *target, md_json_t *value, apr_pool_t *p)
+{
+    md_t *md = target;
     const char *s;
-    md_t *md = md_create_empty(p);
-    if (md) {
-        md->name = md_json_dups(p, json, MD_KEY_NAME, NULL);            
-        md_json_dupsa(md->domains, p, json, MD_KEY_DOMAINS, NULL);
-        md_json_dupsa(md->contacts, p, json, MD_KEY_CONTACTS, NULL);
-        md->ca_account = md_json_dups(p, json, MD_KEY_CA, MD_KEY_ACCOUNT, NULL);
-        md->ca_proto = md_json_dups(p, json, MD_KEY_CA, MD_KEY_PROTO, NULL);
-        md->ca_url = md_json_dups(p, json, MD_KEY_CA, MD_KEY_URL, NULL);
-        md->ca_agreement = md_json_dups(p, json, MD_KEY_CA, MD_KEY_AGREEMENT, NULL);
-        md->cert_url = md_json_dups(p, json, MD_KEY_CERT, MD_KEY_URL, NULL);
-        if (md_json_has_key(json, MD_KEY_PKEY, MD_KEY_TYPE, NULL)) {
-            md->pkey_spec = md_pkey_spec_from_json(md_json_getj(json, MD_KEY_PKEY, NULL), p);
-        }
-        md->state = (md_state_t)md_json_getl(json, MD_KEY_STATE, NULL);
-        md->drive_mode = (int)md_json_getl(json, MD_KEY_DRIVE_MODE, NULL);
-        md->domains = md_array_str_compact(p, md->domains, 0);
-        md->transitive = (int)md_json_getl(json, MD_KEY_TRANSITIVE, NULL);
-        s = md_json_dups(p, json, MD_KEY_CERT, MD_KEY_EXPIRES, NULL);
-        if (s && *s) {
-            md->expires = apr_date_parse_rfc(s);
-        }
-        s = md_json_dups(p, json, MD_KEY_CERT, MD_KEY_VALID_FROM, NULL);
-        if (s && *s) {
-            md->valid_from = apr_date_parse_rfc(s);
-        }
-        md->renew_norm = 0;
-        md->renew_window = apr_time_from_sec(md_json_getl(json, MD_KEY_RENEW_WINDOW, NULL));
-        if (md->renew_window <= 0) {
-            s = md_json_gets(json, MD_KEY_RENEW_WINDOW, NULL);
-            if (s && strchr(s, '%')) {
-                int percent = atoi(s);
-                if (0 < percent && percent < 100) {
-                    md->renew_norm = apr_time_from_sec(100 * MD_SECS_PER_DAY);
-                    md->renew_window = apr_time_from_sec(percent * MD_SECS_PER_DAY);
-                }
+    
+    (void)p;
+    md->renew_window = apr_time_from_sec(md_json_getl(value, NULL));
+    if (md->renew_window <= 0) {
+        s = md_json_gets(value, NULL);
+        if (s && strchr(s, '%')) {
+            int percent = atoi(s);
+            if (0 < percent && percent < 100) {
+                md->renew_norm = apr_time_from_sec(100 * MD_SECS_PER_DAY);
+                md->renew_window = apr_time_from_sec(percent * MD_SECS_PER_DAY);
             }
         }
-        if (md_json_has_key(json, MD_KEY_CA, MD_KEY_CHALLENGES, NULL)) {
-            md->ca_challenges = apr_array_make(p, 5, sizeof(const char*));
-            md_json_dupsa(md->ca_challenges, p, json, MD_KEY_CA, MD_KEY_CHALLENGES, NULL);
-        }
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t md_require_https_from_json(void *target, md_json_t *value, apr_pool_t *p)
+{
+    md_t *md = target;
+    const char *s = md_json_gets(value, NULL);
+    
+    (void)p;
+    if (s && !strcmp(MD_KEY_TEMPORARY, s)) {
+        md->require_https = MD_REQUIRE_TEMPORARY;
+    }
+    else if (s && !strcmp(MD_KEY_PERMANENT, s)) {
+        md->require_https = MD_REQUIRE_PERMANENT;
+    }
+    return APR_SUCCESS;
+}
+
+#define MD_FIELD(key, type, member)  { key, type, APR_OFFSETOF(md_t, member), NULL, NULL }
+#define MD_FIELD_CB(key, cb)         { key, MD_JSON_FIELD_CB, 0, NULL, cb }
+
+static const md_json_field_t MD_CA_FIELDS[] = {
+    MD_FIELD(MD_KEY_ACCOUNT,        MD_JSON_FIELD_STR,  ca_account),
+    MD_FIELD(MD_KEY_PROTO,          MD_JSON_FIELD_STR,  ca_proto),
+    MD_FIELD(MD_KEY_URL,            MD_JSON_FIELD_STR,  ca_url),
+    MD_FIELD(MD_KEY_AGREEMENT,      MD_JSON_FIELD_STR,  ca_agreement),
+    MD_FIELD(MD_KEY_CHALLENGES,     MD_JSON_FIELD_STRA, ca_challenges),
+    { NULL, MD_JSON_FIELD_STR, 0, NULL, NULL }
+};
+
+static const md_json_field_t MD_CERT_FIELDS[] = {
+    MD_FIELD(MD_KEY_URL,            MD_JSON_FIELD_STR,  cert_url),
+    MD_FIELD_CB(MD_KEY_EXPIRES,     md_expires_from_json),
+    MD_FIELD_CB(MD_KEY_VALID_FROM,  md_valid_from_json),
+    { NULL, MD_JSON_FIELD_STR, 0, NULL, NULL }
+};
+
+/* in the order md_to_json() writes them */
+static const md_json_field_t MD_FIELDS[] = {
+    MD_FIELD(MD_KEY_NAME,           MD_JSON_FIELD_STR,  name),
+    MD_FIELD(MD_KEY_DOMAINS,        MD_JSON_FIELD_STRA, domains),
+    MD_FIELD(MD_KEY_CONTACTS,       MD_JSON_FIELD_STRA, contacts),
+    MD_FIELD(MD_KEY_TRANSITIVE,     MD_JSON_FIELD_INT,  transitive),
+    { MD_KEY_CA, MD_JSON_FIELD_OBJ, 0, MD_CA_FIELDS, NULL },
+    { MD_KEY_CERT, MD_JSON_FIELD_OBJ, 0, MD_CERT_FIELDS, NULL },
+    MD_FIELD_CB(MD_KEY_PKEY,        md_pkey_from_json),
+    MD_FIELD_CB(MD_KEY_STATE,       md_state_from_json),
+    MD_FIELD(MD_KEY_DRIVE_MODE,     MD_JSON_FIELD_INT,  drive_mode),
+    MD_FIELD_CB(MD_KEY_RENEW_WINDOW, md_renew_window_from_json),
+    MD_FIELD_CB(MD_KEY_REQUIRE_HTTPS, md_require_https_from_json),
+    MD_FIELD(MD_KEY_MUST_STAPLE,    MD_JSON_FIELD_BOOL, must_staple),
+    { NULL, MD_JSON_FIELD_STR, 0, NULL, NULL }
+};
+
+md_t *md_from_json(md_json_t *json, apr_pool_t *p)
+{
+    md_t *md = md_create_empty(p);
+    if (md) {
+        /* what an absent member means */
+        md->state = MD_S_UNKNOWN;
+        md->drive_mode = 0;
+        md->transitive = 0;
         md->require_https = MD_REQUIRE_OFF;
-        s = md_json_gets(json, MD_KEY_REQUIRE_HTTPS, NULL);
-        if (s && !strcmp(MD_KEY_TEMPORARY, s)) {
-            md->require_https = MD_REQUIRE_TEMPORARY;
-        }
-        else if (s && !strcmp(MD_KEY_PERMANENT, s)) {
-            md->require_https = MD_REQUIRE_PERMANENT;
-        }
-        md->must_staple = (int)md_json_getb(json, MD_KEY_MUST_STAPLE, NULL);
+        md->must_staple = 0;
         
+        if (APR_SUCCESS != md_json_decode(md, MD_FIELDS, json, p)) {
+            return NULL;
+        }
+        md->domains = md_array_str_compact(p, md->domains, 0);
         return md;
     }
     return NULL;
@@ -20,8 +20,12 @@
 #include <apr_lib.h>
 #include <apr_buckets.h>
 #include <apr_file_io.h>
+#include <apr_hash.h>
 #include <apr_strings.h>
+#include <apr_thread_mutex.h>
 
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
 #include <openssl/err.h>
 #include <openssl/evp.h>
 #include <openssl/pem.h>
@@ -54,6 +58,15 @@ static int initialized;
 struct md_pkey_t {
     apr_pool_t *pool;
     EVP_PKEY   *pkey;
+    
+    /* JWS material, computed on first use and kept for the key's lifetime */
+    int jws_ready;
+    const char *jws_alg;
+    const EVP_MD *sign_md;
+    apr_size_t ec_flen;         /* bytes of r and s in an EC signature */
+    EVP_MD_CTX *sign_ctx;
+    md_json_t *jwk;
+    const char *jwk_thumb64;
 };
 
 #ifdef MD_HAVE_ARC4RANDOM
@@ -131,7 +144,7 @@ apr_status_t md_crypt_init(apr_pool_t *pool)
 
         initialized = 1;
     }
-    return APR_SUCCESS;
+    return stock_init(pool);
 }
 
 typedef struct {
@@ -256,6 +269,12 @@ md_json_t *md_pkey_spec_to_json(const md_pkey_spec_t *spec, apr_pool_t *p)
                     md_json_setl((long)spec->params.rsa.bits, json, MD_KEY_BITS, NULL);
                 }
                 break;
+            case MD_PKEY_TYPE_EC:
+                md_json_sets("EC", json, MD_KEY_TYPE, NULL);
+                if (spec->params.ec.curve) {
+                    md_json_sets(spec->params.ec.curve, json, MD_KEY_CURVE, NULL);
+                }
+                break;
             default:
                 md_json_sets("Unsupported", json, MD_KEY_TYPE, NULL);
                 break;
@@ -285,6 +304,14 @@ md_pkey_spec_t *md_pkey_spec_from_json(struct md_json_t *json, apr_pool_t *p)
                 spec->params.rsa.bits = MD_PKEY_RSA_BITS_DEF;
             }
         }
+        else if (!apr_strnatcasecmp("EC", s)) {
+            spec->type = MD_PKEY_TYPE_EC;
+            s = md_json_gets(json, MD_KEY_CURVE, NULL);
+            spec->params.ec.curve = md_pkey_ec_curve_name(s? s : MD_PKEY_EC_CURVE_DEF);
+            if (!spec->params.ec.curve) {
+                spec->params.ec.curve = apr_pstrdup(p, s);
+            }
+        }
     }
     return spec;
 }
@@ -303,6 +330,12 @@ int md_pkey_spec_eq(md_pkey_spec_t *spec1, md_pkey_spec_t *spec2)
                     return 1;
                 }
                 break;
+            case MD_PKEY_TYPE_EC:
+                if (spec1->params.ec.curve && spec2->params.ec.curve
+                    && !strcmp(spec1->params.ec.curve, spec2->params.ec.curve)) {
+                    return 1;
+                }
+                break;
         }
     }
     return 0;
@@ -315,6 +348,16 @@ static md_pkey_t *make_pkey(apr_pool_t *p)
     return pkey;
 }
 
+static apr_status_t sign_ctx_cleanup(void *data)
+{
+    md_pkey_t *pkey = data;
+    if (pkey->sign_ctx) {
+        EVP_MD_CTX_destroy(pkey->sign_ctx);
+        pkey->sign_ctx = NULL;
+    }
+    return APR_SUCCESS;
+}
+
 static apr_status_t pkey_cleanup(void *data)
 {
     md_pkey_t *pkey = data;
@@ -322,6 +365,10 @@ static apr_status_t pkey_cleanup(void *data)
         EVP_PKEY_free(pkey->pkey);
         pkey->pkey = NULL;
     }
+    sign_ctx_cleanup(pkey);
+    pkey->jws_ready = 0;
+    pkey->jwk = NULL;
+    pkey->jwk_thumb64 = NULL;
     return APR_SUCCESS;
 }
 
@@ -432,6 +479,60 @@ apr_status_t md_pkey_fsave(md_pkey_t *pkey, apr_pool_t *p,
     return rv;
 }
 
+apr_status_t md_pkey_from_pem(md_pkey_t **ppkey, apr_pool_t *p, 
+                              const char *pass_phrase, apr_size_t pass_len,
+                              const char *pem, apr_size_t pem_len)
+{
+    apr_status_t rv = APR_EINVAL;
+    md_pkey_t *pkey;
+    BIO *bio;
+    passwd_ctx ctx;
+    
+    if (pem_len > INT_MAX || pass_len > INT_MAX) {
+        return APR_EINVAL;
+    }
+    pkey = make_pkey(p);
+    if (NULL == (bio = BIO_new_mem_buf((void*)pem, (int)pem_len))) {
+        return APR_ENOMEM;
+    }
+    ctx.pass_phrase = pass_phrase;
+    ctx.pass_len = (int)pass_len;
+    
+    ERR_clear_error();
+    pkey->pkey = PEM_read_bio_PrivateKey(bio, NULL, pem_passwd, &ctx);
+    BIO_free(bio);
+    
+    if (pkey->pkey != NULL) {
+        rv = APR_SUCCESS;
+        apr_pool_cleanup_register(p, pkey, pkey_cleanup, apr_pool_cleanup_null);
+    }
+    else {
+        unsigned long err = ERR_get_error();
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, 
+                      "error reading pkey: %s (pass phrase was %snull)", 
+                      ERR_error_string(err, NULL), pass_phrase? "not " : ""); 
+    }
+    *ppkey = (APR_SUCCESS == rv)? pkey : NULL;
+    return rv;
+}
+
+apr_status_t md_pkey_to_pem(const char **ppem, apr_size_t *ppem_len, md_pkey_t *pkey, 
+                            apr_pool_t *p, const char *pass_phrase, apr_size_t pass_len)
+{
+    buffer_rec buffer;
+    apr_status_t rv;
+    
+    memset(&buffer, 0, sizeof(buffer));
+    if (APR_SUCCESS == (rv = pkey_to_buffer(&buffer, pkey, p, pass_phrase, pass_len))) {
+        *ppem = buffer.data? buffer.data : "";
+        *ppem_len = buffer.len;
+        return APR_SUCCESS;
+    }
+    *ppem = NULL;
+    *ppem_len = 0;
+    return rv;
+}
+
 static apr_status_t gen_rsa(md_pkey_t **ppkey, apr_pool_t *p, unsigned int bits)
 {
     EVP_PKEY_CTX *ctx = NULL;
@@ -457,7 +558,97 @@ static apr_status_t gen_rsa(md_pkey_t **ppkey, apr_pool_t *p, unsigned int bits)
     return rv;
 }
 
-apr_status_t md_pkey_gen(md_pkey_t **ppkey, apr_pool_t *p, md_pkey_spec_t *spec)
+typedef struct {
+    const char *name;               /* JWA name, used in our specs and JWKs */
+    const char *alias1;             /* OpenSSL short name */
+    const char *alias2;             /* SECG name */
+    int nid;
+    const char *alg;                /* JWS algorithm for this curve */
+} ec_curve_t;
+
+static const ec_curve_t ec_curves[] = {
+    { "P-256", "prime256v1", "secp256r1", NID_X9_62_prime256v1, "ES256" },
+    { "P-384", "secp384r1",  "secp384r1", NID_secp384r1,        "ES384" },
+};
+
+static const ec_curve_t *ec_curve_by_name(const char *name)
+{
+    apr_size_t i;
+    
+    if (name) {
+        for (i = 0; i < sizeof(ec_curves)/sizeof(ec_curves[0]); ++i) {
+            if (!apr_strnatcasecmp(name, ec_curves[i].name)
+                || !apr_strnatcasecmp(name, ec_curves[i].alias1)
+                || !apr_strnatcasecmp(name, ec_curves[i].alias2)) {
+                return &ec_curves[i];
+            }
+        }
+    }
+    return NULL;
+}
+
+static const ec_curve_t *ec_curve_by_nid(int nid)
+{
+    apr_size_t i;
+    
+    for (i = 0; i < sizeof(ec_curves)/sizeof(ec_curves[0]); ++i) {
+        if (nid == ec_curves[i].nid) {
+            return &ec_curves[i];
+        }
+    }
+    return NULL;
+}
+
+const char *md_pkey_ec_curve_name(const char *name)
+{
+    const ec_curve_t *curve = ec_curve_by_name(name);
+    return curve? curve->name : NULL;
+}
+
+static apr_status_t gen_ec(md_pkey_t **ppkey, apr_pool_t *p, const char *name)
+{
+    EC_KEY *ec = NULL;
+    const ec_curve_t *curve;
+    apr_status_t rv;
+    
+    curve = ec_curve_by_name(name? name : MD_PKEY_EC_CURVE_DEF);
+    if (!curve) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, 0, p, "unsupported curve: %s", name); 
+        *ppkey = NULL;
+        return APR_ENOTIMPL;
+    }
+    
+    /* EVP_PKEY_CTX_set_ec_paramgen_curve_nid() on a keygen context needs OpenSSL 1.1,
+     * the EC_KEY way works from 1.0.2 on */
+    *ppkey = make_pkey(p);
+    if ((ec = EC_KEY_new_by_curve_name(curve->nid)) != NULL
+        && EC_KEY_generate_key(ec) == 1
+        && ((*ppkey)->pkey = EVP_PKEY_new()) != NULL
+        && EVP_PKEY_assign_EC_KEY((*ppkey)->pkey, ec) == 1) {
+        /* owned by the pkey now. Older OpenSSL default to explicit parameters, 
+         * which clients refuse. */
+        EC_KEY_set_asn1_flag(ec, OPENSSL_EC_NAMED_CURVE);
+        ec = NULL;
+        rv = APR_SUCCESS;
+    }
+    else {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, 0, p, "error generate pkey EC %s", 
+                      curve->name); 
+        if ((*ppkey)->pkey) {
+            EVP_PKEY_free((*ppkey)->pkey);
+            (*ppkey)->pkey = NULL;
+        }
+        *ppkey = NULL;
+        rv = APR_EGENERAL;
+    }
+    
+    if (ec != NULL) {
+        EC_KEY_free(ec);
+    }
+    return rv;
+}
+
+static apr_status_t pkey_gen(md_pkey_t **ppkey, apr_pool_t *p, md_pkey_spec_t *spec)
 {
     md_pkey_type_t ptype = spec? spec->type : MD_PKEY_TYPE_DEFAULT;
     switch (ptype) {
@@ -465,11 +656,234 @@ apr_status_t md_pkey_gen(md_pkey_t **ppkey, apr_pool_t *p, md_pkey_spec_t *spec)
             return gen_rsa(ppkey, p, MD_PKEY_RSA_BITS_DEF);
         case MD_PKEY_TYPE_RSA:
             return gen_rsa(ppkey, p, spec->params.rsa.bits);
+        case MD_PKEY_TYPE_EC:
+            return gen_ec(ppkey, p, spec->params.ec.curve);
         default:
             return APR_ENOTIMPL;
     }
 }
 
+/**************************************************************************************************/
+/* key stock: keys generated ahead of time, so that staging does not have to wait */
+
+typedef struct {
+    md_pkey_spec_t spec;
+    int wanted;                     /* number of keys to keep in stock */
+    apr_array_header_t *keys;       /* of EVP_PKEY*, ready to hand out */
+} stock_entry_t;
+
+static apr_pool_t *stock_pool;
+static apr_hash_t *stock;           /* spec key -> stock_entry_t */
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *stock_mutex;
+#endif
+
+static void stock_lock(void)
+{
+#if APR_HAS_THREADS
+    if (stock_mutex) apr_thread_mutex_lock(stock_mutex);
+#endif
+}
+
+static void stock_unlock(void)
+{
+#if APR_HAS_THREADS
+    if (stock_mutex) apr_thread_mutex_unlock(stock_mutex);
+#endif
+}
+
+static apr_status_t stock_cleanup(void *dummy)
+{
+    apr_hash_index_t *hi;
+    stock_entry_t *e;
+    int i;
+    
+    (void)dummy;
+    for (hi = apr_hash_first(stock_pool, stock); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, (void **)&e);
+        for (i = 0; i < e->keys->nelts; ++i) {
+            EVP_PKEY_free(APR_ARRAY_IDX(e->keys, i, EVP_PKEY*));
+        }
+        apr_array_clear(e->keys);
+    }
+    stock_pool = NULL;
+    stock = NULL;
+#if APR_HAS_THREADS
+    stock_mutex = NULL;
+#endif
+    return APR_SUCCESS;
+}
+
+static apr_status_t stock_init(apr_pool_t *p)
+{
+    apr_status_t rv;
+    
+    if (stock_pool) {
+        return APR_SUCCESS;
+    }
+    if (APR_SUCCESS != (rv = apr_pool_create(&stock_pool, p))) {
+        return rv;
+    }
+    apr_pool_tag(stock_pool, "md_pkey_stock");
+#if APR_HAS_THREADS
+    if (APR_SUCCESS != (rv = apr_thread_mutex_create(&stock_mutex, 
+                                                     APR_THREAD_MUTEX_DEFAULT, stock_pool))) {
+        apr_pool_destroy(stock_pool);
+        stock_pool = NULL;
+        return rv;
+    }
+#endif
+    stock = apr_hash_make(stock_pool);
+    apr_pool_cleanup_register(stock_pool, NULL, stock_cleanup, apr_pool_cleanup_null);
+    return APR_SUCCESS;
+}
+
+#define STOCK_KEY_LEN       64
+
+/* Called each watchdog run, so the key goes into a buffer of the caller, not a pool */
+static const char *stock_key(char *buf, const md_pkey_spec_t *spec)
+{
+    const char *curve;
+    md_pkey_type_t ptype = spec? spec->type : MD_PKEY_TYPE_DEFAULT;
+    switch (ptype) {
+        case MD_PKEY_TYPE_DEFAULT:
+            apr_snprintf(buf, STOCK_KEY_LEN, "RSA:%d", MD_PKEY_RSA_BITS_DEF);
+            return buf;
+        case MD_PKEY_TYPE_RSA:
+            apr_snprintf(buf, STOCK_KEY_LEN, "RSA:%u", (unsigned int)spec->params.rsa.bits);
+            return buf;
+        case MD_PKEY_TYPE_EC:
+            curve = md_pkey_ec_curve_name(spec->params.ec.curve);
+            if (!curve) {
+                return NULL;
+            }
+            apr_snprintf(buf, STOCK_KEY_LEN, "EC:%s", curve);
+            return buf;
+        default:
+            return NULL;
+    }
+}
+
+void md_pkey_stock_reset(void)
+{
+    apr_hash_index_t *hi;
+    stock_entry_t *e;
+    
+    if (!stock_pool) {
+        return;
+    }
+    stock_lock();
+    for (hi = apr_hash_first(NULL, stock); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, (void **)&e);
+        e->wanted = 0;
+    }
+    stock_unlock();
+}
+
+void md_pkey_stock_want(const md_pkey_spec_t *spec, int n)
+{
+    stock_entry_t *e;
+    char buf[STOCK_KEY_LEN];
+    const char *key;
+    
+    if (!stock_pool) {
+        return;
+    }
+    stock_lock();
+    if ((key = stock_key(buf, spec)) != NULL) {
+        e = apr_hash_get(stock, key, APR_HASH_KEY_STRING);
+        if (!e) {
+            key = apr_pstrdup(stock_pool, key);
+            e = apr_pcalloc(stock_pool, sizeof(*e));
+            if (spec) {
+                e->spec = *spec;
+                if (e->spec.type == MD_PKEY_TYPE_EC) {
+                    e->spec.params.ec.curve = md_pkey_ec_curve_name(spec->params.ec.curve);
+                }
+            }
+            e->keys = apr_array_make(stock_pool, 5, sizeof(EVP_PKEY*));
+            apr_hash_set(stock, key, APR_HASH_KEY_STRING, e);
+        }
+        e->wanted = (n > MD_PKEY_STOCK_MAX)? MD_PKEY_STOCK_MAX : n;
+    }
+    stock_unlock();
+}
+
+static EVP_PKEY *stock_take(const md_pkey_spec_t *spec)
+{
+    EVP_PKEY *key = NULL;
+    stock_entry_t *e;
+    char buf[STOCK_KEY_LEN];
+    const char *skey;
+    
+    if (!stock_pool || !(skey = stock_key(buf, spec))) {
+        return NULL;
+    }
+    stock_lock();
+    e = apr_hash_get(stock, skey, APR_HASH_KEY_STRING);
+    if (e && e->keys->nelts > 0) {
+        key = *(EVP_PKEY**)apr_array_pop(e->keys);
+    }
+    stock_unlock();
+    return key;
+}
+
+apr_status_t md_pkey_stock_fill(apr_pool_t *p, apr_interval_time_t budget)
+{
+    apr_hash_index_t *hi;
+    stock_entry_t *e, *todo;
+    md_pkey_t *pkey;
+    apr_time_t end = apr_time_now() + budget;
+    apr_status_t rv;
+    
+    if (!stock_pool) {
+        return APR_SUCCESS;
+    }
+    while (1) {
+        /* find the emptiest entry, so that no spec starves while another fills up */
+        todo = NULL;
+        stock_lock();
+        for (hi = apr_hash_first(p, stock); hi; hi = apr_hash_next(hi)) {
+            apr_hash_this(hi, NULL, NULL, (void **)&e);
+            if (e->keys->nelts < e->wanted 
+                && (!todo || e->keys->nelts < todo->keys->nelts)) {
+                todo = e;
+            }
+        }
+        stock_unlock();
+        
+        if (!todo) {
+            return APR_SUCCESS;
+        }
+        else if (apr_time_now() >= end) {
+            return APR_EAGAIN;
+        }
+        
+        /* generate without holding the lock, this takes a while */
+        if (APR_SUCCESS != (rv = pkey_gen(&pkey, p, &todo->spec))) {
+            return rv;
+        }
+        stock_lock();
+        APR_ARRAY_PUSH(todo->keys, EVP_PKEY*) = pkey->pkey;
+        stock_unlock();
+        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, p, "pkey stock: added key, now %d of %d",
+                      todo->keys->nelts, todo->wanted);
+    }
+}
+
+apr_status_t md_pkey_gen(md_pkey_t **ppkey, apr_pool_t *p, md_pkey_spec_t *spec)
+{
+    EVP_PKEY *key;
+    
+    if ((key = stock_take(spec)) != NULL) {
+        *ppkey = make_pkey(p);
+        (*ppkey)->pkey = key;
+        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, p, "pkey taken from stock");
+        return APR_SUCCESS;
+    }
+    return pkey_gen(ppkey, p, spec);
+}
+
 #if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
 
 #ifndef NID_tlsfeature
@@ -487,6 +901,24 @@ static void RSA_get0_key(const RSA *r,
         *d = r->d;
 }
 
+static void ECDSA_SIG_get0(const ECDSA_SIG *sig, const BIGNUM **pr, const BIGNUM **ps)
+{
+    if (pr != NULL)
+        *pr = sig->r;
+    if (ps != NULL)
+        *ps = sig->s;
+}
+
+static int EVP_PKEY_up_ref(EVP_PKEY *pkey)
+{
+    return CRYPTO_add(&pkey->references, 1, CRYPTO_LOCK_EVP_PKEY) > 1;
+}
+
+static int X509_up_ref(X509 *x)
+{
+    return CRYPTO_add(&x->references, 1, CRYPTO_LOCK_X509) > 1;
+}
+
 #endif
 
 static const char *bn64(const BIGNUM *b, apr_pool_t *p) 
@@ -505,57 +937,283 @@ static const char *bn64(const BIGNUM *b, apr_pool_t *p)
 const char *md_pkey_get_rsa_e64(md_pkey_t *pkey, apr_pool_t *p)
 {
     const BIGNUM *e;
+    const char *e64;
     RSA *rsa = EVP_PKEY_get1_RSA(pkey->pkey);
     
     if (!rsa) {
         return NULL;
     }
     RSA_get0_key(rsa, NULL, &e, NULL);
-    return bn64(e, p);
+    e64 = bn64(e, p);
+    RSA_free(rsa);
+    return e64;
 }
 
 const char *md_pkey_get_rsa_n64(md_pkey_t *pkey, apr_pool_t *p)
 {
     const BIGNUM *n;
+    const char *n64;
     RSA *rsa = EVP_PKEY_get1_RSA(pkey->pkey);
     
     if (!rsa) {
         return NULL;
     }
     RSA_get0_key(rsa, &n, NULL, NULL);
-    return bn64(n, p);
+    n64 = bn64(n, p);
+    RSA_free(rsa);
+    return n64;
+}
+
+md_pkey_t *md_pkey_share(md_pkey_t *pkey, apr_pool_t *p)
+{
+    md_pkey_t *shared = make_pkey(p);
+    
+    EVP_PKEY_up_ref(pkey->pkey);
+    shared->pkey = pkey->pkey;
+    apr_pool_cleanup_register(p, shared, pkey_cleanup, apr_pool_cleanup_null);
+    return shared;
+}
+
+md_pkey_type_t md_pkey_get_type(md_pkey_t *pkey)
+{
+    switch (EVP_PKEY_base_id(pkey->pkey)) {
+        case EVP_PKEY_RSA:
+            return MD_PKEY_TYPE_RSA;
+        case EVP_PKEY_EC:
+            return MD_PKEY_TYPE_EC;
+        default:
+            return MD_PKEY_TYPE_DEFAULT;
+    }
+}
+
+static const ec_curve_t *pkey_ec_curve(md_pkey_t *pkey)
+{
+    const ec_curve_t *curve = NULL;
+    EC_KEY *ec;
+    
+    if (EVP_PKEY_base_id(pkey->pkey) == EVP_PKEY_EC
+        && (ec = EVP_PKEY_get1_EC_KEY(pkey->pkey)) != NULL) {
+        curve = ec_curve_by_nid(EC_GROUP_get_curve_name(EC_KEY_get0_group(ec)));
+        EC_KEY_free(ec);
+    }
+    return curve;
+}
+
+/* base64url of a big number, left padded with 0 to len bytes as JWA requires */
+static const char *bn64_padded(const BIGNUM *b, apr_size_t len, apr_pool_t *p) 
+{
+    apr_size_t blen = (apr_size_t)BN_num_bytes(b);
+    char *buffer;
+    
+    if (blen > len) {
+        return NULL;
+    }
+    buffer = apr_pcalloc(p, len);
+    BN_bn2bin(b, (unsigned char *)buffer + (len - blen));
+    return md_util_base64url_encode(buffer, len, p);
+}
+
+static const char *ec_coord64(md_pkey_t *pkey, int want_y, apr_pool_t *p)
+{
+    const char *s64 = NULL;
+    const EC_GROUP *group;
+    const EC_POINT *pt;
+    EC_KEY *ec;
+    BIGNUM *x, *y;
+    
+    if (EVP_PKEY_base_id(pkey->pkey) != EVP_PKEY_EC
+        || (ec = EVP_PKEY_get1_EC_KEY(pkey->pkey)) == NULL) {
+        return NULL;
+    }
+    group = EC_KEY_get0_group(ec);
+    pt = EC_KEY_get0_public_key(ec);
+    x = BN_new();
+    y = BN_new();
+    if (group && pt && x && y 
+        && EC_POINT_get_affine_coordinates_GFp(group, pt, x, y, NULL)) {
+        s64 = bn64_padded(want_y? y : x, 
+                          (apr_size_t)(EC_GROUP_get_degree(group) + 7) / 8, p);
+    }
+    BN_free(x);
+    BN_free(y);
+    EC_KEY_free(ec);
+    return s64;
+}
+
+const char *md_pkey_get_ec_crv(md_pkey_t *pkey)
+{
+    const ec_curve_t *curve = pkey_ec_curve(pkey);
+    return curve? curve->name : NULL;
+}
+
+const char *md_pkey_get_ec_x64(md_pkey_t *pkey, apr_pool_t *p)
+{
+    return ec_coord64(pkey, 0, p);
+}
+
+const char *md_pkey_get_ec_y64(md_pkey_t *pkey, apr_pool_t *p)
+{
+    return ec_coord64(pkey, 1, p);
+}
+
+static void jws_init(md_pkey_t *pkey)
+{
+    const ec_curve_t *curve;
+    EC_KEY *ec;
+    
+    if (pkey->jws_ready) {
+        return;
+    }
+    pkey->sign_md = EVP_sha256();
+    switch (md_pkey_get_type(pkey)) {
+        case MD_PKEY_TYPE_RSA:
+            pkey->jws_alg = "RS256";
+            break;
+        case MD_PKEY_TYPE_EC:
+            curve = pkey_ec_curve(pkey);
+            pkey->jws_alg = curve? curve->alg : NULL;
+            if (curve && curve->nid == NID_secp384r1) {
+                pkey->sign_md = EVP_sha384();
+            }
+            if ((ec = EVP_PKEY_get1_EC_KEY(pkey->pkey)) != NULL) {
+                pkey->ec_flen = (apr_size_t)(EC_GROUP_get_degree(EC_KEY_get0_group(ec)) + 7) / 8;
+                EC_KEY_free(ec);
+            }
+            break;
+        default:
+            pkey->jws_alg = NULL;
+            break;
+    }
+    pkey->jws_ready = 1;
+}
+
+const char *md_pkey_get_jws_alg(md_pkey_t *pkey)
+{
+    jws_init(pkey);
+    return pkey->jws_alg;
+}
+
+md_json_t *md_pkey_get_jwk(md_pkey_t *pkey)
+{
+    md_json_t *jwk;
+    const char *s1, *s2, *s3;
+    
+    if (pkey->jwk) {
+        return pkey->jwk;
+    }
+    /* RFC 7638 members in lexicographic order, so the compact form is the 
+     * input for the thumbprint */
+    jwk = md_json_create(pkey->pool);
+    switch (md_pkey_get_type(pkey)) {
+        case MD_PKEY_TYPE_EC:
+            s1 = md_pkey_get_ec_crv(pkey);
+            s2 = md_pkey_get_ec_x64(pkey, pkey->pool);
+            s3 = md_pkey_get_ec_y64(pkey, pkey->pool);
+            if (!s1 || !s2 || !s3) {
+                return NULL;
+            }
+            md_json_sets(s1, jwk, "crv", NULL);
+            md_json_sets("EC", jwk, "kty", NULL);
+            md_json_sets(s2, jwk, "x", NULL);
+            md_json_sets(s3, jwk, "y", NULL);
+            break;
+        case MD_PKEY_TYPE_RSA:
+            s1 = md_pkey_get_rsa_e64(pkey, pkey->pool);
+            s2 = md_pkey_get_rsa_n64(pkey, pkey->pool);
+            if (!s1 || !s2) {
+                return NULL;
+            }
+            md_json_sets(s1, jwk, "e", NULL);
+            md_json_sets("RSA", jwk, "kty", NULL);
+            md_json_sets(s2, jwk, "n", NULL);
+            break;
+        default:
+            return NULL;
+    }
+    pkey->jwk = jwk;
+    return jwk;
+}
+
+const char *md_pkey_get_jwk_thumb64(md_pkey_t *pkey)
+{
+    md_json_t *jwk;
+    const char *s, *thumb64;
+    
+    if (!pkey->jwk_thumb64 
+        && (jwk = md_pkey_get_jwk(pkey)) != NULL
+        && (s = md_json_writep(jwk, pkey->pool, MD_JSON_FMT_COMPACT)) != NULL
+        && APR_SUCCESS == md_crypt_sha256_digest64(&thumb64, pkey->pool, s, strlen(s))) {
+        pkey->jwk_thumb64 = thumb64;
+    }
+    return pkey->jwk_thumb64;
+}
+
+/* JWS wants the raw r||s concatenation, OpenSSL gives us a DER ECDSA-Sig-Value */
+static const char *ec_sig64(md_pkey_t *pkey, const unsigned char *der, unsigned int dlen,
+                            apr_pool_t *p)
+{
+    const unsigned char *q = der;
+    const BIGNUM *r, *s;
+    ECDSA_SIG *sig;
+    apr_size_t flen = pkey->ec_flen;
+    char *buffer;
+    const char *sign64 = NULL;
+    
+    if (!flen) {
+        return NULL;
+    }
+    if ((sig = d2i_ECDSA_SIG(NULL, &q, (long)dlen)) != NULL) {
+        ECDSA_SIG_get0(sig, &r, &s);
+        if ((apr_size_t)BN_num_bytes(r) <= flen && (apr_size_t)BN_num_bytes(s) <= flen) {
+            buffer = apr_pcalloc(p, 2 * flen);
+            BN_bn2bin(r, (unsigned char *)buffer + (flen - (apr_size_t)BN_num_bytes(r)));
+            BN_bn2bin(s, (unsigned char *)buffer + (2 * flen - (apr_size_t)BN_num_bytes(s)));
+            sign64 = md_util_base64url_encode(buffer, 2 * flen, p);
+        }
+        ECDSA_SIG_free(sig);
+    }
+    return sign64;
 }
 
 apr_status_t md_crypt_sign64(const char **psign64, md_pkey_t *pkey, apr_pool_t *p, 
                              const char *d, size_t dlen)
 {
-    EVP_MD_CTX *ctx = NULL;
+    EVP_MD_CTX *ctx;
+    int is_ec;
     char *buffer;
     unsigned int blen;
     const char *sign64 = NULL;
     apr_status_t rv = APR_ENOMEM;
     
+    jws_init(pkey);
+    is_ec = (md_pkey_get_type(pkey) == MD_PKEY_TYPE_EC);
+    
+    /* the digest context is kept with the key, a burst of requests signed with
+     * the account key then does not set up a new one each time. */
+    if (!pkey->sign_ctx) {
+        pkey->sign_ctx = EVP_MD_CTX_create();
+        if (pkey->sign_ctx) {
+            apr_pool_cleanup_register(pkey->pool, pkey, sign_ctx_cleanup, 
+                                      apr_pool_cleanup_null);
+        }
+    }
+    ctx = pkey->sign_ctx;
+    
     buffer = apr_pcalloc(p, (apr_size_t)EVP_PKEY_size(pkey->pkey));
-    if (buffer) {
-        ctx = EVP_MD_CTX_create();
-        if (ctx) {
-            rv = APR_ENOTIMPL;
-            if (EVP_SignInit_ex(ctx, EVP_sha256(), NULL)) {
-                rv = APR_EGENERAL;
-                if (EVP_SignUpdate(ctx, d, dlen)) {
-                    if (EVP_SignFinal(ctx, (unsigned char*)buffer, &blen, pkey->pkey)) {
-                        sign64 = md_util_base64url_encode(buffer, blen, p);
-                        if (sign64) {
-                            rv = APR_SUCCESS;
-                        }
+    if (buffer && ctx) {
+        rv = APR_ENOTIMPL;
+        if (EVP_SignInit_ex(ctx, pkey->sign_md, NULL)) {
+            rv = APR_EGENERAL;
+            if (EVP_SignUpdate(ctx, d, dlen)) {
+                if (EVP_SignFinal(ctx, (unsigned char*)buffer, &blen, pkey->pkey)) {
+                    sign64 = (is_ec? ec_sig64(pkey, (unsigned char*)buffer, blen, p)
+                              : md_util_base64url_encode(buffer, blen, p));
+                    if (sign64) {
+                        rv = APR_SUCCESS;
                     }
                 }
             }
         }
-        
-        if (ctx) {
-            EVP_MD_CTX_destroy(ctx);
-        }
     }
     
     if (rv != APR_SUCCESS) {
@@ -696,6 +1354,12 @@ static md_cert_t *make_cert(apr_pool_t *p, X509 *x509)
     return cert;
 }
 
+md_cert_t *md_cert_share(md_cert_t *cert, apr_pool_t *p)
+{
+    X509_up_ref(cert->x509);
+    return make_cert(p, cert->x509);
+}
+
 void md_cert_free(md_cert_t *cert)
 {
     cert_cleanup(cert);
@@ -1036,6 +1700,68 @@ apr_status_t md_chain_fsave(apr_array_header_t *certs, apr_pool_t *p,
     return rv;
 }
 
+apr_status_t md_chain_from_pem(apr_array_header_t **pcerts, apr_pool_t *p, 
+                               const char *pem, apr_size_t pem_len)
+{
+    apr_array_header_t *certs;
+    apr_status_t rv = APR_SUCCESS;
+    unsigned long err;
+    X509 *x509;
+    BIO *bio;
+    
+    if (pem_len > INT_MAX) {
+        return APR_EINVAL;
+    }
+    if (NULL == (bio = BIO_new_mem_buf((void*)pem, (int)pem_len))) {
+        return APR_ENOMEM;
+    }
+    certs = apr_array_make(p, 5, sizeof(md_cert_t *));
+    ERR_clear_error();
+    while (NULL != (x509 = PEM_read_bio_X509(bio, NULL, NULL, NULL))) {
+        APR_ARRAY_PUSH(certs, md_cert_t *) = make_cert(p, x509);
+    }
+    BIO_free(bio);
+    
+    if (0 < (err =  ERR_get_error())
+        && !(ERR_GET_LIB(err) == ERR_LIB_PEM && ERR_GET_REASON(err) == PEM_R_NO_START_LINE)) {
+        rv = APR_EINVAL;
+    }
+    *pcerts = (APR_SUCCESS == rv)? certs : NULL;
+    return rv;
+}
+
+apr_status_t md_chain_to_pem(const char **ppem, apr_size_t *ppem_len, 
+                             apr_array_header_t *certs, apr_pool_t *p)
+{
+    const md_cert_t *cert;
+    char *data;
+    BIO *bio;
+    int i;
+    
+    *ppem = NULL;
+    *ppem_len = 0;
+    if (NULL == (bio = BIO_new(BIO_s_mem()))) {
+        return APR_ENOMEM;
+    }
+    ERR_clear_error();
+    for (i = 0; i < certs->nelts; ++i) {
+        cert = APR_ARRAY_IDX(certs, i, const md_cert_t *);
+        if (!PEM_write_bio_X509(bio, cert->x509)) {
+            BIO_free(bio);
+            return APR_EINVAL;
+        }
+    }
+    
+    i = BIO_pending(bio);
+    data = apr_palloc(p, (apr_size_t)(i > 0? i : 0) + 1);
+    i = (i > 0)? BIO_read(bio, data, i) : 0;
+    data[(i > 0)? i : 0] = '\0';
+    BIO_free(bio);
+    *ppem = data;
+    *ppem_len = (apr_size_t)((i > 0)? i : 0);
+    return APR_SUCCESS;
+}
+
 /**************************************************************************************************/
 /* certificate signing requests */
 
@@ -44,16 +44,22 @@ typedef struct md_pkey_t md_pkey_t;
 typedef enum {
     MD_PKEY_TYPE_DEFAULT,
     MD_PKEY_TYPE_RSA,
+    MD_PKEY_TYPE_EC,
 } md_pkey_type_t;
 
 typedef struct md_pkey_rsa_spec_t {
     apr_uint32_t bits;
 } md_pkey_rsa_spec_t;
 
+typedef struct md_pkey_ec_spec_t {
+    const char *curve;              /* JWA curve name, e.g. "P-256" */
+} md_pkey_ec_spec_t;
+
 typedef struct md_pkey_spec_t {
     md_pkey_type_t type;
     union {
         md_pkey_rsa_spec_t rsa;
+        md_pkey_ec_spec_t ec;
     } params;
 } md_pkey_spec_t;
 
@@ -62,9 +68,58 @@ apr_status_t md_crypt_init(apr_pool_t *pool);
 apr_status_t md_pkey_gen(md_pkey_t **ppkey, apr_pool_t *p, md_pkey_spec_t *spec);
 void md_pkey_free(md_pkey_t *pkey);
 
+/**
+ * Get another reference to the key, valid for the lifetime of pool p.
+ */
+md_pkey_t *md_pkey_share(md_pkey_t *pkey, apr_pool_t *p);
+
+/**
+ * Ask for n keys of the given spec to be kept in stock. md_pkey_gen() hands
+ * out stocked keys first and only generates inline when the stock is empty.
+ * The count is capped by MD_PKEY_STOCK_MAX.
+ */
+void md_pkey_stock_want(const md_pkey_spec_t *spec, int n);
+
+/**
+ * Want no more keys of any spec. Keys already in stock are kept for md_pkey_gen().
+ */
+void md_pkey_stock_reset(void);
+
+/**
+ * Generate keys for the stock until all wanted counts are met or the time
+ * budget is used up. Returns APR_EAGAIN if the stock is not yet full.
+ */
+apr_status_t md_pkey_stock_fill(apr_pool_t *p, apr_interval_time_t budget);
+
+md_pkey_type_t md_pkey_get_type(md_pkey_t *pkey);
+
 const char *md_pkey_get_rsa_e64(md_pkey_t *pkey, apr_pool_t *p);
 const char *md_pkey_get_rsa_n64(md_pkey_t *pkey, apr_pool_t *p);
 
+/**
+ * Map a curve name (JWA "P-256", or the OpenSSL/SECG aliases) to the
+ * canonical JWA name. Returns NULL for curves we do not support.
+ */
+const char *md_pkey_ec_curve_name(const char *name);
+
+const char *md_pkey_get_ec_crv(md_pkey_t *pkey);
+const char *md_pkey_get_ec_x64(md_pkey_t *pkey, apr_pool_t *p);
+const char *md_pkey_get_ec_y64(md_pkey_t *pkey, apr_pool_t *p);
+
+/**
+ * Get the JWS "alg" matching the key and the digest md_crypt_sign64 will use,
+ * e.g. "RS256" for RSA or "ES384" for a P-384 key.
+ */
+const char *md_pkey_get_jws_alg(md_pkey_t *pkey);
+
+/**
+ * Get the public JWK of the key with the members RFC 7638 requires, in its
+ * order. It and its base64url SHA-256 thumbprint are computed once and live 
+ * as long as the key. NULL if the key type is not supported.
+ */
+struct md_json_t *md_pkey_get_jwk(md_pkey_t *pkey);
+const char *md_pkey_get_jwk_thumb64(md_pkey_t *pkey);
+
 apr_status_t md_pkey_fload(md_pkey_t **ppkey, apr_pool_t *p, 
                            const char *pass_phrase, apr_size_t pass_len,
                            const char *fname);
@@ -72,6 +127,16 @@ apr_status_t md_pkey_fsave(md_pkey_t *pkey, apr_pool_t *p,
                            const char *pass_phrase, apr_size_t pass_len, 
                            const char *fname, apr_fileperms_t perms);
 
+/**
+ * Read/write a private key in PEM format from/to memory, encrypted when
+ * a pass phrase is given. Same format as md_pkey_fload/fsave use.
+ */
+apr_status_t md_pkey_from_pem(md_pkey_t **ppkey, apr_pool_t *p, 
+                              const char *pass_phrase, apr_size_t pass_len,
+                              const char *pem, apr_size_t pem_len);
+apr_status_t md_pkey_to_pem(const char **ppem, apr_size_t *ppem_len, md_pkey_t *pkey, 
+                            apr_pool_t *p, const char *pass_phrase, apr_size_t pass_len);
+
 apr_status_t md_crypt_sign64(const char **psign64, md_pkey_t *pkey, apr_pool_t *p, 
                              const char *d, size_t dlen);
 
@@ -95,6 +160,11 @@ typedef enum {
 
 void md_cert_free(md_cert_t *cert);
 
+/**
+ * Get another reference to the certificate, valid for the lifetime of pool p.
+ */
+md_cert_t *md_cert_share(md_cert_t *cert, apr_pool_t *p);
+
 apr_status_t md_cert_fload(md_cert_t **pcert, apr_pool_t *p, const char *fname);
 apr_status_t md_cert_fsave(md_cert_t *cert, apr_pool_t *p, 
                            const char *fname, apr_fileperms_t perms);
@@ -123,6 +193,14 @@ apr_status_t md_chain_fsave(struct apr_array_header_t *certs,
 apr_status_t md_chain_fappend(struct apr_array_header_t *certs, 
                               apr_pool_t *p, const char *fname);
 
+/**
+ * Read/write certificates in PEM format from/to memory, as md_chain_fload/fsave do.
+ */
+apr_status_t md_chain_from_pem(struct apr_array_header_t **pcerts, apr_pool_t *p, 
+                               const char *pem, apr_size_t pem_len);
+apr_status_t md_chain_to_pem(const char **ppem, apr_size_t *ppem_len, 
+                             struct apr_array_header_t *certs, apr_pool_t *p);
+
 apr_status_t md_cert_req_create(const char **pcsr_der_64, const struct md_t *md, 
                                 md_pkey_t *pkey, apr_pool_t *p);
 
@@ -14,12 +14,14 @@
  */
 
 #include <assert.h>
+#include <stdio.h>
 
 #include <curl/curl.h>
 
 #include <apr_lib.h>
 #include <apr_strings.h>
 #include <apr_buckets.h>
+#include <apr_hash.h>
 
 #include "md_http.h"
 #include "md_log.h"
@@ -48,47 +50,6 @@ static apr_status_t curl_status(int curl_code)
     }
 }
 
-static size_t req_data_cb(void *data, size_t len, size_t nmemb, void *baton)
-{
-    apr_bucket_brigade *body = baton;
-    size_t blen, read_len = 0, max_len = len * nmemb;
-    const char *bdata;
-    apr_bucket *b;
-    apr_status_t rv;
-    
-    while (body && !APR_BRIGADE_EMPTY(body) && max_len > 0) {
-        b = APR_BRIGADE_FIRST(body);
-        if (APR_BUCKET_IS_METADATA(b)) {
-            if (APR_BUCKET_IS_EOS(b)) {
-                body = NULL;
-            }
-        }
-        else {
-            rv = apr_bucket_read(b, &bdata, &blen, APR_BLOCK_READ);
-            if (rv == APR_SUCCESS) {
-                if (blen > max_len) {
-                    apr_bucket_split(b, max_len);
-                    blen = max_len;
-                }
-                memcpy(data, bdata, blen);
-                read_len += blen;
-                max_len -= blen;
-            }
-            else {
-                body = NULL;
-                if (!APR_STATUS_IS_EOF(rv)) {
-                    /* everything beside EOF is an error */
-                    read_len = CURL_READFUNC_ABORT;
-                }
-            }
-            
-        }
-        apr_bucket_delete(b);
-    }
-    
-    return read_len;
-}
-
 static size_t resp_data_cb(void *data, size_t len, size_t nmemb, void *baton)
 {
     md_http_response_t *res = baton;
@@ -141,21 +102,168 @@ static size_t header_cb(void *buffer, size_t elen, size_t nmemb, void *baton)
     return clen;
 }
 
+/* Per md_http_t instance, we keep an idle easy handle around that holds on to its
+ * connections. Additional handles share DNS, TLS sessions and, where libcurl 
+ * supports it, connections with each other. Requests submitted asynchronously
+ * are run by a multi handle. */
+typedef struct md_curl_result_t md_curl_result_t;
+struct md_curl_result_t {
+    long id;
+    apr_status_t rv;
+    md_curl_result_t *next;         /* in the list of free results */
+};
+
+typedef struct {
+    apr_pool_t *p;
+    CURLSH *share;
+    CURL *idle;
+    CURLM *multi;
+    int in_flight;
+    apr_array_header_t *pending; /* requests waiting for one in flight to finish */
+    int pending_next;
+    apr_hash_t *results;    /* request id -> md_curl_result_t* of finished async requests */
+    md_curl_result_t *free_results; /* taken results, reused since ch->p lives long */
+} md_curl_http_t;
+
+/* What an easy handle needs while the request is in progress */
+typedef struct {
+    CURL *curl;
+    md_http_response_t *res;
+    struct curl_slist *hdrs;
+    apr_bucket_brigade *body;   /* request body, left intact for rewinds */
+    apr_bucket *rb;             /* bucket of the body to read next */
+    apr_size_t roff;            /* bytes of rb already read */
+} md_curl_req_t;
+
+/* The request body is read without consuming the brigade, since libcurl may need
+ * to rewind and send it again, e.g. when a reused connection was closed meanwhile. */
+static size_t req_data_cb(void *data, size_t len, size_t nmemb, void *baton)
+{
+    md_curl_req_t *creq = baton;
+    size_t blen, read_len = 0, max_len = len * nmemb;
+    const char *bdata;
+    apr_bucket *b;
+    apr_status_t rv;
+    
+    while (creq->body && creq->rb != APR_BRIGADE_SENTINEL(creq->body) && max_len > 0) {
+        b = creq->rb;
+        if (APR_BUCKET_IS_METADATA(b)) {
+            if (APR_BUCKET_IS_EOS(b)) {
+                break;
+            }
+        }
+        else {
+            rv = apr_bucket_read(b, &bdata, &blen, APR_BLOCK_READ);
+            if (APR_SUCCESS != rv) {
+                /* everything beside EOF is an error */
+                return APR_STATUS_IS_EOF(rv)? read_len : CURL_READFUNC_ABORT;
+            }
+            if (creq->roff < blen) {
+                blen -= creq->roff;
+                if (blen > max_len) {
+                    blen = max_len;
+                }
+                memcpy((char *)data + read_len, bdata + creq->roff, blen);
+                creq->roff += blen;
+                read_len += blen;
+                max_len -= blen;
+                continue;
+            }
+        }
+        creq->rb = APR_BUCKET_NEXT(b);
+        creq->roff = 0;
+    }
+    return read_len;
+}
+
+static int req_seek_cb(void *baton, curl_off_t offset, int origin)
+{
+    md_curl_req_t *creq = baton;
+    
+    /* libcurl only ever rewinds to the start */
+    if (origin != SEEK_SET || offset != 0) {
+        return CURL_SEEKFUNC_CANTSEEK;
+    }
+    creq->rb = creq->body? APR_BRIGADE_FIRST(creq->body) : NULL;
+    creq->roff = 0;
+    return CURL_SEEKFUNC_OK;
+}
+
+static apr_status_t curl_http_cleanup(void *data)
+{
+    md_curl_http_t *ch = data;
+    
+    if (ch->multi) {
+        curl_multi_cleanup(ch->multi);
+        ch->multi = NULL;
+    }
+    if (ch->idle) {
+        curl_easy_cleanup(ch->idle);
+        ch->idle = NULL;
+    }
+    if (ch->share) {
+        curl_share_cleanup(ch->share);
+        ch->share = NULL;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t curl_http_create(void **pinternals, md_http_t *http, apr_pool_t *p)
+{
+    md_curl_http_t *ch;
+    
+    (void)http;
+    ch = apr_pcalloc(p, sizeof(*ch));
+    ch->p = p;
+    ch->results = apr_hash_make(p);
+    ch->pending = apr_array_make(p, 5, sizeof(md_http_request_t *));
+    ch->share = curl_share_init();
+    if (ch->share) {
+        curl_share_setopt(ch->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+        curl_share_setopt(ch->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+        curl_share_setopt(ch->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+    }
+    /* runs after all request pools, children of p, are gone */
+    apr_pool_cleanup_register(p, ch, curl_http_cleanup, apr_pool_cleanup_null);
+    *pinternals = ch;
+    return APR_SUCCESS;
+}
+
 static apr_status_t curl_init(md_http_request_t *req)
 {
-    CURL *curl = curl_easy_init();
-    if (!curl) {
-        return APR_EGENERAL;
+    md_curl_http_t *ch = md_http_get_internals(req->http);
+    md_curl_req_t *creq;
+    CURL *curl;
+    
+    if (ch && ch->idle) {
+        curl = ch->idle;
+        ch->idle = NULL;
+    }
+    else {
+        curl = curl_easy_init();
+        if (!curl) {
+            return APR_EGENERAL;
+        }
+        if (ch && ch->share) {
+            curl_easy_setopt(curl, CURLOPT_SHARE, ch->share);
+        }
     }
     
     curl_easy_setopt(curl, CURLOPT_HEADERFUNCTION, header_cb);
     curl_easy_setopt(curl, CURLOPT_HEADERDATA, NULL);
     curl_easy_setopt(curl, CURLOPT_READFUNCTION, req_data_cb);
     curl_easy_setopt(curl, CURLOPT_READDATA, NULL);
+    curl_easy_setopt(curl, CURLOPT_SEEKFUNCTION, req_seek_cb);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, NULL);
     curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, resp_data_cb);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, NULL);
+    curl_easy_setopt(curl, CURLOPT_PRIVATE, (char *)req);
     
-    req->internals = curl;
+    creq = apr_pcalloc(req->pool, sizeof(*creq));
+    creq->curl = curl;
+    req->internals = creq;
     return APR_SUCCESS;
 }
 
@@ -180,16 +288,19 @@ static int curlify_headers(void *baton, const char *key, const char *value)
     return 1;
 }
 
-static apr_status_t curl_perform(md_http_request_t *req)
+/* Get an easy handle ready to perform the request */
+static apr_status_t curl_setup(md_http_request_t *req)
 {
-    apr_status_t rv = APR_SUCCESS;
-    CURLcode curle;
+    apr_status_t rv;
+    md_curl_req_t *creq;
     md_http_response_t *res;
     CURL *curl;
-    struct curl_slist *req_hdrs = NULL;
 
-    rv = curl_init(req);
-    curl = req->internals;
+    if (APR_SUCCESS != (rv = curl_init(req))) {
+        return rv;
+    }
+    creq = req->internals;
+    curl = creq->curl;
     
     res = apr_pcalloc(req->pool, sizeof(*res));
     
@@ -198,6 +309,7 @@ static apr_status_t curl_perform(md_http_request_t *req)
     res->status = 400;
     res->headers = apr_table_make(req->pool, 5);
     res->body = apr_brigade_create(req->pool, req->bucket_alloc);
+    creq->res = res;
     
     curl_easy_setopt(curl, CURLOPT_URL, req->url);
     if (!apr_strnatcasecmp("GET", req->method)) {
@@ -213,7 +325,10 @@ static apr_status_t curl_perform(md_http_request_t *req)
         curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, req->method);
     }
     curl_easy_setopt(curl, CURLOPT_HEADERDATA, res);
-    curl_easy_setopt(curl, CURLOPT_READDATA, req->body);
+    creq->body = req->body;
+    req_seek_cb(creq, 0, SEEK_SET);
+    curl_easy_setopt(curl, CURLOPT_READDATA, creq);
+    curl_easy_setopt(curl, CURLOPT_SEEKDATA, creq);
     curl_easy_setopt(curl, CURLOPT_WRITEDATA, res);
     
     if (req->user_agent) {
@@ -229,9 +344,9 @@ static apr_status_t curl_perform(md_http_request_t *req)
         ctx.hdrs = NULL;
         ctx.rv = APR_SUCCESS;
         apr_table_do(curlify_headers, &ctx, req->headers, NULL);
-        req_hdrs = ctx.hdrs;
+        creq->hdrs = ctx.hdrs;
         if (ctx.rv == APR_SUCCESS) {
-            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, req_hdrs);
+            curl_easy_setopt(curl, CURLOPT_HTTPHEADER, creq->hdrs);
         }
     }
     
@@ -241,13 +356,21 @@ static apr_status_t curl_perform(md_http_request_t *req)
     if (md_log_is_level(req->pool, MD_LOG_TRACE3)) {
         curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
     }
+    return APR_SUCCESS;
+}
+
+/* The transfer is over, inform the callback and get rid of the request */
+static apr_status_t curl_done(md_http_request_t *req, CURLcode curle)
+{
+    md_curl_req_t *creq = req->internals;
+    md_http_response_t *res = creq->res;
+    apr_status_t rv;
     
-    curle = curl_easy_perform(curl);
     res->rv = curl_status(curle);
     
     if (APR_SUCCESS == res->rv) {
         long l;
-        res->rv = curl_status(curl_easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &l));
+        res->rv = curl_status(curl_easy_getinfo(creq->curl, CURLINFO_RESPONSE_CODE, &l));
         if (APR_SUCCESS == res->rv) {
             res->status = (int)l;
         }
@@ -266,10 +389,186 @@ static apr_status_t curl_perform(md_http_request_t *req)
     
     rv = res->rv;
     md_http_req_destroy(req);
-    if (req_hdrs) {
-        curl_slist_free_all(req_hdrs);
+    return rv;
+}
+
+static apr_status_t curl_perform(md_http_request_t *req)
+{
+    md_curl_req_t *creq;
+    apr_status_t rv;
+
+    if (APR_SUCCESS != (rv = curl_setup(req))) {
+        md_http_req_destroy(req);
+        return rv;
+    }
+    creq = req->internals;
+    return curl_done(req, curl_easy_perform(creq->curl));
+}
+
+static apr_status_t multi_add(md_curl_http_t *ch, md_http_request_t *req)
+{
+    md_curl_req_t *creq;
+    apr_status_t rv;
+    
+    if (APR_SUCCESS != (rv = curl_setup(req))) {
+        md_http_req_destroy(req);
+        return rv;
+    }
+    creq = req->internals;
+    if (CURLM_OK != curl_multi_add_handle(ch->multi, creq->curl)) {
+        md_http_req_destroy(req);
+        return APR_EGENERAL;
+    }
+    ++ch->in_flight;
+    return APR_SUCCESS;
+}
+
+static void set_result(md_curl_http_t *ch, long req_id, apr_status_t rv)
+{
+    md_curl_result_t *res;
+    
+    if ((res = ch->free_results)) {
+        ch->free_results = res->next;
+    }
+    else {
+        res = apr_palloc(ch->p, sizeof(*res));
+    }
+    res->id = req_id;
+    res->rv = rv;
+    res->next = NULL;
+    apr_hash_set(ch->results, &res->id, sizeof(res->id), res);
+}
+
+static apr_status_t take_result(md_curl_http_t *ch, md_curl_result_t *res)
+{
+    apr_hash_set(ch->results, &res->id, sizeof(res->id), NULL);
+    res->next = ch->free_results;
+    ch->free_results = res;
+    return res->rv;
+}
+
+/* Move pending requests into the multi handle as far as the limit allows */
+static void multi_add_pending(md_curl_http_t *ch, md_http_t *http)
+{
+    md_http_request_t *req;
+    int max = md_http_get_max_inflight(http);
+    long req_id;
+    apr_status_t rv;
+    
+    while (ch->pending_next < ch->pending->nelts && (max <= 0 || ch->in_flight < max)) {
+        req = APR_ARRAY_IDX(ch->pending, ch->pending_next, md_http_request_t *);
+        ++ch->pending_next;
+        req_id = req->id;
+        if (APR_SUCCESS != (rv = multi_add(ch, req))) {
+            set_result(ch, req_id, rv);
+        }
     }
+    if (ch->pending_next >= ch->pending->nelts) {
+        apr_array_clear(ch->pending);
+        ch->pending_next = 0;
+    }
+}
+
+static apr_status_t curl_submit(md_http_request_t *req)
+{
+    md_curl_http_t *ch = md_http_get_internals(req->http);
+    int max;
+    
+    if (!ch) {
+        return curl_perform(req);
+    }
+    if (!ch->multi && !(ch->multi = curl_multi_init())) {
+        md_http_req_destroy(req);
+        return APR_EGENERAL;
+    }
+    max = md_http_get_max_inflight(req->http);
+    if (max > 0 && ch->in_flight >= max) {
+        APR_ARRAY_PUSH(ch->pending, md_http_request_t *) = req;
+        return APR_SUCCESS;
+    }
+    return multi_add(ch, req);
+}
+
+static void multi_done(md_curl_http_t *ch, CURL *curl, CURLcode curle)
+{
+    md_http_request_t *req = NULL;
+    md_http_t *http;
+    long req_id;
+    
+    curl_easy_getinfo(curl, CURLINFO_PRIVATE, (char **)&req);
+    curl_multi_remove_handle(ch->multi, curl);
+    --ch->in_flight;
+    if (req) {
+        http = req->http;
+        req_id = req->id;
+        set_result(ch, req_id, curl_done(req, curle));
+        multi_add_pending(ch, http);
+    }
+}
+
+/* Let the transfers make progress, waiting at most a second for something to happen */
+static apr_status_t multi_step(md_curl_http_t *ch)
+{
+    CURLMcode mc;
+    CURLMsg *msg;
+    int running, nfds, nmsgs;
     
+    mc = curl_multi_perform(ch->multi, &running);
+    if (CURLM_OK == mc && running > 0) {
+        mc = curl_multi_wait(ch->multi, NULL, 0, 1000, &nfds);
+    }
+    while (NULL != (msg = curl_multi_info_read(ch->multi, &nmsgs))) {
+        if (CURLMSG_DONE == msg->msg) {
+            multi_done(ch, msg->easy_handle, msg->data.result);
+        }
+    }
+    if (CURLM_OK != mc) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, ch->p, 
+                      "curl multi: %s", curl_multi_strerror(mc));
+        return APR_EGENERAL;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t curl_await(md_http_t *http, long req_id)
+{
+    md_curl_http_t *ch = md_http_get_internals(http);
+    apr_hash_index_t *hi;
+    md_curl_result_t *res;
+    apr_status_t rv = APR_SUCCESS, rv2;
+    
+    if (!ch || !ch->multi) {
+        return APR_SUCCESS;
+    }
+    
+    if (req_id >= 0) {
+        while (!(res = apr_hash_get(ch->results, &req_id, sizeof(req_id))) 
+               && (ch->in_flight > 0 || ch->pending->nelts > 0)) {
+            multi_add_pending(ch, http);
+            if (APR_SUCCESS != (rv = multi_step(ch))) {
+                return rv;
+            }
+        }
+        if (res) {
+            rv = take_result(ch, res);
+        }
+        return rv;
+    }
+    
+    while (ch->in_flight > 0 || ch->pending->nelts > 0) {
+        multi_add_pending(ch, http);
+        if (APR_SUCCESS != (rv = multi_step(ch))) {
+            return rv;
+        }
+    }
+    /* deleting the current entry while iterating is fine with apr_hash */
+    for (hi = apr_hash_first(NULL, ch->results); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, (void **)&res);
+        rv2 = take_result(ch, res);
+        if (APR_SUCCESS == rv) {
+            rv = rv2;
+        }
+    }
     return rv;
 }
 
@@ -285,8 +584,21 @@ static apr_status_t md_curl_init(void) {
 
 static void curl_req_cleanup(md_http_request_t *req) 
 {
-    if (req->internals) {
-        curl_easy_cleanup(req->internals);
+    md_curl_http_t *ch = md_http_get_internals(req->http);
+    md_curl_req_t *creq = req->internals;
+    
+    if (creq) {
+        if (ch && !ch->idle) {
+            /* keep it for the next request, reset leaves its connections open */
+            curl_easy_reset(creq->curl);
+            ch->idle = creq->curl;
+        }
+        else {
+            curl_easy_cleanup(creq->curl);
+        }
+        if (creq->hdrs) {
+            curl_slist_free_all(creq->hdrs);
+        }
         req->internals = NULL;
     }
 }
@@ -294,7 +606,10 @@ static void curl_req_cleanup(md_http_request_t *req)
 static md_http_impl_t impl = {
     md_curl_init,
     curl_req_cleanup,
-    curl_perform
+    curl_perform,
+    curl_http_create,
+    curl_submit,
+    curl_await
 };
 
 md_http_impl_t * md_curl_get_impl(apr_pool_t *p)
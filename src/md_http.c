@@ -28,6 +28,9 @@ struct md_http_t {
     md_http_impl_t *impl;
     const char *user_agent;
     const char *proxy_url;
+    void *internals;
+    int async;
+    int max_inflight;
 };
 
 static md_http_impl_t *cur_impl;
@@ -72,10 +75,24 @@ apr_status_t md_http_create(md_http_t **phttp, apr_pool_t *p, const char *user_a
     if (!http->bucket_alloc) {
         return APR_EGENERAL;
     }
+    if (http->impl->create 
+        && APR_SUCCESS != (rv = http->impl->create(&http->internals, http, p))) {
+        return rv;
+    }
     *phttp = http;
     return APR_SUCCESS;
 }
 
+void *md_http_get_internals(md_http_t *http)
+{
+    return http->internals;
+}
+
+apr_bucket_alloc_t *md_http_get_bucket_alloc(md_http_t *http)
+{
+    return http->bucket_alloc;
+}
+
 void md_http_set_response_limit(md_http_t *http, apr_off_t resp_limit)
 {
     http->resp_limit = resp_limit;
@@ -149,8 +166,13 @@ static apr_status_t schedule(md_http_request_t *req,
         *preq_id = req->id;
     }
     
-    /* we send right away */
-    rv = req->http->impl->perform(req);
+    if (req->http->async && req->http->impl->submit) {
+        rv = req->http->impl->submit(req);
+    }
+    else {
+        /* we send right away */
+        rv = req->http->impl->perform(req);
+    }
     
     return rv;
 }
@@ -234,10 +256,34 @@ apr_status_t md_http_POSTd(md_http_t *http, const char *url,
     return schedule(req, body, 1, preq_id);
 }
 
+void md_http_set_async(md_http_t *http, int async)
+{
+    http->async = async;
+}
+
+void md_http_set_max_inflight(md_http_t *http, int max_inflight)
+{
+    http->max_inflight = max_inflight;
+}
+
+int md_http_get_max_inflight(md_http_t *http)
+{
+    return http->max_inflight;
+}
+
 apr_status_t md_http_await(md_http_t *http, long req_id)
 {
-    (void)http;
-    (void)req_id;
+    if (http->impl->await) {
+        return http->impl->await(http, req_id);
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t md_http_await_all(md_http_t *http)
+{
+    if (http->impl->await) {
+        return http->impl->await(http, -1);
+    }
     return APR_SUCCESS;
 }
 
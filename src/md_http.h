@@ -58,6 +58,11 @@ apr_status_t md_http_create(md_http_t **phttp, apr_pool_t *p, const char *user_a
 
 void md_http_set_response_limit(md_http_t *http, apr_off_t resp_limit);
 
+/**
+ * The bucket allocator to use for request bodies given to md_http_POST(). 
+ */
+struct apr_bucket_alloc_t *md_http_get_bucket_alloc(md_http_t *http);
+
 apr_status_t md_http_GET(md_http_t *http, 
                          const char *url, struct apr_table_t *headers,
                          md_http_cb *cb, void *baton, long *preq_id);
@@ -76,8 +81,41 @@ apr_status_t md_http_POSTd(md_http_t *http, const char *url,
                            const char *data, size_t data_len, 
                            md_http_cb *cb, void *baton, long *preq_id);
 
+/**
+ * Switch the http instance between sending requests right away and submitting
+ * them for asynchronous processing. In async mode, md_http_GET() and friends
+ * return once the request is queued and its callback is invoked from inside
+ * md_http_await() or md_http_await_all(). Callbacks must then not rely on the
+ * synchronous completion of requests they send themselves.
+ * Without support from the implementation, requests are always sent right away.
+ */
+void md_http_set_async(md_http_t *http, int async);
+
+/**
+ * Limit the number of requests processed at the same time in async mode. Requests
+ * submitted beyond this limit are queued. A value <= 0 means no limit.
+ */
+void md_http_set_max_inflight(md_http_t *http, int max_inflight);
+int md_http_get_max_inflight(md_http_t *http);
+
+/**
+ * Wait for the request to be done. Returns the status of its callback, if the
+ * request was processed asynchronously.
+ */
 apr_status_t md_http_await(md_http_t *http, long req_id);
 
+/**
+ * Wait for all submitted requests to be done. Returns APR_SUCCESS or the first
+ * failed status of the requests' callbacks.
+ */
+apr_status_t md_http_await_all(md_http_t *http);
+
+/**
+ * Get the data the implementation keeps for the lifetime of the http instance,
+ * e.g. connections to be reused by subsequent requests.
+ */
+void *md_http_get_internals(md_http_t *http);
+
 void md_http_req_destroy(md_http_request_t *req);
 
 /**************************************************************************************************/
@@ -86,12 +124,18 @@ void md_http_req_destroy(md_http_request_t *req);
 typedef apr_status_t md_http_init_cb(void);
 typedef void md_http_req_cleanup_cb(md_http_request_t *req);
 typedef apr_status_t md_http_perform_cb(md_http_request_t *req);
+typedef apr_status_t md_http_create_cb(void **pinternals, md_http_t *http, apr_pool_t *p);
+typedef apr_status_t md_http_submit_cb(md_http_request_t *req);
+typedef apr_status_t md_http_await_cb(md_http_t *http, long req_id);
 
 typedef struct md_http_impl_t md_http_impl_t;
 struct md_http_impl_t {
     md_http_init_cb *init;
     md_http_req_cleanup_cb *req_cleanup;
     md_http_perform_cb *perform;
+    md_http_create_cb *create;
+    md_http_submit_cb *submit;      /* optional, queue request for async processing */
+    md_http_await_cb *await;        /* optional, req_id < 0 awaits all */
 };
 
 void md_http_use_implementation(md_http_impl_t *impl);
@@ -747,6 +747,597 @@ apr_status_t md_json_setsa(apr_array_header_t *a, md_json_t *json, ...)
     return APR_SUCCESS;
 }
 
+/**************************************************************************************************/
+/* compiled paths */
+
+md_json_path_t *md_json_path_make(apr_pool_t *p, ...)
+{
+    md_json_path_t *path;
+    const char *key;
+    va_list ap;
+    
+    path = apr_pcalloc(p, sizeof(*path));
+    va_start(ap, p);
+    for (key = va_arg(ap, char *); key; key = va_arg(ap, char *)) {
+        if (path->nkeys >= MD_JSON_PATH_MAX) {
+            path = NULL;
+            break;
+        }
+        path->keys[path->nkeys++] = apr_pstrdup(p, key);
+    }
+    va_end(ap);
+    return path;
+}
+
+static json_t *pselect(md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = json->j;
+    int i;
+    
+    for (i = 0; i < path->nkeys && j; ++i) {
+        j = json_object_get(j, path->keys[i]);
+    }
+    return j;
+}
+
+static json_t *pselect_parent(const char **child_key, int create, 
+                              md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = json->j, *jn;
+    int i;
+    
+    *child_key = (path->nkeys > 0)? path->keys[path->nkeys-1] : NULL;
+    for (i = 0; i + 1 < path->nkeys && j; ++i) {
+        jn = json_object_get(j, path->keys[i]);
+        if (!jn && create) {
+            jn = json_object();
+            json_object_set_new(j, path->keys[i], jn);
+        }
+        j = jn;
+    }
+    return j;
+}
+
+static apr_status_t pselect_set_new(json_t *val, md_json_t *json, const md_json_path_t *path)
+{
+    const char *key;
+    json_t *j;
+    
+    j = pselect_parent(&key, 1, json, path);
+    if (!j || (key && !json_is_object(j))) {
+        json_decref(val);
+        return APR_EINVAL;
+    }
+    if (key) {
+        json_object_set_new(j, key, val);
+    }
+    else {
+        /* replace */
+        if (json->j) {
+            json_decref(json->j);
+        }
+        json->j = val;
+    }
+    return APR_SUCCESS;
+}
+
+int md_json_path_has(md_json_t *json, const md_json_path_t *path)
+{
+    return pselect(json, path) != NULL;
+}
+
+const char *md_json_path_gets(md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = pselect(json, path);
+    return (j && json_is_string(j))? json_string_value(j) : NULL;
+}
+
+const char *md_json_path_dups(apr_pool_t *p, md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = pselect(json, path);
+    return (j && json_is_string(j))? apr_pstrdup(p, json_string_value(j)) : NULL;
+}
+
+long md_json_path_getl(md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = pselect(json, path);
+    return (long)((j && json_is_number(j))? json_integer_value(j) : 0L);
+}
+
+int md_json_path_getb(md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = pselect(json, path);
+    return j? json_is_true(j) : 0;
+}
+
+apr_status_t md_json_path_sets(const char *value, md_json_t *json, const md_json_path_t *path)
+{
+    return pselect_set_new(json_string(value), json, path);
+}
+
+apr_status_t md_json_path_setl(long value, md_json_t *json, const md_json_path_t *path)
+{
+    return pselect_set_new(json_integer(value), json, path);
+}
+
+apr_status_t md_json_path_setb(int value, md_json_t *json, const md_json_path_t *path)
+{
+    return pselect_set_new(json_boolean(value), json, path);
+}
+
+apr_status_t md_json_path_setj(md_json_t *value, md_json_t *json, const md_json_path_t *path)
+{
+    json_incref(value->j);
+    return pselect_set_new(value->j, json, path);
+}
+
+apr_status_t md_json_path_dupsa(apr_array_header_t *a, apr_pool_t *p, 
+                                md_json_t *json, const md_json_path_t *path)
+{
+    json_t *j = pselect(json, path), *val;
+    size_t index;
+    
+    if (j && json_is_array(j)) {
+        json_array_foreach(j, index, val) {
+            if (json_is_string(val)) {
+                APR_ARRAY_PUSH(a, const char *) = apr_pstrdup(p, json_string_value(val));
+            }
+        }
+        return APR_SUCCESS;
+    }
+    return APR_ENOENT;
+}
+
+apr_status_t md_json_path_setsa(apr_array_header_t *a, md_json_t *json, 
+                                const md_json_path_t *path)
+{
+    json_t *j;
+    int i;
+    
+    j = json_array();
+    for (i = 0; i < a->nelts; ++i) {
+        json_array_append_new(j, json_string(APR_ARRAY_IDX(a, i, const char*)));
+    }
+    return pselect_set_new(j, json, path);
+}
+
+/**************************************************************************************************/
+/* decoding objects */
+
+static apr_status_t jdecode(void *target, const md_json_field_t *fields, json_t *j, 
+                            apr_pool_t *p, apr_pool_t *jpool)
+{
+    const md_json_field_t *f;
+    const char *key;
+    json_t *val, *item;
+    apr_array_header_t **pa;
+    md_json_t wrap;
+    char *dest;
+    size_t index;
+    int n, i, k, last = -1;
+    apr_status_t rv = APR_SUCCESS;
+    
+    for (n = 0; fields[n].key; ++n) {
+        /* count */
+    }
+    if (n <= 0) {
+        return APR_SUCCESS;
+    }
+    json_object_foreach(j, key, val) {
+        /* Objects are mostly written in the order of the fields, start looking 
+         * after the last match */
+        f = NULL;
+        for (i = 1; i <= n; ++i) {
+            k = (last + i) % n;
+            if (!strcmp(key, fields[k].key)) {
+                f = &fields[k];
+                last = k;
+                break;
+            }
+        }
+        if (!f) {
+            continue;
+        }
+        
+        dest = (char*)target + f->offset;
+        switch (f->type) {
+            case MD_JSON_FIELD_STR:
+                *(const char **)dest = (json_is_string(val)? 
+                                        apr_pstrdup(p, json_string_value(val)) : NULL);
+                break;
+            case MD_JSON_FIELD_LONG:
+                *(long *)dest = (long)(json_is_number(val)? json_integer_value(val) : 0L);
+                break;
+            case MD_JSON_FIELD_INT:
+                *(int *)dest = (int)(json_is_number(val)? json_integer_value(val) : 0L);
+                break;
+            case MD_JSON_FIELD_BOOL:
+                *(int *)dest = json_is_true(val);
+                break;
+            case MD_JSON_FIELD_STRA:
+                pa = (apr_array_header_t **)dest;
+                if (!*pa) {
+                    *pa = apr_array_make(p, 5, sizeof(const char *));
+                }
+                if (json_is_array(val)) {
+                    json_array_foreach(val, index, item) {
+                        if (json_is_string(item)) {
+                            APR_ARRAY_PUSH(*pa, const char *) = 
+                                apr_pstrdup(p, json_string_value(item));
+                        }
+                    }
+                }
+                break;
+            case MD_JSON_FIELD_OBJ:
+                if (json_is_object(val)) {
+                    rv = jdecode(target, f->fields, val, p, jpool);
+                }
+                break;
+            case MD_JSON_FIELD_CB:
+                wrap.p = jpool;
+                wrap.j = val;
+                rv = f->cb(target, &wrap, p);
+                break;
+            default:
+                rv = APR_ENOTIMPL;
+                break;
+        }
+        if (APR_SUCCESS != rv) {
+            break;
+        }
+    }
+    return rv;
+}
+
+apr_status_t md_json_decode(void *target, const md_json_field_t *fields, 
+                            md_json_t *json, apr_pool_t *p)
+{
+    if (!json->j || !json_is_object(json->j)) {
+        return APR_EINVAL;
+    }
+    return jdecode(target, fields, json->j, p, json->p);
+}
+
+/**************************************************************************************************/
+/* MessagePack encoding */
+
+/* The subset of MessagePack needed for the JSON data model: nil, booleans, integers,
+ * floats, strings, arrays and maps with string keys. Anything else is refused. */
+
+#define MP_MAX_DEPTH        64
+
+static int mp_put(json_dump_callback_t cb, void *baton, 
+                  unsigned char tag, apr_uint64_t val, int nbytes)
+{
+    unsigned char buf[9];
+    int i;
+    
+    buf[0] = tag;
+    for (i = nbytes; i > 0; --i) {
+        buf[i] = (unsigned char)(val & 0xff);
+        val >>= 8;
+    }
+    return cb((const char *)buf, (size_t)nbytes + 1, baton);
+}
+
+static int mp_head(json_dump_callback_t cb, void *baton, apr_size_t n, 
+                   unsigned char fix, apr_size_t fix_max, unsigned char tag8)
+{
+    if (n <= fix_max) {
+        return mp_put(cb, baton, (unsigned char)(fix | n), 0, 0);
+    }
+    else if (tag8 && n <= 0xff) {
+        return mp_put(cb, baton, tag8, n, 1);
+    }
+    else if (n <= 0xffff) {
+        /* str16/32, array16/32 and map16/32 follow their 8 bit or fix variants */
+        return mp_put(cb, baton, (unsigned char)(fix == 0xa0? 0xda : (fix == 0x90? 0xdc : 0xde)), 
+                      n, 2);
+    }
+    return mp_put(cb, baton, (unsigned char)(fix == 0xa0? 0xdb : (fix == 0x90? 0xdd : 0xdf)), 
+                  n, 4);
+}
+
+static int mp_str(json_dump_callback_t cb, void *baton, const char *s, apr_size_t len)
+{
+    if (mp_head(cb, baton, len, 0xa0, 31, 0xd9)) {
+        return -1;
+    }
+    return len? cb(s, len, baton) : 0;
+}
+
+static int mp_int(json_dump_callback_t cb, void *baton, json_int_t v)
+{
+    if (v >= 0) {
+        if (v <= 0x7f) {
+            return mp_put(cb, baton, (unsigned char)v, 0, 0);
+        }
+        else if (v <= 0xff) {
+            return mp_put(cb, baton, 0xcc, (apr_uint64_t)v, 1);
+        }
+        else if (v <= 0xffff) {
+            return mp_put(cb, baton, 0xcd, (apr_uint64_t)v, 2);
+        }
+        else if (v <= 0xffffffffLL) {
+            return mp_put(cb, baton, 0xce, (apr_uint64_t)v, 4);
+        }
+        return mp_put(cb, baton, 0xcf, (apr_uint64_t)v, 8);
+    }
+    else if (v >= -32) {
+        return mp_put(cb, baton, (unsigned char)(v & 0xff), 0, 0);
+    }
+    else if (v >= -128) {
+        return mp_put(cb, baton, 0xd0, (apr_uint64_t)v & 0xff, 1);
+    }
+    else if (v >= -32768) {
+        return mp_put(cb, baton, 0xd1, (apr_uint64_t)v & 0xffff, 2);
+    }
+    else if (v >= -2147483647LL - 1) {
+        return mp_put(cb, baton, 0xd2, (apr_uint64_t)v & 0xffffffff, 4);
+    }
+    return mp_put(cb, baton, 0xd3, (apr_uint64_t)v, 8);
+}
+
+static int mp_dump(json_t *j, json_dump_callback_t cb, void *baton, int depth)
+{
+    const char *key;
+    json_t *val;
+    size_t index;
+    union {
+        double d;
+        apr_uint64_t u;
+    } real;
+    
+    if (depth > MP_MAX_DEPTH) {
+        return -1;
+    }
+    switch (json_typeof(j)) {
+        case JSON_NULL:
+            return mp_put(cb, baton, 0xc0, 0, 0);
+        case JSON_FALSE:
+            return mp_put(cb, baton, 0xc2, 0, 0);
+        case JSON_TRUE:
+            return mp_put(cb, baton, 0xc3, 0, 0);
+        case JSON_INTEGER:
+            return mp_int(cb, baton, json_integer_value(j));
+        case JSON_REAL:
+            real.d = json_real_value(j);
+            return mp_put(cb, baton, 0xcb, real.u, 8);
+        case JSON_STRING:
+            return mp_str(cb, baton, json_string_value(j), json_string_length(j));
+        case JSON_ARRAY:
+            if (mp_head(cb, baton, json_array_size(j), 0x90, 15, 0)) {
+                return -1;
+            }
+            json_array_foreach(j, index, val) {
+                if (mp_dump(val, cb, baton, depth + 1)) {
+                    return -1;
+                }
+            }
+            return 0;
+        case JSON_OBJECT:
+            if (mp_head(cb, baton, json_object_size(j), 0x80, 15, 0)) {
+                return -1;
+            }
+            json_object_foreach(j, key, val) {
+                if (mp_str(cb, baton, key, strlen(key)) 
+                    || mp_dump(val, cb, baton, depth + 1)) {
+                    return -1;
+                }
+            }
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+typedef struct {
+    const unsigned char *s;
+    const unsigned char *end;
+} mp_reader;
+
+static int mp_get(apr_uint64_t *pval, mp_reader *r, int nbytes)
+{
+    apr_uint64_t val = 0;
+    
+    if (r->end - r->s < nbytes) {
+        return -1;
+    }
+    while (nbytes-- > 0) {
+        val = (val << 8) | *r->s++;
+    }
+    *pval = val;
+    return 0;
+}
+
+static json_t *mp_load(mp_reader *r, int depth);
+
+static json_t *mp_load_str(mp_reader *r, apr_uint64_t n)
+{
+    json_t *j;
+    
+    if ((apr_uint64_t)(r->end - r->s) < n) {
+        return NULL;
+    }
+    j = json_stringn((const char *)r->s, (size_t)n);
+    r->s += n;
+    return j;
+}
+
+static json_t *mp_load_array(mp_reader *r, apr_uint64_t n, int depth)
+{
+    json_t *j, *val;
+    
+    /* every element takes at least one byte */
+    if ((apr_uint64_t)(r->end - r->s) < n || !(j = json_array())) {
+        return NULL;
+    }
+    while (n-- > 0) {
+        if (!(val = mp_load(r, depth + 1)) || json_array_append_new(j, val)) {
+            json_decref(j);
+            return NULL;
+        }
+    }
+    return j;
+}
+
+static json_t *mp_load_map(mp_reader *r, apr_uint64_t n, int depth)
+{
+    json_t *j, *key, *val;
+    int err;
+    
+    if ((apr_uint64_t)(r->end - r->s) < 2 * n || !(j = json_object())) {
+        return NULL;
+    }
+    while (n-- > 0) {
+        if (!(key = mp_load(r, depth + 1))) {
+            json_decref(j);
+            return NULL;
+        }
+        val = json_is_string(key)? mp_load(r, depth + 1) : NULL;
+        err = !val || json_object_set_new(j, json_string_value(key), val);
+        json_decref(key);
+        if (err) {
+            json_decref(j);
+            return NULL;
+        }
+    }
+    return j;
+}
+
+static json_t *mp_load(mp_reader *r, int depth)
+{
+    apr_uint64_t n;
+    unsigned char c;
+    union {
+        double d;
+        apr_uint64_t u;
+    } r64;
+    union {
+        float f;
+        apr_uint32_t u;
+    } r32;
+    
+    if (depth > MP_MAX_DEPTH || r->s >= r->end) {
+        return NULL;
+    }
+    c = *r->s++;
+    if (c <= 0x7f) {
+        return json_integer(c);
+    }
+    else if (c >= 0xe0) {
+        return json_integer((json_int_t)c - 256);
+    }
+    switch (c & 0xf0) {
+        case 0x80:
+            return mp_load_map(r, c & 0x0f, depth);
+        case 0x90:
+            return mp_load_array(r, c & 0x0f, depth);
+        case 0xa0:
+        case 0xb0:
+            return mp_load_str(r, c & 0x1f);
+        default:
+            break;
+    }
+    switch (c) {
+        case 0xc0: 
+            return json_null();
+        case 0xc2: 
+            return json_false();
+        case 0xc3: 
+            return json_true();
+        case 0xca: 
+            if (mp_get(&n, r, 4)) {
+                return NULL;
+            }
+            r32.u = (apr_uint32_t)n;
+            return json_real((double)r32.f);
+        case 0xcb:
+            if (mp_get(&n, r, 8)) {
+                return NULL;
+            }
+            r64.u = n;
+            return json_real(r64.d);
+        case 0xcc: 
+        case 0xcd: 
+        case 0xce: 
+        case 0xcf:
+            if (mp_get(&n, r, 1 << (c - 0xcc)) || n > (apr_uint64_t)APR_INT64_MAX) {
+                return NULL;
+            }
+            return json_integer((json_int_t)n);
+        case 0xd0: 
+        case 0xd1: 
+        case 0xd2: 
+        case 0xd3:
+            if (mp_get(&n, r, 1 << (c - 0xd0))) {
+                return NULL;
+            }
+            switch (c) {
+                case 0xd0: 
+                    return json_integer((json_int_t)(signed char)n);
+                case 0xd1: 
+                    return json_integer((json_int_t)(apr_int16_t)n);
+                case 0xd2: 
+                    return json_integer((json_int_t)(apr_int32_t)n);
+                default: 
+                    return json_integer((json_int_t)(apr_int64_t)n);
+            }
+        case 0xd9: 
+        case 0xda: 
+        case 0xdb:
+            if (mp_get(&n, r, 1 << (c - 0xd9))) {
+                return NULL;
+            }
+            return mp_load_str(r, n);
+        case 0xdc: 
+        case 0xdd:
+            if (mp_get(&n, r, 2 << (c - 0xdc))) {
+                return NULL;
+            }
+            return mp_load_array(r, n, depth);
+        case 0xde: 
+        case 0xdf:
+            if (mp_get(&n, r, 2 << (c - 0xde))) {
+                return NULL;
+            }
+            return mp_load_map(r, n, depth);
+        default:
+            /* bin, ext and the reserved 0xc1 have no JSON equivalent */
+            return NULL;
+    }
+}
+
+static int is_msgpack(const char *data, size_t len)
+{
+    /* JSON text starts with whitespace or ASCII, a packed map or array does not */
+    unsigned char c = len? (unsigned char)data[0] : 0;
+    return (c & 0xe0) == 0x80 || (c >= 0xdc && c <= 0xdf);
+}
+
+static json_t *load_any(const char *data, size_t len, json_error_t *error)
+{
+    mp_reader r;
+    json_t *j;
+    
+    if (is_msgpack(data, len)) {
+        r.s = (const unsigned char *)data;
+        r.end = r.s + len;
+        j = mp_load(&r, 0);
+        if (j && r.s != r.end) {
+            json_decref(j);
+            j = NULL;
+        }
+        if (!j) {
+            memset(error, 0, sizeof(*error));
+            apr_cpystrn(error->text, "invalid msgpack", sizeof(error->text));
+            error->position = (int)((const char *)r.s - data);
+        }
+        return j;
+    }
+    return json_loadb(data, len, 0, error);
+}
+
 /**************************************************************************************************/
 /* formatting, parsing */
 
@@ -757,6 +1348,33 @@ typedef struct {
     apr_file_t *f;
 } j_write_ctx;
 
+static const char *FmtNames[] = {
+    "compact",
+    "indent",
+    "msgpack",
+};
+
+const char *md_json_fmt_name(md_json_fmt_t fmt)
+{
+    if ((size_t)fmt < sizeof(FmtNames)/sizeof(FmtNames[0])) {
+        return FmtNames[fmt];
+    }
+    return "unknown";
+}
+
+apr_status_t md_json_fmt_parse(md_json_fmt_t *pfmt, const char *name)
+{
+    size_t i;
+    
+    for (i = 0; i < sizeof(FmtNames)/sizeof(FmtNames[0]); ++i) {
+        if (name && !apr_strnatcasecmp(FmtNames[i], name)) {
+            *pfmt = (md_json_fmt_t)i;
+            return APR_SUCCESS;
+        }
+    }
+    return APR_EINVAL;
+}
+
 /* Convert from md_json_fmt_t to the Jansson json_dumpX flags. */
 static size_t fmt_to_flags(md_json_fmt_t fmt)
 {
@@ -767,6 +1385,14 @@ static size_t fmt_to_flags(md_json_fmt_t fmt)
            ((fmt == MD_JSON_FMT_COMPACT) ? JSON_COMPACT : JSON_INDENT(2)); 
 }
 
+static int jdump(json_t *j, json_dump_callback_t cb, void *baton, md_json_fmt_t fmt)
+{
+    if (fmt == MD_JSON_FMT_MSGPACK) {
+        return mp_dump(j, cb, baton, 0);
+    }
+    return json_dump_callback(j, cb, baton, fmt_to_flags(fmt));
+}
+
 static int dump_cb(const char *buffer, size_t len, void *baton)
 {
     apr_bucket_brigade *bb = baton;
@@ -778,56 +1404,112 @@ static int dump_cb(const char *buffer, size_t len, void *baton)
 
 apr_status_t md_json_writeb(md_json_t *json, md_json_fmt_t fmt, apr_bucket_brigade *bb)
 {
-    int rv = json_dump_callback(json->j, dump_cb, bb, fmt_to_flags(fmt));
+    int rv = jdump(json->j, dump_cb, bb, fmt);
     return rv? APR_EGENERAL : APR_SUCCESS;
 }
 
-static int chunk_cb(const char *buffer, size_t len, void *baton)
+typedef struct {
+    apr_pool_t *p;
+    char *buf;
+    apr_size_t len;
+    apr_size_t size;
+} j_str_ctx;
+
+static int str_cb(const char *buffer, size_t len, void *baton)
 {
-    apr_array_header_t *chunks = baton;
-    char *chunk = apr_pcalloc(chunks->pool, len+1);
+    j_str_ctx *ctx = baton;
+    char *nbuf;
     
-    memcpy(chunk, buffer, len);
-    APR_ARRAY_PUSH(chunks, const char *) = chunk;
+    if (ctx->len + len >= ctx->size) {
+        /* grow geometrically, the old buffer stays in the pool */
+        do {
+            ctx->size *= 2;
+        } while (ctx->len + len >= ctx->size);
+        nbuf = apr_palloc(ctx->p, ctx->size);
+        memcpy(nbuf, ctx->buf, ctx->len);
+        ctx->buf = nbuf;
+    }
+    memcpy(ctx->buf + ctx->len, buffer, len);
+    ctx->len += len;
     return 0;
 }
 
 const char *md_json_writep(md_json_t *json, apr_pool_t *p, md_json_fmt_t fmt)
 {
-    apr_array_header_t *chunks;
+    j_str_ctx ctx;
     int rv;
 
-    chunks = apr_array_make(p, 10, sizeof(char *));
-    rv = json_dump_callback(json->j, chunk_cb, chunks, fmt_to_flags(fmt));
+    if (fmt == MD_JSON_FMT_MSGPACK) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, p, "md_json_writep: msgpack is no string");
+        return NULL;
+    }
+    ctx.p = p;
+    ctx.size = 1024;
+    ctx.len = 0;
+    ctx.buf = apr_palloc(p, ctx.size);
+    rv = json_dump_callback(json->j, str_cb, &ctx, fmt_to_flags(fmt));
 
     if (rv) {
         md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, p,
                       "md_json_writep failed to dump JSON");
         return NULL;
     }
+    ctx.buf[ctx.len] = '\0';
+    return ctx.buf;
+}
 
-    switch (chunks->nelts) {
-        case 0:
-            return "";
-        case 1:
-            return APR_ARRAY_IDX(chunks, 0, const char *);
-        default:
-            return apr_array_pstrcat(p, chunks, 0);
+#define J_FILE_BUF_SIZE     8192
+
+typedef struct {
+    apr_file_t *f;
+    apr_status_t rv;
+    apr_size_t len;
+    char buf[J_FILE_BUF_SIZE];
+} j_file_ctx;
+
+static apr_status_t file_flush(j_file_ctx *ctx)
+{
+    if (ctx->len > 0 && APR_SUCCESS == ctx->rv) {
+        ctx->rv = apr_file_write_full(ctx->f, ctx->buf, ctx->len, NULL);
     }
+    ctx->len = 0;
+    return ctx->rv;
+}
+
+static int file_cb(const char *buffer, size_t len, void *baton)
+{
+    j_file_ctx *ctx = baton;
+    
+    /* jansson hands us many tiny pieces, collect them before writing */
+    if (ctx->len + len > sizeof(ctx->buf)) {
+        if (APR_SUCCESS != file_flush(ctx)) {
+            return -1;
+        }
+        if (len > sizeof(ctx->buf)) {
+            ctx->rv = apr_file_write_full(ctx->f, buffer, len, NULL);
+            return (APR_SUCCESS == ctx->rv)? 0 : -1;
+        }
+    }
+    memcpy(ctx->buf + ctx->len, buffer, len);
+    ctx->len += len;
+    return 0;
 }
 
 apr_status_t md_json_writef(md_json_t *json, apr_pool_t *p, md_json_fmt_t fmt, apr_file_t *f)
 {
     apr_status_t rv;
-    const char *s;
+    j_file_ctx ctx;
     
-    s = md_json_writep(json, p, fmt);
-
-    if (s) {
-        rv = apr_file_write_full(f, s, strlen(s), NULL);
+    (void)p;
+    ctx.f = f;
+    ctx.rv = APR_SUCCESS;
+    ctx.len = 0;
+    
+    if (jdump(json->j, file_cb, &ctx, fmt)) {
+        rv = (APR_SUCCESS != ctx.rv)? ctx.rv : APR_EINVAL;
     }
     else {
-        rv = APR_EINVAL;
+        rv = file_flush(&ctx);
     }
 
     if (APR_SUCCESS != rv) {
@@ -939,26 +1621,14 @@ apr_status_t md_json_readb(md_json_t **pjson, apr_pool_t *pool, apr_bucket_briga
     return APR_SUCCESS;
 }
 
-static size_t load_file_cb(void *data, size_t max_len, void *baton)
-{
-    apr_file_t *f = baton;
-    apr_size_t len = max_len;
-    apr_status_t rv;
-    
-    rv = apr_file_read(f, data, &len);
-    if (APR_SUCCESS == rv) {
-        return len;
-    }
-    else if (APR_EOF == rv) {
-        return 0;
-    }
-    return (size_t)-1;
-}
-
 apr_status_t md_json_readf(md_json_t **pjson, apr_pool_t *p, const char *fpath)
 {
     apr_file_t *f;
-    json_t *j;
+    apr_finfo_t finfo;
+    apr_pool_t *ptemp;
+    apr_size_t len;
+    char *buf;
+    json_t *j = NULL;
     apr_status_t rv;
     json_error_t error;
     
@@ -967,14 +1637,25 @@ apr_status_t md_json_readf(md_json_t **pjson, apr_pool_t *p, const char *fpath)
         return rv;
     }
 
-    j = json_load_callback(load_file_cb, f, 0, &error);
-    if (j) {
-        *pjson = json_create(p, j);
-    }
-    else {
-        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, p,
-                      "failed to load JSON file %s: %s (line %d:%d)",
-                      fpath, error.text, error.line, error.column);
+    if (APR_SUCCESS == (rv = apr_file_info_get(&finfo, APR_FINFO_SIZE, f))
+        && APR_SUCCESS == (rv = apr_pool_create(&ptemp, p))) {
+        /* read the file in one go and let the parser work on the buffer, 
+         * detecting the encoding from the first byte */
+        len = (apr_size_t)finfo.size;
+        buf = apr_palloc(ptemp, len + 1);
+        rv = apr_file_read_full(f, buf, len, &len);
+        if (APR_SUCCESS == rv || APR_EOF == rv) {
+            j = load_any(buf, len, &error);
+            if (j) {
+                *pjson = json_create(p, j);
+            }
+            else {
+                md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, p,
+                              "failed to load JSON file %s: %s (line %d:%d)",
+                              fpath, error.text, error.line, error.column);
+            }
+        }
+        apr_pool_destroy(ptemp);
     }
 
     apr_file_close(f);
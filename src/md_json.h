@@ -30,8 +30,13 @@ typedef struct md_json_t md_json_t;
 typedef enum {
     MD_JSON_FMT_COMPACT,
     MD_JSON_FMT_INDENT,
+    MD_JSON_FMT_MSGPACK,            /* binary, not for md_json_writep() */
 } md_json_fmt_t;
 
+/* "compact", "indent" or "msgpack" */
+const char *md_json_fmt_name(md_json_fmt_t fmt);
+apr_status_t md_json_fmt_parse(md_json_fmt_t *pfmt, const char *name);
+
 md_json_t *md_json_create(apr_pool_t *pool);
 void md_json_destroy(md_json_t *json);
 
@@ -97,9 +102,65 @@ apr_status_t md_json_getsa(apr_array_header_t *a, md_json_t *json, ...);
 apr_status_t md_json_dupsa(apr_array_header_t *a, apr_pool_t *p, md_json_t *json, ...);
 apr_status_t md_json_setsa(apr_array_header_t *a, md_json_t *json, ...);
 
+/* Compiled paths, for accessing the same values over and over without walking
+ * a variable argument list each time. May be initialized statically. */
+#define MD_JSON_PATH_MAX    5
+
+typedef struct md_json_path_t md_json_path_t;
+struct md_json_path_t {
+    int nkeys;
+    const char *keys[MD_JSON_PATH_MAX];
+};
+
+/* NULL terminated list of keys, returns NULL if there are too many */
+md_json_path_t *md_json_path_make(apr_pool_t *p, ...);
+
+int md_json_path_has(md_json_t *json, const md_json_path_t *path);
+const char *md_json_path_gets(md_json_t *json, const md_json_path_t *path);
+const char *md_json_path_dups(apr_pool_t *p, md_json_t *json, const md_json_path_t *path);
+long md_json_path_getl(md_json_t *json, const md_json_path_t *path);
+int md_json_path_getb(md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_path_sets(const char *value, md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_path_setl(long value, md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_path_setb(int value, md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_path_setj(md_json_t *value, md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_path_dupsa(apr_array_header_t *a, apr_pool_t *p, 
+                                md_json_t *json, const md_json_path_t *path);
+apr_status_t md_json_path_setsa(apr_array_header_t *a, md_json_t *json, 
+                                const md_json_path_t *path);
+
+/* Decoding an object into a struct in a single pass over its members. Members
+ * without a field are ignored, fields without a member are left untouched. */
+typedef enum {
+    MD_JSON_FIELD_STR,              /* const char *, copied */
+    MD_JSON_FIELD_LONG,             /* long */
+    MD_JSON_FIELD_INT,              /* int */
+    MD_JSON_FIELD_BOOL,             /* int, 1 for true */
+    MD_JSON_FIELD_STRA,             /* apr_array_header_t * of const char *, made if NULL */
+    MD_JSON_FIELD_OBJ,              /* members of a nested object, into the same struct */
+    MD_JSON_FIELD_CB,               /* handled by a callback */
+} md_json_field_type_t;
+
+typedef apr_status_t md_json_field_cb(void *target, md_json_t *value, apr_pool_t *p);
+
+typedef struct md_json_field_t md_json_field_t;
+struct md_json_field_t {
+    const char *key;
+    md_json_field_type_t type;
+    apr_size_t offset;              /* of the value in the target struct */
+    const md_json_field_t *fields;  /* MD_JSON_FIELD_OBJ, terminated by a NULL key */
+    md_json_field_cb *cb;           /* MD_JSON_FIELD_CB, value only valid during the call */
+};
+
+apr_status_t md_json_decode(void *target, const md_json_field_t *fields, 
+                            md_json_t *json, apr_pool_t *p);
+
 /* serialization & parsing */
+
+/* Dump the JSON into heap buckets appended to bb, without an intermediate string. */
 apr_status_t md_json_writeb(md_json_t *json, md_json_fmt_t fmt, struct apr_bucket_brigade *bb);
 const char *md_json_writep(md_json_t *json, apr_pool_t *p, md_json_fmt_t fmt);
+/* Dump the JSON straight to the file, p is not used. */
 apr_status_t md_json_writef(md_json_t *json, apr_pool_t *p, 
                             md_json_fmt_t fmt, struct apr_file_t *f);
 apr_status_t md_json_fcreatex(md_json_t *json, apr_pool_t *p, md_json_fmt_t fmt, 
@@ -109,6 +170,7 @@ apr_status_t md_json_freplace(md_json_t *json, apr_pool_t *p, md_json_fmt_t fmt,
 
 apr_status_t md_json_readb(md_json_t **pjson, apr_pool_t *pool, struct apr_bucket_brigade *bb);
 apr_status_t md_json_readd(md_json_t **pjson, apr_pool_t *pool, const char *data, size_t data_len);
+/* Reads JSON text as well as MD_JSON_FMT_MSGPACK files */
 apr_status_t md_json_readf(md_json_t **pjson, apr_pool_t *pool, const char *fpath);
 
 
@@ -35,23 +35,31 @@ apr_status_t md_jws_sign(md_json_t **pmsg, apr_pool_t *p,
                          struct apr_table_t *protected, 
                          struct md_pkey_t *pkey, const char *key_id)
 {
-    md_json_t *msg, *jprotected;
-    const char *prot64, *pay64, *sign64, *sign, *prot;
+    md_json_t *msg, *jprotected, *jwk;
+    const char *prot64, *pay64, *sign64, *sign, *prot, *alg;
     apr_status_t rv = APR_SUCCESS;
 
     *pmsg = NULL;
     
+    alg = md_pkey_get_jws_alg(pkey);
+    if (!alg) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, APR_ENOTIMPL, p, "jws: unsupported key type");
+        return APR_ENOTIMPL;
+    }
+    
     msg = md_json_create(p);
 
     jprotected = md_json_create(p);
-    md_json_sets("RS256", jprotected, "alg", NULL);
+    md_json_sets(alg, jprotected, "alg", NULL);
     if (key_id) {
         md_json_sets(key_id, jprotected, "kid", NULL);
     }
+    else if ((jwk = md_pkey_get_jwk(pkey)) != NULL) {
+        md_json_setj(jwk, jprotected, "jwk", NULL);
+    }
     else {
-        md_json_sets(md_pkey_get_rsa_e64(pkey, p), jprotected, "jwk", "e", NULL);
-        md_json_sets("RSA", jprotected, "jwk", "kty", NULL);
-        md_json_sets(md_pkey_get_rsa_n64(pkey, p), jprotected, "jwk", "n", NULL);
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, APR_EINVAL, p, "jws: no jwk for key");
+        return APR_EINVAL;
     }
     apr_table_do(header_set, jprotected, protected, NULL);
     prot = md_json_writep(jprotected, p, MD_JSON_FMT_COMPACT);
@@ -68,7 +76,7 @@ apr_status_t md_jws_sign(md_json_t **pmsg, apr_pool_t *p,
         pay64 = md_util_base64url_encode(payload, len, p);
 
         md_json_sets(pay64, msg, "payload", NULL);
-        sign = apr_psprintf(p, "%s.%s", prot64, pay64);
+        sign = apr_pstrcat(p, prot64, ".", pay64, NULL);
 
         rv = md_crypt_sign64(&sign64, pkey, p, sign, strlen(sign));
     }
@@ -89,17 +97,11 @@ apr_status_t md_jws_sign(md_json_t **pmsg, apr_pool_t *p,
 
 apr_status_t md_jws_pkey_thumb(const char **pthumb, apr_pool_t *p, struct md_pkey_t *pkey)
 {
-    const char *e64, *n64, *s;
-    apr_status_t rv;
+    const char *thumb64 = md_pkey_get_jwk_thumb64(pkey);
     
-    e64 = md_pkey_get_rsa_e64(pkey, p);
-    n64 = md_pkey_get_rsa_n64(pkey, p);
-    if (!e64 || !n64) {
+    if (!thumb64) {
         return APR_EINVAL;
     }
-
-    /* whitespace and order is relevant, since we hand out a digest of this */
-    s = apr_psprintf(p, "{\"e\":\"%s\",\"kty\":\"RSA\",\"n\":\"%s\"}", e64, n64);
-    rv = md_crypt_sha256_digest64(pthumb, p, s, strlen(s));
-    return rv;
+    *pthumb = apr_pstrdup(p, thumb64);
+    return APR_SUCCESS;
 }
@@ -21,6 +21,7 @@
 #include <apr_lib.h>
 #include <apr_hash.h>
 #include <apr_strings.h>
+#include <apr_thread_mutex.h>
 #include <apr_uri.h>
 
 #include "md.h"
@@ -40,8 +41,28 @@ struct md_reg_t {
     int can_http;
     int can_https;
     const char *proxy_url;
+    int max_requests;
+    
+    apr_pool_t *p;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;     /* protects the index, registry may be used by several threads */
+#endif
+    apr_pool_t *idx_pool;          /* pool for the domain index, recreated on rebuild */
+    apr_hash_t *idx_domains;       /* lowercase domain name -> md name */
+    apr_hash_t *idx_mds;           /* md name -> array of its indexed domain names */
+    
+    int batch;                     /* nesting level of md_reg_batch_begin() */
+    apr_pool_t *batch_pool;        /* holds pending changes, cleared on batch end */
+    apr_hash_t *pending;           /* md name -> reg_pending_t*, written on batch end */
+    apr_array_header_t *pending_order; /* of reg_pending_t*, in order of first change */
 };
 
+typedef struct {
+    md_t *md;
+    int create;                    /* md is new, not in the store yet */
+    int dropped;                   /* superseded by a direct store change */
+} reg_pending_t;
+
 /**************************************************************************************************/
 /* life cycle */
 
@@ -73,12 +94,21 @@ apr_status_t md_reg_init(md_reg_t **preg, apr_pool_t *p, struct md_store_t *stor
     apr_status_t rv;
     
     reg = apr_pcalloc(p, sizeof(*reg));
+    reg->p = p;
     reg->store = store;
     reg->protos = apr_hash_make(p);
     reg->can_http = 1;
     reg->can_https = 1;
     reg->proxy_url = proxy_url? apr_pstrdup(p, proxy_url) : NULL;
+    reg->max_requests = MD_MAX_REQUESTS_DEF;
     
+#if APR_HAS_THREADS
+    if (APR_SUCCESS != (rv = apr_thread_mutex_create(&reg->mutex, 
+                                                     APR_THREAD_MUTEX_NESTED, p))) {
+        *preg = NULL;
+        return rv;
+    }
+#endif
     if (APR_SUCCESS == (rv = md_acme_protos_add(reg->protos, p))) {
         rv = load_props(reg, p);
     }
@@ -92,6 +122,320 @@ struct md_store_t *md_reg_store_get(md_reg_t *reg)
     return reg->store;
 }
 
+/**************************************************************************************************/
+/* batched writes */
+
+/* Changes to mds made inside a batch are kept in memory and written once per md
+ * when the outermost batch ends. Lookups on the registry see pending changes. */
+
+static void reg_lock(md_reg_t *reg);
+static void reg_unlock(md_reg_t *reg);
+
+static md_t *pending_clone(apr_pool_t *p, const md_t *md)
+{
+    md_t *nmd = md_clone(p, md);
+    
+    if (md->pkey_spec) {
+        nmd->pkey_spec = apr_pmemdup(p, md->pkey_spec, sizeof(md_pkey_spec_t));
+    }
+    nmd->valid_from = md->valid_from;
+    nmd->expires = md->expires;
+    return nmd;
+}
+
+static md_t *pending_get(md_reg_t *reg, const char *name, apr_pool_t *p)
+{
+    reg_pending_t *pending;
+    md_t *md = NULL;
+    
+    reg_lock(reg);
+    if (reg->pending 
+        && (pending = apr_hash_get(reg->pending, name, APR_HASH_KEY_STRING))
+        && !pending->dropped) {
+        md = pending_clone(p, pending->md);
+    }
+    reg_unlock(reg);
+    return md;
+}
+
+static void pending_drop(md_reg_t *reg, const char *name)
+{
+    reg_pending_t *pending;
+    
+    reg_lock(reg);
+    if (reg->pending 
+        && (pending = apr_hash_get(reg->pending, name, APR_HASH_KEY_STRING))) {
+        pending->dropped = 1;
+        apr_hash_set(reg->pending, name, APR_HASH_KEY_STRING, NULL);
+    }
+    reg_unlock(reg);
+}
+
+static apr_status_t reg_save(md_reg_t *reg, apr_pool_t *p, md_t *md, int create)
+{
+    reg_pending_t *pending;
+    
+    reg_lock(reg);
+    if (reg->batch > 0) {
+        pending = apr_hash_get(reg->pending, md->name, APR_HASH_KEY_STRING);
+        if (!pending) {
+            pending = apr_pcalloc(reg->batch_pool, sizeof(*pending));
+            pending->create = create;
+            APR_ARRAY_PUSH(reg->pending_order, reg_pending_t *) = pending;
+        }
+        pending->md = pending_clone(reg->batch_pool, md);
+        apr_hash_set(reg->pending, pending->md->name, APR_HASH_KEY_STRING, pending);
+        reg_unlock(reg);
+        return APR_SUCCESS;
+    }
+    reg_unlock(reg);
+    return md_save(reg->store, p, MD_SG_DOMAINS, md, create);
+}
+
+static apr_status_t reg_load(md_reg_t *reg, const char *name, md_t **pmd, apr_pool_t *p)
+{
+    if (NULL != (*pmd = pending_get(reg, name, p))) {
+        return APR_SUCCESS;
+    }
+    return md_load(reg->store, MD_SG_DOMAINS, name, pmd, p);
+}
+
+apr_status_t md_reg_batch_begin(md_reg_t *reg)
+{
+    apr_status_t rv = APR_SUCCESS;
+    
+    reg_lock(reg);
+    if (reg->batch == 0) {
+        if (APR_SUCCESS != (rv = apr_pool_create(&reg->batch_pool, reg->p))) {
+            goto out;
+        }
+        apr_pool_tag(reg->batch_pool, "md_reg_batch");
+        reg->pending = apr_hash_make(reg->batch_pool);
+        reg->pending_order = apr_array_make(reg->batch_pool, 10, sizeof(reg_pending_t *));
+    }
+    ++reg->batch;
+out:
+    reg_unlock(reg);
+    return rv;
+}
+
+apr_status_t md_reg_batch_end(md_reg_t *reg, apr_pool_t *p, int commit)
+{
+    reg_pending_t *pending;
+    apr_status_t rv = APR_SUCCESS, rv2;
+    int i, n = 0;
+    
+    reg_lock(reg);
+    if (reg->batch <= 0 || --reg->batch > 0) {
+        goto out;
+    }
+    for (i = 0; commit && i < reg->pending_order->nelts; ++i) {
+        pending = APR_ARRAY_IDX(reg->pending_order, i, reg_pending_t *);
+        if (!pending->dropped) {
+            rv2 = md_save(reg->store, p, MD_SG_DOMAINS, pending->md, pending->create);
+            if (APR_SUCCESS != rv2) {
+                md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv2, p, "saving md %s", 
+                              pending->md->name);
+                rv = rv2;
+            }
+            ++n;
+        }
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "reg batch end, %d mds %s", 
+                  n, commit? "written" : "discarded");
+    if (!commit) {
+        /* the index may point to domains that never got saved */
+        reg->idx_domains = NULL;
+        reg->idx_mds = NULL;
+    }
+    apr_pool_destroy(reg->batch_pool);
+    reg->batch_pool = NULL;
+    reg->pending = NULL;
+    reg->pending_order = NULL;
+out:
+    reg_unlock(reg);
+    return rv;
+}
+
+/**************************************************************************************************/
+/* domain index */
+
+/* The registry keeps an index from domain names to the md containing it. It is built
+ * on first use from the store and kept up to date by md_reg_add(), md_reg_update() and
+ * md_reg_load(). Changes by other processes come in through md_reg_changed(), when the
+ * store reports them. Every hit is verified against the loaded md and the index is 
+ * rebuilt when it turns out to be stale. A miss is answered by the index alone.
+ */
+
+static void reg_lock(md_reg_t *reg)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(reg->mutex);
+#else
+    (void)reg;
+#endif
+}
+
+static void reg_unlock(md_reg_t *reg)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(reg->mutex);
+#else
+    (void)reg;
+#endif
+}
+
+static void idx_remove(md_reg_t *reg, const char *name)
+{
+    apr_array_header_t *domains;
+    const char *domain, *owner;
+    int i;
+    
+    if (NULL != (domains = apr_hash_get(reg->idx_mds, name, APR_HASH_KEY_STRING))) {
+        for (i = 0; i < domains->nelts; ++i) {
+            domain = APR_ARRAY_IDX(domains, i, const char *);
+            owner = apr_hash_get(reg->idx_domains, domain, APR_HASH_KEY_STRING);
+            if (owner && !strcmp(owner, name)) {
+                apr_hash_set(reg->idx_domains, domain, APR_HASH_KEY_STRING, NULL);
+            }
+        }
+        apr_hash_set(reg->idx_mds, name, APR_HASH_KEY_STRING, NULL);
+    }
+}
+
+static void idx_set(md_reg_t *reg, const md_t *md)
+{
+    apr_array_header_t *domains;
+    const char *name;
+    char *domain;
+    int i;
+    
+    reg_lock(reg);
+    if (!reg->idx_domains) {
+        goto out;
+    }
+    idx_remove(reg, md->name);
+    if (md->domains) {
+        name = apr_pstrdup(reg->idx_pool, md->name);
+        domains = apr_array_make(reg->idx_pool, md->domains->nelts, sizeof(const char *));
+        for (i = 0; i < md->domains->nelts; ++i) {
+            domain = apr_pstrdup(reg->idx_pool, APR_ARRAY_IDX(md->domains, i, const char *));
+            md_util_str_tolower(domain);
+            apr_hash_set(reg->idx_domains, domain, APR_HASH_KEY_STRING, name);
+            APR_ARRAY_PUSH(domains, const char *) = domain;
+        }
+        apr_hash_set(reg->idx_mds, name, APR_HASH_KEY_STRING, domains);
+    }
+out:
+    reg_unlock(reg);
+}
+
+static int idx_add_md(void *baton, md_store_t *store, md_t *md, apr_pool_t *ptemp)
+{
+    md_reg_t *reg = baton;
+    md_t *pmd;
+    
+    (void)store;
+    idx_set(reg, (pmd = pending_get(reg, md->name, ptemp))? pmd : md);
+    return 1;
+}
+
+static void idx_add_pending_new(md_reg_t *reg)
+{
+    reg_pending_t *pending;
+    int i;
+    
+    for (i = 0; reg->pending_order && i < reg->pending_order->nelts; ++i) {
+        pending = APR_ARRAY_IDX(reg->pending_order, i, reg_pending_t *);
+        if (pending->create && !pending->dropped) {
+            idx_set(reg, pending->md);
+        }
+    }
+}
+
+static apr_status_t idx_build(md_reg_t *reg, apr_pool_t *p, int force)
+{
+    apr_status_t rv = APR_SUCCESS;
+    
+    reg_lock(reg);
+    if (reg->idx_domains && !force) {
+        goto out;
+    }
+    if (reg->idx_pool) {
+        apr_pool_clear(reg->idx_pool);
+    }
+    else if (APR_SUCCESS != (rv = apr_pool_create(&reg->idx_pool, reg->p))) {
+        goto out;
+    }
+    reg->idx_domains = apr_hash_make(reg->idx_pool);
+    reg->idx_mds = apr_hash_make(reg->idx_pool);
+    
+    rv = md_store_md_iter(idx_add_md, reg, reg->store, p, MD_SG_DOMAINS, "*");
+    if (APR_STATUS_IS_ENOENT(rv)) {
+        rv = APR_SUCCESS;
+    }
+    if (APR_SUCCESS == rv) {
+        idx_add_pending_new(reg);
+    }
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, "building md domain index");
+        reg->idx_domains = NULL;
+        reg->idx_mds = NULL;
+    }
+    else {
+        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv, p, "md domain index built, %d domains", 
+                      (int)apr_hash_count(reg->idx_domains));
+    }
+out:
+    reg_unlock(reg);
+    return rv;
+}
+
+/* The wildcard name covering domain, when it is a single label below its parent. */
+static const char *idx_wildcard(const char *domain, apr_pool_t *p)
+{
+    const char *dot = strchr(domain, '.');
+    apr_size_t len = strlen(domain);
+    
+    if (!dot || dot == domain || memchr(domain, '*', (apr_size_t)(dot - domain))
+        || !dot[1] || strstr(dot, "..") || domain[len-1] == '.') {
+        return NULL;
+    }
+    return apr_pstrcat(p, "*", dot, NULL);
+}
+
+void md_reg_changed(md_reg_t *reg, const char *name, apr_pool_t *p)
+{
+    md_t *md;
+    apr_status_t rv;
+    
+    /* an index not built yet sees the change when it is */
+    if (APR_SUCCESS == (rv = reg_load(reg, name, &md, p))) {
+        idx_set(reg, md);
+    }
+    else if (APR_STATUS_IS_ENOENT(rv)) {
+        reg_lock(reg);
+        if (reg->idx_mds) {
+            idx_remove(reg, name);
+        }
+        reg_unlock(reg);
+    }
+}
+
+static const char *idx_lookup(md_reg_t *reg, const char *domain, apr_pool_t *p)
+{
+    char *key = md_util_str_tolower(apr_pstrdup(p, domain));
+    const char *name = NULL;
+    
+    reg_lock(reg);
+    if (reg->idx_domains) {
+        name = apr_hash_get(reg->idx_domains, key, APR_HASH_KEY_STRING);
+        name = name? apr_pstrdup(p, name) : NULL;
+    }
+    reg_unlock(reg);
+    return name;
+}
+
 /**************************************************************************************************/
 /* checks */
 
@@ -176,7 +520,7 @@ static apr_status_t check_values(md_reg_t *reg, apr_pool_t *p, const md_t *md, i
 /**************************************************************************************************/
 /* state assessment */
 
-static apr_status_t state_init(md_reg_t *reg, apr_pool_t *p, md_t *md, int save_changes)
+static apr_status_t state_init(md_reg_t *reg, apr_pool_t *p, md_t *md)
 {
     md_state_t state = MD_S_UNKNOWN;
     const md_creds_t *creds;
@@ -242,16 +586,11 @@ out:
         md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, "md{%s}: error", md->name);
     }
     
-    if (save_changes && md->state == state
-        && md->valid_from == valid_from && md->expires == expires) {
-        save_changes = 0;
-    }
+    /* Only assessed here, never saved. This is called from lookups and those must not
+     * write. The state is persisted along with the next change to the md. */
     md->state = state;
     md->valid_from = valid_from;
     md->expires = expires;
-    if (save_changes && APR_SUCCESS == rv) {
-        return md_save(reg->store, p, MD_SG_DOMAINS, md, 0);
-    }
     return rv;
 }
 
@@ -310,29 +649,71 @@ typedef struct {
     void *baton;
     const char *exclude;
     const void *result;
+    int stopped;
 } reg_do_ctx;
 
 static int reg_md_iter(void *baton, md_store_t *store, md_t *md, apr_pool_t *ptemp)
 {
     reg_do_ctx *ctx = baton;
+    md_t *pmd;
     
     (void)store;
     if (!ctx->exclude || strcmp(ctx->exclude, md->name)) {
-        state_init(ctx->reg, ptemp, (md_t*)md, 1);
-        return ctx->cb(ctx->baton, ctx->reg, md);
+        if (NULL != (pmd = pending_get(ctx->reg, md->name, ptemp))) {
+            md = pmd;
+        }
+        state_init(ctx->reg, ptemp, (md_t*)md);
+        ctx->stopped = !ctx->cb(ctx->baton, ctx->reg, md);
+        return !ctx->stopped;
     }
     return 1;
 }
 
+static void reg_do_pending_new(reg_do_ctx *ctx, apr_pool_t *p)
+{
+    apr_array_header_t *mds;
+    reg_pending_t *pending;
+    md_t *md;
+    int i;
+    
+    /* mds added in the current batch are not in the store yet */
+    mds = apr_array_make(p, 5, sizeof(md_t *));
+    reg_lock(ctx->reg);
+    for (i = 0; ctx->reg->pending_order && i < ctx->reg->pending_order->nelts; ++i) {
+        pending = APR_ARRAY_IDX(ctx->reg->pending_order, i, reg_pending_t *);
+        if (pending->create && !pending->dropped) {
+            APR_ARRAY_PUSH(mds, md_t *) = pending_clone(p, pending->md);
+        }
+    }
+    reg_unlock(ctx->reg);
+    
+    for (i = 0; i < mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mds, i, md_t *);
+        if (!ctx->exclude || strcmp(ctx->exclude, md->name)) {
+            state_init(ctx->reg, p, md);
+            if (!ctx->cb(ctx->baton, ctx->reg, md)) {
+                ctx->stopped = 1;
+                return;
+            }
+        }
+    }
+}
+
 static int reg_do(md_reg_do_cb *cb, void *baton, md_reg_t *reg, apr_pool_t *p, const char *exclude)
 {
     reg_do_ctx ctx;
+    int rv;
     
     ctx.reg = reg;
     ctx.cb = cb;
     ctx.baton = baton;
     ctx.exclude = exclude;
-    return md_store_md_iter(reg_md_iter, &ctx, reg->store, p, MD_SG_DOMAINS, "*");
+    ctx.stopped = 0;
+    rv = md_store_md_iter(reg_md_iter, &ctx, reg->store, p, MD_SG_DOMAINS, "*");
+    if (!ctx.stopped) {
+        reg_do_pending_new(&ctx, p);
+    }
+    return rv;
 }
 
 
@@ -348,80 +729,96 @@ md_t *md_reg_get(md_reg_t *reg, const char *name, apr_pool_t *p)
 {
     md_t *md;
     
-    if (APR_SUCCESS == md_load(reg->store, MD_SG_DOMAINS, name, &md, p)) {
-        state_init(reg, p, md, 1);
+    if (APR_SUCCESS == reg_load(reg, name, &md, p)) {
+        state_init(reg, p, md);
         return md;
     }
     return NULL;
 }
 
-typedef struct {
-    const char *domain;
-    md_t *md;
-} find_domain_ctx;
-
-static int find_domain(void *baton, md_reg_t *reg, md_t *md)
+/* Returns APR_ENOENT when the index does not know match, APR_EAGAIN when it points
+ * to an md no longer containing it. */
+static apr_status_t find_domain(md_t **pmd, md_reg_t *reg, const char *domain, 
+                                const char *match, apr_pool_t *p)
 {
-    find_domain_ctx *ctx = baton;
+    const char *name;
+    md_t *md;
     
-    (void)reg;
-    if (md_contains(md, ctx->domain, 0)) {
-        ctx->md = md;
-        return 0;
+    *pmd = NULL;
+    if (NULL == (name = idx_lookup(reg, match, p))) {
+        return APR_ENOENT;
     }
-    return 1;
+    if (APR_SUCCESS != reg_load(reg, name, &md, p) || !md_contains(md, match, 0)) {
+        return APR_EAGAIN;
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, p, "domain %s found in md %s", 
+                  domain, md->name);
+    *pmd = md;
+    return APR_SUCCESS;
 }
 
 md_t *md_reg_find(md_reg_t *reg, const char *domain, apr_pool_t *p)
 {
-    find_domain_ctx ctx;
-
-    ctx.domain = domain;
-    ctx.md = NULL;
-    
-    md_reg_do(find_domain, &ctx, reg, p);
-    if (ctx.md) {
-        state_init(reg, p, ctx.md, 1);
+    const char *wildcard;
+    md_t *md = NULL;
+    apr_status_t rv = APR_ENOENT;
+    int retry;
+
+    wildcard = idx_wildcard(domain, p);
+    for (retry = 0; retry < 2; ++retry) {
+        if (APR_SUCCESS != idx_build(reg, p, retry)) {
+            return NULL;
+        }
+        rv = find_domain(&md, reg, domain, domain, p);
+        if (APR_STATUS_IS_ENOENT(rv) && wildcard) {
+            rv = find_domain(&md, reg, domain, wildcard, p);
+        }
+        if (!APR_STATUS_IS_EAGAIN(rv)) {
+            break;
+        }
     }
-    return ctx.md;
-}
-
-typedef struct {
-    const md_t *md_checked;
-    md_t *md;
-    const char *s;
-} find_overlap_ctx;
-
-static int find_overlap(void *baton, md_reg_t *reg, md_t *md)
-{
-    find_overlap_ctx *ctx = baton;
-    const char *overlap;
-    
-    (void)reg;
-    if ((overlap = md_common_name(ctx->md_checked, md))) {
-        ctx->md = md;
-        ctx->s = overlap;
-        return 0;
+    if (APR_SUCCESS != rv) {
+        return NULL;
     }
-    return 1;
+    state_init(reg, p, md);
+    return md;
 }
 
 md_t *md_reg_find_overlap(md_reg_t *reg, const md_t *md, const char **pdomain, apr_pool_t *p)
 {
-    find_overlap_ctx ctx;
-    
-    ctx.md_checked = md;
-    ctx.md = NULL;
-    ctx.s = NULL;
+    const char *domain, *name, *common;
+    md_t *omd;
+    int i, retry, stale;
     
-    reg_do(find_overlap, &ctx, reg, p, md->name);
-    if (pdomain && ctx.s) {
-        *pdomain = ctx.s;
+    if (!md->domains) {
+        return NULL;
     }
-    if (ctx.md) {
-        state_init(reg, p, ctx.md, 1);
+    for (retry = 0; retry < 2; ++retry) {
+        if (APR_SUCCESS != idx_build(reg, p, retry)) {
+            return NULL;
+        }
+        stale = 0;
+        for (i = 0; i < md->domains->nelts; ++i) {
+            domain = APR_ARRAY_IDX(md->domains, i, const char *);
+            name = idx_lookup(reg, domain, p);
+            if (!name || !strcmp(name, md->name)) {
+                continue;
+            }
+            if (APR_SUCCESS == reg_load(reg, name, &omd, p)
+                && (common = md_common_name(md, omd))) {
+                if (pdomain) {
+                    *pdomain = common;
+                }
+                state_init(reg, p, omd);
+                return omd;
+            }
+            stale = 1;
+        }
+        if (!stale) {
+            break;
+        }
     }
-    return ctx.md;
+    return NULL;
 }
 
 apr_status_t md_reg_get_cred_files(md_reg_t *reg, const md_t *md, apr_pool_t *p,
@@ -448,8 +845,9 @@ static apr_status_t p_md_add(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
     md = va_arg(ap, md_t *);
     mine = md_clone(ptemp, md);
     if (APR_SUCCESS == (rv = check_values(reg, ptemp, md, MD_UPD_ALL))
-        && APR_SUCCESS == (rv = state_init(reg, ptemp, mine, 0))
-        && APR_SUCCESS == (rv = md_save(reg->store, p, MD_SG_DOMAINS, mine, 1))) {
+        && APR_SUCCESS == (rv = state_init(reg, ptemp, mine))
+        && APR_SUCCESS == (rv = reg_save(reg, p, mine, 1))) {
+        idx_set(reg, mine);
     }
     return rv;
 }
@@ -546,8 +944,11 @@ static apr_status_t p_md_update(void *baton, apr_pool_t *p, apr_pool_t *ptemp, v
         nmd->must_staple = updates->must_staple;
     }
     
-    if (fields && APR_SUCCESS == (rv = md_save(reg->store, p, MD_SG_DOMAINS, nmd, 0))) {
-        rv = state_init(reg, ptemp, nmd, 0);
+    if (fields) {
+        state_init(reg, ptemp, nmd);
+        if (APR_SUCCESS == (rv = reg_save(reg, p, nmd, 0))) {
+            idx_set(reg, nmd);
+        }
     }
     return rv;
 }
@@ -625,22 +1026,230 @@ apr_status_t md_reg_creds_get(const md_creds_t **pcreds, md_reg_t *reg,
 /**************************************************************************************************/
 /* synching */
 
+typedef struct {
+    md_t *md;
+    int idx;                        /* position in store iteration, to break ties */
+    int hits;                       /* domains in common with the md being matched */
+    int fields;                     /* MD_UPD_* fields that need to be written */
+} sync_md;
+
 typedef struct {
     apr_pool_t *p;
     apr_array_header_t *conf_mds;
-    apr_array_header_t *store_mds;
+    apr_hash_t *conf_by_name;       /* name -> md_t*, configured */
+    apr_array_header_t *store_mds;  /* of sync_md*, in store order */
+    apr_hash_t *by_name;            /* name -> sync_md*, stored */
+    apr_hash_t *by_domain;          /* lowercase domain -> array of sync_md* */
+    apr_array_header_t *updates;    /* of sync_md*, with pending writes */
 } sync_ctx;
 
+static const char *sync_dkey(sync_ctx *ctx, const char *domain)
+{
+    return md_util_str_tolower(apr_pstrdup(ctx->p, domain));
+}
+
+static void sync_index_domain(sync_ctx *ctx, sync_md *smd, const char *domain)
+{
+    const char *key = sync_dkey(ctx, domain);
+    apr_array_header_t *list;
+    
+    list = apr_hash_get(ctx->by_domain, key, APR_HASH_KEY_STRING);
+    if (!list) {
+        list = apr_array_make(ctx->p, 1, sizeof(sync_md *));
+        apr_hash_set(ctx->by_domain, key, APR_HASH_KEY_STRING, list);
+    }
+    APR_ARRAY_PUSH(list, sync_md *) = smd;
+}
+
+static void sync_unindex_domain(sync_ctx *ctx, sync_md *smd, const char *domain)
+{
+    apr_array_header_t *list;
+    int i;
+    
+    list = apr_hash_get(ctx->by_domain, sync_dkey(ctx, domain), APR_HASH_KEY_STRING);
+    for (i = 0; list && i < list->nelts; ++i) {
+        if (APR_ARRAY_IDX(list, i, sync_md *) == smd) {
+            if (i + 1 < list->nelts) {
+                memmove(list->elts + i * list->elt_size, list->elts + (i + 1) * list->elt_size,
+                        (apr_size_t)((list->nelts - i - 1) * list->elt_size));
+            }
+            --list->nelts;
+            break;
+        }
+    }
+}
+
+static void sync_set_domains(sync_ctx *ctx, sync_md *smd, apr_array_header_t *domains)
+{
+    int i;
+    
+    for (i = 0; i < smd->md->domains->nelts; ++i) {
+        sync_unindex_domain(ctx, smd, APR_ARRAY_IDX(smd->md->domains, i, const char *));
+    }
+    smd->md->domains = domains;
+    for (i = 0; i < smd->md->domains->nelts; ++i) {
+        sync_index_domain(ctx, smd, APR_ARRAY_IDX(smd->md->domains, i, const char *));
+    }
+}
+
+static void sync_changed(sync_ctx *ctx, sync_md *smd, int fields)
+{
+    if (!smd->fields) {
+        APR_ARRAY_PUSH(ctx->updates, sync_md *) = smd;
+    }
+    smd->fields |= fields;
+}
+
 static int find_changes(void *baton, md_store_t *store, md_t *md, apr_pool_t *ptemp)
 {
     sync_ctx *ctx = baton;
+    sync_md *smd;
+    int i;
 
     (void)store;
     (void)ptemp;
-    APR_ARRAY_PUSH(ctx->store_mds, const md_t*) = md_clone(ctx->p, md);
+    smd = apr_pcalloc(ctx->p, sizeof(*smd));
+    smd->md = md_clone(ctx->p, md);
+    smd->idx = ctx->store_mds->nelts;
+    APR_ARRAY_PUSH(ctx->store_mds, sync_md *) = smd;
+    apr_hash_set(ctx->by_name, smd->md->name, APR_HASH_KEY_STRING, smd);
+    for (i = 0; i < smd->md->domains->nelts; ++i) {
+        sync_index_domain(ctx, smd, APR_ARRAY_IDX(smd->md->domains, i, const char *));
+    }
     return 1;
 }
 
+/**
+ * Find the stored md that is the closest match for a configured one. Same
+ * rules as md_find_closest_match(), but counting common domains via the index:
+ * - the md with the same name
+ * - the first md that has all domains of md
+ * - the first md with the most domains in common with md
+ */
+static sync_md *sync_closest_match(sync_ctx *ctx, const md_t *md)
+{
+    apr_array_header_t *list, *touched;
+    sync_md *smd, *candidate = NULL;
+    int i, j;
+    
+    if ((candidate = apr_hash_get(ctx->by_name, md->name, APR_HASH_KEY_STRING))) {
+        return candidate;
+    }
+    
+    touched = apr_array_make(ctx->p, 5, sizeof(sync_md *));
+    for (i = 0; i < md->domains->nelts; ++i) {
+        list = apr_hash_get(ctx->by_domain, 
+                            sync_dkey(ctx, APR_ARRAY_IDX(md->domains, i, const char *)), 
+                            APR_HASH_KEY_STRING);
+        for (j = 0; list && j < list->nelts; ++j) {
+            smd = APR_ARRAY_IDX(list, j, sync_md *);
+            if (!smd->hits++) {
+                APR_ARRAY_PUSH(touched, sync_md *) = smd;
+            }
+        }
+    }
+    
+    for (i = 0; i < touched->nelts; ++i) {
+        smd = APR_ARRAY_IDX(touched, i, sync_md *);
+        if (!candidate) {
+            candidate = smd;
+        }
+        else if ((smd->hits >= md->domains->nelts) != (candidate->hits >= md->domains->nelts)) {
+            /* containing all domains beats any partial match */
+            if (smd->hits >= md->domains->nelts) {
+                candidate = smd;
+            }
+        }
+        else if (smd->hits > candidate->hits
+                 || (smd->hits == candidate->hits && smd->idx < candidate->idx)) {
+            candidate = smd;
+        }
+    }
+    for (i = 0; i < touched->nelts; ++i) {
+        APR_ARRAY_IDX(touched, i, sync_md *)->hits = 0;
+    }
+    return candidate;
+}
+
+/**
+ * Remove the domains of the configured md from all other stored mds that
+ * carry them, in one pass over md's domains.
+ */
+static apr_status_t sync_overlaps(sync_ctx *ctx, const md_t *md, apr_pool_t *p)
+{
+    apr_array_header_t *list;
+    const char *common;
+    sync_md *omd;
+    md_t *config_md;
+    int i, j;
+    
+    for (i = 0; i < md->domains->nelts; ++i) {
+        common = APR_ARRAY_IDX(md->domains, i, const char *);
+        list = apr_hash_get(ctx->by_domain, sync_dkey(ctx, common), APR_HASH_KEY_STRING);
+        for (j = 0; list && j < list->nelts; ) {
+            omd = APR_ARRAY_IDX(list, j, sync_md *);
+            if (!strcmp(omd->md->name, md->name)) {
+                ++j;
+                continue;
+            }
+            
+            /* Is this md still configured or has it been abandoned in the config? */
+            config_md = apr_hash_get(ctx->conf_by_name, omd->md->name, APR_HASH_KEY_STRING);
+            if (config_md && md_contains(config_md, common, 0)) {
+                /* domain used in two configured mds, not allowed */
+                md_log_perror(MD_LOG_MARK, MD_LOG_ERR, APR_EINVAL, p, 
+                              "domain %s used in md %s and %s", 
+                              common, md->name, omd->md->name);
+                return APR_EINVAL;
+            }
+            
+            /* this shrinks list, j stays */
+            sync_set_domains(ctx, omd, md_array_str_remove(ctx->p, omd->md->domains, common, 0));
+            if (config_md) {
+                /* domain stored in omd, but no longer has the offending domain,
+                   remove it from the store md. */
+                sync_changed(ctx, omd, MD_UPD_DOMAINS);
+            }
+            else {
+                /* domain in a store md that is no longer configured, warn about it.
+                 * Remove the domain here, so we can progress, but never save it. */
+                md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, 0, p, 
+                              "domain %s, configured in md %s, is part of the stored md %s."
+                              " That md however is no longer mentioned in the config. "
+                              "If you longer want it, remove the md from the store.", 
+                              common, md->name, omd->md->name);
+            }
+        }
+    }
+    return APR_SUCCESS;
+}
+
+/**
+ * Put the new domain lists of all updated mds into the batch before any of them
+ * is checked. A domain may move along a chain of mds (C takes x from A, which takes
+ * y from B) and no order of single updates avoids a transient overlap. With all
+ * lists staged, every overlap check sees the final domains of the others.
+ */
+static apr_status_t sync_stage_domains(md_reg_t *reg, sync_ctx *ctx, apr_pool_t *p)
+{
+    sync_md *sync;
+    md_t *md;
+    apr_status_t rv = APR_SUCCESS;
+    int i;
+    
+    for (i = 0; APR_SUCCESS == rv && i < ctx->updates->nelts; ++i) {
+        sync = APR_ARRAY_IDX(ctx->updates, i, sync_md *);
+        if ((MD_UPD_DOMAINS & sync->fields)
+            && APR_SUCCESS == (rv = reg_load(reg, sync->md->name, &md, p))) {
+            md->domains = sync->md->domains;
+            if (APR_SUCCESS == (rv = reg_save(reg, p, md, 0))) {
+                idx_set(reg, md);
+            }
+        }
+    }
+    return rv;
+}
+
 apr_status_t md_reg_set_props(md_reg_t *reg, apr_pool_t *p, int can_http, int can_https)
 {
     if (reg->can_http != can_http || reg->can_https != can_https) {
@@ -657,6 +1266,11 @@ apr_status_t md_reg_set_props(md_reg_t *reg, apr_pool_t *p, int can_http, int ca
     }
     return APR_SUCCESS;
 }
+
+void md_reg_set_max_requests(md_reg_t *reg, int max_requests)
+{
+    reg->max_requests = max_requests;
+}
  
 /**
  * Procedure:
@@ -679,11 +1293,26 @@ apr_status_t md_reg_sync(md_reg_t *reg, apr_pool_t *p, apr_pool_t *ptemp,
 {
     sync_ctx ctx;
     md_store_t *store = reg->store;
+    apr_array_header_t *added;
     apr_status_t rv;
+    int i;
 
     ctx.p = ptemp;
     ctx.conf_mds = master_mds;
-    ctx.store_mds = apr_array_make(ptemp, 100, sizeof(md_t *));
+    ctx.conf_by_name = apr_hash_make(ptemp);
+    ctx.store_mds = apr_array_make(ptemp, 100, sizeof(sync_md *));
+    ctx.by_name = apr_hash_make(ptemp);
+    ctx.by_domain = apr_hash_make(ptemp);
+    ctx.updates = apr_array_make(ptemp, 10, sizeof(sync_md *));
+    added = apr_array_make(ptemp, 10, sizeof(md_t *));
+    
+    if (APR_SUCCESS != (rv = md_reg_batch_begin(reg))) {
+        return rv;
+    }
+    for (i = 0; i < ctx.conf_mds->nelts; ++i) {
+        md_t *md = APR_ARRAY_IDX(ctx.conf_mds, i, md_t *);
+        apr_hash_set(ctx.conf_by_name, md->name, APR_HASH_KEY_STRING, md);
+    }
     
     rv = md_store_md_iter(find_changes, &ctx, store, ptemp, MD_SG_DOMAINS, "*");
     if (APR_STATUS_IS_ENOENT(rv)) {
@@ -693,63 +1322,38 @@ apr_status_t md_reg_sync(md_reg_t *reg, apr_pool_t *p, apr_pool_t *ptemp,
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
                   "sync: found %d mds in store", ctx.store_mds->nelts);
     if (APR_SUCCESS == rv) {
-        int i, fields;
-        md_t *md, *config_md, *smd, *omd;
-        const char *common;
+        int fields;
+        md_t *md, *smd;
+        sync_md *sync;
         
-        for (i = 0; i < ctx.conf_mds->nelts; ++i) {
+        for (i = 0; APR_SUCCESS == rv && i < ctx.conf_mds->nelts; ++i) {
             md = APR_ARRAY_IDX(ctx.conf_mds, i, md_t *);
             
             /* find the store md that is closest match for the configured md */
-            smd = md_find_closest_match(ctx.store_mds, md);
-            if (smd) {
+            sync = sync_closest_match(&ctx, md);
+            if (sync) {
+                smd = sync->md;
                 fields = 0;
                 
                 /* Once stored, we keep the name */
                 if (strcmp(md->name, smd->name)) {
+                    apr_hash_set(ctx.conf_by_name, md->name, APR_HASH_KEY_STRING, NULL);
                     md->name = apr_pstrdup(p, smd->name);
+                    apr_hash_set(ctx.conf_by_name, md->name, APR_HASH_KEY_STRING, md);
                 }
                 
                 /* Make the stored domain list *exactly* the same, even if
                  * someone only changed upper/lowercase, we'd like to persist that. */
                 if (!md_equal_domains(md, smd, 1)) {
                     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, 
-                                 "%s: %d domains changed", smd->name);
-                    smd->domains = md_array_str_clone(ptemp, md->domains);
+                                 "%s: domains changed", smd->name);
+                    sync_set_domains(&ctx, sync, md_array_str_clone(ptemp, md->domains));
                     fields |= MD_UPD_DOMAINS;
                 }
                 
                 /* Look for other store mds which have domains now being part of smd */
-                while (APR_SUCCESS == rv && (omd = md_get_by_dns_overlap(ctx.store_mds, md))) {
-                    /* find the name now duplicate */
-                    common = md_common_name(md, omd);
-                    assert(common);
-                    
-                    /* Is this md still configured or has it been abandoned in the config? */
-                    config_md = md_get_by_name(ctx.conf_mds, omd->name);
-                    if (config_md && md_contains(config_md, common, 0)) {
-                        /* domain used in two configured mds, not allowed */
-                        rv = APR_EINVAL;
-                        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, 
-                                      "domain %s used in md %s and %s", 
-                                      common, md->name, omd->name);
-                    }
-                    else if (config_md) {
-                        /* domain stored in omd, but no longer has the offending domain,
-                           remove it from the store md. */
-                        omd->domains = md_array_str_remove(ptemp, omd->domains, common, 0);
-                        rv = md_reg_update(reg, ptemp, omd->name, omd, MD_UPD_DOMAINS);
-                    }
-                    else {
-                        /* domain in a store md that is no longer configured, warn about it.
-                         * Remove the domain here, so we can progress, but never save it. */
-                        omd->domains = md_array_str_remove(ptemp, omd->domains, common, 0);
-                        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, 
-                                      "domain %s, configured in md %s, is part of the stored md %s."
-                                      " That md however is no longer mentioned in the config. "
-                                      "If you longer want it, remove the md from the store.", 
-                                      common, md->name, omd->name);
-                    }
+                if (APR_SUCCESS != (rv = sync_overlaps(&ctx, md, p))) {
+                    break;
                 }
 
                 if (MD_SVAL_UPDATE(md, smd, ca_url)) {
@@ -815,21 +1419,43 @@ apr_status_t md_reg_sync(md_reg_t *reg, apr_pool_t *p, apr_pool_t *ptemp,
                 }
                 
                 if (fields) {
-                    rv = md_reg_update(reg, ptemp, smd->name, smd, fields);
-                    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "md %s updated", smd->name);
+                    sync_changed(&ctx, sync, fields);
                 }
             }
             else {
                 /* new managed domain */
-                rv = md_reg_add(reg, md, ptemp);
-                md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "new md %s added", md->name);
+                APR_ARRAY_PUSH(added, md_t *) = md;
             }
         }
+        
+        /* Only change the registry once all configured mds have been checked, so that
+         * a conflict leaves the store untouched. Updates go first, as they free domains
+         * that new mds may take. The batch writes each md.json at most once and
+         * discards everything, staged domains included, when one of them fails. */
+        if (APR_SUCCESS == rv) {
+            rv = sync_stage_domains(reg, &ctx, ptemp);
+        }
+        for (i = 0; APR_SUCCESS == rv && i < ctx.updates->nelts; ++i) {
+            sync = APR_ARRAY_IDX(ctx.updates, i, sync_md *);
+            rv = md_reg_update(reg, ptemp, sync->md->name, sync->md, sync->fields);
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "md %s updated", sync->md->name);
+        }
+        for (i = 0; APR_SUCCESS == rv && i < added->nelts; ++i) {
+            md = APR_ARRAY_IDX(added, i, md_t *);
+            rv = md_reg_add(reg, md, ptemp);
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "new md %s added", md->name);
+        }
     }
     else {
         md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "loading mds");
     }
     
+    if (APR_SUCCESS == rv) {
+        rv = md_reg_batch_end(reg, ptemp, 1);
+    }
+    else {
+        md_reg_batch_end(reg, ptemp, 0);
+    }
     return rv;
 }
 
@@ -854,6 +1480,7 @@ static apr_status_t init_proto_driver(md_proto_driver_t *driver, const md_proto_
     driver->reg = reg;
     driver->store = md_reg_store_get(reg);
     driver->proxy_url = reg->proxy_url;
+    driver->max_requests = reg->max_requests;
     driver->md = md;
     driver->reset = reset;
 
@@ -923,6 +1550,7 @@ static apr_status_t run_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
     const md_proto_t *proto;
     const md_t *md, *nmd;
     md_proto_driver_t *driver;
+    md_store_txn_t *txn;
     apr_status_t rv;
     
     name = va_arg(ap, const char *);
@@ -957,9 +1585,12 @@ static apr_status_t run_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
     if (APR_SUCCESS == (rv = proto->init(driver))) {
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, ptemp, "%s: run load", md->name);
         
-        if (APR_SUCCESS == (rv = proto->preload(driver, MD_SG_TMP))) {
-            /* swap */
-            rv = md_store_move(reg->store, p, MD_SG_TMP, MD_SG_DOMAINS, md->name, 1);
+        if (APR_SUCCESS == (rv = md_store_txn_begin(&txn, reg->store, ptemp, 
+                                                    MD_SG_DOMAINS, md->name))
+            && APR_SUCCESS == (rv = proto->preload(driver, txn))) {
+            /* swap, the staged md replaces any changes not yet written */
+            pending_drop(reg, md->name);
+            rv = md_store_txn_commit(txn, 1);
             if (APR_SUCCESS == rv) {
                 /* load again */
                 nmd = md_reg_get(reg, md->name, p);
@@ -967,9 +1598,12 @@ static apr_status_t run_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
                     rv = APR_ENOENT;
                     md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "loading md after staging");
                 }
-                else if (nmd->state != MD_S_COMPLETE) {
-                    md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, 
-                                  "md has state %d after load", nmd->state);
+                else {
+                    idx_set(reg, nmd);
+                    if (nmd->state != MD_S_COMPLETE) {
+                        md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, 
+                                      "md has state %d after load", nmd->state);
+                    }
                 }
                 
                 md_store_purge(reg->store, p, MD_SG_STAGING, md->name);
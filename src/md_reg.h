@@ -19,6 +19,7 @@
 struct apr_hash_t;
 struct apr_array_header_t;
 struct md_store_t;
+struct md_store_txn_t;
 struct md_pkey_t;
 struct md_cert_t;
 
@@ -39,6 +40,21 @@ struct md_store_t *md_reg_store_get(md_reg_t *reg);
 
 apr_status_t md_reg_set_props(md_reg_t *reg, apr_pool_t *p, int can_http, int can_https);
 
+/**
+ * Set the maximum number of requests a protocol driver may have open at the
+ * same time, e.g. when setting up authorizations for many domains.
+ */
+void md_reg_set_max_requests(md_reg_t *reg, int max_requests);
+
+/**
+ * Start a batch of changes. Until the matching md_reg_batch_end(), md_reg_add()
+ * and md_reg_update() only record their changes, and lookups on the registry
+ * return the changed mds. Batches nest; the outermost end writes each changed
+ * md once, or discards all changes if commit is 0.
+ */
+apr_status_t md_reg_batch_begin(md_reg_t *reg);
+apr_status_t md_reg_batch_end(md_reg_t *reg, apr_pool_t *p, int commit);
+
 /**
  * Add a new md to the registry. This will check the name for uniqueness and
  * that domain names do not overlap with already existing mds.
@@ -46,8 +62,9 @@ apr_status_t md_reg_set_props(md_reg_t *reg, apr_pool_t *p, int can_http, int ca
 apr_status_t md_reg_add(md_reg_t *reg, md_t *md, apr_pool_t *p);
 
 /**
- * Find the md, if any, that contains the given domain name. 
- * NULL if none found.
+ * Find the md, if any, that contains the given domain name. If no md contains
+ * the name itself, an md containing the wildcard name one label above it is 
+ * returned. NULL if none found.
  */
 md_t *md_reg_find(md_reg_t *reg, const char *domain, apr_pool_t *p);
 
@@ -58,6 +75,12 @@ md_t *md_reg_find(md_reg_t *reg, const char *domain, apr_pool_t *p);
  */
 md_t *md_reg_find_overlap(md_reg_t *reg, const md_t *md, const char **pdomain, apr_pool_t *p);
 
+/**
+ * The md with the given name was changed or removed in the store by someone else,
+ * as e.g. a store watch reports. Bring what the registry knows about it up to date.
+ */
+void md_reg_changed(md_reg_t *reg, const char *name, apr_pool_t *p);
+
 /**
  * Get the md with the given unique name. NULL if it does not exist.
  * Will update the md->state.
@@ -143,11 +166,13 @@ struct md_proto_driver_t {
     int reset;
     apr_time_t stage_valid_from;
     const char *proxy_url;
+    int max_requests;
 };
 
 typedef apr_status_t md_proto_init_cb(md_proto_driver_t *driver);
 typedef apr_status_t md_proto_stage_cb(md_proto_driver_t *driver);
-typedef apr_status_t md_proto_preload_cb(md_proto_driver_t *driver, md_store_group_t group);
+/* Load the staged credentials and put what goes into the domains group into txn. */
+typedef apr_status_t md_proto_preload_cb(md_proto_driver_t *driver, struct md_store_txn_t *txn);
 
 struct md_proto_t {
     const char *protocol;
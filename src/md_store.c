@@ -54,6 +54,7 @@ static const char *GROUP_NAME[] = {
     "staging",
     "archive",
     "tmp",
+    "cache",
     NULL
 };
 
@@ -127,6 +128,80 @@ apr_status_t md_store_move(md_store_t *store, apr_pool_t *p,
     return store->move(store, p, from, to, name, archive);
 }
 
+struct md_store_txn_t {
+    md_store_t *store;
+    apr_pool_t *p;
+    md_store_group_t group;
+    const char *name;
+    apr_array_header_t *vals;
+};
+
+apr_status_t md_store_txn_begin(md_store_txn_t **ptxn, md_store_t *store, apr_pool_t *p,
+                                md_store_group_t group, const char *name)
+{
+    md_store_txn_t *txn;
+
+    txn = apr_pcalloc(p, sizeof(*txn));
+    txn->store = store;
+    txn->p = p;
+    txn->group = group;
+    txn->name = apr_pstrdup(p, name);
+    txn->vals = apr_array_make(p, 5, sizeof(md_store_txn_val_t));
+    *ptxn = txn;
+    return APR_SUCCESS;
+}
+
+apr_status_t md_store_txn_put(md_store_txn_t *txn, const char *aspect,
+                              md_store_vtype_t vtype, void *value)
+{
+    md_store_txn_val_t *val;
+    int i;
+
+    for (i = 0; i < txn->vals->nelts; ++i) {
+        val = &APR_ARRAY_IDX(txn->vals, i, md_store_txn_val_t);
+        if (!strcmp(aspect, val->aspect)) {
+            val->vtype = vtype;
+            val->value = value;
+            return APR_SUCCESS;
+        }
+    }
+    val = apr_array_push(txn->vals);
+    val->aspect = apr_pstrdup(txn->p, aspect);
+    val->vtype = vtype;
+    val->value = value;
+    return APR_SUCCESS;
+}
+
+apr_status_t md_store_txn_commit(md_store_txn_t *txn, int archive)
+{
+    return md_store_commit(txn->store, txn->p, txn->group, txn->name, txn->vals, archive);
+}
+
+apr_status_t md_store_commit(md_store_t *store, apr_pool_t *p,
+                             md_store_group_t group, const char *name,
+                             apr_array_header_t *vals, int archive)
+{
+    md_store_txn_val_t *val;
+    apr_status_t rv;
+    int i;
+
+    if (store->commit) {
+        return store->commit(store, p, group, name, vals, archive);
+    }
+    if (MD_SG_TMP == group) {
+        return APR_EINVAL;
+    }
+    rv = md_store_purge(store, p, MD_SG_TMP, name);
+    for (i = 0; i < vals->nelts && APR_SUCCESS == rv; ++i) {
+        val = &APR_ARRAY_IDX(vals, i, md_store_txn_val_t);
+        rv = md_store_save(store, p, MD_SG_TMP, name, val->aspect, val->vtype, val->value, 1);
+    }
+    if (APR_SUCCESS == rv) {
+        rv = md_store_move(store, p, MD_SG_TMP, group, name, archive);
+    }
+    return rv;
+}
+
 apr_status_t md_store_get_fname(const char **pfname, 
                                 md_store_t *store, md_store_group_t group, 
                                 const char *name, const char *aspect, 
@@ -144,6 +219,94 @@ int md_store_is_newer(md_store_t *store, md_store_group_t group1, md_store_group
     return store->is_newer(store, group1, group2, name, aspect, p);
 }
 
+apr_status_t md_store_iter_names(md_store_names_inspect *inspect, void *baton, 
+                                 md_store_t *store, apr_pool_t *p, 
+                                 md_store_group_t group, const char *pattern)
+{
+    if (store->iterate_names) {
+        return store->iterate_names(inspect, baton, store, p, group, pattern);
+    }
+    return APR_ENOTIMPL;
+}
+
+static int ends_with(const char *s, const char *suffix)
+{
+    apr_size_t slen = strlen(s), len = strlen(suffix);
+    return slen >= len && !strcmp(s + slen - len, suffix);
+}
+
+md_store_vtype_t md_store_aspect_vtype(const char *aspect)
+{
+    if (ends_with(aspect, ".json")) {
+        return MD_SV_JSON;
+    }
+    else if (ends_with(aspect, "key.pem") || !strcmp("account.pem", aspect)) {
+        return MD_SV_PKEY;
+    }
+    else if (ends_with(aspect, "cert.pem") && strcmp(MD_FN_PUBCERT, aspect)) {
+        return MD_SV_CERT;
+    }
+    else if (ends_with(aspect, ".pem")) {
+        return MD_SV_CHAIN;
+    }
+    return MD_SV_TEXT;
+}
+
+typedef struct {
+    md_store_t *dest;
+    md_store_t *src;
+    md_store_group_t group;
+    apr_status_t rv;
+    int count;
+} copy_ctx;
+
+static int copy_value(void *baton, const char *name, const char *aspect, apr_pool_t *ptemp)
+{
+    copy_ctx *ctx = baton;
+    md_store_vtype_t vtype = md_store_aspect_vtype(aspect);
+    void *value;
+    
+    if (APR_SUCCESS == (ctx->rv = md_store_load(ctx->src, ctx->group, name, aspect, 
+                                                vtype, &value, ptemp))
+        && APR_SUCCESS == (ctx->rv = md_store_save(ctx->dest, ptemp, ctx->group, name, aspect, 
+                                                   vtype, value, 0))) {
+        ++ctx->count;
+        return 1;
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_ERR, ctx->rv, ptemp, "copying %s/%s/%s", 
+                  md_store_group_name(ctx->group), name, aspect);
+    return 0;
+}
+
+apr_status_t md_store_copy(md_store_t *dest, md_store_t *src, apr_pool_t *p)
+{
+    static const md_store_group_t groups[] = {
+        MD_SG_ACCOUNTS, MD_SG_CHALLENGES, MD_SG_DOMAINS, MD_SG_STAGING, MD_SG_ARCHIVE,
+        MD_SG_CACHE,
+    };
+    copy_ctx ctx;
+    apr_status_t rv = APR_SUCCESS;
+    unsigned int i;
+    
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.dest = dest;
+    ctx.src = src;
+    for (i = 0; i < sizeof(groups)/sizeof(groups[0]) && APR_SUCCESS == rv; ++i) {
+        ctx.group = groups[i];
+        ctx.rv = APR_SUCCESS;
+        rv = md_store_iter_names(copy_value, &ctx, src, p, groups[i], "*");
+        if (APR_SUCCESS != ctx.rv) {
+            rv = ctx.rv;
+        }
+        else if (APR_STATUS_IS_ENOENT(rv)) {
+            /* nothing in this group */
+            rv = APR_SUCCESS;
+        }
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "copied %d values", ctx.count);
+    return rv;
+}
+
 /**************************************************************************************************/
 /* convenience */
 
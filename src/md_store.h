@@ -48,9 +48,27 @@ typedef apr_status_t md_store_iter_cb(md_store_inspect *inspect, void *baton, md
                                       apr_pool_t *p, md_store_group_t group, const char *pattern,
                                       const char *aspect, md_store_vtype_t vtype);
 
+typedef int md_store_names_inspect(void *baton, const char *name, const char *aspect, 
+                                   apr_pool_t *ptemp);
+
+typedef apr_status_t md_store_names_iter_cb(md_store_names_inspect *inspect, void *baton, 
+                                            md_store_t *store, apr_pool_t *p, 
+                                            md_store_group_t group, const char *pattern);
+
 typedef apr_status_t md_store_move_cb(md_store_t *store, apr_pool_t *p, md_store_group_t from, 
                                       md_store_group_t to, const char *name, int archive);
 
+typedef struct md_store_txn_val_t md_store_txn_val_t;
+struct md_store_txn_val_t {
+    const char *aspect;
+    md_store_vtype_t vtype;
+    void *value;
+};
+
+typedef apr_status_t md_store_commit_cb(md_store_t *store, apr_pool_t *p, 
+                                        md_store_group_t group, const char *name, 
+                                        struct apr_array_header_t *vals, int archive);
+
 typedef apr_status_t md_store_get_fname_cb(const char **pfname, 
                                            md_store_t *store, md_store_group_t group, 
                                            const char *name, const char *aspect, 
@@ -71,6 +89,8 @@ struct md_store_t {
     md_store_purge_cb *purge;
     md_store_get_fname_cb *get_fname;
     md_store_is_newer_cb *is_newer;
+    md_store_names_iter_cb *iterate_names;
+    md_store_commit_cb *commit;
 };
 
 void md_store_destroy(md_store_t *store);
@@ -102,10 +122,64 @@ apr_status_t md_store_iter(md_store_inspect *inspect, void *baton, md_store_t *s
                            apr_pool_t *p, md_store_group_t group, const char *pattern, 
                            const char *aspect, md_store_vtype_t vtype);
 
+/**
+ * Iterate over all names matching pattern in group and the aspects stored for them,
+ * without loading any values. Returns APR_ENOTIMPL if the store cannot do that.
+ */
+apr_status_t md_store_iter_names(md_store_names_inspect *inspect, void *baton, 
+                                 md_store_t *store, apr_pool_t *p, 
+                                 md_store_group_t group, const char *pattern);
+
+/**
+ * Get the type of value stored under aspect, judging by its name. 
+ */
+md_store_vtype_t md_store_aspect_vtype(const char *aspect);
+
+/**
+ * Copy all values of the accounts, challenges, domains, staging and archive groups
+ * from store src to store dest, replacing existing values in dest. Used to migrate 
+ * from one store implementation to another.
+ */
+apr_status_t md_store_copy(md_store_t *dest, md_store_t *src, apr_pool_t *p);
+
 apr_status_t md_store_move(md_store_t *store, apr_pool_t *p,
                            md_store_group_t from, md_store_group_t to,
                            const char *name, int archive);
 
+/**
+ * A transaction gives a name in a group a complete new set of values. Nothing is
+ * written before md_store_txn_commit(), dropping a transaction without commit
+ * leaves the store as it was.
+ */
+typedef struct md_store_txn_t md_store_txn_t;
+
+apr_status_t md_store_txn_begin(md_store_txn_t **ptxn, md_store_t *store, apr_pool_t *p, 
+                                md_store_group_t group, const char *name);
+
+/**
+ * Add a value to the transaction, replacing one added before for the same aspect.
+ */
+apr_status_t md_store_txn_put(md_store_txn_t *txn, const char *aspect, 
+                              md_store_vtype_t vtype, void *value);
+
+/**
+ * Replace all values of the name by the ones of the transaction at once. A crash
+ * leaves either all old or all new values. The fs store may only get there when it
+ * is opened the next time, where it cannot swap directories in one step. With archive
+ * set, the old values are kept in the archive group, otherwise an existing name fails 
+ * with APR_EEXIST.
+ */
+apr_status_t md_store_txn_commit(md_store_txn_t *txn, int archive);
+
+/**
+ * Commit the values in vals (md_store_txn_val_t) to name in group, as done
+ * by md_store_txn_commit(). Stores without support of their own get the values
+ * written to MD_SG_TMP and moved from there.
+ */
+apr_status_t md_store_commit(md_store_t *store, apr_pool_t *p, 
+                             md_store_group_t group, const char *name,
+                             struct apr_array_header_t *vals, int archive);
+
 apr_status_t md_store_get_fname(const char **pfname, 
                                 md_store_t *store, md_store_group_t group, 
                                 const char *name, const char *aspect, 
@@ -0,0 +1,450 @@
+/* Copyright 2017 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <apr_lib.h>
+#include <apr_file_info.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+
+#include "md.h"
+#include "md_crypt.h"
+#include "md_json.h"
+#include "md_log.h"
+#include "md_store.h"
+#include "md_store_cache.h"
+#include "md_util.h"
+
+/**************************************************************************************************/
+/* caching decorator for md_store_t */
+
+typedef struct cache_entry_t cache_entry_t;
+struct cache_entry_t {
+    cache_entry_t *prev;            /* lru list, head is the most recently used */
+    cache_entry_t *next;
+    apr_pool_t *pool;               /* owns key and value */
+    const char *key;
+    md_store_group_t group;
+    const char *name;
+    const char *aspect;
+    md_store_vtype_t vtype;
+    void *value;
+
+    int have_finfo;                 /* backend file info is known and checked on lookup */
+    apr_time_t mtime;
+    apr_off_t size;
+    apr_ino_t inode;
+};
+
+typedef struct md_store_cache_t md_store_cache_t;
+struct md_store_cache_t {
+    md_store_t s;
+
+    md_store_t *backend;
+    apr_pool_t *p;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+    apr_hash_t *entries;            /* key -> cache_entry_t* */
+    cache_entry_t *head;
+    cache_entry_t *tail;
+    apr_size_t max_entries;
+    md_store_cache_stats_t stats;
+};
+
+#define CACHE_STORE(store)     (md_store_cache_t*)(((char*)store)-offsetof(md_store_cache_t, s))
+
+static apr_status_t cache_load(md_store_t *store, md_store_group_t group,
+                               const char *name, const char *aspect,
+                               md_store_vtype_t vtype, void **pvalue, apr_pool_t *p);
+
+static void cache_lock(md_store_cache_t *cache)
+{
+#if APR_HAS_THREADS
+    if (cache->mutex) apr_thread_mutex_lock(cache->mutex);
+#else
+    (void)cache;
+#endif
+}
+
+static void cache_unlock(md_store_cache_t *cache)
+{
+#if APR_HAS_THREADS
+    if (cache->mutex) apr_thread_mutex_unlock(cache->mutex);
+#else
+    (void)cache;
+#endif
+}
+
+static const char *entry_key(md_store_group_t group, const char *name, const char *aspect,
+                             md_store_vtype_t vtype, apr_pool_t *p)
+{
+    return apr_psprintf(p, "%d/%s/%s/%d", group, name? name : "", aspect? aspect : "", vtype);
+}
+
+/* Give p its own copy, or a new reference, of a value as returned by a store */
+static void *value_share(md_store_vtype_t vtype, void *value, apr_pool_t *p)
+{
+    apr_array_header_t *chain, *copy;
+    int i;
+
+    switch (vtype) {
+        case MD_SV_TEXT:
+            return apr_pstrdup(p, value);
+        case MD_SV_JSON:
+            return md_json_clone(p, value);
+        case MD_SV_CERT:
+            return md_cert_share(value, p);
+        case MD_SV_PKEY:
+            return md_pkey_share(value, p);
+        case MD_SV_CHAIN:
+            chain = value;
+            copy = apr_array_make(p, chain->nelts, sizeof(md_cert_t *));
+            for (i = 0; i < chain->nelts; ++i) {
+                APR_ARRAY_PUSH(copy, md_cert_t *) =
+                    md_cert_share(APR_ARRAY_IDX(chain, i, md_cert_t *), p);
+            }
+            return copy;
+        default:
+            return NULL;
+    }
+}
+
+static void lru_unlink(md_store_cache_t *cache, cache_entry_t *e)
+{
+    if (e->prev) e->prev->next = e->next;
+    else cache->head = e->next;
+    if (e->next) e->next->prev = e->prev;
+    else cache->tail = e->prev;
+    e->prev = e->next = NULL;
+}
+
+static void lru_push(md_store_cache_t *cache, cache_entry_t *e)
+{
+    e->prev = NULL;
+    e->next = cache->head;
+    if (cache->head) cache->head->prev = e;
+    cache->head = e;
+    if (!cache->tail) cache->tail = e;
+}
+
+/* call with lock held */
+static void entry_drop(md_store_cache_t *cache, cache_entry_t *e)
+{
+    apr_hash_set(cache->entries, e->key, APR_HASH_KEY_STRING, NULL);
+    lru_unlink(cache, e);
+    --cache->stats.entries;
+    /* releases the references to keys and certificates */
+    apr_pool_destroy(e->pool);
+}
+
+static void invalidate_aspect(md_store_cache_t *cache, md_store_group_t group,
+                              const char *name, const char *aspect, apr_pool_t *p)
+{
+    cache_entry_t *e;
+    int vtype;
+
+    cache_lock(cache);
+    for (vtype = MD_SV_TEXT; vtype <= MD_SV_CHAIN; ++vtype) {
+        e = apr_hash_get(cache->entries, entry_key(group, name, aspect,
+                                                   (md_store_vtype_t)vtype, p),
+                         APR_HASH_KEY_STRING);
+        if (e) {
+            entry_drop(cache, e);
+            ++cache->stats.invalidated;
+        }
+    }
+    cache_unlock(cache);
+}
+
+static void invalidate_name(md_store_cache_t *cache, md_store_group_t group, const char *name)
+{
+    cache_entry_t *e, *next;
+
+    cache_lock(cache);
+    for (e = cache->head; e; e = next) {
+        next = e->next;
+        if (e->group == group && (!name || (e->name && !strcmp(name, e->name)))) {
+            entry_drop(cache, e);
+            ++cache->stats.invalidated;
+        }
+    }
+    cache_unlock(cache);
+}
+
+static int get_finfo(apr_finfo_t *finfo, md_store_cache_t *cache, md_store_group_t group,
+                     const char *name, const char *aspect, apr_pool_t *p)
+{
+    const char *fname;
+
+    return (cache->backend->get_fname
+            && APR_SUCCESS == md_store_get_fname(&fname, cache->backend, group,
+                                                 name, aspect, p)
+            && APR_SUCCESS == apr_stat(finfo, fname,
+                                       APR_FINFO_MTIME|APR_FINFO_SIZE|APR_FINFO_INODE, p));
+}
+
+static apr_status_t cache_load(md_store_t *store, md_store_group_t group,
+                               const char *name, const char *aspect,
+                               md_store_vtype_t vtype, void **pvalue, apr_pool_t *p)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    cache_entry_t *e;
+    apr_finfo_t finfo;
+    const char *key;
+    int have_finfo;
+    void *value;
+    apr_status_t rv;
+
+    key = entry_key(group, name, aspect, vtype, p);
+    /* stat before loading: a change in between makes the entry stale, never wrong */
+    have_finfo = get_finfo(&finfo, cache, group, name, aspect, p);
+
+    cache_lock(cache);
+    if ((e = apr_hash_get(cache->entries, key, APR_HASH_KEY_STRING))) {
+        if (e->have_finfo && (!have_finfo || finfo.mtime != e->mtime
+                              || finfo.size != e->size || finfo.inode != e->inode)) {
+            entry_drop(cache, e);
+            ++cache->stats.stale;
+        }
+        else {
+            lru_unlink(cache, e);
+            lru_push(cache, e);
+            ++cache->stats.hits;
+            if (pvalue) {
+                *pvalue = value_share(vtype, e->value, p);
+            }
+            cache_unlock(cache);
+            return APR_SUCCESS;
+        }
+    }
+    ++cache->stats.misses;
+    cache_unlock(cache);
+
+    rv = md_store_load(cache->backend, group, name, aspect, vtype, &value, p);
+    if (APR_SUCCESS != rv || cache->max_entries == 0) {
+        goto out;
+    }
+
+    cache_lock(cache);
+    if (!apr_hash_get(cache->entries, key, APR_HASH_KEY_STRING)) {
+        apr_pool_t *ep;
+
+        while (cache->stats.entries >= cache->max_entries && cache->tail) {
+            entry_drop(cache, cache->tail);
+            ++cache->stats.evicted;
+        }
+        if (APR_SUCCESS == apr_pool_create(&ep, cache->p)) {
+            apr_pool_tag(ep, "md_store_cache_entry");
+            e = apr_pcalloc(ep, sizeof(*e));
+            e->pool = ep;
+            e->key = apr_pstrdup(ep, key);
+            e->group = group;
+            e->name = name? apr_pstrdup(ep, name) : NULL;
+            e->aspect = aspect? apr_pstrdup(ep, aspect) : NULL;
+            e->vtype = vtype;
+            e->value = value_share(vtype, value, ep);
+            if ((e->have_finfo = have_finfo)) {
+                e->mtime = finfo.mtime;
+                e->size = finfo.size;
+                e->inode = finfo.inode;
+            }
+            apr_hash_set(cache->entries, e->key, APR_HASH_KEY_STRING, e);
+            lru_push(cache, e);
+            ++cache->stats.entries;
+        }
+    }
+    cache_unlock(cache);
+out:
+    if (pvalue) {
+        *pvalue = (APR_SUCCESS == rv)? value : NULL;
+    }
+    return rv;
+}
+
+static apr_status_t cache_save(md_store_t *store, apr_pool_t *p, md_store_group_t group,
+                               const char *name, const char *aspect,
+                               md_store_vtype_t vtype, void *value, int create)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    apr_status_t rv;
+
+    rv = md_store_save(cache->backend, p, group, name, aspect, vtype, value, create);
+    invalidate_aspect(cache, group, name, aspect, p);
+    return rv;
+}
+
+static apr_status_t cache_remove(md_store_t *store, md_store_group_t group,
+                                 const char *name, const char *aspect,
+                                 apr_pool_t *p, int force)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    apr_status_t rv;
+
+    rv = md_store_remove(cache->backend, group, name, aspect, p, force);
+    invalidate_aspect(cache, group, name, aspect, p);
+    return rv;
+}
+
+static apr_status_t cache_purge(md_store_t *store, apr_pool_t *p,
+                                md_store_group_t group, const char *name)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    apr_status_t rv;
+
+    rv = md_store_purge(cache->backend, p, group, name);
+    invalidate_name(cache, group, name);
+    return rv;
+}
+
+static apr_status_t cache_move(md_store_t *store, apr_pool_t *p, md_store_group_t from,
+                               md_store_group_t to, const char *name, int archive)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    apr_status_t rv;
+
+    rv = md_store_move(cache->backend, p, from, to, name, archive);
+    invalidate_name(cache, from, name);
+    invalidate_name(cache, to, name);
+    if (archive) {
+        /* archived copies get new names, we cannot know which */
+        invalidate_name(cache, MD_SG_ARCHIVE, NULL);
+    }
+    return rv;
+}
+
+static apr_status_t cache_iterate(md_store_inspect *inspect, void *baton, md_store_t *store,
+                                  apr_pool_t *p, md_store_group_t group, const char *pattern,
+                                  const char *aspect, md_store_vtype_t vtype)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    return md_store_iter(inspect, baton, cache->backend, p, group, pattern, aspect, vtype);
+}
+
+static apr_status_t cache_get_fname(const char **pfname, md_store_t *store,
+                                    md_store_group_t group, const char *name,
+                                    const char *aspect, apr_pool_t *p)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    return md_store_get_fname(pfname, cache->backend, group, name, aspect, p);
+}
+
+static int cache_is_newer(md_store_t *store, md_store_group_t group1, md_store_group_t group2,
+                          const char *name, const char *aspect, apr_pool_t *p)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    return md_store_is_newer(cache->backend, group1, group2, name, aspect, p);
+}
+
+static apr_status_t cache_iterate_names(md_store_names_inspect *inspect, void *baton,
+                                        md_store_t *store, apr_pool_t *p,
+                                        md_store_group_t group, const char *pattern)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    return md_store_iter_names(inspect, baton, cache->backend, p, group, pattern);
+}
+
+static apr_status_t cache_commit(md_store_t *store, apr_pool_t *p, md_store_group_t group,
+                                 const char *name, apr_array_header_t *vals, int archive)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    apr_status_t rv;
+
+    rv = md_store_commit(cache->backend, p, group, name, vals, archive);
+    invalidate_name(cache, group, name);
+    invalidate_name(cache, MD_SG_TMP, name);
+    if (archive) {
+        invalidate_name(cache, MD_SG_ARCHIVE, NULL);
+    }
+    return rv;
+}
+
+static void cache_destroy(md_store_t *store)
+{
+    md_store_cache_t *cache = CACHE_STORE(store);
+    md_store_destroy(cache->backend);
+}
+
+apr_status_t md_store_cache_init(md_store_t **pstore, apr_pool_t *p,
+                                 md_store_t *backend, apr_size_t max_entries)
+{
+    md_store_cache_t *cache;
+    apr_status_t rv = APR_SUCCESS;
+
+    cache = apr_pcalloc(p, sizeof(*cache));
+    cache->s.destroy = cache_destroy;
+    cache->s.load = cache_load;
+    cache->s.save = cache_save;
+    cache->s.remove = cache_remove;
+    cache->s.move = cache_move;
+    cache->s.purge = cache_purge;
+    cache->s.iterate = cache_iterate;
+    cache->s.get_fname = cache_get_fname;
+    cache->s.is_newer = cache_is_newer;
+    cache->s.iterate_names = cache_iterate_names;
+    cache->s.commit = cache_commit;
+
+    cache->backend = backend;
+    cache->max_entries = max_entries;
+    cache->entries = apr_hash_make(p);
+
+    if (APR_SUCCESS != (rv = apr_pool_create(&cache->p, p))) {
+        goto out;
+    }
+    apr_pool_tag(cache->p, "md_store_cache");
+#if APR_HAS_THREADS
+    rv = apr_thread_mutex_create(&cache->mutex, APR_THREAD_MUTEX_DEFAULT, p);
+#endif
+out:
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "init store cache");
+    }
+    *pstore = (APR_SUCCESS == rv)? &(cache->s) : NULL;
+    return rv;
+}
+
+void md_store_cache_invalidate(md_store_t *store, md_store_group_t group, const char *name)
+{
+    if (store && store->load == cache_load) {
+        invalidate_name(CACHE_STORE(store), group, name);
+    }
+}
+
+md_store_t *md_store_cache_backend_get(md_store_t *store)
+{
+    if (store && store->load == cache_load) {
+        return CACHE_STORE(store)->backend;
+    }
+    return store;
+}
+
+apr_status_t md_store_cache_stats_get(md_store_cache_stats_t *stats, md_store_t *store)
+{
+    md_store_cache_t *cache;
+
+    if (!store || store->load != cache_load) {
+        return APR_EINVAL;
+    }
+    cache = CACHE_STORE(store);
+    cache_lock(cache);
+    *stats = cache->stats;
+    cache_unlock(cache);
+    return APR_SUCCESS;
+}
@@ -0,0 +1,63 @@
+/* Copyright 2017 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef mod_md_md_store_cache_h
+#define mod_md_md_store_cache_h
+
+struct md_store_t;
+
+#define MD_STORE_CACHE_MAX_DEF      512
+
+typedef struct md_store_cache_stats_t {
+    apr_uint64_t hits;              /* loads answered from the cache */
+    apr_uint64_t misses;            /* loads passed on to the backend */
+    apr_uint64_t stale;             /* entries found changed in the backend */
+    apr_uint64_t invalidated;       /* entries dropped on changes through the store */
+    apr_uint64_t evicted;           /* entries dropped to stay below max_entries */
+    apr_size_t entries;             /* entries currently held */
+} md_store_cache_stats_t;
+
+/**
+ * Create a store that keeps the values loaded from the backend store in memory,
+ * up to max_entries of them. Callers get their own copies or, for keys and
+ * certificates, new references of the cached values.
+ *
+ * Cached values are checked against the file modification time and size when
+ * the backend gives file names. Changes through the cache store invalidate
+ * the affected entries. Changes done elsewhere, on a backend without files,
+ * need md_store_cache_invalidate().
+ */
+apr_status_t md_store_cache_init(struct md_store_t **pstore, apr_pool_t *p,
+                                 struct md_store_t *backend, apr_size_t max_entries);
+
+/**
+ * Forget all cached values for name in group, or the whole group if name is NULL.
+ * Does nothing if store is not a cache store.
+ */
+void md_store_cache_invalidate(struct md_store_t *store, md_store_group_t group,
+                               const char *name);
+
+/**
+ * Get the store the cache loads its values from, or store itself if it is
+ * not a cache store.
+ */
+struct md_store_t *md_store_cache_backend_get(struct md_store_t *store);
+
+/**
+ * Get the cache statistics. Returns APR_EINVAL if store is not a cache store.
+ */
+apr_status_t md_store_cache_stats_get(md_store_cache_stats_t *stats, struct md_store_t *store);
+
+#endif /* mod_md_md_store_cache_h */
@@ -0,0 +1,1331 @@
+/* Copyright 2017 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <assert.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <apr_lib.h>
+#include <apr_file_info.h>
+#include <apr_file_io.h>
+#include <apr_fnmatch.h>
+#include <apr_hash.h>
+#include <apr_strings.h>
+#include <apr_thread_mutex.h>
+#include <apr_version.h>
+
+#include "md.h"
+#include "md_crypt.h"
+#include "md_json.h"
+#include "md_log.h"
+#include "md_store.h"
+#include "md_store_db.h"
+#include "md_store_fs.h"
+#include "md_util.h"
+
+/**************************************************************************************************/
+/* single file implementation of md_store_t
+ *
+ * The file starts with a header, followed by records that each describe one change:
+ * a value put or deleted, all values of a name purged or moved to another group.
+ * The records of a transaction carry DB_F_MORE, except the last one. Records are
+ * only applied when their transaction is complete and all checksums match, so a
+ * write interrupted by a crash is ignored and cut off by the next writer.
+ *
+ * header:  "MDSTORDB" version(4) key_len(4) key(key_len)
+ * record:  op(1) group(1) to(1) flags(1) name_len(4) aspect_len(4) value_len(4)
+ *          mtime(8) crc32(4) name aspect value
+ *
+ * All numbers are big endian. The crc32 covers the record without itself.
+ */
+
+#define DB_MAGIC            "MDSTORDB"
+#define DB_MAGIC_LEN        8
+#define DB_VERSION          1
+#define DB_KEY_LEN          48
+#define DB_HDR_LEN          (DB_MAGIC_LEN + 4 + 4 + DB_KEY_LEN)
+#define DB_REC_HDR_LEN      28
+
+#define DB_OP_PUT           1
+#define DB_OP_DEL           2
+#define DB_OP_PURGE         3
+#define DB_OP_MOVE          4
+
+#define DB_F_MORE           0x01
+
+/* Compact the file when it holds more outdated than current data, but not before
+ * there is a certain amount of it. */
+#define DB_COMPACT_MIN      (1024 * 1024)
+
+typedef struct {
+    apr_off_t offset;               /* where the value starts in the file */
+    apr_size_t len;
+    apr_size_t rec_len;             /* length of the record holding the value */
+    apr_time_t mtime;
+} db_val_t;
+
+typedef struct {
+    const char *name;
+    apr_hash_t *vals;               /* aspect -> db_val_t* */
+} db_md_t;
+
+typedef struct {
+    int op;
+    md_store_group_t group;
+    md_store_group_t to;
+    int flags;
+    const char *name;
+    const char *aspect;
+    const char *value;              /* value to write or, on MOVE, the archive name */
+    apr_size_t vlen;
+    apr_off_t voffset;              /* where the value is in the file, when read */
+    apr_size_t rec_len;
+    apr_time_t mtime;
+} db_rec_t;
+
+typedef struct md_store_db_t md_store_db_t;
+struct md_store_db_t {
+    md_store_t s;
+
+    apr_pool_t *p;
+    const char *fname;
+    apr_file_t *lockf;              /* serializes writers of all processes */
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;      /* serializes all access in this process */
+#endif
+
+    apr_pool_t *idx_pool;           /* the open file and the index */
+    apr_file_t *f;
+    apr_ino_t inode;
+    apr_off_t size;                 /* file size when last looked */
+    apr_off_t end;                  /* end of the last complete transaction */
+    apr_off_t live;                 /* size of all records holding current values */
+    apr_hash_t *groups[MD_SG_COUNT];/* name -> db_md_t* */
+
+    unsigned char key[DB_KEY_LEN];
+    int plain_pkey[MD_SG_COUNT];
+};
+
+#define DB_STORE(store)     (md_store_db_t*)(((char*)store)-offsetof(md_store_db_t, s))
+
+/**************************************************************************************************/
+/* encoding */
+
+static apr_uint32_t crc_table[256];
+static int crc_table_ready;
+
+static void crc_init(void)
+{
+    apr_uint32_t c;
+    int n, k;
+
+    if (!crc_table_ready) {
+        for (n = 0; n < 256; ++n) {
+            c = (apr_uint32_t)n;
+            for (k = 0; k < 8; ++k) {
+                c = (c & 1)? (0xedb88320U ^ (c >> 1)) : (c >> 1);
+            }
+            crc_table[n] = c;
+        }
+        crc_table_ready = 1;
+    }
+}
+
+static apr_uint32_t crc_update(apr_uint32_t crc, const unsigned char *buf, apr_size_t len)
+{
+    apr_uint32_t c = crc ^ 0xffffffffU;
+    apr_size_t i;
+
+    for (i = 0; i < len; ++i) {
+        c = crc_table[(c ^ buf[i]) & 0xff] ^ (c >> 8);
+    }
+    return c ^ 0xffffffffU;
+}
+
+static void put32(unsigned char *b, apr_uint32_t v)
+{
+    b[0] = (unsigned char)(v >> 24);
+    b[1] = (unsigned char)(v >> 16);
+    b[2] = (unsigned char)(v >> 8);
+    b[3] = (unsigned char)v;
+}
+
+static apr_uint32_t get32(const unsigned char *b)
+{
+    return ((apr_uint32_t)b[0] << 24) | ((apr_uint32_t)b[1] << 16)
+           | ((apr_uint32_t)b[2] << 8) | (apr_uint32_t)b[3];
+}
+
+static void put64(unsigned char *b, apr_uint64_t v)
+{
+    put32(b, (apr_uint32_t)(v >> 32));
+    put32(b + 4, (apr_uint32_t)v);
+}
+
+static apr_uint64_t get64(const unsigned char *b)
+{
+    return ((apr_uint64_t)get32(b) << 32) | get32(b + 4);
+}
+
+static apr_size_t rec_size(const db_rec_t *rec)
+{
+    return DB_REC_HDR_LEN + strlen(rec->name) + strlen(rec->aspect) + rec->vlen;
+}
+
+static apr_size_t rec_encode(unsigned char *buf, const db_rec_t *rec, int more)
+{
+    apr_size_t nlen = strlen(rec->name), alen = strlen(rec->aspect);
+    unsigned char *d = buf + DB_REC_HDR_LEN;
+    apr_uint32_t crc;
+
+    buf[0] = (unsigned char)rec->op;
+    buf[1] = (unsigned char)rec->group;
+    buf[2] = (unsigned char)rec->to;
+    buf[3] = (unsigned char)(more? DB_F_MORE : 0);
+    put32(buf + 4, (apr_uint32_t)nlen);
+    put32(buf + 8, (apr_uint32_t)alen);
+    put32(buf + 12, (apr_uint32_t)rec->vlen);
+    put64(buf + 16, (apr_uint64_t)rec->mtime);
+    memcpy(d, rec->name, nlen);
+    memcpy(d + nlen, rec->aspect, alen);
+    if (rec->vlen) {
+        memcpy(d + nlen + alen, rec->value, rec->vlen);
+    }
+    crc = crc_update(0, buf, DB_REC_HDR_LEN - 4);
+    crc = crc_update(crc, d, nlen + alen + rec->vlen);
+    put32(buf + DB_REC_HDR_LEN - 4, crc);
+    return DB_REC_HDR_LEN + nlen + alen + rec->vlen;
+}
+
+static void get_pass(const char **ppass, apr_size_t *plen,
+                     md_store_db_t *db, md_store_group_t group)
+{
+    if (db->plain_pkey[group]) {
+        *ppass = NULL;
+        *plen = 0;
+    }
+    else {
+        *ppass = (const char *)db->key;
+        *plen = DB_KEY_LEN;
+    }
+}
+
+/* Values are kept in the same formats as the file system store uses. */
+static apr_status_t value_encode(const char **pdata, apr_size_t *plen, md_store_db_t *db,
+                                 md_store_group_t group, md_store_vtype_t vtype,
+                                 void *value, apr_pool_t *p)
+{
+    apr_array_header_t *certs;
+    const char *pass;
+    apr_size_t pass_len;
+
+    switch (vtype) {
+        case MD_SV_TEXT:
+            *pdata = value;
+            *plen = strlen(*pdata);
+            return APR_SUCCESS;
+        case MD_SV_JSON:
+            if (NULL == (*pdata = md_json_writep((md_json_t *)value, p, MD_JSON_FMT_COMPACT))) {
+                return APR_EINVAL;
+            }
+            *plen = strlen(*pdata);
+            return APR_SUCCESS;
+        case MD_SV_CERT:
+            certs = apr_array_make(p, 1, sizeof(md_cert_t *));
+            APR_ARRAY_PUSH(certs, md_cert_t *) = value;
+            return md_chain_to_pem(pdata, plen, certs, p);
+        case MD_SV_PKEY:
+            get_pass(&pass, &pass_len, db, group);
+            return md_pkey_to_pem(pdata, plen, (md_pkey_t *)value, p, pass, pass_len);
+        case MD_SV_CHAIN:
+            return md_chain_to_pem(pdata, plen, (apr_array_header_t *)value, p);
+        default:
+            return APR_ENOTIMPL;
+    }
+}
+
+static apr_status_t value_decode(void **pvalue, md_store_db_t *db, md_store_group_t group,
+                                 md_store_vtype_t vtype, const char *data, apr_size_t len,
+                                 apr_pool_t *p)
+{
+    apr_array_header_t *certs;
+    md_json_t *json;
+    md_pkey_t *pkey;
+    const char *pass;
+    apr_size_t pass_len;
+    apr_status_t rv;
+
+    switch (vtype) {
+        case MD_SV_TEXT:
+            *pvalue = apr_pstrmemdup(p, data, len);
+            return APR_SUCCESS;
+        case MD_SV_JSON:
+            rv = md_json_readd(&json, p, data, len);
+            *pvalue = (APR_SUCCESS == rv)? json : NULL;
+            return rv;
+        case MD_SV_CERT:
+            if (APR_SUCCESS == (rv = md_chain_from_pem(&certs, p, data, len))) {
+                if (certs->nelts <= 0) {
+                    return APR_EINVAL;
+                }
+                *pvalue = APR_ARRAY_IDX(certs, 0, md_cert_t *);
+            }
+            return rv;
+        case MD_SV_PKEY:
+            get_pass(&pass, &pass_len, db, group);
+            rv = md_pkey_from_pem(&pkey, p, pass, pass_len, data, len);
+            *pvalue = (APR_SUCCESS == rv)? pkey : NULL;
+            return rv;
+        case MD_SV_CHAIN:
+            rv = md_chain_from_pem(&certs, p, data, len);
+            *pvalue = (APR_SUCCESS == rv)? certs : NULL;
+            return rv;
+        default:
+            return APR_ENOTIMPL;
+    }
+}
+
+/**************************************************************************************************/
+/* locking */
+
+static void db_lock(md_store_db_t *db)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(db->mutex);
+#else
+    (void)db;
+#endif
+}
+
+static void db_unlock(md_store_db_t *db)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(db->mutex);
+#else
+    (void)db;
+#endif
+}
+
+static apr_status_t db_fsync(apr_file_t *f)
+{
+#if APR_VERSION_AT_LEAST(1,6,0)
+    return apr_file_datasync(f);
+#else
+    return apr_file_flush(f);
+#endif
+}
+
+/**************************************************************************************************/
+/* the index */
+
+static void idx_reset(md_store_db_t *db)
+{
+    int i;
+
+    /* closes the file, if it was open */
+    apr_pool_clear(db->idx_pool);
+    db->f = NULL;
+    db->inode = 0;
+    db->size = db->end = db->live = 0;
+    for (i = 0; i < MD_SG_COUNT; ++i) {
+        db->groups[i] = apr_hash_make(db->idx_pool);
+    }
+}
+
+static db_md_t *idx_md_get(md_store_db_t *db, md_store_group_t group,
+                           const char *name, int create)
+{
+    db_md_t *md;
+
+    if ((int)group < 0 || group >= MD_SG_COUNT) {
+        return NULL;
+    }
+    md = apr_hash_get(db->groups[group], name, APR_HASH_KEY_STRING);
+    if (!md && create) {
+        md = apr_pcalloc(db->idx_pool, sizeof(*md));
+        md->name = apr_pstrdup(db->idx_pool, name);
+        md->vals = apr_hash_make(db->idx_pool);
+        apr_hash_set(db->groups[group], md->name, APR_HASH_KEY_STRING, md);
+    }
+    return md;
+}
+
+static db_val_t *idx_val_get(md_store_db_t *db, md_store_group_t group,
+                             const char *name, const char *aspect)
+{
+    db_md_t *md = idx_md_get(db, group, name, 0);
+    return md? apr_hash_get(md->vals, aspect, APR_HASH_KEY_STRING) : NULL;
+}
+
+static void idx_md_drop(md_store_db_t *db, md_store_group_t group, db_md_t *md)
+{
+    apr_hash_index_t *hi;
+    db_val_t *val;
+
+    for (hi = apr_hash_first(NULL, md->vals); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, NULL, NULL, (void **)&val);
+        db->live -= (apr_off_t)val->rec_len;
+    }
+    apr_hash_set(db->groups[group], md->name, APR_HASH_KEY_STRING, NULL);
+}
+
+static void idx_apply(md_store_db_t *db, const db_rec_t *rec)
+{
+    db_md_t *md, *old, *prev;
+    db_val_t *val;
+
+    switch (rec->op) {
+        case DB_OP_PUT:
+            if (NULL == (md = idx_md_get(db, rec->group, rec->name, 1))) {
+                break;
+            }
+            val = apr_hash_get(md->vals, rec->aspect, APR_HASH_KEY_STRING);
+            if (val) {
+                db->live -= (apr_off_t)val->rec_len;
+            }
+            else {
+                val = apr_pcalloc(db->idx_pool, sizeof(*val));
+                apr_hash_set(md->vals, apr_pstrdup(db->idx_pool, rec->aspect),
+                             APR_HASH_KEY_STRING, val);
+            }
+            val->offset = rec->voffset;
+            val->len = rec->vlen;
+            val->rec_len = rec->rec_len;
+            val->mtime = rec->mtime;
+            db->live += (apr_off_t)rec->rec_len;
+            break;
+
+        case DB_OP_DEL:
+            md = idx_md_get(db, rec->group, rec->name, 0);
+            if (md && NULL != (val = apr_hash_get(md->vals, rec->aspect, APR_HASH_KEY_STRING))) {
+                db->live -= (apr_off_t)val->rec_len;
+                apr_hash_set(md->vals, rec->aspect, APR_HASH_KEY_STRING, NULL);
+            }
+            break;
+
+        case DB_OP_PURGE:
+            if (NULL != (md = idx_md_get(db, rec->group, rec->name, 0))) {
+                idx_md_drop(db, rec->group, md);
+            }
+            break;
+
+        case DB_OP_MOVE:
+            if (NULL == (md = idx_md_get(db, rec->group, rec->name, 0))
+                || (int)rec->to < 0 || rec->to >= MD_SG_COUNT) {
+                break;
+            }
+            if (NULL != (old = idx_md_get(db, rec->to, rec->name, 0))) {
+                if (rec->value && *rec->value) {
+                    /* what was there goes to the archive */
+                    apr_hash_set(db->groups[rec->to], old->name, APR_HASH_KEY_STRING, NULL);
+                    if (NULL != (prev = idx_md_get(db, MD_SG_ARCHIVE, rec->value, 0))) {
+                        idx_md_drop(db, MD_SG_ARCHIVE, prev);
+                    }
+                    old->name = apr_pstrdup(db->idx_pool, rec->value);
+                    apr_hash_set(db->groups[MD_SG_ARCHIVE], old->name, APR_HASH_KEY_STRING, old);
+                }
+                else {
+                    idx_md_drop(db, rec->to, old);
+                }
+            }
+            apr_hash_set(db->groups[rec->group], md->name, APR_HASH_KEY_STRING, NULL);
+            apr_hash_set(db->groups[rec->to], md->name, APR_HASH_KEY_STRING, md);
+            break;
+
+        default:
+            break;
+    }
+}
+
+/**************************************************************************************************/
+/* reading and writing the file */
+
+static apr_status_t db_read_at(md_store_db_t *db, apr_off_t offset, char *buf, apr_size_t len)
+{
+    apr_off_t pos = offset;
+    apr_status_t rv;
+
+    if (APR_SUCCESS == (rv = apr_file_seek(db->f, APR_SET, &pos))) {
+        rv = apr_file_read_full(db->f, buf, len, NULL);
+    }
+    return rv;
+}
+
+/* Apply all complete transactions between db->end and size. */
+static apr_status_t db_replay(md_store_db_t *db, apr_off_t size, apr_pool_t *ptemp)
+{
+    unsigned char h[DB_REC_HDR_LEN];
+    apr_array_header_t *txn;
+    apr_pool_t *tp;
+    char *buf = NULL;
+    apr_size_t buf_len = 0, nlen, alen, vlen, plen;
+    apr_off_t pos = db->end;
+    apr_uint32_t crc;
+    db_rec_t *rec;
+    apr_status_t rv;
+    int i;
+
+    db->size = size;
+    if (APR_SUCCESS != (rv = apr_pool_create(&tp, ptemp))) {
+        return rv;
+    }
+    txn = apr_array_make(tp, 5, sizeof(db_rec_t));
+    while (pos + DB_REC_HDR_LEN <= size) {
+        if (APR_SUCCESS != (rv = db_read_at(db, pos, (char*)h, DB_REC_HDR_LEN))) {
+            break;
+        }
+        nlen = get32(h + 4);
+        alen = get32(h + 8);
+        vlen = get32(h + 12);
+        plen = nlen + alen + vlen;
+        if (pos + DB_REC_HDR_LEN + (apr_off_t)plen > size) {
+            /* not completely written (yet) */
+            break;
+        }
+        if (plen > buf_len) {
+            while (buf_len < plen) {
+                buf_len = buf_len? 2 * buf_len : 4096;
+            }
+            buf = apr_palloc(ptemp, buf_len);
+        }
+        if (plen && APR_SUCCESS != (rv = db_read_at(db, pos + DB_REC_HDR_LEN, buf, plen))) {
+            break;
+        }
+        crc = crc_update(0, h, DB_REC_HDR_LEN - 4);
+        crc = crc_update(crc, (unsigned char*)buf, plen);
+        if (crc != get32(h + DB_REC_HDR_LEN - 4) || h[1] >= MD_SG_COUNT || h[2] >= MD_SG_COUNT) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, 0, ptemp, "%s: invalid record at "
+                          "offset %ld, ignoring the rest", db->fname, (long)pos);
+            break;
+        }
+
+        rec = apr_array_push(txn);
+        rec->op = h[0];
+        rec->group = (md_store_group_t)h[1];
+        rec->to = (md_store_group_t)h[2];
+        rec->flags = h[3];
+        rec->name = apr_pstrmemdup(tp, buf, nlen);
+        rec->aspect = apr_pstrmemdup(tp, buf + nlen, alen);
+        rec->value = (DB_OP_MOVE == rec->op)? apr_pstrmemdup(tp, buf + nlen + alen, vlen) : NULL;
+        rec->vlen = vlen;
+        rec->voffset = pos + DB_REC_HDR_LEN + (apr_off_t)(nlen + alen);
+        rec->rec_len = DB_REC_HDR_LEN + plen;
+        rec->mtime = (apr_time_t)get64(h + 16);
+        pos += (apr_off_t)rec->rec_len;
+
+        if (!(rec->flags & DB_F_MORE)) {
+            for (i = 0; i < txn->nelts; ++i) {
+                idx_apply(db, &APR_ARRAY_IDX(txn, i, db_rec_t));
+            }
+            db->end = pos;
+            apr_pool_clear(tp);
+            txn = apr_array_make(tp, 5, sizeof(db_rec_t));
+        }
+    }
+    apr_pool_destroy(tp);
+    return rv;
+}
+
+static apr_status_t write_header(apr_file_t *f, const unsigned char *key)
+{
+    unsigned char hdr[DB_HDR_LEN];
+
+    memcpy(hdr, DB_MAGIC, DB_MAGIC_LEN);
+    put32(hdr + DB_MAGIC_LEN, DB_VERSION);
+    put32(hdr + DB_MAGIC_LEN + 4, DB_KEY_LEN);
+    memcpy(hdr + DB_MAGIC_LEN + 8, key, DB_KEY_LEN);
+    return apr_file_write_full(f, hdr, DB_HDR_LEN, NULL);
+}
+
+/* (Re-)open the file and read the index. Only a writer, holding the lock, may
+ * initialize a new file. */
+static apr_status_t db_open(md_store_db_t *db, int locked, apr_pool_t *ptemp)
+{
+    unsigned char hdr[DB_HDR_LEN];
+    apr_finfo_t finfo;
+    apr_status_t rv;
+    apr_int32_t flags;
+
+    idx_reset(db);
+    flags = APR_FOPEN_READ|APR_FOPEN_WRITE|APR_FOPEN_APPEND|APR_FOPEN_BINARY;
+    if (locked) {
+        flags |= APR_FOPEN_CREATE;
+    }
+    rv = apr_file_open(&db->f, db->fname, flags, MD_FPROT_F_UONLY, db->idx_pool);
+    if (APR_SUCCESS != rv) {
+        goto out;
+    }
+    if (APR_SUCCESS != (rv = apr_file_info_get(&finfo, APR_FINFO_SIZE|APR_FINFO_INODE, db->f))) {
+        goto out;
+    }
+    db->inode = finfo.inode;
+
+    if (finfo.size < DB_HDR_LEN) {
+        if (!locked) {
+            /* being created right now */
+            rv = APR_EAGAIN;
+            goto out;
+        }
+        if (APR_SUCCESS != (rv = md_rand_bytes(db->key, DB_KEY_LEN, ptemp))
+            || APR_SUCCESS != (rv = apr_file_trunc(db->f, 0))
+            || APR_SUCCESS != (rv = write_header(db->f, db->key))
+            || APR_SUCCESS != (rv = db_fsync(db->f))) {
+            goto out;
+        }
+        finfo.size = DB_HDR_LEN;
+    }
+    else {
+        if (APR_SUCCESS != (rv = db_read_at(db, 0, (char*)hdr, DB_HDR_LEN))) {
+            goto out;
+        }
+        if (memcmp(DB_MAGIC, hdr, DB_MAGIC_LEN)
+            || get32(hdr + DB_MAGIC_LEN + 4) != DB_KEY_LEN) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, ptemp, "%s: not a md store", db->fname);
+            rv = APR_EINVAL;
+            goto out;
+        }
+        if (get32(hdr + DB_MAGIC_LEN) > DB_VERSION) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, ptemp, "%s: version too new: %d",
+                          db->fname, (int)get32(hdr + DB_MAGIC_LEN));
+            rv = APR_EINVAL;
+            goto out;
+        }
+        memcpy(db->key, hdr + DB_MAGIC_LEN + 8, DB_KEY_LEN);
+    }
+
+    db->end = DB_HDR_LEN;
+    rv = db_replay(db, finfo.size, ptemp);
+
+out:
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "open store %s", db->fname);
+        idx_reset(db);
+    }
+    return rv;
+}
+
+/* Pick up the changes done by others since we last looked. */
+static apr_status_t db_sync(md_store_db_t *db, int locked, apr_pool_t *ptemp)
+{
+    apr_finfo_t finfo;
+    apr_status_t rv;
+
+    rv = apr_stat(&finfo, db->fname, APR_FINFO_SIZE|APR_FINFO_INODE, ptemp);
+    if (APR_SUCCESS != rv && !(locked && APR_STATUS_IS_ENOENT(rv))) {
+        return rv;
+    }
+    if (!db->f || APR_SUCCESS != rv || finfo.inode != db->inode) {
+        /* new or replaced by a compaction */
+        return db_open(db, locked, ptemp);
+    }
+    if (finfo.size != db->size) {
+        return db_replay(db, finfo.size, ptemp);
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t db_compact(md_store_db_t *db, apr_pool_t *ptemp);
+
+/* Start a write, holding the lock across processes */
+static apr_status_t db_wbegin(md_store_db_t *db, apr_pool_t *ptemp)
+{
+    apr_status_t rv;
+
+    if (APR_SUCCESS == (rv = apr_file_lock(db->lockf, APR_FLOCK_EXCLUSIVE))) {
+        if (APR_SUCCESS != (rv = db_sync(db, 1, ptemp))) {
+            apr_file_unlock(db->lockf);
+        }
+    }
+    return rv;
+}
+
+static void db_wend(md_store_db_t *db)
+{
+    apr_file_unlock(db->lockf);
+}
+
+/* Append the records as one transaction. */
+static apr_status_t db_write(md_store_db_t *db, apr_array_header_t *recs, apr_pool_t *ptemp)
+{
+    unsigned char *buf;
+    apr_size_t len = 0, off = 0;
+    apr_off_t dead;
+    apr_status_t rv;
+    int i;
+
+    if (recs->nelts <= 0) {
+        return APR_SUCCESS;
+    }
+    for (i = 0; i < recs->nelts; ++i) {
+        len += rec_size(&APR_ARRAY_IDX(recs, i, db_rec_t));
+    }
+    buf = apr_palloc(ptemp, len);
+    for (i = 0; i < recs->nelts; ++i) {
+        off += rec_encode(buf + off, &APR_ARRAY_IDX(recs, i, db_rec_t), i + 1 < recs->nelts);
+    }
+
+    if (db->size > db->end) {
+        /* left over from a writer that did not finish */
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, ptemp, "%s: truncating %ld bytes",
+                      db->fname, (long)(db->size - db->end));
+        if (APR_SUCCESS != (rv = apr_file_trunc(db->f, db->end))) {
+            return rv;
+        }
+        db->size = db->end;
+    }
+    if (APR_SUCCESS != (rv = apr_file_write_full(db->f, buf, len, NULL))
+        || APR_SUCCESS != (rv = db_fsync(db->f))
+        || APR_SUCCESS != (rv = db_replay(db, db->size + (apr_off_t)len, ptemp))) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, ptemp, "%s: write", db->fname);
+        return rv;
+    }
+
+    dead = db->end - DB_HDR_LEN - db->live;
+    if (dead > DB_COMPACT_MIN && dead > db->live) {
+        db_compact(db, ptemp);
+    }
+    return APR_SUCCESS;
+}
+
+/* Write all current values into a new file and replace the old one with it. */
+static apr_status_t db_compact(md_store_db_t *db, apr_pool_t *ptemp)
+{
+    apr_hash_index_t *hi, *hj;
+    apr_file_t *f;
+    apr_pool_t *vp;
+    const char *tmp;
+    unsigned char *buf;
+    char *data;
+    db_md_t *md;
+    db_val_t *val;
+    db_rec_t rec;
+    apr_status_t rv;
+    apr_off_t before = db->size;
+    int g;
+
+    tmp = apr_pstrcat(ptemp, db->fname, ".tmp", NULL);
+    rv = apr_file_open(&f, tmp, APR_FOPEN_WRITE|APR_FOPEN_CREATE|APR_FOPEN_TRUNCATE
+                       |APR_FOPEN_BINARY|APR_FOPEN_BUFFERED, MD_FPROT_F_UONLY, ptemp);
+    if (APR_SUCCESS != rv) {
+        goto out;
+    }
+    if (APR_SUCCESS != (rv = apr_pool_create(&vp, ptemp))) {
+        apr_file_close(f);
+        goto out;
+    }
+
+    rv = write_header(f, db->key);
+    for (g = 0; g < MD_SG_COUNT && APR_SUCCESS == rv; ++g) {
+        for (hi = apr_hash_first(ptemp, db->groups[g]); hi && APR_SUCCESS == rv;
+             hi = apr_hash_next(hi)) {
+            apr_hash_this(hi, NULL, NULL, (void **)&md);
+            for (hj = apr_hash_first(ptemp, md->vals); hj && APR_SUCCESS == rv;
+                 hj = apr_hash_next(hj)) {
+                apr_hash_this(hj, (const void **)&rec.aspect, NULL, (void **)&val);
+                apr_pool_clear(vp);
+                data = apr_palloc(vp, val->len + 1);
+                if (APR_SUCCESS != (rv = db_read_at(db, val->offset, data, val->len))) {
+                    break;
+                }
+                /* each value is a transaction of its own, this file only becomes
+                 * visible when complete */
+                rec.op = DB_OP_PUT;
+                rec.group = (md_store_group_t)g;
+                rec.to = MD_SG_NONE;
+                rec.name = md->name;
+                rec.value = data;
+                rec.vlen = val->len;
+                rec.mtime = val->mtime;
+                buf = apr_palloc(vp, rec_size(&rec));
+                rv = apr_file_write_full(f, buf, rec_encode(buf, &rec, 0), NULL);
+            }
+        }
+    }
+    apr_pool_destroy(vp);
+
+    if (APR_SUCCESS == rv
+        && APR_SUCCESS == (rv = apr_file_flush(f))) {
+        rv = db_fsync(f);
+    }
+    apr_file_close(f);
+    if (APR_SUCCESS == rv
+        && APR_SUCCESS == (rv = apr_file_rename(tmp, db->fname, ptemp))) {
+        rv = db_open(db, 1, ptemp);
+    }
+    else {
+        apr_file_remove(tmp, ptemp);
+    }
+out:
+    md_log_perror(MD_LOG_MARK, (APR_SUCCESS == rv)? MD_LOG_DEBUG : MD_LOG_ERR, rv, ptemp,
+                  "%s: compacted from %ld to %ld bytes", db->fname, (long)before, (long)db->size);
+    return rv;
+}
+
+/**************************************************************************************************/
+/* md_store_t implementation */
+
+static apr_status_t pdb_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
+{
+    md_store_db_t *db = baton;
+    const char *name, *aspect;
+    md_store_group_t group;
+    md_store_vtype_t vtype;
+    void **pvalue;
+    db_val_t *val;
+    char *data = NULL;
+    apr_size_t len = 0;
+    apr_status_t rv;
+
+    group = (md_store_group_t)va_arg(ap, int);
+    name = va_arg(ap, const char *);
+    aspect = va_arg(ap, const char *);
+    vtype = (md_store_vtype_t)va_arg(ap, int);
+    pvalue= va_arg(ap, void **);
+
+    db_lock(db);
+    if (APR_SUCCESS == (rv = db_sync(db, 0, ptemp))) {
+        if (NULL == (val = idx_val_get(db, group, name, aspect))) {
+            rv = APR_ENOENT;
+        }
+        else {
+            len = val->len;
+            data = apr_palloc(ptemp, len + 1);
+            rv = db_read_at(db, val->offset, data, len);
+            data[len] = '\0';
+        }
+    }
+    db_unlock(db);
+
+    if (APR_SUCCESS == rv) {
+        rv = value_decode(pvalue, db, group, vtype, data, len, p);
+    }
+    return rv;
+}
+
+static apr_status_t db_load(md_store_t *store, md_store_group_t group,
+                            const char *name, const char *aspect,
+                            md_store_vtype_t vtype, void **pvalue, apr_pool_t *p)
+{
+    md_store_db_t *db = DB_STORE(store);
+    return md_util_pool_vdo(pdb_load, db, p, group, name, aspect, vtype, pvalue, NULL);
+}
+
+static apr_status_t pdb_save(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
+{
+    md_store_db_t *db = baton;
+    const char *name, *aspect, *data;
+    md_store_group_t group;
+    md_store_vtype_t vtype;
+    apr_array_header_t *recs;
+    apr_size_t len;
+    void *value;
+    int create;
+    db_rec_t *rec;
+    apr_status_t rv;
+
+    (void)p;
+    group = (md_store_group_t)va_arg(ap, int);
+    name = va_arg(ap, const char*);
+    aspect = va_arg(ap, const char*);
+    vtype = (md_store_vtype_t)va_arg(ap, int);
+    value = va_arg(ap, void *);
+    create = va_arg(ap, int);
+
+    if (APR_SUCCESS != (rv = value_encode(&data, &len, db, group, vtype, value, ptemp))) {
+        return rv;
+    }
+    recs = apr_array_make(ptemp, 1, sizeof(db_rec_t));
+    rec = apr_array_push(recs);
+    memset(rec, 0, sizeof(*rec));
+    rec->op = DB_OP_PUT;
+    rec->group = group;
+    rec->name = name;
+    rec->aspect = aspect;
+    rec->value = data;
+    rec->vlen = len;
+    rec->mtime = apr_time_now();
+
+    db_lock(db);
+    if (APR_SUCCESS == (rv = db_wbegin(db, ptemp))) {
+        if (create && idx_val_get(db, group, name, aspect)) {
+            rv = APR_EEXIST;
+        }
+        else {
+            rv = db_write(db, recs, ptemp);
+        }
+        db_wend(db);
+    }
+    db_unlock(db);
+    return rv;
+}
+
+static apr_status_t db_save(md_store_t *store, apr_pool_t *p, md_store_group_t group,
+                            const char *name, const char *aspect,
+                            md_store_vtype_t vtype, void *value, int create)
+{
+    md_store_db_t *db = DB_STORE(store);
+    return md_util_pool_vdo(pdb_save, db, p, group, name, aspect, vtype, value, create, NULL);
+}
+
+static apr_status_t pdb_remove(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
+{
+    md_store_db_t *db = baton;
+    const char *name, *aspect;
+    md_store_group_t group;
+    apr_array_header_t *recs;
+    db_rec_t *rec;
+    int force;
+    apr_status_t rv;
+
+    (void)p;
+    group = (md_store_group_t)va_arg(ap, int);
+    name = va_arg(ap, const char*);
+    aspect = va_arg(ap, const char *);
+    force = va_arg(ap, int);
+
+    recs = apr_array_make(ptemp, 1, sizeof(db_rec_t));
+    rec = apr_array_push(recs);
+    memset(rec, 0, sizeof(*rec));
+    rec->op = DB_OP_DEL;
+    rec->group = group;
+    rec->name = name;
+    rec->aspect = aspect;
+    rec->mtime = apr_time_now();
+
+    db_lock(db);
+    if (APR_SUCCESS == (rv = db_wbegin(db, ptemp))) {
+        if (!idx_val_get(db, group, name, aspect)) {
+            rv = force? APR_SUCCESS : APR_ENOENT;
+        }
+        else {
+            rv = db_write(db, recs, ptemp);
+        }
+        db_wend(db);
+    }
+    db_unlock(db);
+    return rv;
+}
+
+static apr_status_t db_remove(md_store_t *store, md_store_group_t group,
+                              const char *name, const char *aspect,
+                              apr_pool_t *p, int force)
+{
+    md_store_db_t *db = DB_STORE(store);
+    return md_util_pool_vdo(pdb_remove, db, p, group, name, aspect, force, NULL);
+}
+
+static apr_status_t pdb_purge(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
+{
+    md_store_db_t *db = baton;
+    const char *name;
+    md_store_group_t group;
+    apr_array_header_t *recs;
+    db_rec_t *rec;
+    apr_status_t rv;
+
+    (void)p;
+    group = (md_store_group_t)va_arg(ap, int);
+    name = va_arg(ap, const char*);
+
+    recs = apr_array_make(ptemp, 1, sizeof(db_rec_t));
+    rec = apr_array_push(recs);
+    memset(rec, 0, sizeof(*rec));
+    rec->op = DB_OP_PURGE;
+    rec->group = group;
+    rec->name = name;
+    rec->aspect = "";
+    rec->mtime = apr_time_now();
+
+    db_lock(db);
+    if (APR_SUCCESS == (rv = db_wbegin(db, ptemp))) {
+        if (idx_md_get(db, group, name, 0)) {
+            rv = db_write(db, recs, ptemp);
+        }
+        db_wend(db);
+    }
+    db_unlock(db);
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "purge %s/%s",
+                  md_store_group_name(group), name);
+    return rv;
+}
+
+static apr_status_t db_purge(md_store_t *store, apr_pool_t *p,
+                             md_store_group_t group, const char *name)
+{
+    md_store_db_t *db = DB_STORE(store);
+    return md_util_pool_vdo(pdb_purge, db, p, group, name, NULL);
+}
+
+/* Find the name under which values of name go to the archive group. */
+static apr_status_t arch_name_get(const char **parch_name, md_store_db_t *db, 
+                                  const char *name, apr_pool_t *p)
+{
+    const char *arch_name;
+    int n;
+
+    for (n = 1; n < 1000; ++n) {
+        arch_name = apr_psprintf(p, "%s.%d", name, n);
+        if (!idx_md_get(db, MD_SG_ARCHIVE, arch_name, 0)) {
+            *parch_name = arch_name;
+            return APR_SUCCESS;
+        }
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, p, "ran out of numbers less than 1000 "
+                  "while looking for an available one to archive %s", name);
+    return APR_EGENERAL;
+}
+
+static apr_status_t pdb_move(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
+{
+    md_store_db_t *db = baton;
+    const char *name, *arch_name = "";
+    md_store_group_t from, to;
+    apr_array_header_t *recs;
+    db_rec_t *rec;
+    int archive;
+    apr_status_t rv;
+
+    (void)p;
+    from = (md_store_group_t)va_arg(ap, int);
+    to = (md_store_group_t)va_arg(ap, int);
+    name = va_arg(ap, const char*);
+    archive = va_arg(ap, int);
+
+    if (from == to) {
+        return APR_EINVAL;
+    }
+
+    db_lock(db);
+    if (APR_SUCCESS != (rv = db_wbegin(db, ptemp))) {
+        goto out;
+    }
+    if (!idx_md_get(db, from, name, 0)) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, ptemp, "move: no %s/%s",
+                      md_store_group_name(from), name);
+        rv = APR_ENOENT;
+    }
+    else if (idx_md_get(db, to, name, 0)) {
+        if (!archive) {
+            rv = APR_EEXIST;
+        }
+        else {
+            rv = arch_name_get(&arch_name, db, name, ptemp);
+        }
+    }
+
+    if (APR_SUCCESS == rv) {
+        recs = apr_array_make(ptemp, 1, sizeof(db_rec_t));
+        rec = apr_array_push(recs);
+        memset(rec, 0, sizeof(*rec));
+        rec->op = DB_OP_MOVE;
+        rec->group = from;
+        rec->to = to;
+        rec->name = name;
+        rec->aspect = "";
+        rec->value = arch_name;
+        rec->vlen = strlen(arch_name);
+        rec->mtime = apr_time_now();
+        rv = db_write(db, recs, ptemp);
+    }
+    db_wend(db);
+out:
+    db_unlock(db);
+    return rv;
+}
+
+static apr_status_t db_move(md_store_t *store, apr_pool_t *p,
+                            md_store_group_t from, md_store_group_t to,
+                            const char *name, int archive)
+{
+    md_store_db_t *db = DB_STORE(store);
+    return md_util_pool_vdo(pdb_move, db, p, from, to, name, archive, NULL);
+}
+
+static apr_status_t pdb_commit(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
+{
+    md_store_db_t *db = baton;
+    const char *name, *arch_name = "";
+    md_store_group_t group;
+    apr_array_header_t *vals, *recs;
+    md_store_txn_val_t *val;
+    db_rec_t *rec;
+    int archive, i;
+    apr_status_t rv = APR_SUCCESS;
+
+    (void)p;
+    group = (md_store_group_t)va_arg(ap, int);
+    name = va_arg(ap, const char*);
+    vals = va_arg(ap, apr_array_header_t*);
+    archive = va_arg(ap, int);
+
+    if (MD_SG_TMP == group) {
+        return APR_EINVAL;
+    }
+
+    /* the values are put into TMP and moved from there, all in one transaction */
+    recs = apr_array_make(ptemp, vals->nelts + 2, sizeof(db_rec_t));
+    rec = apr_array_push(recs);
+    memset(rec, 0, sizeof(*rec));
+    rec->op = DB_OP_PURGE;
+    rec->group = MD_SG_TMP;
+    rec->name = name;
+    rec->aspect = "";
+    rec->mtime = apr_time_now();
+    for (i = 0; i < vals->nelts && APR_SUCCESS == rv; ++i) {
+        val = &APR_ARRAY_IDX(vals, i, md_store_txn_val_t);
+        rec = apr_array_push(recs);
+        memset(rec, 0, sizeof(*rec));
+        rec->op = DB_OP_PUT;
+        rec->group = MD_SG_TMP;
+        rec->name = name;
+        rec->aspect = val->aspect;
+        rec->mtime = apr_time_now();
+        rv = value_encode(&rec->value, &rec->vlen, db, group, val->vtype, val->value, ptemp);
+    }
+    if (APR_SUCCESS != rv) {
+        return rv;
+    }
+
+    db_lock(db);
+    if (APR_SUCCESS == (rv = db_wbegin(db, ptemp))) {
+        if (idx_md_get(db, group, name, 0)) {
+            rv = archive? arch_name_get(&arch_name, db, name, ptemp) : APR_EEXIST;
+        }
+        if (APR_SUCCESS == rv) {
+            rec = apr_array_push(recs);
+            memset(rec, 0, sizeof(*rec));
+            rec->op = DB_OP_MOVE;
+            rec->group = MD_SG_TMP;
+            rec->to = group;
+            rec->name = name;
+            rec->aspect = "";
+            rec->value = arch_name;
+            rec->vlen = strlen(arch_name);
+            rec->mtime = apr_time_now();
+            rv = db_write(db, recs, ptemp);
+        }
+        db_wend(db);
+    }
+    db_unlock(db);
+    return rv;
+}
+
+static apr_status_t db_commit(md_store_t *store, apr_pool_t *p, 
+                              md_store_group_t group, const char *name, 
+                              apr_array_header_t *vals, int archive)
+{
+    md_store_db_t *db = DB_STORE(store);
+    return md_util_pool_vdo(pdb_commit, db, p, group, name, vals, archive, NULL);
+}
+
+typedef struct {
+    const char *name;
+    const char *aspect;
+} db_key_t;
+
+/* Get the name/aspect pairs matching, so that callers may change the store
+ * while iterating. */
+static apr_status_t db_match(apr_array_header_t **pkeys, md_store_db_t *db,
+                             md_store_group_t group, const char *pattern,
+                             const char *aspect, apr_pool_t *p)
+{
+    apr_array_header_t *keys;
+    apr_hash_index_t *hi, *hj;
+    const char *vaspect;
+    db_md_t *md;
+    db_key_t *key;
+    apr_status_t rv;
+
+    keys = apr_array_make(p, 10, sizeof(db_key_t));
+    db_lock(db);
+    if (APR_SUCCESS == (rv = db_sync(db, 0, p)) && (int)group >= 0 && group < MD_SG_COUNT) {
+        for (hi = apr_hash_first(p, db->groups[group]); hi; hi = apr_hash_next(hi)) {
+            apr_hash_this(hi, NULL, NULL, (void **)&md);
+            if (APR_SUCCESS != apr_fnmatch(pattern, md->name, 0)) {
+                continue;
+            }
+            for (hj = apr_hash_first(p, md->vals); hj; hj = apr_hash_next(hj)) {
+                apr_hash_this(hj, (const void **)&vaspect, NULL, NULL);
+                if (APR_SUCCESS == apr_fnmatch(aspect, vaspect, 0)) {
+                    key = apr_array_push(keys);
+                    key->name = apr_pstrdup(p, md->name);
+                    key->aspect = apr_pstrdup(p, vaspect);
+                }
+            }
+        }
+    }
+    db_unlock(db);
+    *pkeys = (APR_SUCCESS == rv)? keys : NULL;
+    return rv;
+}
+
+static apr_status_t db_iterate(md_store_inspect *inspect, void *baton, md_store_t *store,
+                               apr_pool_t *p, md_store_group_t group, const char *pattern,
+                               const char *aspect, md_store_vtype_t vtype)
+{
+    md_store_db_t *db = DB_STORE(store);
+    apr_array_header_t *keys;
+    apr_pool_t *ptemp;
+    db_key_t *key;
+    void *value;
+    apr_status_t rv;
+    int i;
+
+    if (APR_SUCCESS != (rv = apr_pool_create(&ptemp, p))) {
+        return rv;
+    }
+    if (APR_SUCCESS == (rv = db_match(&keys, db, group, pattern, aspect, ptemp))) {
+        for (i = 0; i < keys->nelts; ++i) {
+            key = &APR_ARRAY_IDX(keys, i, db_key_t);
+            rv = db_load(store, group, key->name, key->aspect, vtype, &value, ptemp);
+            if (APR_STATUS_IS_ENOENT(rv)) {
+                /* gone in the meantime */
+                rv = APR_SUCCESS;
+                continue;
+            }
+            if (APR_SUCCESS != rv) {
+                break;
+            }
+            if (!inspect(baton, key->name, key->aspect, vtype, value, ptemp)) {
+                rv = APR_EOF;
+                break;
+            }
+        }
+    }
+    apr_pool_destroy(ptemp);
+    return rv;
+}
+
+static apr_status_t db_iterate_names(md_store_names_inspect *inspect, void *baton,
+                                     md_store_t *store, apr_pool_t *p,
+                                     md_store_group_t group, const char *pattern)
+{
+    md_store_db_t *db = DB_STORE(store);
+    apr_array_header_t *keys;
+    apr_pool_t *ptemp;
+    db_key_t *key;
+    apr_status_t rv;
+    int i;
+
+    if (APR_SUCCESS != (rv = apr_pool_create(&ptemp, p))) {
+        return rv;
+    }
+    if (APR_SUCCESS == (rv = db_match(&keys, db, group, pattern, "*", ptemp))) {
+        for (i = 0; i < keys->nelts; ++i) {
+            key = &APR_ARRAY_IDX(keys, i, db_key_t);
+            if (!inspect(baton, key->name, key->aspect, ptemp)) {
+                rv = APR_EOF;
+                break;
+            }
+        }
+    }
+    apr_pool_destroy(ptemp);
+    return rv;
+}
+
+static int db_is_newer(md_store_t *store, md_store_group_t group1, md_store_group_t group2,
+                       const char *name, const char *aspect, apr_pool_t *p)
+{
+    md_store_db_t *db = DB_STORE(store);
+    db_val_t *val1, *val2;
+    int newer = 0;
+
+    db_lock(db);
+    if (APR_SUCCESS == db_sync(db, 0, p)
+        && NULL != (val1 = idx_val_get(db, group1, name, aspect))
+        && NULL != (val2 = idx_val_get(db, group2, name, aspect))) {
+        newer = val1->mtime > val2->mtime;
+    }
+    db_unlock(db);
+    return newer;
+}
+
+apr_status_t md_store_db_compact(md_store_t *store, apr_pool_t *p)
+{
+    md_store_db_t *db;
+    apr_pool_t *ptemp;
+    apr_status_t rv;
+
+    if (!store || store->load != db_load) {
+        return APR_EINVAL;
+    }
+    db = DB_STORE(store);
+    if (APR_SUCCESS != (rv = apr_pool_create(&ptemp, p))) {
+        return rv;
+    }
+    db_lock(db);
+    if (APR_SUCCESS == (rv = db_wbegin(db, ptemp))) {
+        rv = db_compact(db, ptemp);
+        db_wend(db);
+    }
+    db_unlock(db);
+    apr_pool_destroy(ptemp);
+    return rv;
+}
+
+apr_status_t md_store_db_init(md_store_t **pstore, apr_pool_t *p, const char *fname)
+{
+    md_store_db_t *db;
+    apr_pool_t *ptemp = NULL;
+    apr_status_t rv;
+
+    crc_init();
+    db = apr_pcalloc(p, sizeof(*db));
+    db->s.load = db_load;
+    db->s.save = db_save;
+    db->s.remove = db_remove;
+    db->s.move = db_move;
+    db->s.purge = db_purge;
+    db->s.iterate = db_iterate;
+    db->s.is_newer = db_is_newer;
+    db->s.iterate_names = db_iterate_names;
+    db->s.commit = db_commit;
+
+    db->p = p;
+    db->fname = apr_pstrdup(p, fname);
+    /* as in the file system store, keys of the domains are not encrypted */
+    db->plain_pkey[MD_SG_DOMAINS] = 1;
+    db->plain_pkey[MD_SG_TMP] = 1;
+
+#if APR_HAS_THREADS
+    if (APR_SUCCESS != (rv = apr_thread_mutex_create(&db->mutex,
+                                                     APR_THREAD_MUTEX_DEFAULT, p))) {
+        goto out;
+    }
+#endif
+    if (APR_SUCCESS != (rv = apr_pool_create(&db->idx_pool, p))
+        || APR_SUCCESS != (rv = apr_pool_create(&ptemp, p))) {
+        goto out;
+    }
+    apr_pool_tag(db->idx_pool, "md_store_db");
+    idx_reset(db);
+
+    rv = apr_file_open(&db->lockf, apr_pstrcat(ptemp, db->fname, ".lock", NULL),
+                       APR_FOPEN_WRITE|APR_FOPEN_CREATE, MD_FPROT_F_UONLY, p);
+    if (APR_SUCCESS == rv && APR_SUCCESS == (rv = db_wbegin(db, ptemp))) {
+        db_wend(db);
+    }
+
+out:
+    if (ptemp) {
+        apr_pool_destroy(ptemp);
+    }
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "init db store at %s", fname);
+    }
+    *pstore = (APR_SUCCESS == rv)? &(db->s) : NULL;
+    return rv;
+}
@@ -0,0 +1,41 @@
+/* Copyright 2017 greenbytes GmbH (https://www.greenbytes.de)
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef mod_md_md_store_db_h
+#define mod_md_md_store_db_h
+
+struct md_store_t;
+
+/**
+ * Create a store that keeps all values in the single file fname. Changes are
+ * appended to the file as transactions, which are either read completely or
+ * not at all. An index of all values is kept in memory.
+ *
+ * Several processes may use the same file. Writes are serialized by a lock
+ * on "fname.lock", and each process picks up the changes of others before it
+ * reads or writes.
+ *
+ * The store has no file names for its values, md_store_get_fname() returns
+ * APR_ENOTIMPL. Use md_store_copy() to migrate from or to a file system store.
+ */
+apr_status_t md_store_db_init(struct md_store_t **pstore, apr_pool_t *p, const char *fname);
+
+/**
+ * Rewrite the file with only the current values in it. This happens
+ * automatically when more than half of the file holds outdated values.
+ */
+apr_status_t md_store_db_compact(struct md_store_t *store, apr_pool_t *p);
+
+#endif /* mod_md_md_store_db_h */
@@ -13,6 +13,10 @@
  * limitations under the License.
  */
 
+#if defined(MD_HAVE_RENAME_EXCHANGE) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE         /* renameat2() */
+#endif
+
 #include <assert.h>
 #include <stddef.h>
 #include <stdio.h>
@@ -25,6 +29,22 @@
 #include <apr_hash.h>
 #include <apr_strings.h>
 
+#ifdef MD_HAVE_RENAME_EXCHANGE
+#include <errno.h>
+#include <fcntl.h>
+#endif
+
+#if defined(MD_HAVE_INOTIFY) && APR_HAS_THREADS
+#define MD_FS_WATCH         1
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
+#endif
+
 #include "md.h"
 #include "md_crypt.h"
 #include "md_json.h"
@@ -39,11 +59,19 @@
 
 #define MD_STORE_VERSION        3
 
+/* Where renameat2(RENAME_EXCHANGE) is missing, a commit that replaces existing data
+ * takes two renames and the target is gone for a moment. A marker file in TMP, named 
+ * after the target, tells commit_recover() to finish the job after a crash. '_' is not 
+ * valid in md names, group names contain no '.'. */
+#define FS_COMMIT_MARK          "_commit."
+
 typedef struct {
     apr_fileperms_t dir;
     apr_fileperms_t file;
 } perms_t;
 
+typedef struct fs_watch_t fs_watch_t;
+
 typedef struct md_store_fs_t md_store_fs_t;
 struct md_store_fs_t {
     md_store_t s;
@@ -53,10 +81,12 @@ struct md_store_fs_t {
     perms_t group_perms[MD_SG_COUNT];
     md_store_fs_cb *event_cb;
     void *event_baton;
+    fs_watch_t *watch;      /* watch on the store directories, if started */
     
     const unsigned char *key;
     apr_size_t key_len;
     int plain_pkey[MD_SG_COUNT];
+    md_json_fmt_t json_fmt; /* how JSON values are written */
     
     int port_80;
     int port_443;
@@ -90,6 +120,17 @@ static apr_status_t fs_get_fname(const char **pfname,
                                  apr_pool_t *p);
 static int fs_is_newer(md_store_t *store, md_store_group_t group1, md_store_group_t group2,  
                        const char *name, const char *aspect, apr_pool_t *p);
+static apr_status_t fs_iterate_names(md_store_names_inspect *inspect, void *baton, 
+                                     md_store_t *store, apr_pool_t *p, 
+                                     md_store_group_t group, const char *pattern);
+static apr_status_t fs_commit(md_store_t *store, apr_pool_t *p, 
+                              md_store_group_t group, const char *name, 
+                              apr_array_header_t *vals, int archive);
+static apr_status_t commit_recover(void *baton, apr_pool_t *p, apr_pool_t *ptemp, 
+                                   const char *dir, const char *fname, 
+                                   apr_filetype_e ftype);
+
+static void watch_own(md_store_fs_t *s_fs, const char *dir);
 
 static apr_status_t init_store_file(md_store_fs_t *s_fs, const char *fname, 
                                     apr_pool_t *p, apr_pool_t *ptemp)
@@ -190,7 +231,7 @@ static apr_status_t read_store_file(md_store_fs_t *s_fs, const char *fname,
                                     apr_pool_t *p, apr_pool_t *ptemp)
 {
     md_json_t *json;
-    const char *key64, *key;
+    const char *key64, *key, *format;
     apr_status_t rv;
     double store_version;
     
@@ -205,6 +246,12 @@ static apr_status_t read_store_file(md_store_fs_t *s_fs, const char *fname,
             return APR_EINVAL;
         }
 
+        format = md_json_gets(json, MD_KEY_STORE, MD_KEY_FORMAT, NULL);
+        if (format && APR_SUCCESS != md_json_fmt_parse(&s_fs->json_fmt, format)) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, p, "unknown store format: %s", format);
+            return APR_EINVAL;
+        }
+
         key64 = md_json_dups(p, json, MD_KEY_KEY, NULL);
         if (!key64) {
             md_log_perror(MD_LOG_MARK, MD_LOG_ERR, 0, p, "missing key: %s", MD_KEY_KEY);
@@ -265,6 +312,14 @@ read:
             goto read;
         }
     }
+    if (APR_SUCCESS == rv) {
+        /* finish commits a crash interrupted */
+        rv = md_util_files_do(commit_recover, s_fs, p, s_fs->base, 
+                              md_store_group_name(MD_SG_TMP), FS_COMMIT_MARK "*", NULL);
+        if (APR_STATUS_IS_ENOENT(rv)) {
+            rv = APR_SUCCESS;
+        }
+    }
     return rv;
 }
 
@@ -283,6 +338,8 @@ apr_status_t md_store_fs_init(md_store_t **pstore, apr_pool_t *p, const char *pa
     s_fs->s.iterate = fs_iterate;
     s_fs->s.get_fname = fs_get_fname;
     s_fs->s.is_newer = fs_is_newer;
+    s_fs->s.iterate_names = fs_iterate_names;
+    s_fs->s.commit = fs_commit;
     
     /* by default, everything is only readable by the current user */ 
     s_fs->def_perms.dir = MD_FPROT_D_UONLY;
@@ -297,7 +354,11 @@ apr_status_t md_store_fs_init(md_store_t **pstore, apr_pool_t *p, const char *pa
     /* challenges dir and files are readable by all, no secrets involved */ 
     s_fs->group_perms[MD_SG_CHALLENGES].dir = MD_FPROT_D_UALL_WREAD;
     s_fs->group_perms[MD_SG_CHALLENGES].file = MD_FPROT_F_UALL_WREAD;
+    /* as are cached public documents, e.g. the directories of CAs */
+    s_fs->group_perms[MD_SG_CACHE].dir = MD_FPROT_D_UALL_WREAD;
+    s_fs->group_perms[MD_SG_CACHE].file = MD_FPROT_F_UALL_WREAD;
 
+    s_fs->json_fmt = MD_JSON_FMT_INDENT;
     s_fs->base = apr_pstrdup(p, path);
     
     if (APR_SUCCESS != (rv = md_util_is_dir(s_fs->base, p))) {
@@ -363,6 +424,91 @@ static const perms_t *gperms(md_store_fs_t *s_fs, md_store_group_t group)
     return &s_fs->group_perms[group];
 }
 
+/**************************************************************************************************/
+/* JSON format */
+
+md_json_fmt_t md_store_fs_json_fmt_get(md_store_t *store)
+{
+    if (!store || store->load != fs_load) {
+        /* not ours, what a new fs store would use */
+        return MD_JSON_FMT_INDENT;
+    }
+    return FS_STORE(store)->json_fmt;
+}
+
+typedef struct {
+    md_store_fs_t *s_fs;
+    md_store_group_t group;
+    int count;
+} convert_ctx;
+
+static apr_status_t convert_file(void *baton, apr_pool_t *p, apr_pool_t *ptemp, 
+                                 const char *dir, const char *name, 
+                                 apr_filetype_e ftype)
+{
+    convert_ctx *ctx = baton;
+    md_json_t *json;
+    const char *fpath = name;
+    apr_status_t rv;
+    
+    (void)p;
+    if (APR_REG != ftype) {
+        return APR_SUCCESS;
+    }
+    if (   APR_SUCCESS == (rv = md_util_path_merge(&fpath, ptemp, dir, name, NULL))
+        && APR_SUCCESS == (rv = md_json_readf(&json, ptemp, fpath))
+        && APR_SUCCESS == (rv = md_json_freplace(json, ptemp, ctx->s_fs->json_fmt, fpath, 
+                                                 gperms(ctx->s_fs, ctx->group)->file))) {
+        ++ctx->count;
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE1, rv, ptemp, "converted %s", fpath);
+    return rv;
+}
+
+static apr_status_t pfs_convert(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
+{
+    md_store_fs_t *s_fs = baton;
+    convert_ctx ctx;
+    md_json_t *json;
+    const char *fname;
+    apr_status_t rv;
+    int group;
+    
+    s_fs->json_fmt = (md_json_fmt_t)va_arg(ap, int);
+    ctx.s_fs = s_fs;
+    ctx.count = 0;
+    rv = APR_SUCCESS;
+    for (group = MD_SG_NONE + 1; group < MD_SG_COUNT && APR_SUCCESS == rv; ++group) {
+        ctx.group = (md_store_group_t)group;
+        rv = md_util_files_do(convert_file, &ctx, p, s_fs->base, 
+                              md_store_group_name(group), "*", "*.json", NULL);
+        if (APR_STATUS_IS_ENOENT(rv)) {
+            rv = APR_SUCCESS;
+        }
+    }
+    
+    /* remember the format for everyone else using the store. The store file itself
+     * stays readable text. */
+    if (   APR_SUCCESS == rv
+        && APR_SUCCESS == (rv = md_util_path_merge(&fname, ptemp, s_fs->base, 
+                                                   FS_STORE_JSON, NULL))
+        && APR_SUCCESS == (rv = md_json_readf(&json, ptemp, fname))) {
+        md_json_sets(md_json_fmt_name(s_fs->json_fmt), json, MD_KEY_STORE, MD_KEY_FORMAT, NULL);
+        rv = md_json_freplace(json, ptemp, MD_JSON_FMT_INDENT, fname, MD_FPROT_F_UONLY);
+    }
+    md_log_perror(MD_LOG_MARK, (APR_SUCCESS == rv)? MD_LOG_DEBUG : MD_LOG_ERR, rv, p, 
+                  "converted %d JSON files to %s", ctx.count, md_json_fmt_name(s_fs->json_fmt));
+    return rv;
+}
+
+apr_status_t md_store_fs_convert(md_store_t *store, apr_pool_t *p, md_json_fmt_t fmt)
+{
+    if (!store || store->load != fs_load) {
+        return APR_ENOTIMPL;
+    }
+    return md_util_pool_vdo(pfs_convert, FS_STORE(store), p, (int)fmt, NULL);
+}
+
 static apr_status_t fs_get_fname(const char **pfname, 
                                  md_store_t *store, md_store_group_t group, 
                                  const char *name, const char *aspect, 
@@ -465,10 +611,8 @@ static apr_status_t pfs_load(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
 static apr_status_t dispatch(md_store_fs_t *s_fs, md_store_fs_ev_t ev, int group, 
                              const char *fname, apr_filetype_e ftype, apr_pool_t *p)
 {
-    (void)ev;
     if (s_fs->event_cb) {
-        return s_fs->event_cb(s_fs->event_baton, &s_fs->s, MD_S_FS_EV_CREATED, 
-                              group, fname, ftype, p);
+        return s_fs->event_cb(s_fs->event_baton, &s_fs->s, ev, group, fname, ftype, p);
     }
     return APR_SUCCESS;
 }
@@ -484,6 +628,9 @@ static apr_status_t mk_group_dir(const char **pdir, md_store_fs_t *s_fs,
 
     if (APR_SUCCESS == (rv = fs_get_dname(pdir, &s_fs->s, group, name, p))
         && (MD_SG_NONE != group)) {
+        if (name) {
+            watch_own(s_fs, *pdir);
+        }
         if (APR_SUCCESS != md_util_is_dir(*pdir, p)) {
             if (APR_SUCCESS == (rv = apr_dir_make_recursive(*pdir, perms->dir, p))) {
                 rv = dispatch(s_fs, MD_S_FS_EV_CREATED, group, *pdir, APR_DIR, p);
@@ -547,6 +694,49 @@ static int fs_is_newer(md_store_t *store, md_store_group_t group1, md_store_grou
     return 0;
 }
 
+static apr_status_t fs_fsave(md_store_fs_t *s_fs, const char *fpath, md_store_group_t group,
+                             md_store_vtype_t vtype, void *value, int create, 
+                             apr_pool_t *p, apr_pool_t *ptemp)
+{
+    const perms_t *perms;
+    const char *pass;
+    apr_size_t pass_len;
+    apr_status_t rv;
+    
+    perms = gperms(s_fs, group);
+    
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE3, 0, ptemp, "storing in %s", fpath);
+    switch (vtype) {
+        case MD_SV_TEXT:
+            rv = (create? md_text_fcreatex(fpath, perms->file, p, value)
+                  : md_text_freplace(fpath, perms->file, p, value));
+            break;
+        case MD_SV_JSON:
+            rv = (create? md_json_fcreatex((md_json_t *)value, p, s_fs->json_fmt, 
+                                           fpath, perms->file)
+                  : md_json_freplace((md_json_t *)value, p, s_fs->json_fmt, 
+                                     fpath, perms->file));
+            break;
+        case MD_SV_CERT:
+            rv = md_cert_fsave((md_cert_t *)value, ptemp, fpath, perms->file);
+            break;
+        case MD_SV_PKEY:
+            /* Take care that we write private key with access only to the user,
+             * unless we write the key encrypted */
+            get_pass(&pass, &pass_len, s_fs, group);
+            rv = md_pkey_fsave((md_pkey_t *)value, ptemp, pass, pass_len, 
+                               fpath, (pass && pass_len)? perms->file : MD_FPROT_F_UONLY);
+            break;
+        case MD_SV_CHAIN:
+            rv = md_chain_fsave((apr_array_header_t*)value, ptemp, fpath, perms->file);
+            break;
+        default:
+            rv = APR_ENOTIMPL;
+            break;
+    }
+    return rv;
+}
+
 static apr_status_t pfs_save(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
 {
     md_store_fs_t *s_fs = baton;
@@ -556,9 +746,6 @@ static apr_status_t pfs_save(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
     void *value;
     int create;
     apr_status_t rv;
-    const perms_t *perms;
-    const char *pass;
-    apr_size_t pass_len;
     
     group = (md_store_group_t)va_arg(ap, int);
     name = va_arg(ap, const char*);
@@ -567,43 +754,11 @@ static apr_status_t pfs_save(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
     value = va_arg(ap, void *);
     create = va_arg(ap, int);
     
-    perms = gperms(s_fs, group);
-    
     if (APR_SUCCESS == (rv = mk_group_dir(&gdir, s_fs, group, NULL, p)) 
         && APR_SUCCESS == (rv = mk_group_dir(&dir, s_fs, group, name, p))
-        && APR_SUCCESS == (rv = md_util_path_merge(&fpath, ptemp, dir, aspect, NULL))) {
-        
-        md_log_perror(MD_LOG_MARK, MD_LOG_TRACE3, 0, ptemp, "storing in %s", fpath);
-        switch (vtype) {
-            case MD_SV_TEXT:
-                rv = (create? md_text_fcreatex(fpath, perms->file, p, value)
-                      : md_text_freplace(fpath, perms->file, p, value));
-                break;
-            case MD_SV_JSON:
-                rv = (create? md_json_fcreatex((md_json_t *)value, p, MD_JSON_FMT_INDENT, 
-                                               fpath, perms->file)
-                      : md_json_freplace((md_json_t *)value, p, MD_JSON_FMT_INDENT, 
-                                         fpath, perms->file));
-                break;
-            case MD_SV_CERT:
-                rv = md_cert_fsave((md_cert_t *)value, ptemp, fpath, perms->file);
-                break;
-            case MD_SV_PKEY:
-                /* Take care that we write private key with access only to the user,
-                 * unless we write the key encrypted */
-                get_pass(&pass, &pass_len, s_fs, group);
-                rv = md_pkey_fsave((md_pkey_t *)value, ptemp, pass, pass_len, 
-                                   fpath, (pass && pass_len)? perms->file : MD_FPROT_F_UONLY);
-                break;
-            case MD_SV_CHAIN:
-                rv = md_chain_fsave((apr_array_header_t*)value, ptemp, fpath, perms->file);
-                break;
-            default:
-                return APR_ENOTIMPL;
-        }
-        if (APR_SUCCESS == rv) {
-            rv = dispatch(s_fs, MD_S_FS_EV_CREATED, group, fpath, APR_REG, p);
-        }
+        && APR_SUCCESS == (rv = md_util_path_merge(&fpath, ptemp, dir, aspect, NULL))
+        && APR_SUCCESS == (rv = fs_fsave(s_fs, fpath, group, vtype, value, create, p, ptemp))) {
+        rv = dispatch(s_fs, MD_S_FS_EV_CREATED, group, fpath, APR_REG, p);
     }
     return rv;
 }
@@ -629,6 +784,7 @@ static apr_status_t pfs_remove(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va
         && APR_SUCCESS == (rv = md_util_path_merge(&fpath, ptemp, dir, aspect, NULL))) {
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, ptemp, "start remove of md %s/%s/%s", 
                       groupname, name, aspect);
+        watch_own(s_fs, dir);
 
         if (APR_SUCCESS != (rv = apr_stat(&info, dir, APR_FINFO_TYPE, ptemp))) {
             if (APR_ENOENT == rv && force) {
@@ -685,6 +841,7 @@ static apr_status_t pfs_purge(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_
 
     if (APR_SUCCESS == (rv = md_util_path_merge(&dir, ptemp, s_fs->base, groupname, name, NULL))) {
         /* Remove all files in dir, there should be no sub-dirs */
+        watch_own(s_fs, dir);
         rv = md_util_rm_recursive(dir, ptemp, 1);
     }
     md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "purge %s/%s (%s)", groupname, name, dir);
@@ -753,13 +910,114 @@ static apr_status_t fs_iterate(md_store_inspect *inspect, void *baton, md_store_
     return rv;
 }
 
+typedef struct {
+    md_store_names_inspect *inspect;
+    void *baton;
+} names_ctx;
+
+static apr_status_t insp_name(void *baton, apr_pool_t *p, apr_pool_t *ptemp, 
+                              const char *dir, const char *name, apr_filetype_e ftype)
+{
+    names_ctx *ctx = baton;
+    
+    (void)p;
+    if (APR_REG == ftype 
+        && !ctx->inspect(ctx->baton, apr_filepath_name_get(dir), name, ptemp)) {
+        return APR_EOF;
+    }
+    return APR_SUCCESS;
+}
+
+static apr_status_t fs_iterate_names(md_store_names_inspect *inspect, void *baton, 
+                                     md_store_t *store, apr_pool_t *p, 
+                                     md_store_group_t group, const char *pattern)
+{
+    md_store_fs_t *s_fs = FS_STORE(store);
+    names_ctx ctx;
+    
+    ctx.inspect = inspect;
+    ctx.baton = baton;
+    return md_util_files_do(insp_name, &ctx, p, s_fs->base, 
+                            md_store_group_name(group), pattern, "*", NULL);
+}
+
 /**************************************************************************************************/
 /* moving */
 
+/* Find a free numbered directory in the archive for the data of name, coming from from_dir */
+static apr_status_t archive_dir_next(const char **pnarch_dir, md_store_fs_t *s_fs, 
+                                     const char *name, const char *from_dir, apr_pool_t *ptemp)
+{
+    const char *dir, *arch_dir, *narch_dir = NULL;
+    int n = 1;
+    apr_status_t rv;
+
+    rv = md_util_path_merge(&dir, ptemp, s_fs->base, md_store_group_name(MD_SG_ARCHIVE), NULL);
+    if (APR_SUCCESS != rv) goto out;
+    rv = apr_dir_make_recursive(dir, MD_FPROT_D_UONLY, ptemp); 
+    if (APR_SUCCESS != rv) goto out;
+    rv = md_util_path_merge(&arch_dir, ptemp, dir, name, NULL);
+    if (APR_SUCCESS != rv) goto out;
+    
+#ifdef WIN32
+    /* WIN32 and handling of files/dirs. What can one say? */
+    
+    while (n < 1000) {
+        narch_dir = apr_psprintf(ptemp, "%s.%d", arch_dir, n);
+        rv = md_util_is_dir(narch_dir, ptemp);
+        if (APR_STATUS_IS_ENOENT(rv)) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "using archive dir: %s", 
+                          narch_dir);
+            rv = APR_SUCCESS;
+            break;
+        }
+        else {
+            ++n;
+            narch_dir = NULL;
+        }
+    }
+
+#else   /* ifdef WIN32 */
+
+    while (n < 1000) {
+        narch_dir = apr_psprintf(ptemp, "%s.%d", arch_dir, n);
+        rv = apr_dir_make(narch_dir, MD_FPROT_D_UONLY, ptemp);
+        if (APR_SUCCESS == rv) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "using archive dir: %s", 
+                          narch_dir);
+            break;
+        }
+        else if (APR_EEXIST == rv) {
+            ++n;
+            narch_dir = NULL;
+        }
+        else {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, ptemp, "creating archive dir: %s", 
+                          narch_dir);
+            goto out;
+        }
+    }
+     
+#endif   /* ifdef WIN32 (else part) */
+    
+    if (!narch_dir) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, ptemp, "ran out of numbers less than 1000 "
+                      "while looking for an available one in %s to archive the data "
+                      "from %s. Either something is generally wrong or you need to "
+                      "clean up some of those directories.", arch_dir, from_dir);
+        rv = APR_EGENERAL;
+        goto out;
+    }
+    
+out:
+    *pnarch_dir = (APR_SUCCESS == rv)? narch_dir : NULL;
+    return rv;
+}
+
 static apr_status_t pfs_move(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
 {
     md_store_fs_t *s_fs = baton;
-    const char *name, *from_group, *to_group, *from_dir, *to_dir, *arch_dir, *dir;
+    const char *name, *from_group, *to_group, *from_dir, *to_dir;
     md_store_group_t from, to;
     int archive;
     apr_status_t rv;
@@ -785,68 +1043,18 @@ static apr_status_t pfs_move(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_l
         md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "source is no dir: %s", from_dir);
         goto out;
     }
+    watch_own(s_fs, from_dir);
+    watch_own(s_fs, to_dir);
     
     rv = archive? md_util_is_dir(to_dir, ptemp) : APR_ENOENT;
     if (APR_SUCCESS == rv) {
-        int n = 1;
         const char *narch_dir;
 
-        rv = md_util_path_merge(&dir, ptemp, s_fs->base, md_store_group_name(MD_SG_ARCHIVE), NULL);
-        if (APR_SUCCESS != rv) goto out;
-        rv = apr_dir_make_recursive(dir, MD_FPROT_D_UONLY, ptemp); 
-        if (APR_SUCCESS != rv) goto out;
-        rv = md_util_path_merge(&arch_dir, ptemp, dir, name, NULL);
-        if (APR_SUCCESS != rv) goto out;
-        
-#ifdef WIN32
-        /* WIN32 and handling of files/dirs. What can one say? */
-        
-        while (n < 1000) {
-            narch_dir = apr_psprintf(ptemp, "%s.%d", arch_dir, n);
-            rv = md_util_is_dir(narch_dir, ptemp);
-            if (APR_STATUS_IS_ENOENT(rv)) {
-                md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "using archive dir: %s", 
-                              narch_dir);
-                break;
-            }
-            else {
-                ++n;
-                narch_dir = NULL;
-            }
-        }
-
-#else   /* ifdef WIN32 */
-
-        while (n < 1000) {
-            narch_dir = apr_psprintf(ptemp, "%s.%d", arch_dir, n);
-            rv = apr_dir_make(narch_dir, MD_FPROT_D_UONLY, ptemp);
-            if (APR_SUCCESS == rv) {
-                md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "using archive dir: %s", 
-                              narch_dir);
-                break;
-            }
-            else if (APR_EEXIST == rv) {
-                ++n;
-                narch_dir = NULL;
-            }
-            else {
-                md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, ptemp, "creating archive dir: %s", 
-                              narch_dir);
-                goto out;
-            }
-        }
-         
-#endif   /* ifdef WIN32 (else part) */
-        
-        if (!narch_dir) {
-            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, ptemp, "ran out of numbers less than 1000 "
-                          "while looking for an available one in %s to archive the data "
-                          "from %s. Either something is generally wrong or you need to "
-                          "clean up some of those directories.", arch_dir, from_dir);
-            rv = APR_EGENERAL;
+        if (APR_SUCCESS != (rv = archive_dir_next(&narch_dir, s_fs, name, from_dir, ptemp))) {
             goto out;
         }
         
+        watch_own(s_fs, narch_dir);
         if (APR_SUCCESS != (rv = apr_file_rename(to_dir, narch_dir, ptemp))) {
                 md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, ptemp, "rename from %s to %s", 
                               to_dir, narch_dir);
@@ -886,3 +1094,599 @@ static apr_status_t fs_move(md_store_t *store, apr_pool_t *p,
     md_store_fs_t *s_fs = FS_STORE(store);
     return md_util_pool_vdo(pfs_move, s_fs, p, from, to, name, archive, NULL);
 }
+
+/**************************************************************************************************/
+/* transactions */
+
+static apr_status_t commit_mark(const char **pmark, md_store_fs_t *s_fs, 
+                                md_store_group_t group, const char *name, apr_pool_t *p)
+{
+    const char *tdir;
+    apr_file_t *f;
+    apr_status_t rv;
+    
+    if (APR_SUCCESS == (rv = fs_get_dname(&tdir, &s_fs->s, MD_SG_TMP, NULL, p))
+        && APR_SUCCESS == (rv = md_util_path_merge(pmark, p, tdir, apr_pstrcat(p, 
+                                FS_COMMIT_MARK, md_store_group_name(group), ".", name, NULL),
+                                NULL))
+        && APR_SUCCESS == (rv = apr_file_open(&f, *pmark, (APR_FOPEN_WRITE|APR_FOPEN_CREATE
+                                              |APR_FOPEN_TRUNCATE), MD_FPROT_F_UONLY, p))) {
+        rv = apr_file_sync(f);
+        apr_file_close(f);
+        if (APR_SUCCESS == rv) {
+            rv = md_util_fsync(tdir, p);
+        }
+    }
+    return rv;
+}
+
+static apr_status_t commit_recover(void *baton, apr_pool_t *p, apr_pool_t *ptemp, 
+                                   const char *dir, const char *fname, 
+                                   apr_filetype_e ftype)
+{
+    md_store_fs_t *s_fs = baton;
+    const char *group, *name, *mark, *from_dir, *to_dir;
+    apr_status_t rv;
+    
+    (void)ftype;
+    group = fname + strlen(FS_COMMIT_MARK);
+    if (NULL == (name = strchr(group, '.')) || !name[1]) {
+        return APR_SUCCESS;
+    }
+    group = apr_pstrndup(ptemp, group, (apr_size_t)(name - group));
+    ++name;
+    
+    if (APR_SUCCESS != (rv = md_util_path_merge(&mark, ptemp, dir, fname, NULL))
+        || APR_SUCCESS != (rv = md_util_path_merge(&from_dir, ptemp, dir, name, NULL))
+        || APR_SUCCESS != (rv = md_util_path_merge(&to_dir, ptemp, s_fs->base, 
+                                                   group, name, NULL))) {
+        return rv;
+    }
+    /* Only the second rename can be missing. Otherwise, the old data is still in
+     * place or the commit went through. */
+    if (APR_STATUS_IS_ENOENT(md_util_is_dir(to_dir, ptemp))
+        && APR_SUCCESS == md_util_is_dir(from_dir, ptemp)) {
+        rv = apr_file_rename(from_dir, to_dir, ptemp);
+        md_log_perror(MD_LOG_MARK, APR_SUCCESS == rv? MD_LOG_WARNING : MD_LOG_ERR, rv, p, 
+                      "completing interrupted commit of %s/%s", group, name);
+        if (APR_SUCCESS != rv) {
+            return rv;
+        }
+    }
+    return apr_file_remove(mark, ptemp);
+}
+
+/* Replace the data of name in group with the one in from_dir, archiving the old one */
+static apr_status_t commit_swap(md_store_fs_t *s_fs, md_store_group_t group, 
+                                const char *name, const char *from_dir, apr_pool_t *p)
+{
+    const char *to_dir, *narch_dir, *mark;
+    apr_status_t rv;
+    
+    if (APR_SUCCESS != (rv = fs_get_dname(&to_dir, &s_fs->s, group, name, p))) {
+        return rv;
+    }
+    watch_own(s_fs, to_dir);
+    rv = md_util_is_dir(to_dir, p);
+    if (APR_STATUS_IS_ENOENT(rv)) {
+        /* nothing to replace, one rename does it */
+        if (APR_SUCCESS != (rv = apr_file_rename(from_dir, to_dir, p))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "rename from %s to %s", 
+                          from_dir, to_dir);
+        }
+        return rv;
+    }
+    else if (APR_SUCCESS != rv
+             || APR_SUCCESS != (rv = archive_dir_next(&narch_dir, s_fs, name, from_dir, p))) {
+        return rv;
+    }
+    watch_own(s_fs, narch_dir);
+    
+    rv = APR_ENOTIMPL;
+#ifdef MD_HAVE_RENAME_EXCHANGE
+    if (0 == renameat2(AT_FDCWD, from_dir, AT_FDCWD, to_dir, RENAME_EXCHANGE)) {
+        /* new data is in place, the old now sits in from_dir */
+        if (APR_SUCCESS != (rv = apr_file_rename(from_dir, narch_dir, p))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, "%s: archiving old data "
+                          "from %s to %s, it is left in place", name, from_dir, narch_dir);
+            return APR_SUCCESS;
+        }
+    }
+    else if (EINVAL != errno && ENOSYS != errno) {
+        rv = APR_FROM_OS_ERROR(errno);
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "exchange %s with %s", from_dir, to_dir);
+        return rv;
+    }
+#endif
+    
+    if (APR_STATUS_IS_ENOTIMPL(rv)) {
+        /* platform, kernel or file system cannot exchange, use two renames */
+        if (APR_SUCCESS != (rv = commit_mark(&mark, s_fs, group, name, p))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "%s: marking commit", name);
+            return rv;
+        }
+        if (APR_SUCCESS != (rv = apr_file_rename(to_dir, narch_dir, p))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "rename from %s to %s", 
+                          to_dir, narch_dir);
+        }
+        else if (APR_SUCCESS != (rv = apr_file_rename(from_dir, to_dir, p))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "rename from %s to %s", 
+                          from_dir, to_dir);
+            apr_file_rename(narch_dir, to_dir, p);
+        }
+        apr_file_remove(mark, p);
+        if (APR_SUCCESS != rv) {
+            return rv;
+        }
+    }
+    
+    rv = dispatch(s_fs, MD_S_FS_EV_MOVED, group, to_dir, APR_DIR, p);
+    if (APR_SUCCESS == rv) {
+        rv = dispatch(s_fs, MD_S_FS_EV_MOVED, MD_SG_ARCHIVE, narch_dir, APR_DIR, p);
+    }
+    return rv;
+}
+
+static apr_status_t pfs_commit(void *baton, apr_pool_t *p, apr_pool_t *ptemp, va_list ap)
+{
+    md_store_fs_t *s_fs = baton;
+    const char *name, *gdir, *dir = NULL, *fpath;
+    md_store_group_t group;
+    apr_array_header_t *vals;
+    md_store_txn_val_t *val;
+    int archive, i;
+    apr_status_t rv;
+    
+    group = (md_store_group_t)va_arg(ap, int);
+    name = va_arg(ap, const char*);
+    vals = va_arg(ap, apr_array_header_t*);
+    archive = va_arg(ap, int);
+    
+    if (MD_SG_TMP == group) {
+        return APR_EINVAL;
+    }
+    
+    /* All values go into a fresh dir in TMP that is then swapped in place, see 
+     * commit_swap(). The files need no replace dance of their own and are written in 
+     * the format and with the permissions of the target group. */
+    if (!archive && APR_SUCCESS == fs_get_dname(&gdir, &s_fs->s, group, name, ptemp)
+        && APR_SUCCESS == md_util_is_dir(gdir, ptemp)) {
+        return APR_EEXIST;
+    }
+    if (APR_SUCCESS != (rv = fs_get_dname(&dir, &s_fs->s, MD_SG_TMP, name, ptemp))) {
+        goto out;
+    }
+    watch_own(s_fs, dir);
+    md_util_rm_recursive(dir, ptemp, 1);
+    if (APR_SUCCESS != (rv = mk_group_dir(&gdir, s_fs, MD_SG_TMP, NULL, p))
+        || APR_SUCCESS != (rv = mk_group_dir(&dir, s_fs, MD_SG_TMP, name, p))) {
+        goto out;
+    }
+    for (i = 0; i < vals->nelts; ++i) {
+        val = &APR_ARRAY_IDX(vals, i, md_store_txn_val_t);
+        if (APR_SUCCESS != (rv = md_util_path_merge(&fpath, ptemp, dir, val->aspect, NULL))
+            || APR_SUCCESS != (rv = fs_fsave(s_fs, fpath, group, val->vtype, val->value, 
+                                             1, p, ptemp))
+            || APR_SUCCESS != (rv = md_util_fsync(fpath, ptemp))) {
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, ptemp, "%s: writing %s", 
+                          name, val->aspect);
+            goto out;
+        }
+    }
+    if (APR_SUCCESS != (rv = md_util_fsync(dir, ptemp))
+        || APR_SUCCESS != (rv = commit_swap(s_fs, group, name, dir, ptemp))) {
+        goto out;
+    }
+    
+    /* make the renames durable */
+    if (APR_SUCCESS == (rv = fs_get_dname(&gdir, &s_fs->s, group, NULL, ptemp))) {
+        rv = md_util_fsync(gdir, ptemp);
+    }
+    if (APR_SUCCESS == rv && archive) {
+        if (APR_SUCCESS == (rv = fs_get_dname(&gdir, &s_fs->s, MD_SG_ARCHIVE, NULL, ptemp))) {
+            rv = md_util_fsync(gdir, ptemp);
+        }
+        if (APR_STATUS_IS_ENOENT(rv)) {
+            rv = APR_SUCCESS;
+        }
+    }
+    
+out:
+    if (APR_SUCCESS != rv && dir) {
+        md_util_rm_recursive(dir, ptemp, 1);
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, ptemp, "commit %d values to %s/%s", 
+                  vals->nelts, md_store_group_name(group), name);
+    return rv;
+}
+
+static apr_status_t fs_commit(md_store_t *store, apr_pool_t *p, 
+                              md_store_group_t group, const char *name, 
+                              apr_array_header_t *vals, int archive)
+{
+    md_store_fs_t *s_fs = FS_STORE(store);
+    return md_util_pool_vdo(pfs_commit, s_fs, p, group, name, vals, archive, NULL);
+}
+
+/**************************************************************************************************/
+/* watching for changes */
+
+#ifdef MD_FS_WATCH
+
+/* Changes made through the store itself are remembered per MD directory for at least
+ * this long, so the watch does not report them a second time. */
+#define MD_FS_WATCH_OWN_TIME    apr_time_from_sec(2)
+#define MD_FS_WATCH_BUFLEN      4096
+
+#define MD_FS_WATCH_GROUP_MASK  (IN_CREATE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR)
+#define MD_FS_WATCH_MD_MASK     (IN_CLOSE_WRITE|IN_DELETE|IN_MOVED_FROM|IN_MOVED_TO|IN_ONLYDIR)
+
+typedef struct watch_dir_t watch_dir_t;
+struct watch_dir_t {
+    int wd;                         /* inotify watch descriptor */
+    md_store_group_t group;
+    int is_group;                   /* != 0 for the directory of the group itself */
+    char *path;
+    apr_size_t path_len;            /* space allocated for path */
+    watch_dir_t *next_free;
+};
+
+struct fs_watch_t {
+    md_store_fs_t *s_fs;
+    apr_pool_t *p;
+    apr_pool_t *ptemp;              /* for handling events, cleared after each read */
+    apr_thread_t *thread;
+    int fd;                         /* the inotify instance */
+    int wake[2];                    /* pipe, closing the write end stops the thread */
+    apr_hash_t *dirs;               /* watch descriptor -> watch_dir_t* */
+    apr_hash_t *dirs_by_path;       /* path -> watch_dir_t* */
+    watch_dir_t *free_dirs;         /* no longer watched, for reuse */
+    int exhausted;                  /* != 0 after running out of inotify watches */
+    
+    apr_thread_mutex_t *mutex;      /* protects the records of own changes */
+    apr_pool_t *own_p[2];
+    apr_hash_t *own[2];             /* MD directories we changed, [0] is the newer one */
+    apr_time_t own_since;           /* when own[0] was started */
+};
+
+static void own_rotate(fs_watch_t *w, apr_time_t now)
+{
+    apr_pool_t *op;
+    
+    if (now - w->own_since >= 2 * MD_FS_WATCH_OWN_TIME) {
+        apr_pool_clear(w->own_p[0]);
+        apr_pool_clear(w->own_p[1]);
+        w->own[0] = apr_hash_make(w->own_p[0]);
+        w->own[1] = apr_hash_make(w->own_p[1]);
+        w->own_since = now;
+    }
+    else if (now - w->own_since >= MD_FS_WATCH_OWN_TIME) {
+        op = w->own_p[1];
+        apr_pool_clear(op);
+        w->own_p[1] = w->own_p[0];
+        w->own[1] = w->own[0];
+        w->own_p[0] = op;
+        w->own[0] = apr_hash_make(op);
+        w->own_since = now;
+    }
+}
+
+static void watch_own(md_store_fs_t *s_fs, const char *dir)
+{
+    fs_watch_t *w = s_fs->watch;
+    const char *path;
+    
+    if (w) {
+        apr_thread_mutex_lock(w->mutex);
+        own_rotate(w, apr_time_now());
+        path = apr_pstrdup(w->own_p[0], dir);
+        apr_hash_set(w->own[0], path, APR_HASH_KEY_STRING, path);
+        apr_thread_mutex_unlock(w->mutex);
+    }
+}
+
+static int watch_is_own(fs_watch_t *w, const char *dir)
+{
+    int own;
+    
+    apr_thread_mutex_lock(w->mutex);
+    own_rotate(w, apr_time_now());
+    own = (apr_hash_get(w->own[0], dir, APR_HASH_KEY_STRING) 
+           || apr_hash_get(w->own[1], dir, APR_HASH_KEY_STRING));
+    apr_thread_mutex_unlock(w->mutex);
+    return own;
+}
+
+static apr_status_t watch_add(fs_watch_t *w, md_store_group_t group, const char *path, 
+                              int is_group, apr_pool_t *p)
+{
+    watch_dir_t *dir;
+    apr_status_t rv;
+    apr_size_t len;
+    int wd, err;
+    
+    wd = inotify_add_watch(w->fd, path, is_group? MD_FS_WATCH_GROUP_MASK : MD_FS_WATCH_MD_MASK);
+    if (wd < 0) {
+        err = errno;
+        rv = APR_FROM_OS_ERROR(err);
+        if (ENOSPC == err && !w->exhausted) {
+            w->exhausted = 1;
+            md_log_perror(MD_LOG_MARK, MD_LOG_WARNING, rv, p, "store watch: no more inotify "
+                          "watches available (see fs.inotify.max_user_watches), changes in %s "
+                          "and later directories are only seen on regular checks", path);
+        }
+        else {
+            md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, rv, p, "store watch: adding %s", path);
+        }
+        return rv;
+    }
+    
+    dir = apr_hash_get(w->dirs, &wd, sizeof(wd));
+    if (dir) {
+        /* same directory as before, moved to another place */
+        if (apr_hash_get(w->dirs_by_path, dir->path, APR_HASH_KEY_STRING) == dir) {
+            apr_hash_set(w->dirs_by_path, dir->path, APR_HASH_KEY_STRING, NULL);
+        }
+    }
+    else if (w->free_dirs) {
+        dir = w->free_dirs;
+        w->free_dirs = dir->next_free;
+    }
+    else {
+        dir = apr_pcalloc(w->p, sizeof(*dir));
+    }
+    
+    len = strlen(path) + 1;
+    if (dir->path_len < len) {
+        dir->path = apr_palloc(w->p, len);
+        dir->path_len = len;
+    }
+    memcpy(dir->path, path, len);
+    dir->wd = wd;
+    dir->group = group;
+    dir->is_group = is_group;
+    dir->next_free = NULL;
+    apr_hash_set(w->dirs, &dir->wd, sizeof(dir->wd), dir);
+    apr_hash_set(w->dirs_by_path, dir->path, APR_HASH_KEY_STRING, dir);
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, p, "store watch: watching %s", path);
+    return APR_SUCCESS;
+}
+
+static void watch_drop(fs_watch_t *w, watch_dir_t *dir)
+{
+    apr_hash_set(w->dirs, &dir->wd, sizeof(dir->wd), NULL);
+    if (apr_hash_get(w->dirs_by_path, dir->path, APR_HASH_KEY_STRING) == dir) {
+        apr_hash_set(w->dirs_by_path, dir->path, APR_HASH_KEY_STRING, NULL);
+    }
+    dir->next_free = w->free_dirs;
+    w->free_dirs = dir;
+}
+
+static void watch_event(fs_watch_t *w, const struct inotify_event *ev, apr_pool_t *p)
+{
+    watch_dir_t *dir, *moved;
+    apr_hash_index_t *hi;
+    const char *fpath;
+    apr_filetype_e ftype;
+    
+    if (ev->mask & IN_Q_OVERFLOW) {
+        /* events were lost, anything in the groups might have changed */
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "store watch: event queue overflow");
+        for (hi = apr_hash_first(p, w->dirs); hi; hi = apr_hash_next(hi)) {
+            apr_hash_this(hi, NULL, NULL, (void **)&dir);
+            if (dir->is_group) {
+                dispatch(w->s_fs, MD_S_FS_EV_CHANGED, dir->group, dir->path, APR_DIR, p);
+            }
+        }
+        return;
+    }
+    
+    if (NULL == (dir = apr_hash_get(w->dirs, &ev->wd, sizeof(ev->wd)))) {
+        return;
+    }
+    if (ev->mask & IN_IGNORED) {
+        /* directory is gone or no longer watched */
+        watch_drop(w, dir);
+        return;
+    }
+    if (!ev->len || APR_SUCCESS != md_util_path_merge(&fpath, p, dir->path, ev->name, NULL)) {
+        return;
+    }
+    
+    ftype = (ev->mask & IN_ISDIR)? APR_DIR : APR_REG;
+    if (dir->is_group && APR_DIR == ftype) {
+        /* keep track of MD directories, no matter who changed them */
+        if (ev->mask & (IN_CREATE|IN_MOVED_TO)) {
+            watch_add(w, dir->group, fpath, 0, p);
+        }
+        else if ((ev->mask & IN_MOVED_FROM)
+                 && (moved = apr_hash_get(w->dirs_by_path, fpath, APR_HASH_KEY_STRING))) {
+            /* the watch would move along with the directory */
+            inotify_rm_watch(w->fd, moved->wd);
+        }
+    }
+    
+    if (watch_is_own(w, dir->is_group? fpath : dir->path)) {
+        return;
+    }
+    md_log_perror(MD_LOG_MARK, MD_LOG_TRACE2, 0, p, "store watch: event %x on %s", 
+                  (unsigned int)ev->mask, fpath);
+    dispatch(w->s_fs, MD_S_FS_EV_CHANGED, dir->group, fpath, ftype, p);
+}
+
+static void * APR_THREAD_FUNC watch_run(apr_thread_t *thread, void *baton)
+{
+    fs_watch_t *w = baton;
+    union {
+        struct inotify_event ev;
+        char buf[MD_FS_WATCH_BUFLEN];
+    } u;
+    const struct inotify_event *ev;
+    struct pollfd pfds[2];
+    ssize_t len, i;
+    
+    (void)thread;
+    while (1) {
+        pfds[0].fd = w->fd;
+        pfds[0].events = POLLIN;
+        pfds[0].revents = 0;
+        pfds[1].fd = w->wake[0];
+        pfds[1].events = POLLIN;
+        pfds[1].revents = 0;
+        
+        if (poll(pfds, 2, -1) < 0) {
+            if (EINTR == errno) continue;
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, APR_FROM_OS_ERROR(errno), w->ptemp, 
+                          "store watch: poll");
+            break;
+        }
+        if (pfds[1].revents) {
+            /* we are asked to stop */
+            break;
+        }
+        
+        len = read(w->fd, u.buf, sizeof(u.buf));
+        if (len < 0) {
+            if (EINTR == errno || EAGAIN == errno) continue;
+            md_log_perror(MD_LOG_MARK, MD_LOG_ERR, APR_FROM_OS_ERROR(errno), w->ptemp, 
+                          "store watch: read");
+            break;
+        }
+        for (i = 0; i + (ssize_t)sizeof(struct inotify_event) <= len; 
+             i += (ssize_t)(sizeof(struct inotify_event) + ev->len)) {
+            ev = (const struct inotify_event *)(u.buf + i);
+            watch_event(w, ev, w->ptemp);
+        }
+        apr_pool_clear(w->ptemp);
+    }
+    return NULL;
+}
+
+static apr_status_t watch_cleanup(void *baton)
+{
+    fs_watch_t *w = baton;
+    apr_status_t rv;
+    
+    if (w->s_fs->watch == w) {
+        w->s_fs->watch = NULL;
+    }
+    if (w->wake[1] >= 0) {
+        close(w->wake[1]);
+    }
+    if (w->thread) {
+        apr_thread_join(&rv, w->thread);
+    }
+    if (w->wake[0] >= 0) {
+        close(w->wake[0]);
+    }
+    if (w->fd >= 0) {
+        close(w->fd);
+    }
+    return APR_SUCCESS;
+}
+
+typedef struct {
+    fs_watch_t *w;
+    md_store_group_t group;
+} watch_md_ctx;
+
+static apr_status_t watch_add_md(void *baton, apr_pool_t *p, apr_pool_t *ptemp, 
+                                 const char *dir, const char *name, apr_filetype_e ftype)
+{
+    watch_md_ctx *ctx = baton;
+    const char *path;
+    
+    (void)p;
+    if (APR_DIR == ftype && APR_SUCCESS == md_util_path_merge(&path, ptemp, dir, name, NULL)) {
+        /* failures were logged, the MD is then only seen on regular checks */
+        watch_add(ctx->w, ctx->group, path, 0, ptemp);
+    }
+    return APR_SUCCESS;
+}
+
+apr_status_t md_store_fs_watch_start(md_store_t *store, apr_pool_t *p)
+{
+    static const md_store_group_t groups[] = {
+        MD_SG_CHALLENGES, MD_SG_STAGING, MD_SG_DOMAINS,
+    };
+    md_store_fs_t *s_fs;
+    fs_watch_t *w;
+    watch_md_ctx ctx;
+    const char *gdir;
+    apr_status_t rv;
+    unsigned int i;
+    
+    if (!store || store->load != fs_load) {
+        return APR_ENOTIMPL;
+    }
+    s_fs = FS_STORE(store);
+    if (s_fs->watch) {
+        return APR_EEXIST;
+    }
+    
+    w = apr_pcalloc(p, sizeof(*w));
+    w->s_fs = s_fs;
+    w->p = p;
+    w->fd = w->wake[0] = w->wake[1] = -1;
+    w->dirs = apr_hash_make(p);
+    w->dirs_by_path = apr_hash_make(p);
+    /* run before sub pools are destroyed, the thread uses them */
+    apr_pool_pre_cleanup_register(p, w, watch_cleanup);
+    
+    if (APR_SUCCESS != (rv = apr_thread_mutex_create(&w->mutex, APR_THREAD_MUTEX_DEFAULT, p))
+        || APR_SUCCESS != (rv = apr_pool_create(&w->ptemp, p))
+        || APR_SUCCESS != (rv = apr_pool_create(&w->own_p[0], p))
+        || APR_SUCCESS != (rv = apr_pool_create(&w->own_p[1], p))) {
+        goto out;
+    }
+    w->own[0] = apr_hash_make(w->own_p[0]);
+    w->own[1] = apr_hash_make(w->own_p[1]);
+    w->own_since = apr_time_now();
+    
+    if ((w->fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC)) < 0 || pipe(w->wake) < 0) {
+        rv = APR_FROM_OS_ERROR(errno);
+        goto out;
+    }
+    
+    ctx.w = w;
+    for (i = 0; i < sizeof(groups)/sizeof(groups[0]); ++i) {
+        ctx.group = groups[i];
+        if (APR_SUCCESS != (rv = mk_group_dir(&gdir, s_fs, groups[i], NULL, p))
+            || APR_SUCCESS != (rv = watch_add(w, groups[i], gdir, 1, p))
+            || APR_SUCCESS != (rv = md_util_files_do(watch_add_md, &ctx, p, gdir, "*", NULL))) {
+            goto out;
+        }
+    }
+    
+    s_fs->watch = w;
+    if (APR_SUCCESS != (rv = apr_thread_create(&w->thread, NULL, watch_run, w, p))) {
+        s_fs->watch = NULL;
+        w->thread = NULL;
+    }
+out:
+    if (APR_SUCCESS != rv) {
+        md_log_perror(MD_LOG_MARK, MD_LOG_ERR, rv, p, "store watch: start on %s", s_fs->base);
+    }
+    else {
+        md_log_perror(MD_LOG_MARK, MD_LOG_DEBUG, 0, p, "store watch: started on %s, %d dirs", 
+                      s_fs->base, (int)apr_hash_count(w->dirs));
+    }
+    return rv;
+}
+
+#else /* ifdef MD_FS_WATCH */
+
+static void watch_own(md_store_fs_t *s_fs, const char *dir)
+{
+    (void)s_fs;
+    (void)dir;
+}
+
+apr_status_t md_store_fs_watch_start(md_store_t *store, apr_pool_t *p)
+{
+    (void)store;
+    (void)p;
+    return APR_ENOTIMPL;
+}
+
+#endif /* ifdef MD_FS_WATCH (else part) */
@@ -49,9 +49,24 @@ apr_status_t md_store_fs_group_perms_set(struct md_store_t *store,
                                          apr_fileperms_t file_perms,
                                          apr_fileperms_t dir_perms);
 
+/**
+ * The format JSON values are written in, as recorded in the store. Files are
+ * read in any format, so a store may contain a mix of them. For stores that are
+ * no file system store, this is MD_JSON_FMT_INDENT.
+ */
+md_json_fmt_t md_store_fs_json_fmt_get(struct md_store_t *store);
+
+/**
+ * Rewrite all JSON files of the store in the given format and record it
+ * as the one to use from now on. Returns APR_ENOTIMPL when store is not a
+ * file system store.
+ */
+apr_status_t md_store_fs_convert(struct md_store_t *store, apr_pool_t *p, md_json_fmt_t fmt);
+
 typedef enum {
     MD_S_FS_EV_CREATED,
     MD_S_FS_EV_MOVED,
+    MD_S_FS_EV_CHANGED,     /* changed by someone else, as seen by the store watch */
 } md_store_fs_ev_t; 
 
 typedef apr_status_t md_store_fs_cb(void *baton, struct md_store_t *store,
@@ -61,4 +76,16 @@ typedef apr_status_t md_store_fs_cb(void *baton, struct md_store_t *store,
                                     
 apr_status_t md_store_fs_set_event_cb(struct md_store_t *store, md_store_fs_cb *cb, void *baton);
 
+/**
+ * Watch the directories of the challenges, staging and domains groups for changes
+ * made by other processes. These are passed, from a thread of the watch, to the
+ * event callback as MD_S_FS_EV_CHANGED, new MD directories included. Changes made
+ * through this store are not reported again. CREATED and MOVED events therefore 
+ * always come from this store itself.
+ *
+ * The watch ends when pool p is destroyed. Returns APR_ENOTIMPL when the platform
+ * has no support for it, or when store is not a file system store.
+ */
+apr_status_t md_store_fs_watch_start(struct md_store_t *store, apr_pool_t *p);
+
 #endif /* mod_md_md_store_fs_h */
@@ -22,6 +22,7 @@
 #include <apr_fnmatch.h>
 #include <apr_tables.h>
 #include <apr_uri.h>
+#include <apr_version.h>
 
 #include "md_log.h"
 #include "md_util.h"
@@ -217,6 +218,25 @@ apr_status_t md_util_is_file(const char *path, apr_pool_t *pool)
     return rv;
 }
 
+apr_status_t md_util_fsync(const char *path, apr_pool_t *p)
+{
+#if APR_VERSION_AT_LEAST(1,6,0) && !defined(WIN32)
+    apr_file_t *f;
+    apr_status_t rv;
+    
+    /* opening directories read-only works on unix */
+    if (APR_SUCCESS == (rv = apr_file_open(&f, path, APR_FOPEN_READ, APR_OS_DEFAULT, p))) {
+        rv = apr_file_sync(f);
+        apr_file_close(f);
+    }
+    return rv;
+#else
+    (void)path;
+    (void)p;
+    return APR_SUCCESS;
+#endif
+}
+
 apr_status_t md_util_path_merge(const char **ppath, apr_pool_t *p, ...)
 {
     const char *segment, *path;
@@ -861,26 +881,16 @@ static const unsigned char BASE64URL_CHARS[] = {
 };
 
 #define BASE64URL_CHAR(x)    BASE64URL_CHARS[ (unsigned int)(x) & 0x3fu ]
-   
-apr_size_t md_util_base64url_decode(const char **decoded, const char *encoded, 
-                                    apr_pool_t *pool)
+
+/* Decode len chars, all of which are in the alphabet. */
+static apr_size_t b64url_dec_scalar(unsigned char *d, const unsigned char *e, apr_size_t len)
 {
-    const unsigned char *e = (const unsigned char *)encoded;
-    const unsigned char *p = e;
-    unsigned char *d;
+    unsigned char *start = d;
     unsigned int n;
-    long len, mlen, remain, i;
+    apr_size_t mlen, i;
     
-    while (*p && BASE64URL_UINT6[ *p ] != N6) {
-        ++p;
-    }
-    len = (int)(p - e);
     mlen = (len/4)*4;
-    *decoded = apr_pcalloc(pool, (apr_size_t)len + 1);
-    
-    i = 0;
-    d = (unsigned char*)*decoded;
-    for (; i < mlen; i += 4) {
+    for (i = 0; i < mlen; i += 4) {
         n = ((BASE64URL_UINT6[ e[i+0] ] << 18) +
              (BASE64URL_UINT6[ e[i+1] ] << 12) +
              (BASE64URL_UINT6[ e[i+2] ] << 6) +
@@ -889,13 +899,11 @@ apr_size_t md_util_base64url_decode(const char **decoded, const char *encoded,
         *d++ = (unsigned char)(n >> 8 & 0xffu);
         *d++ = (unsigned char)(n & 0xffu);
     }
-    remain = len - mlen;
-    switch (remain) {
+    switch (len - mlen) {
         case 2:
             n = ((BASE64URL_UINT6[ e[mlen+0] ] << 18) +
                  (BASE64URL_UINT6[ e[mlen+1] ] << 12));
             *d++ = (unsigned char)(n >> 16);
-            remain = 1;
             break;
         case 3:
             n = ((BASE64URL_UINT6[ e[mlen+0] ] << 18) +
@@ -903,23 +911,19 @@ apr_size_t md_util_base64url_decode(const char **decoded, const char *encoded,
                  (BASE64URL_UINT6[ e[mlen+2] ] << 6));
             *d++ = (unsigned char)(n >> 16);
             *d++ = (unsigned char)(n >> 8 & 0xffu);
-            remain = 2;
             break;
         default: /* do nothing */
             break;
     }
-    return (apr_size_t)(mlen/4*3 + remain);
+    return (apr_size_t)(d - start);
 }
 
-const char *md_util_base64url_encode(const char *data, apr_size_t dlen, apr_pool_t *pool)
+static apr_size_t b64url_enc_scalar(unsigned char *p, const unsigned char *udata, apr_size_t len)
 {
-    int i, len = (int)dlen;
-    apr_size_t slen = ((dlen+2)/3)*4 + 1; /* 0 terminated */
-    const unsigned char *udata = (const unsigned char*)data;
-    unsigned char *enc, *p = apr_pcalloc(pool, slen);
+    unsigned char *enc = p;
+    apr_size_t i;
     
-    enc = p;
-    for (i = 0; i < len-2; i+= 3) {
+    for (i = 0; i + 2 < len; i += 3) {
         *p++ = BASE64URL_CHAR( (udata[i]   >> 2) );
         *p++ = BASE64URL_CHAR( (udata[i]   << 4) + (udata[i+1] >> 4) );
         *p++ = BASE64URL_CHAR( (udata[i+1] << 2) + (udata[i+2] >> 6) );
@@ -936,8 +940,295 @@ const char *md_util_base64url_encode(const char *data, apr_size_t dlen, apr_pool
             *p++ = BASE64URL_CHAR( (udata[i+1] << 2) );
         }
     }
-    *p++ = '\0';
-    return (char *)enc;
+    return (apr_size_t)(p - enc);
+}
+
+/* A kernel converts as many whole blocks as it can, starting at src, and leaves
+ * the rest to the scalar code. It returns the number of bytes written to dest
+ * and sets *pdone to the number of bytes consumed from src. A decode kernel 
+ * stops at the first block holding a char outside the alphabet. */
+typedef apr_size_t b64url_kernel(unsigned char *dest, const unsigned char *src, 
+                                 apr_size_t len, apr_size_t *pdone);
+
+typedef struct {
+    const char *name;
+    b64url_kernel *enc;
+    b64url_kernel *dec;
+} b64url_impl_t;
+
+#if (defined(__x86_64__) || defined(__i386__)) \
+    && (defined(__clang__) || (defined(__GNUC__) && __GNUC__ >= 5))
+#define MD_B64_SIMD     1
+#endif
+
+#ifdef MD_B64_SIMD
+
+#include <immintrin.h>
+
+/* The vector kernels follow W. Mula and D. Lemire, "Faster Base64 Encoding and 
+ * Decoding using AVX2 Instructions", with the url alphabet ('-' and '_'). 
+ * The compiler emits the instructions only for the functions marked with their 
+ * target, which are called only after the CPU was found to support them. */
+
+__attribute__((target("ssse3")))
+static __m128i b64url_enc_ssse3_block(__m128i in)
+{
+    __m128i t0, t1, t2, t3, idx, off;
+    
+    /* spread 12 bytes into 16 lanes of 4x6 bits each */
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+    t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+    idx = _mm_or_si128(t1, t3);
+    
+    /* 0..51 -> 0, 52..63 -> 1..12, and 13 for the upper case 0..25 */
+    off = _mm_subs_epu8(idx, _mm_set1_epi8(51));
+    off = _mm_or_si128(off, _mm_and_si128(_mm_cmpgt_epi8(_mm_set1_epi8(26), idx), 
+                                          _mm_set1_epi8(13)));
+    off = _mm_shuffle_epi8(_mm_setr_epi8(71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, 
+                                         -17, 32, 65, 0, 0), off);
+    return _mm_add_epi8(idx, off);
+}
+
+__attribute__((target("ssse3")))
+static apr_size_t b64url_enc_ssse3(unsigned char *dest, const unsigned char *src, 
+                                   apr_size_t len, apr_size_t *pdone)
+{
+    apr_size_t i = 0, o = 0;
+    
+    /* reads 16 bytes, uses 12 */
+    for (; i + 16 <= len; i += 12, o += 16) {
+        _mm_storeu_si128((__m128i *)(dest + o), 
+                         b64url_enc_ssse3_block(_mm_loadu_si128((const __m128i *)(src + i))));
+    }
+    *pdone = i;
+    return o;
+}
+
+/* Map chars to their 6 bit values, set *pvalid to a mask of the valid chars. */
+__attribute__((target("ssse3")))
+static __m128i b64url_dec_ssse3_map(__m128i c, int *pvalid)
+{
+    __m128i upper, lower, digit, dash, under, shift;
+    
+    /* bytes >= 0x80 are negative and fall outside every range */
+    upper = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('A' - 1)), 
+                          _mm_cmplt_epi8(c, _mm_set1_epi8('Z' + 1)));
+    lower = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('a' - 1)), 
+                          _mm_cmplt_epi8(c, _mm_set1_epi8('z' + 1)));
+    digit = _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8('0' - 1)), 
+                          _mm_cmplt_epi8(c, _mm_set1_epi8('9' + 1)));
+    dash = _mm_cmpeq_epi8(c, _mm_set1_epi8('-'));
+    under = _mm_cmpeq_epi8(c, _mm_set1_epi8('_'));
+    
+    *pvalid = _mm_movemask_epi8(_mm_or_si128(_mm_or_si128(upper, lower), 
+                                             _mm_or_si128(digit, _mm_or_si128(dash, under))));
+    shift = _mm_or_si128(_mm_and_si128(upper, _mm_set1_epi8(-65)), 
+                         _mm_and_si128(lower, _mm_set1_epi8(-71)));
+    shift = _mm_or_si128(shift, _mm_and_si128(digit, _mm_set1_epi8(4)));
+    shift = _mm_or_si128(shift, _mm_and_si128(dash, _mm_set1_epi8(17)));
+    shift = _mm_or_si128(shift, _mm_and_si128(under, _mm_set1_epi8(-32)));
+    return _mm_add_epi8(c, shift);
+}
+
+__attribute__((target("ssse3")))
+static apr_size_t b64url_dec_ssse3(unsigned char *dest, const unsigned char *src, 
+                                   apr_size_t len, apr_size_t *pdone)
+{
+    __m128i v;
+    apr_size_t i = 0, o = 0;
+    int valid, w;
+    
+    for (; i + 16 <= len; i += 16, o += 12) {
+        v = b64url_dec_ssse3_map(_mm_loadu_si128((const __m128i *)(src + i)), &valid);
+        if (valid != 0xffff) {
+            break;
+        }
+        /* pack 4x6 bits into 3 bytes per 32 bit lane, then squeeze out the gaps */
+        v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+        v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+        v = _mm_shuffle_epi8(v, _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, 
+                                              -1, -1, -1, -1));
+        w = _mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+        _mm_storel_epi64((__m128i *)(dest + o), v);
+        memcpy(dest + o + 8, &w, 4);
+    }
+    *pdone = i;
+    return o;
+}
+
+__attribute__((target("avx2")))
+static apr_size_t b64url_enc_avx2(unsigned char *dest, const unsigned char *src, 
+                                  apr_size_t len, apr_size_t *pdone)
+{
+    __m256i in, t0, t1, t2, t3, idx, off;
+    apr_size_t i = 0, o = 0;
+    
+    /* reads 28 bytes, uses 24: 12 per 128 bit lane */
+    for (; i + 28 <= len; i += 24, o += 32) {
+        in = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + i))),
+            _mm_loadu_si128((const __m128i *)(src + i + 12)), 1);
+        in = _mm256_shuffle_epi8(in, _mm256_set_epi8(
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1,
+            10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1));
+        t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        idx = _mm256_or_si256(t1, t3);
+        
+        off = _mm256_subs_epu8(idx, _mm256_set1_epi8(51));
+        off = _mm256_or_si256(off, _mm256_and_si256(_mm256_cmpgt_epi8(_mm256_set1_epi8(26), idx), 
+                                                    _mm256_set1_epi8(13)));
+        off = _mm256_shuffle_epi8(_mm256_setr_epi8(
+            71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 65, 0, 0,
+            71, -4, -4, -4, -4, -4, -4, -4, -4, -4, -4, -17, 32, 65, 0, 0), off);
+        _mm256_storeu_si256((__m256i *)(dest + o), _mm256_add_epi8(idx, off));
+    }
+    *pdone = i;
+    return o;
+}
+
+__attribute__((target("avx2")))
+static apr_size_t b64url_dec_avx2(unsigned char *dest, const unsigned char *src, 
+                                  apr_size_t len, apr_size_t *pdone)
+{
+    __m256i c, v, upper, lower, digit, dash, under, shift;
+    apr_size_t i = 0, o = 0;
+    
+    for (; i + 32 <= len; i += 32, o += 24) {
+        c = _mm256_loadu_si256((const __m256i *)(src + i));
+        upper = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('A' - 1)), 
+                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('Z' + 1), c));
+        lower = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('a' - 1)), 
+                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('z' + 1), c));
+        digit = _mm256_and_si256(_mm256_cmpgt_epi8(c, _mm256_set1_epi8('0' - 1)), 
+                                 _mm256_cmpgt_epi8(_mm256_set1_epi8('9' + 1), c));
+        dash = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('-'));
+        under = _mm256_cmpeq_epi8(c, _mm256_set1_epi8('_'));
+        if (_mm256_movemask_epi8(_mm256_or_si256(_mm256_or_si256(upper, lower), 
+                                 _mm256_or_si256(digit, _mm256_or_si256(dash, under)))) != -1) {
+            break;
+        }
+        shift = _mm256_or_si256(_mm256_and_si256(upper, _mm256_set1_epi8(-65)), 
+                                _mm256_and_si256(lower, _mm256_set1_epi8(-71)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(digit, _mm256_set1_epi8(4)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(dash, _mm256_set1_epi8(17)));
+        shift = _mm256_or_si256(shift, _mm256_and_si256(under, _mm256_set1_epi8(-32)));
+        v = _mm256_add_epi8(c, shift);
+        
+        v = _mm256_maddubs_epi16(v, _mm256_set1_epi32(0x01400140));
+        v = _mm256_madd_epi16(v, _mm256_set1_epi32(0x00011000));
+        v = _mm256_shuffle_epi8(v, _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1,
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1));
+        /* 12 bytes in each lane, move them together */
+        v = _mm256_permutevar8x32_epi32(v, _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7));
+        _mm_storeu_si128((__m128i *)(dest + o), _mm256_castsi256_si128(v));
+        _mm_storel_epi64((__m128i *)(dest + o + 16), _mm256_extracti128_si256(v, 1));
+    }
+    *pdone = i;
+    return o;
+}
+
+#endif /* MD_B64_SIMD */
+
+static apr_size_t b64url_none(unsigned char *dest, const unsigned char *src, 
+                              apr_size_t len, apr_size_t *pdone)
+{
+    (void)dest;
+    (void)src;
+    (void)len;
+    *pdone = 0;
+    return 0;
+}
+
+static const b64url_impl_t B64URL_IMPLS[] = {
+    { "scalar", b64url_none, b64url_none },
+#ifdef MD_B64_SIMD
+    { "ssse3", b64url_enc_ssse3, b64url_dec_ssse3 },
+    { "avx2", b64url_enc_avx2, b64url_dec_avx2 },
+#endif
+};
+
+static const b64url_impl_t *b64url_impl;
+
+static const b64url_impl_t *b64url_best(void)
+{
+#ifdef MD_B64_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return &B64URL_IMPLS[2];
+    }
+    if (__builtin_cpu_supports("ssse3")) {
+        return &B64URL_IMPLS[1];
+    }
+#endif
+    return &B64URL_IMPLS[0];
+}
+
+static const b64url_impl_t *b64url_get(void)
+{
+    /* the race on first use is harmless, everyone arrives at the same choice */
+    if (!b64url_impl) {
+        b64url_impl = b64url_best();
+    }
+    return b64url_impl;
+}
+
+const char *md_util_base64url_impl(int simd)
+{
+    b64url_impl = simd? b64url_best() : &B64URL_IMPLS[0];
+    return b64url_impl->name;
+}
+
+apr_size_t md_util_base64url_decode_to(char *dest, const char *encoded, apr_size_t elen)
+{
+    const unsigned char *e = (const unsigned char *)encoded;
+    unsigned char *d = (unsigned char *)dest;
+    apr_size_t done, len, i;
+    
+    len = b64url_get()->dec(d, e, elen, &done);
+    /* the rest, up to the first char not in the alphabet */
+    for (i = done; i < elen && BASE64URL_UINT6[ e[i] ] != N6; ++i) {
+        /* count */
+    }
+    return len + b64url_dec_scalar(d + len, e + done, i - done);
+}
+
+apr_size_t md_util_base64url_encode_to(char *dest, const char *data, apr_size_t dlen)
+{
+    const unsigned char *udata = (const unsigned char *)data;
+    unsigned char *p = (unsigned char *)dest;
+    apr_size_t done, len;
+    
+    len = b64url_get()->enc(p, udata, dlen, &done);
+    len += b64url_enc_scalar(p + len, udata + done, dlen - done);
+    p[len] = '\0';
+    return len;
+}
+
+apr_size_t md_util_base64url_decode(const char **decoded, const char *encoded, 
+                                    apr_pool_t *pool)
+{
+    apr_size_t elen = strlen(encoded), len;
+    char *d = apr_palloc(pool, MD_BASE64URL_DEC_LEN(elen) + 1);
+    
+    len = md_util_base64url_decode_to(d, encoded, elen);
+    d[len] = '\0';
+    *decoded = d;
+    return len;
+}
+
+const char *md_util_base64url_encode(const char *data, apr_size_t dlen, apr_pool_t *pool)
+{
+    char *enc = apr_palloc(pool, MD_BASE64URL_ENC_LEN(dlen) + 1); /* 0 terminated */
+    
+    md_util_base64url_encode_to(enc, data, dlen);
+    return enc;
 }
 
 /*******************************************************************************
@@ -78,6 +78,12 @@ apr_status_t md_util_path_merge(const char **ppath, apr_pool_t *p, ...);
 apr_status_t md_util_is_dir(const char *path, apr_pool_t *pool);
 apr_status_t md_util_is_file(const char *path, apr_pool_t *pool);
 
+/**
+ * Flush a file or directory to stable storage. Succeeds without doing anything
+ * where this is not supported.
+ */
+apr_status_t md_util_fsync(const char *path, apr_pool_t *p);
+
 typedef apr_status_t md_util_file_cb(void *baton, struct apr_file_t *f, apr_pool_t *p);
 
 apr_status_t md_util_freplace(const char *fpath, apr_fileperms_t perms, apr_pool_t *p, 
@@ -117,6 +123,29 @@ const char *md_util_base64url_encode(const char *data,
 apr_size_t md_util_base64url_decode(const char **decoded, const char *encoded, 
                                     apr_pool_t *pool);
 
+/* Buffer sizes needed for n input bytes, not counting the terminating 0 of encodings. */
+#define MD_BASE64URL_ENC_LEN(n)     (((n) + 2) / 3 * 4)
+#define MD_BASE64URL_DEC_LEN(n)     (((n) + 3) / 4 * 3)
+
+/**
+ * Encode len bytes of data into dest, which needs MD_BASE64URL_ENC_LEN(len) + 1
+ * bytes. The encoding is 0 terminated, its length is returned.
+ */
+apr_size_t md_util_base64url_encode_to(char *dest, const char *data, apr_size_t len);
+
+/**
+ * Decode up to elen chars of encoded into dest, which needs MD_BASE64URL_DEC_LEN(elen)
+ * bytes. Decoding stops at the first char not in the alphabet. Returns the number
+ * of decoded bytes.
+ */
+apr_size_t md_util_base64url_decode_to(char *dest, const char *encoded, apr_size_t elen);
+
+/**
+ * Select the SIMD implementation best for the CPU, or the scalar one when simd is 0.
+ * The best one is used by default. Returns the name of the implementation selected.
+ */
+const char *md_util_base64url_impl(int simd);
+
 /**************************************************************************************************/
 /* http/url related */
 const char *md_util_schemify(apr_pool_t *p, const char *s, const char *def_scheme);
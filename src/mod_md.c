@@ -14,8 +14,14 @@
  */
 
 #include <assert.h>
+#include <apr_atomic.h>
+#include <apr_hash.h>
+#include <apr_lib.h>
 #include <apr_optional.h>
+#include <apr_shm.h>
 #include <apr_strings.h>
+#include <apr_thread_mutex.h>
+#include <apr_thread_proc.h>
 
 #include <ap_release.h>
 #ifndef AP_ENABLE_EXCEPTION_HOOK
@@ -36,6 +42,7 @@
 #include "md_http.h"
 #include "md_json.h"
 #include "md_store.h"
+#include "md_store_cache.h"
 #include "md_store_fs.h"
 #include "md_log.h"
 #include "md_reg.h"
@@ -110,13 +117,27 @@ static void md_merge_srv(md_t *md, md_srv_conf_t *base_sc, apr_pool_t *p)
     }
 }
 
-static apr_status_t check_coverage(md_t *md, const char *domain, server_rec *s, apr_pool_t *p)
+/* Domain names of all MDs, lowercased, mapping to the MD that contains them. Used to
+ * assign MDs to servers in a single pass over all server names and aliases. */
+static const char *domain_key(const char *domain, apr_pool_t *p)
 {
-    if (md_contains(md, domain, 0)) {
+    return md_util_str_tolower(apr_pstrdup(p, domain));
+}
+
+static md_t *domain_lookup(apr_hash_t *domains, const char *domain, apr_pool_t *ptemp)
+{
+    return apr_hash_get(domains, domain_key(domain, ptemp), APR_HASH_KEY_STRING);
+}
+
+static apr_status_t check_coverage(md_t *md, apr_hash_t *domains, const char *domain, 
+                                   server_rec *s, apr_pool_t *p, apr_pool_t *ptemp)
+{
+    if (domain_lookup(domains, domain, ptemp) == md) {
         return APR_SUCCESS;
     }
     else if (md->transitive) {
         APR_ARRAY_PUSH(md->domains, const char*) = apr_pstrdup(p, domain);
+        apr_hash_set(domains, domain_key(domain, ptemp), APR_HASH_KEY_STRING, md);
         return APR_SUCCESS;
     }
     else {
@@ -129,16 +150,18 @@ static apr_status_t check_coverage(md_t *md, const char *domain, server_rec *s,
     }
 }
 
-static apr_status_t md_covers_server(md_t *md, server_rec *s, apr_pool_t *p)
+static apr_status_t md_covers_server(md_t *md, apr_hash_t *domains, server_rec *s, 
+                                     apr_pool_t *p, apr_pool_t *ptemp)
 {
     apr_status_t rv;
     const char *name;
     int i;
     
-    if (APR_SUCCESS == (rv = check_coverage(md, s->server_hostname, s, p)) && s->names) {
+    if (APR_SUCCESS == (rv = check_coverage(md, domains, s->server_hostname, s, p, ptemp)) 
+        && s->names) {
         for (i = 0; i < s->names->nelts; ++i) {
             name = APR_ARRAY_IDX(s->names, i, const char*);
-            if (APR_SUCCESS != (rv = check_coverage(md, name, s, p))) {
+            if (APR_SUCCESS != (rv = check_coverage(md, domains, name, s, p, ptemp))) {
                 break;
             }
         }
@@ -163,136 +186,198 @@ static int matches_port_somewhere(server_rec *s, int port)
     return 0;
 }
 
-static apr_status_t assign_to_servers(md_t *md, server_rec *base_server, 
-                                     apr_pool_t *p, apr_pool_t *ptemp)
+/* Record that the server matches md m, which is a conflict if it already matches another. */
+static apr_status_t server_md_match(md_t **pmd, md_t *m, server_rec *s, server_rec *base_server)
 {
-    server_rec *s, *s_https;
-    request_rec r;
+    if (m && *pmd && m != *pmd) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO(10042)
+                     "conflict: MD %s matches server %s, but MD %s also matches.",
+                     m->name, s->server_hostname, (*pmd)->name);
+        return APR_EINVAL;
+    }
+    if (m) {
+        *pmd = m;
+    }
+    return APR_SUCCESS;
+}
+
+/* Find the MD matching the server the same way ap_matches_request_vhost() would match
+ * one of its domains: against the virtual host addresses, the ServerName and the 
+ * ServerAliases. Wildcard aliases need to be checked against all MD domains. All
+ * of them are checked, since the server may not match more than one MD. */
+static apr_status_t find_server_md(md_t **pmd, server_rec *s, apr_hash_t *domains, 
+                                   apr_array_header_t *mds, server_rec *base_server, 
+                                   apr_pool_t *ptemp)
+{
+    server_addr_rec *sar;
+    md_t *md = NULL, *m;
+    const char *name;
+    apr_status_t rv;
+    int i, j, k;
+    
+    *pmd = NULL;
+    for (sar = s->addrs; sar; sar = sar->next) {
+        if ((sar->host_port == 0 || sar->host_port == s->port) && sar->virthost) {
+            m = domain_lookup(domains, sar->virthost, ptemp);
+            if (APR_SUCCESS != (rv = server_md_match(&md, m, s, base_server))) {
+                return rv;
+            }
+        }
+    }
+    if (s->server_hostname) {
+        m = domain_lookup(domains, s->server_hostname, ptemp);
+        if (APR_SUCCESS != (rv = server_md_match(&md, m, s, base_server))) {
+            return rv;
+        }
+    }
+    for (i = 0; s->names && i < s->names->nelts; ++i) {
+        name = APR_ARRAY_IDX(s->names, i, const char*);
+        m = domain_lookup(domains, name, ptemp);
+        if (APR_SUCCESS != (rv = server_md_match(&md, m, s, base_server))) {
+            return rv;
+        }
+    }
+    for (i = 0; s->wild_names && i < s->wild_names->nelts; ++i) {
+        name = APR_ARRAY_IDX(s->wild_names, i, const char*);
+        for (j = 0; j < mds->nelts; ++j) {
+            m = APR_ARRAY_IDX(mds, j, md_t*);
+            for (k = 0; k < m->domains->nelts; ++k) {
+                if (!ap_strcasecmp_match(APR_ARRAY_IDX(m->domains, k, const char*), name)) {
+                    if (APR_SUCCESS != (rv = server_md_match(&md, m, s, base_server))) {
+                        return rv;
+                    }
+                    break;
+                }
+            }
+        }
+    }
+    *pmd = md;
+    return APR_SUCCESS;
+}
+
+static apr_status_t assign_to_servers(md_mod_conf_t *mc, apr_hash_t *domains, 
+                                      apr_hash_t *md_servers, server_rec *base_server, 
+                                      apr_pool_t *p, apr_pool_t *ptemp)
+{
+    server_rec *s;
     md_srv_conf_t *sc;
-    md_mod_conf_t *mc;
-    apr_status_t rv = APR_SUCCESS;
-    int i;
-    const char *domain;
     apr_array_header_t *servers;
+    apr_status_t rv;
+    md_t *md;
     
-    sc = md_config_get(base_server);
-    mc = sc->mc;
-
-    /* Assign the MD to all server_rec configs that it matches. If there already
-     * is an assigned MD not equal this one, the configuration is in error.
+    /* Assign each server_rec config the MD that it matches. A server matching
+     * more than one MD is a configuration error.
      */
-    memset(&r, 0, sizeof(r));
-    servers = apr_array_make(ptemp, 5, sizeof(server_rec*));
-    
     for (s = base_server; s; s = s->next) {
-        r.server = s;
+        if (APR_SUCCESS != (rv = find_server_md(&md, s, domains, mc->mds, base_server, ptemp))) {
+            return rv;
+        }
+        if (!md) {
+            continue;
+        }
         
-        for (i = 0; i < md->domains->nelts; ++i) {
-            domain = APR_ARRAY_IDX(md->domains, i, const char*);
-            
-            if (ap_matches_request_vhost(&r, domain, s->port)) {
-                /* Create a unique md_srv_conf_t record for this server, if there is none yet */
-                sc = md_config_get_unique(s, p);
-                
-                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10041)
-                             "Server %s:%d matches md %s (config %s)", 
-                             s->server_hostname, s->port, md->name, sc->name);
-                
-                if (sc->assigned == md) {
-                    /* already matched via another domain name */
-                    goto next_server;
-                }
-                else if (sc->assigned) {
-                    ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO(10042)
-                                 "conflict: MD %s matches server %s, but MD %s also matches.",
-                                 md->name, s->server_hostname, sc->assigned->name);
-                    return APR_EINVAL;
-                }
-                
-                /* If server has name or an alias not covered,
-                 * a generated certificate will not match. 
-                 */
-                if (APR_SUCCESS != (rv = md_covers_server(md, s, ptemp))) {
-                    return rv;
-                }
+        /* Create a unique md_srv_conf_t record for this server, if there is none yet */
+        sc = md_config_get_unique(s, p);
+        
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10041)
+                     "Server %s:%d matches md %s (config %s)", 
+                     s->server_hostname, s->port, md->name, sc->name);
+        
+        if (sc->assigned && sc->assigned != md) {
+            ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO(10042)
+                         "conflict: MD %s matches server %s, but MD %s also matches.",
+                         md->name, s->server_hostname, sc->assigned->name);
+            return APR_EINVAL;
+        }
+        
+        /* If server has name or an alias not covered,
+         * a generated certificate will not match. 
+         */
+        if (APR_SUCCESS != (rv = md_covers_server(md, domains, s, p, ptemp))) {
+            return rv;
+        }
 
-                sc->assigned = md;
-                APR_ARRAY_PUSH(servers, server_rec*) = s;
-                
-                ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10043)
-                             "Managed Domain %s applies to vhost %s:%d", md->name,
-                             s->server_hostname, s->port);
-                
-                goto next_server;
-            }
+        sc->assigned = md;
+        servers = apr_hash_get(md_servers, md->name, APR_HASH_KEY_STRING);
+        if (!servers) {
+            servers = apr_array_make(ptemp, 5, sizeof(server_rec*));
+            apr_hash_set(md_servers, md->name, APR_HASH_KEY_STRING, servers);
         }
-    next_server:
-        continue;
+        APR_ARRAY_PUSH(servers, server_rec*) = s;
+        
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10043)
+                     "Managed Domain %s applies to vhost %s:%d", md->name,
+                     s->server_hostname, s->port);
     }
+    return APR_SUCCESS;
+}
 
-    if (APR_SUCCESS == rv) {
-        if (apr_is_empty_array(servers)) {
-            if (md->drive_mode != MD_DRIVE_ALWAYS) {
-                /* Not an error, but looks suspicious */
-                ap_log_error(APLOG_MARK, APLOG_WARNING, 0, base_server, APLOGNO(10045)
-                             "No VirtualHost matches Managed Domain %s", md->name);
-                APR_ARRAY_PUSH(mc->unused_names, const char*)  = md->name;
+static apr_status_t complete_md(md_t *md, md_mod_conf_t *mc, apr_array_header_t *servers,
+                                server_rec *base_server, apr_pool_t *p)
+{
+    server_rec *s, *s_https;
+    int i;
+    
+    if (!servers || apr_is_empty_array(servers)) {
+        if (md->drive_mode != MD_DRIVE_ALWAYS) {
+            /* Not an error, but looks suspicious */
+            ap_log_error(APLOG_MARK, APLOG_WARNING, 0, base_server, APLOGNO(10045)
+                         "No VirtualHost matches Managed Domain %s", md->name);
+            APR_ARRAY_PUSH(mc->unused_names, const char*)  = md->name;
+        }
+    }
+    else {
+        const char *uri;
+        
+        /* Found matching server_rec's. Collect all 'ServerAdmin's into MD's contact list */
+        apr_array_clear(md->contacts);
+        for (i = 0; i < servers->nelts; ++i) {
+            s = APR_ARRAY_IDX(servers, i, server_rec*);
+            if (s->server_admin && strcmp(DEFAULT_ADMIN, s->server_admin)) {
+                uri = md_util_schemify(p, s->server_admin, "mailto");
+                if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
+                    APR_ARRAY_PUSH(md->contacts, const char *) = uri; 
+                    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10044)
+                                 "%s: added contact %s", md->name, uri);
+                }
             }
         }
-        else {
-            const char *uri;
+        
+        if (md->require_https > MD_REQUIRE_OFF) {
+            /* We require https for this MD, but do we have port 443 (or a mapped one)
+             * available? */
+            if (mc->local_443 <= 0) {
+                ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO()
+                             "MDPortMap says there is no port for https (443), "
+                             "but MD %s is configured to require https. This "
+                             "only works when a 443 port is available.", md->name);
+                return APR_EINVAL;
+                
+            }
             
-            /* Found matching server_rec's. Collect all 'ServerAdmin's into MD's contact list */
-            apr_array_clear(md->contacts);
+            /* Ok, we know which local port represents 443, do we have a server_rec
+             * for MD that has addresses with port 443? */
+            s_https = NULL;
             for (i = 0; i < servers->nelts; ++i) {
                 s = APR_ARRAY_IDX(servers, i, server_rec*);
-                if (s->server_admin && strcmp(DEFAULT_ADMIN, s->server_admin)) {
-                    uri = md_util_schemify(p, s->server_admin, "mailto");
-                    if (md_array_str_index(md->contacts, uri, 0, 0) < 0) {
-                        APR_ARRAY_PUSH(md->contacts, const char *) = uri; 
-                        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10044)
-                                     "%s: added contact %s", md->name, uri);
-                    }
+                if (matches_port_somewhere(s, mc->local_443)) {
+                    s_https = s;
+                    break;
                 }
             }
             
-            if (md->require_https > MD_REQUIRE_OFF) {
-                /* We require https for this MD, but do we have port 443 (or a mapped one)
-                 * available? */
-                if (mc->local_443 <= 0) {
-                    ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO()
-                                 "MDPortMap says there is no port for https (443), "
-                                 "but MD %s is configured to require https. This "
-                                 "only works when a 443 port is available.", md->name);
-                    return APR_EINVAL;
-                    
-                }
-                
-                /* Ok, we know which local port represents 443, do we have a server_rec
-                 * for MD that has addresses with port 443? */
-                s_https = NULL;
-                for (i = 0; i < servers->nelts; ++i) {
-                    s = APR_ARRAY_IDX(servers, i, server_rec*);
-                    if (matches_port_somewhere(s, mc->local_443)) {
-                        s_https = s;
-                        break;
-                    }
-                }
-                
-                if (!s_https) {
-                    /* Did not find any server_rec that matches this MD *and* has an
-                     * s->addrs match for the https port. Suspicious. */
-                    ap_log_error(APLOG_MARK, APLOG_WARNING, 0, base_server, APLOGNO()
-                                 "MD %s is configured to require https, but there seems to be "
-                                 "no VirtualHost for it that has port %d in its address list. "
-                                 "This looks as if it will not work.", 
-                                 md->name, mc->local_443);
-                }
+            if (!s_https) {
+                /* Did not find any server_rec that matches this MD *and* has an
+                 * s->addrs match for the https port. Suspicious. */
+                ap_log_error(APLOG_MARK, APLOG_WARNING, 0, base_server, APLOGNO()
+                             "MD %s is configured to require https, but there seems to be "
+                             "no VirtualHost for it that has port %d in its address list. "
+                             "This looks as if it will not work.", 
+                             md->name, mc->local_443);
             }
         }
-        
     }
-    return rv;
+    return APR_SUCCESS;
 }
 
 static apr_status_t md_calc_md_list(apr_pool_t *p, apr_pool_t *plog,
@@ -301,8 +386,10 @@ static apr_status_t md_calc_md_list(apr_pool_t *p, apr_pool_t *plog,
     md_srv_conf_t *sc;
     md_mod_conf_t *mc;
     md_t *md, *omd;
-    const char *domain;
+    const char *domain, *key;
+    apr_hash_t *domains, *md_servers;
     apr_status_t rv = APR_SUCCESS;
+    apr_time_t start;
     ap_listen_rec *lr;
     apr_sockaddr_t *sa;
     int i, j;
@@ -333,6 +420,10 @@ static apr_status_t md_calc_md_list(apr_pool_t *p, apr_pool_t *plog,
                  mc->can_http? "" : " not", mc->local_80,
                  mc->can_https? "" : " not", mc->local_443);
     
+    start = apr_time_now();
+    domains = apr_hash_make(ptemp);
+    md_servers = apr_hash_make(ptemp);
+    
     /* Complete the properties of the MDs, now that we have the complete, merged
      * server configurations. 
      */
@@ -341,9 +432,11 @@ static apr_status_t md_calc_md_list(apr_pool_t *p, apr_pool_t *plog,
         md_merge_srv(md, sc, p);
 
         /* Check that we have no overlap with the MDs already completed */
-        for (j = 0; j < i; ++j) {
-            omd = APR_ARRAY_IDX(mc->mds, j, md_t*);
-            if ((domain = md_common_name(md, omd)) != NULL) {
+        for (j = 0; j < md->domains->nelts; ++j) {
+            domain = APR_ARRAY_IDX(md->domains, j, const char*);
+            key = domain_key(domain, ptemp);
+            omd = apr_hash_get(domains, key, APR_HASH_KEY_STRING);
+            if (omd && omd != md) {
                 ap_log_error(APLOG_MARK, APLOG_ERR, 0, base_server, APLOGNO(10038)
                              "two Managed Domains have an overlap in domain '%s'"
                              ", first definition in %s(line %d), second in %s(line %d)",
@@ -351,65 +444,386 @@ static apr_status_t md_calc_md_list(apr_pool_t *p, apr_pool_t *plog,
                              omd->defn_name, omd->defn_line_number);
                 return APR_EINVAL;
             }
+            apr_hash_set(domains, key, APR_HASH_KEY_STRING, md);
         }
+    }
 
-        /* Assign MD to the server_rec configs that it matches. Perform some
-         * last finishing touches on the MD. */
-        if (APR_SUCCESS != (rv = assign_to_servers(md, base_server, p, ptemp))) {
+    /* Assign MDs to the server_rec configs that they match. */
+    if (APR_SUCCESS != (rv = assign_to_servers(mc, domains, md_servers, base_server, p, ptemp))) {
+        return rv;
+    }
+    
+    /* Perform some last finishing touches on the MDs. */
+    for (i = 0; i < mc->mds->nelts; ++i) {
+        md = APR_ARRAY_IDX(mc->mds, i, md_t*);
+        if (APR_SUCCESS != (rv = complete_md(md, mc, apr_hash_get(md_servers, md->name, 
+                                                                  APR_HASH_KEY_STRING), 
+                                             base_server, p))) {
             return rv;
         }
-
+        
         ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO(10039)
                      "Completed MD[%s, CA=%s, Proto=%s, Agreement=%s, Drive=%d, renew=%ld]",
                      md->name, md->ca_url, md->ca_proto, md->ca_agreement,
                      md->drive_mode, (long)md->renew_window);
     }
     
+    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, base_server, APLOGNO()
+                 "assigned %d mds with %d domains to servers in %ld ms", 
+                 mc->mds->nelts, (int)apr_hash_count(domains), 
+                 (long)apr_time_as_msec(apr_time_now() - start));
     return rv;
 }
 
+/**************************************************************************************************/
+/* http-01 challenge table */
+
+/* Responses to http-01 challenges are kept in a small shared memory table, created in
+ * post_config and inherited by all children. The watchdog writes a slot whenever the
+ * store reports a new challenge file, request processing reads it without touching
+ * the file system. Each slot is guarded by a generation counter: odd while the writer
+ * is busy, so readers retry or go to the store.
+ * Behind the slots sits one more counter, the generation of the tls-sni-01 challenges
+ * in the store. Children keep the decoded credentials until it changes.
+ */
+#define MD_CHA_SLOTS            256
+#define MD_CHA_HOST_LEN         256
+#define MD_CHA_DATA_LEN         256
+
+typedef struct {
+    volatile apr_uint32_t gen;
+    char host[MD_CHA_HOST_LEN];
+    char data[MD_CHA_DATA_LEN];
+} md_cha_slot_t;
+
+static apr_shm_t *cha_shm;
+static md_cha_slot_t *cha_slots;
+static volatile apr_uint32_t *sni_cha_gen;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *cha_mutex;  /* serializes writers, renewals may run in parallel */
+#endif
+/* the tls-sni-01 challenges the watchdog has seen appear in the store */
+static apr_pool_t *sni_cha_live_p;
+static apr_hash_t *sni_cha_live;
+
+static apr_status_t cleanup_cha_table(void *dummy)
+{
+    (void)dummy;
+    cha_shm = NULL;
+    cha_slots = NULL;
+    sni_cha_gen = NULL;
+    sni_cha_live_p = NULL;
+    sni_cha_live = NULL;
+    return APR_SUCCESS;
+}
+
+static void cha_table_init(apr_pool_t *p, server_rec *s)
+{
+    apr_status_t rv;
+    
+    cha_slots = NULL;
+    sni_cha_gen = NULL;
+    rv = apr_shm_create(&cha_shm, MD_CHA_SLOTS * sizeof(md_cha_slot_t) + sizeof(apr_uint32_t), 
+                        NULL, p);
+    if (APR_SUCCESS != rv) {
+        /* not fatal, challenges will be answered from the store */
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO() 
+                     "no shared memory for http-01 challenge table");
+        cha_shm = NULL;
+        return;
+    }
+#if APR_HAS_THREADS
+    if (APR_SUCCESS != (rv = apr_thread_mutex_create(&cha_mutex, APR_THREAD_MUTEX_DEFAULT, p))) {
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, rv, s, APLOGNO() 
+                     "no mutex for http-01 challenge table");
+        apr_shm_destroy(cha_shm);
+        cha_shm = NULL;
+        return;
+    }
+#endif
+    cha_slots = apr_shm_baseaddr_get(cha_shm);
+    memset(cha_slots, 0, MD_CHA_SLOTS * sizeof(md_cha_slot_t) + sizeof(apr_uint32_t));
+    sni_cha_gen = (apr_uint32_t *)(cha_slots + MD_CHA_SLOTS);
+    if (APR_SUCCESS == apr_pool_create(&sni_cha_live_p, p)) {
+        apr_pool_tag(sni_cha_live_p, "md_sni_cha_live");
+        sni_cha_live = apr_hash_make(sni_cha_live_p);
+    }
+    apr_pool_cleanup_register(p, NULL, cleanup_cha_table, apr_pool_cleanup_null);
+}
+
+static unsigned int cha_slot_start(const char *host)
+{
+    unsigned int h = 0;
+    
+    for (; *host; ++host) {
+        h = h * 31 + (unsigned char)apr_tolower(*host);
+    }
+    return h % MD_CHA_SLOTS;
+}
+
+static void cha_table_put(const char *host, const char *data)
+{
+    md_cha_slot_t *slot = NULL, *cand;
+    unsigned int i, start;
+    
+    if (!cha_slots || strlen(host) >= MD_CHA_HOST_LEN || strlen(data) >= MD_CHA_DATA_LEN) {
+        return;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(cha_mutex);
+#endif
+    start = cha_slot_start(host);
+    for (i = 0; i < MD_CHA_SLOTS; ++i) {
+        cand = &cha_slots[(start + i) % MD_CHA_SLOTS];
+        if (!cand->host[0] || !ap_cstr_casecmp(host, cand->host)) {
+            slot = cand;
+            break;
+        }
+    }
+    if (!slot) {
+        /* table full, replace the entry at our home position */
+        slot = &cha_slots[start];
+    }
+    
+    apr_atomic_inc32(&slot->gen);
+    apr_cpystrn(slot->host, host, MD_CHA_HOST_LEN);
+    apr_cpystrn(slot->data, data, MD_CHA_DATA_LEN);
+    apr_atomic_inc32(&slot->gen);
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(cha_mutex);
+#endif
+}
+
+/* Look up the response for host and token. Returns NULL when the table has no
+ * consistent entry that answers this token, the caller then consults the store. */
+static const char *cha_table_get(const char *host, const char *token, apr_pool_t *p)
+{
+    md_cha_slot_t *slot;
+    char data[MD_CHA_DATA_LEN];
+    apr_uint32_t gen;
+    unsigned int i, start;
+    size_t tlen;
+    int found;
+    
+    if (!cha_slots || !host) {
+        return NULL;
+    }
+    tlen = strlen(token);
+    start = cha_slot_start(host);
+    for (i = 0; i < MD_CHA_SLOTS; ++i) {
+        slot = &cha_slots[(start + i) % MD_CHA_SLOTS];
+        gen = apr_atomic_read32(&slot->gen);
+        if (gen & 1) {
+            /* being written right now */
+            return NULL;
+        }
+        if (!slot->host[0]) {
+            return NULL;
+        }
+        found = !ap_cstr_casecmp(host, slot->host);
+        if (found) {
+            memcpy(data, slot->data, sizeof(data));
+        }
+        if (gen != apr_atomic_read32(&slot->gen)) {
+            return NULL;
+        }
+        if (found) {
+            data[MD_CHA_DATA_LEN-1] = '\0';
+            /* key authorizations start with the token they answer */
+            if (!strncmp(token, data, tlen) && data[tlen] == '.') {
+                return apr_pstrdup(p, data);
+            }
+            return NULL;
+        }
+    }
+    return NULL;
+}
+
+static void cha_table_update(const char *fname, apr_pool_t *p)
+{
+    const char *data, *dir;
+    
+    if (cha_slots && !strcmp(MD_FN_HTTP01, apr_filepath_name_get(fname))
+        && APR_SUCCESS == md_text_fread8k(&data, p, fname)) {
+        dir = apr_pstrndup(p, fname, (apr_size_t)(apr_filepath_name_get(fname) - fname));
+        if (*dir && dir[strlen(dir)-1] == '/') {
+            dir = apr_pstrndup(p, dir, strlen(dir)-1);
+        }
+        cha_table_put(apr_filepath_name_get(dir), data);
+    }
+}
+
+static const char *store_ev_md_name(md_store_t *store, int group, 
+                                    const char *fname, apr_pool_t *p);
+
+/* A tls-sni-01 challenge was written or the store changed in other ways, 
+ * have all children reload the credentials they cached. */
+static void sni_cha_changed(md_store_t *store, md_store_fs_ev_t ev, const char *fname, 
+                            apr_filetype_e ftype, apr_pool_t *p)
+{
+    const char *fn, *name;
+    
+    if (!sni_cha_gen) {
+        return;
+    }
+    if (ftype == APR_REG) {
+        fn = apr_filepath_name_get(fname);
+        if (strcmp(MD_FN_TLSSNI01_CERT, fn) && strcmp(MD_FN_TLSSNI01_PKEY, fn)) {
+            return;
+        }
+        name = store_ev_md_name(store, MD_SG_CHALLENGES, fname, p);
+        if (name && sni_cha_live) {
+#if APR_HAS_THREADS
+            apr_thread_mutex_lock(cha_mutex);
+#endif
+            if (!apr_hash_get(sni_cha_live, name, APR_HASH_KEY_STRING)) {
+                name = apr_pstrdup(sni_cha_live_p, name);
+                apr_hash_set(sni_cha_live, name, APR_HASH_KEY_STRING, name);
+            }
+#if APR_HAS_THREADS
+            apr_thread_mutex_unlock(cha_mutex);
+#endif
+        }
+    }
+    else if (MD_S_FS_EV_CHANGED != ev) {
+        /* a new challenge directory of ours, its files follow */
+        return;
+    }
+    apr_atomic_inc32(sni_cha_gen);
+}
+
+/* Run by the watchdog. Challenges of completed authorizations are purged from the
+ * store without an event, look for the ones gone and have the children free them. */
+static void sni_cha_sweep_live(md_store_t *store, apr_pool_t *ptemp)
+{
+    apr_hash_index_t *hi;
+    const char *fname;
+    const void *name;
+    int gone = 0;
+    
+    if (!sni_cha_live) {
+        return;
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(cha_mutex);
+#endif
+    for (hi = apr_hash_first(ptemp, sni_cha_live); hi; hi = apr_hash_next(hi)) {
+        apr_hash_this(hi, &name, NULL, NULL);
+        if (APR_SUCCESS != md_store_get_fname(&fname, store, MD_SG_CHALLENGES, name, 
+                                              MD_FN_TLSSNI01_CERT, ptemp)
+            || APR_SUCCESS != md_util_is_file(fname, ptemp)) {
+            apr_hash_set(sni_cha_live, name, APR_HASH_KEY_STRING, NULL);
+            gone = 1;
+        }
+    }
+    if (gone && !apr_hash_count(sni_cha_live)) {
+        /* the names are all unique, do not let them pile up */
+        apr_pool_clear(sni_cha_live_p);
+        sni_cha_live = apr_hash_make(sni_cha_live_p);
+    }
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(cha_mutex);
+#endif
+    if (gone) {
+        apr_atomic_inc32(sni_cha_gen);
+    }
+}
+
 /**************************************************************************************************/
 /* store & registry setup */
 
+/* The watchdog, if running in this process */
+typedef struct md_watchdog md_watchdog;
+static md_watchdog *md_wd;
+static void md_wd_job_dirty(md_watchdog *wd, const char *name);
+
+/* Get the name of the MD the file/directory in the store group belongs to. */
+static const char *store_ev_md_name(md_store_t *store, int group, 
+                                    const char *fname, apr_pool_t *p)
+{
+    const char *dir, *name, *end;
+    apr_size_t len;
+    
+    if (APR_SUCCESS != md_store_get_fname(&dir, store, (md_store_group_t)group, NULL, NULL, p)) {
+        return NULL;
+    }
+    len = strlen(dir);
+    if (strncmp(dir, fname, len) || fname[len] != '/') {
+        return NULL;
+    }
+    name = fname + len + 1;
+    end = strchr(name, '/');
+    return (end && end > name)? apr_pstrndup(p, name, (apr_size_t)(end - name)) 
+                              : (*name? name : NULL);
+}
+
 static apr_status_t store_file_ev(void *baton, struct md_store_t *store,
                                     md_store_fs_ev_t ev, int group, 
                                     const char *fname, apr_filetype_e ftype,  
                                     apr_pool_t *p)
 {
     server_rec *s = baton;
-    apr_status_t rv;
+    md_mod_conf_t *mc = md_config_get(s)->mc;
+    apr_status_t rv = APR_SUCCESS;
     
-    (void)store;
     ap_log_error(APLOG_MARK, APLOG_TRACE3, 0, s, "store event=%d on %s %s (group %d)", 
                  ev, (ftype == APR_DIR)? "dir" : "file", fname, group);
                  
-    /* Directories in group CHALLENGES and STAGING are written to by our watchdog,
+    if (MD_S_FS_EV_CHANGED == ev && mc->reg) {
+        /* changed by another process, what we have cached may be outdated */
+        const char *name = store_ev_md_name(store, group, fname, p);
+        
+        md_store_cache_invalidate(md_reg_store_get(mc->reg), (md_store_group_t)group, name);
+        if (group == MD_SG_DOMAINS && name) {
+            md_reg_changed(mc->reg, name, p);
+        }
+    }
+    
+    /* Directories in group CHALLENGES, STAGING and CACHE are written to by our watchdog,
      * running on certain mpms in a child process under a different user. Give them
-     * ownership. 
+     * ownership. Only for directories made through our own store: what the watch
+     * reports was made by another process and our child may not change its owner.
      */
-    if (ftype == APR_DIR) {
+    if (ftype == APR_DIR && MD_S_FS_EV_CHANGED != ev) {
         switch (group) {
             case MD_SG_CHALLENGES:
             case MD_SG_STAGING:
+            case MD_SG_CACHE:
                 rv = md_make_worker_accessible(fname, p);
-                if (APR_ENOTIMPL != rv) {
-                    return rv;
+                if (APR_ENOTIMPL == rv) {
+                    rv = APR_SUCCESS;
                 }
                 break;
             default: 
                 break;
         }
     }
-    return APR_SUCCESS;
+    else if (ftype == APR_REG && group == MD_SG_CHALLENGES) {
+        /* a challenge response was written, make it available to all children */
+        cha_table_update(fname, p);
+    }
+    if (group == MD_SG_CHALLENGES) {
+        sni_cha_changed(store, ev, fname, ftype, p);
+    }
+    
+    if (md_wd && MD_S_FS_EV_CHANGED == ev 
+        && (group == MD_SG_DOMAINS || group == MD_SG_STAGING)) {
+        /* changes to MDs not done by the watchdog itself wake it up early */
+        const char *name = store_ev_md_name(store, group, fname, p);
+        if (name) {
+            md_wd_job_dirty(md_wd, name);
+        }
+    }
+    return rv;
 }
 
 static apr_status_t check_group_dir(md_store_t *store, md_store_group_t group, 
-                                    apr_pool_t *p, server_rec *s)
+                                    const char *name, apr_pool_t *p, server_rec *s)
 {
     const char *dir;
     apr_status_t rv;
     
-    if (APR_SUCCESS == (rv = md_store_get_fname(&dir, store, group, NULL, NULL, p))
+    if (APR_SUCCESS == (rv = md_store_get_fname(&dir, store, group, name, NULL, p))
         && APR_SUCCESS == (rv = apr_dir_make_recursive(dir, MD_FPROT_D_UALL_GREAD, p))) {
         rv = store_file_ev(s, store, MD_S_FS_EV_CREATED, group, dir, APR_DIR, p);
     }
@@ -430,21 +844,28 @@ static apr_status_t setup_store(md_store_t **pstore, md_mod_conf_t *mc,
     }
 
     md_store_fs_set_event_cb(*pstore, store_file_ev, s);
-    if (APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_CHALLENGES, p, s))) {
+    if (APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_CHALLENGES, NULL, p, s))) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10047) 
                      "setup challenges directory");
         goto out;
     }
-    if (APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_STAGING, p, s))) {
+    if (APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_STAGING, NULL, p, s))) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10048) 
                      "setup staging directory");
         goto out;
     }
-    if (APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_ACCOUNTS, p, s))) {
+    if (APR_SUCCESS != (rv = check_group_dir(*pstore, MD_SG_ACCOUNTS, NULL, p, s))) {
         ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO(10049) 
                      "setup accounts directory");
         goto out;
     }
+    /* the watchdog persists what it learns about CAs, it needs to own the place */
+    if (APR_SUCCESS != (rv = check_group_dir(*pstore, MD_ACME_DIRS_GROUP, MD_ACME_DIRS_NAME, 
+                                             p, s))) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO() 
+                     "setup acme directory cache");
+        goto out;
+    }
     
 out:
     return rv;
@@ -455,15 +876,17 @@ static apr_status_t setup_reg(md_reg_t **preg, apr_pool_t *p, server_rec *s,
 {
     md_srv_conf_t *sc;
     md_mod_conf_t *mc;
-    md_store_t *store;
+    md_store_t *store, *cached;
     apr_status_t rv;
     
     sc = md_config_get(s);
     mc = sc->mc;
     
     if (APR_SUCCESS == (rv = setup_store(&store, mc, p, s))
-        && APR_SUCCESS == (rv = md_reg_init(preg, p, store, mc->proxy_url))) {
+        && APR_SUCCESS == (rv = md_store_cache_init(&cached, p, store, MD_STORE_CACHE_MAX_DEF))
+        && APR_SUCCESS == (rv = md_reg_init(preg, p, cached, mc->proxy_url))) {
         mc->reg = *preg;
+        md_reg_set_max_requests(*preg, mc->max_parallel_requests);
         return md_reg_set_props(*preg, p, can_http, can_https); 
     }
     return rv;
@@ -536,6 +959,9 @@ static void init_ssl(void)
 
 #define MD_WATCHDOG_NAME   "_md_"
 
+/* How long one watchdog run may spend on generating keys for the stock */
+#define MD_PKEY_STOCK_SLICE     apr_time_from_sec(1)
+
 static APR_OPTIONAL_FN_TYPE(ap_watchdog_get_instance) *wd_get_instance;
 static APR_OPTIONAL_FN_TYPE(ap_watchdog_register_callback) *wd_register_callback;
 static APR_OPTIONAL_FN_TYPE(ap_watchdog_set_callback_interval) *wd_set_interval;
@@ -553,9 +979,13 @@ typedef struct {
     apr_status_t last_rv;
     apr_time_t next_check;
     int error_runs;
+    
+    int qidx;                   /* position in the watchdog's job queue, -1 if not queued */
+    int dirty;                  /* changed by others while being checked */
+    int renew_due;              /* needs a new certificate, not staged yet */
 } md_job_t;
 
-typedef struct {
+struct md_watchdog {
     apr_pool_t *p;
     server_rec *s;
     md_mod_conf_t *mc;
@@ -564,8 +994,150 @@ typedef struct {
     apr_time_t next_change;
     
     apr_array_header_t *jobs;
+    apr_hash_t *jobs_by_name;
+    apr_array_header_t *queue;  /* min-heap of jobs, ordered by next_check */
+    int running;                /* != 0 while the watchdog is checking jobs */
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;  /* protects the queue */
+#endif
     md_reg_t *reg;
-} md_watchdog;
+    apr_pool_t *watch_p;        /* lifetime of the store watch, if one runs */
+};
+
+static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp);
+
+/* The job queue is a binary heap with the job next to be checked at its top. A job
+ * without a next_check time is checked on the next regular run. */
+#define JOB_AT(q, i)      APR_ARRAY_IDX(q, i, md_job_t *)
+
+static void jobq_swap(apr_array_header_t *q, int i, int j)
+{
+    md_job_t *job = JOB_AT(q, i);
+    
+    JOB_AT(q, i) = JOB_AT(q, j);
+    JOB_AT(q, j) = job;
+    JOB_AT(q, i)->qidx = i;
+    JOB_AT(q, j)->qidx = j;
+}
+
+static void jobq_sift_up(apr_array_header_t *q, int i)
+{
+    int parent;
+    
+    while (i > 0) {
+        parent = (i - 1) / 2;
+        if (JOB_AT(q, parent)->next_check <= JOB_AT(q, i)->next_check) {
+            break;
+        }
+        jobq_swap(q, i, parent);
+        i = parent;
+    }
+}
+
+static void jobq_sift_down(apr_array_header_t *q, int i)
+{
+    int child, smallest;
+    
+    for (;;) {
+        smallest = i;
+        child = 2 * i + 1;
+        if (child < q->nelts && JOB_AT(q, child)->next_check < JOB_AT(q, smallest)->next_check) {
+            smallest = child;
+        }
+        ++child;
+        if (child < q->nelts && JOB_AT(q, child)->next_check < JOB_AT(q, smallest)->next_check) {
+            smallest = child;
+        }
+        if (smallest == i) {
+            break;
+        }
+        jobq_swap(q, i, smallest);
+        i = smallest;
+    }
+}
+
+static void jobq_push(apr_array_header_t *q, md_job_t *job)
+{
+    job->qidx = q->nelts;
+    APR_ARRAY_PUSH(q, md_job_t *) = job;
+    jobq_sift_up(q, job->qidx);
+}
+
+static md_job_t *jobq_pop(apr_array_header_t *q)
+{
+    md_job_t *job;
+    
+    if (q->nelts <= 0) {
+        return NULL;
+    }
+    job = JOB_AT(q, 0);
+    jobq_swap(q, 0, q->nelts - 1);
+    --q->nelts;
+    if (q->nelts > 0) {
+        jobq_sift_down(q, 0);
+    }
+    job->qidx = -1;
+    return job;
+}
+
+static void jobq_update(apr_array_header_t *q, md_job_t *job)
+{
+    if (job->qidx >= 0) {
+        jobq_sift_up(q, job->qidx);
+        jobq_sift_down(q, job->qidx);
+    }
+}
+
+static void wd_lock(md_watchdog *wd)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_lock(wd->mutex);
+#else
+    (void)wd;
+#endif
+}
+
+static void wd_unlock(md_watchdog *wd)
+{
+#if APR_HAS_THREADS
+    apr_thread_mutex_unlock(wd->mutex);
+#else
+    (void)wd;
+#endif
+}
+
+static apr_status_t cleanup_md_wd(void *dummy)
+{
+    (void)dummy;
+    md_wd = NULL;
+    return APR_SUCCESS;
+}
+
+/* Something changed for the MD, check its job as soon as possible. */
+static void md_wd_job_dirty(md_watchdog *wd, const char *name)
+{
+    md_job_t *job;
+    int wakeup = 0;
+    
+    wd_lock(wd);
+    job = apr_hash_get(wd->jobs_by_name, name, APR_HASH_KEY_STRING);
+    if (job && job->qidx < 0 && wd->running) {
+        /* being checked right now, have the run look at it again when done */
+        ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, wd->s, "md(%s): changed, check again", name);
+        job->dirty = 1;
+    }
+    else if (job && job->qidx >= 0 && job->next_check > apr_time_now()) {
+        ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, wd->s, "md(%s): changed, check now", name);
+        job->next_check = 0;
+        jobq_update(wd->queue, job);
+        /* a running watchdog picks the queue top as its next run */
+        wakeup = !wd->running;
+    }
+    wd_unlock(wd);
+    if (wakeup) {
+        wd_set_interval(wd->watchdog, 0, wd, run_watchdog);
+    }
+}
 
 static void assess_renewal(md_watchdog *wd, md_job_t *job, apr_pool_t *ptemp) 
 {
@@ -621,7 +1193,8 @@ static apr_status_t check_job(md_watchdog *wd, md_job_t *job, apr_pool_t *ptemp)
     else if (job->renewed) {
         assess_renewal(wd, job, ptemp);
     }
-    else if (APR_SUCCESS == (rv = md_reg_assess(wd->reg, job->md, &errored, &renew, wd->p))) {
+    else if (APR_SUCCESS == (rv = md_reg_assess(wd->reg, job->md, &errored, &renew, ptemp))) {
+        job->renew_due = renew && !errored;
         if (errored) {
             ap_log_error( APLOG_MARK, APLOG_DEBUG, 0, wd->s, APLOGNO(10050) 
                          "md(%s): in error state", job->md->name);
@@ -634,6 +1207,7 @@ static apr_status_t check_job(md_watchdog *wd, md_job_t *job, apr_pool_t *ptemp)
             
             if (APR_SUCCESS == rv) {
                 job->renewed = 1;
+                job->renew_due = 0;
                 job->restart_at = valid_from;
                 assess_renewal(wd, job, ptemp);
             }
@@ -669,10 +1243,194 @@ static apr_status_t check_job(md_watchdog *wd, md_job_t *job, apr_pool_t *ptemp)
     return rv;
 }
 
+/* Jobs that are due are checked by up to MDMaxParallelRenewals threads, so that one
+ * slow CA interaction does not hold up the renewal of all other MDs. Every job gets
+ * a pool with its own allocator, workers share no pool with each other. */
+typedef struct {
+    md_watchdog *wd;
+    apr_array_header_t *jobs;
+    apr_array_header_t *pools;
+    int next;
+#if APR_HAS_THREADS
+    apr_thread_mutex_t *mutex;
+#endif
+} md_job_queue_t;
+
+static md_job_t *job_queue_next(md_job_queue_t *q, apr_pool_t **pp)
+{
+    md_job_t *job = NULL;
+    
+#if APR_HAS_THREADS
+    if (q->mutex) {
+        apr_thread_mutex_lock(q->mutex);
+    }
+#endif
+    if (q->next < q->jobs->nelts) {
+        job = APR_ARRAY_IDX(q->jobs, q->next, md_job_t *);
+        *pp = APR_ARRAY_IDX(q->pools, q->next, apr_pool_t *);
+        ++q->next;
+    }
+#if APR_HAS_THREADS
+    if (q->mutex) {
+        apr_thread_mutex_unlock(q->mutex);
+    }
+#endif
+    return job;
+}
+
+#if APR_HAS_THREADS
+static void * APR_THREAD_FUNC job_worker(apr_thread_t *thread, void *baton)
+{
+    md_job_queue_t *q = baton;
+    md_job_t *job;
+    apr_pool_t *p;
+    
+    (void)thread;
+    while (NULL != (job = job_queue_next(q, &p))) {
+        check_job(q->wd, job, p);
+    }
+    return NULL;
+}
+#endif
+
+static void run_jobs(md_watchdog *wd, apr_array_header_t *jobs, apr_pool_t *ptemp)
+{
+    md_job_queue_t q;
+    apr_allocator_t *allocator;
+    apr_pool_t *jp;
+    md_job_t *job;
+    int i, nworkers = wd->mc->max_parallel_renewals;
+    
+    if (nworkers > jobs->nelts) {
+        nworkers = jobs->nelts;
+    }
+    
+    memset(&q, 0, sizeof(q));
+    q.wd = wd;
+    q.jobs = jobs;
+    q.pools = apr_array_make(ptemp, jobs->nelts, sizeof(apr_pool_t *));
+    for (i = 0; i < jobs->nelts; ++i) {
+        jp = NULL;
+        if (nworkers > 1 && APR_SUCCESS == apr_allocator_create(&allocator)) {
+            if (APR_SUCCESS == apr_pool_create_ex(&jp, ptemp, NULL, allocator)) {
+                apr_allocator_owner_set(allocator, jp);
+                apr_pool_tag(jp, "md_job");
+            }
+            else {
+                apr_allocator_destroy(allocator);
+                jp = NULL;
+            }
+        }
+        if (!jp) {
+            /* no pool of its own, run all jobs in this thread */
+            nworkers = 1;
+        }
+        APR_ARRAY_PUSH(q.pools, apr_pool_t *) = jp? jp : ptemp;
+    }
+
+#if APR_HAS_THREADS
+    if (nworkers > 1 
+        && APR_SUCCESS == apr_thread_mutex_create(&q.mutex, APR_THREAD_MUTEX_DEFAULT, ptemp)) {
+        apr_array_header_t *workers;
+        apr_thread_t *t;
+        apr_status_t rv, trv;
+        
+        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, wd->s, APLOGNO()
+                     "checking %d mds with %d workers", jobs->nelts, nworkers);
+        workers = apr_array_make(ptemp, nworkers, sizeof(apr_thread_t *));
+        for (i = 0; i < nworkers; ++i) {
+            if (APR_SUCCESS != (rv = apr_thread_create(&t, NULL, job_worker, &q, ptemp))) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, rv, wd->s, APLOGNO()
+                             "creating md renewal worker");
+                break;
+            }
+            APR_ARRAY_PUSH(workers, apr_thread_t *) = t;
+        }
+        /* lend a hand, also covers failure to create any worker */
+        job_worker(NULL, &q);
+        for (i = 0; i < workers->nelts; ++i) {
+            apr_thread_join(&trv, APR_ARRAY_IDX(workers, i, apr_thread_t *));
+        }
+        goto out;
+    }
+    q.mutex = NULL;
+#endif
+    /* run all jobs, one after the other */
+    while (NULL != (job = job_queue_next(&q, &jp))) {
+        check_job(wd, job, jp);
+    }
+#if APR_HAS_THREADS
+out:
+#endif
+    for (i = 0; i < q.pools->nelts; ++i) {
+        jp = APR_ARRAY_IDX(q.pools, i, apr_pool_t *);
+        if (jp != ptemp) {
+            apr_pool_destroy(jp);
+        }
+    }
+}
+
+/* Every MD due for renewal needs a new key for its certificate and, with tls-sni-01,
+ * one per domain for the challenges. Keep a stock of these around, for as long as
+ * there are MDs waiting for them. */
+static void stock_pkeys(apr_array_header_t *jobs, apr_pool_t *p)
+{
+    apr_array_header_t *specs, *counts;
+    md_job_t *job;
+    int i, j;
+    
+    specs = apr_array_make(p, 5, sizeof(md_pkey_spec_t *));
+    counts = apr_array_make(p, 5, sizeof(int));
+    for (i = 0; i < jobs->nelts; ++i) {
+        job = APR_ARRAY_IDX(jobs, i, md_job_t *);
+        if (!job->renew_due || job->renewed || job->stalled) {
+            continue;
+        }
+        for (j = 0; j < specs->nelts; ++j) {
+            if (md_pkey_spec_eq(APR_ARRAY_IDX(specs, j, md_pkey_spec_t *), job->md->pkey_spec)) {
+                break;
+            }
+        }
+        if (j == specs->nelts) {
+            APR_ARRAY_PUSH(specs, md_pkey_spec_t *) = job->md->pkey_spec;
+            APR_ARRAY_PUSH(counts, int) = 0;
+        }
+        APR_ARRAY_IDX(counts, j, int) += 1 + job->md->domains->nelts;
+    }
+    md_pkey_stock_reset();
+    for (j = 0; j < specs->nelts; ++j) {
+        md_pkey_stock_want(APR_ARRAY_IDX(specs, j, md_pkey_spec_t *), 
+                           APR_ARRAY_IDX(counts, j, int));
+    }
+}
+
+/* Have the store tell us about changes made by others, e.g. a2md or another server,
+ * so that we do not wait for the next regular run to see them. */
+static void start_store_watch(md_watchdog *wd)
+{
+    md_store_t *store;
+    apr_status_t rv;
+    
+    if (APR_SUCCESS != (rv = apr_pool_create(&wd->watch_p, wd->p))) {
+        wd->watch_p = NULL;
+        return;
+    }
+    apr_pool_tag(wd->watch_p, "md_store_watch");
+    store = md_store_cache_backend_get(md_reg_store_get(wd->reg));
+    rv = md_store_fs_watch_start(store, wd->watch_p);
+    if (APR_SUCCESS != rv) {
+        ap_log_error(APLOG_MARK, APR_STATUS_IS_ENOTIMPL(rv)? APLOG_DEBUG : APLOG_WARNING, 
+                     rv, wd->s, APLOGNO() "not watching the store for changes");
+        apr_pool_destroy(wd->watch_p);
+        wd->watch_p = NULL;
+    }
+}
+
 static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
 {
     md_watchdog *wd = baton;
     apr_status_t rv = APR_SUCCESS;
+    apr_array_header_t *due;
     md_job_t *job;
     apr_time_t next_run, now;
     int restart = 0;
@@ -682,6 +1440,9 @@ static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
         case AP_WATCHDOG_STATE_STARTING:
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, wd->s, APLOGNO(10054)
                          "md watchdog start, auto drive %d mds", wd->jobs->nelts);
+            if (wd->mc->store_watch) {
+                start_store_watch(wd);
+            }
             break;
         case AP_WATCHDOG_STATE_RUNNING:
             assert(wd->reg);
@@ -693,35 +1454,84 @@ static apr_status_t run_watchdog(int state, void *baton, apr_pool_t *ptemp)
             /* normally, we'd like to run at least twice a day */
             next_run = apr_time_now() + apr_time_from_sec(MD_SECS_PER_DAY / 2);
 
-            /* Check on all the jobs we have */
-            for (i = 0; i < wd->jobs->nelts; ++i) {
-                job = APR_ARRAY_IDX(wd->jobs, i, md_job_t *);
-                
-                rv = check_job(wd, job, ptemp);
+            /* Take the jobs that are due from the queue and check on them */
+            now = apr_time_now();
+            due = apr_array_make(ptemp, 10, sizeof(md_job_t *));
+            wd_lock(wd);
+            wd->running = 1;
+            while (wd->queue->nelts > 0 && JOB_AT(wd->queue, 0)->next_check <= now) {
+                APR_ARRAY_PUSH(due, md_job_t *) = jobq_pop(wd->queue);
+            }
+            wd_unlock(wd);
+            
+            run_jobs(wd, due, ptemp);
+            sni_cha_sweep_live(md_reg_store_get(wd->reg), ptemp);
+            
+            wd_lock(wd);
+            for (i = 0; i < due->nelts; ++i) {
+                job = APR_ARRAY_IDX(due, i, md_job_t *);
 
                 if (job->need_restart && !job->restart_processed) {
                     restart = 1;
                 }
-                if (job->next_check && job->next_check < next_run) {
-                    next_run = job->next_check;
+                if (job->dirty) {
+                    job->dirty = 0;
+                    job->next_check = now;
+                }
+                else if (!job->next_check) {
+                    job->next_check = next_run;
+                }
+                jobq_push(wd->queue, job);
+            }
+            if (wd->queue->nelts > 0 && JOB_AT(wd->queue, 0)->next_check < next_run) {
+                next_run = JOB_AT(wd->queue, 0)->next_check;
+            }
+            wd->running = 0;
+            wd_unlock(wd);
+
+            /* With nothing else to do, top up the key stock a slice at a time, so
+             * that changed MDs do not have to wait on key generation. */
+            stock_pkeys(wd->jobs, ptemp);
+            rv = md_pkey_stock_fill(ptemp, MD_PKEY_STOCK_SLICE);
+            if (APR_EAGAIN == rv) {
+                now = apr_time_now();
+                if (next_run > now + MD_PKEY_STOCK_SLICE) {
+                    next_run = now + MD_PKEY_STOCK_SLICE;
                 }
             }
+            else if (APR_SUCCESS != rv) {
+                ap_log_error(APLOG_MARK, APLOG_WARNING, rv, wd->s, APLOGNO()
+                             "generating keys for stock");
+            }
+            rv = APR_SUCCESS;
 
             now = apr_time_now();
             if (APLOGdebug(wd->s)) {
+                md_store_cache_stats_t stats;
+                
                 ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, wd->s, APLOGNO()
                              "next run in %s", md_print_duration(ptemp, next_run - now));
+                if (APR_SUCCESS == md_store_cache_stats_get(&stats, 
+                                                            md_reg_store_get(wd->reg))) {
+                    ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, wd->s, APLOGNO()
+                                 "store cache: %d entries, %lu hits, %lu misses, %lu stale, "
+                                 "%lu invalidated, %lu evicted", (int)stats.entries, 
+                                 (unsigned long)stats.hits, (unsigned long)stats.misses, 
+                                 (unsigned long)stats.stale, (unsigned long)stats.invalidated,
+                                 (unsigned long)stats.evicted);
+                }
             }
-            wd_set_interval(wd->watchdog, next_run - now, wd, run_watchdog);
-
-            for (i = 0; i < wd->jobs->nelts; ++i) {
-                job = APR_ARRAY_IDX(wd->jobs, i, md_job_t *);
-            }
+            wd_set_interval(wd->watchdog, (next_run > now)? next_run - now : 0, 
+                            wd, run_watchdog);
             break;
             
         case AP_WATCHDOG_STATE_STOPPING:
             ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, wd->s, APLOGNO(10058)
                          "md watchdog stopping");
+            if (wd->watch_p) {
+                apr_pool_destroy(wd->watch_p);
+                wd->watch_p = NULL;
+            }
             break;
     }
 
@@ -853,7 +1663,17 @@ static apr_status_t start_watchdog(apr_array_header_t *names, apr_pool_t *p,
     wd->s = s;
     wd->mc = mc;
     
+#if APR_HAS_THREADS
+    if (APR_SUCCESS != (rv = apr_thread_mutex_create(&wd->mutex, 
+                                                     APR_THREAD_MUTEX_DEFAULT, wd->p))) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO() "md_watchdog: create mutex");
+        apr_pool_destroy(wd->p);
+        return rv;
+    }
+#endif
     wd->jobs = apr_array_make(wd->p, 10, sizeof(md_job_t *));
+    wd->jobs_by_name = apr_hash_make(wd->p);
+    wd->queue = apr_array_make(wd->p, 10, sizeof(md_job_t *));
     for (i = 0; i < names->nelts; ++i) {
         name = APR_ARRAY_IDX(names, i, const char *);
         md = md_reg_get(wd->reg, name, wd->p);
@@ -867,7 +1687,10 @@ static apr_status_t start_watchdog(apr_array_header_t *names, apr_pool_t *p,
                 job = apr_pcalloc(wd->p, sizeof(*job));
                 
                 job->md = md;
+                job->renew_due = renew;
                 APR_ARRAY_PUSH(wd->jobs, md_job_t*) = job;
+                apr_hash_set(wd->jobs_by_name, md->name, APR_HASH_KEY_STRING, job);
+                jobq_push(wd->queue, job);
 
                 ap_log_error( APLOG_MARK, APLOG_DEBUG, 0, wd->s, APLOGNO(10064) 
                              "md(%s): state=%d, driving", name, md->state);
@@ -882,6 +1705,7 @@ static apr_status_t start_watchdog(apr_array_header_t *names, apr_pool_t *p,
         apr_pool_destroy(wd->p);
         return APR_SUCCESS;
     }
+    stock_pkeys(wd->jobs, p);
     
     if (APR_SUCCESS != (rv = wd_get_instance(&wd->watchdog, MD_WATCHDOG_NAME, 0, 1, wd->p))) {
         ap_log_error(APLOG_MARK, APLOG_CRIT, rv, s, APLOGNO(10066) 
@@ -891,6 +1715,10 @@ static apr_status_t start_watchdog(apr_array_header_t *names, apr_pool_t *p,
     rv = wd_register_callback(wd->watchdog, 0, wd, run_watchdog);
     ap_log_error(APLOG_MARK, rv? APLOG_CRIT : APLOG_DEBUG, rv, s, APLOGNO(10067) 
                  "register md watchdog(%s)", MD_WATCHDOG_NAME);
+    if (APR_SUCCESS == rv) {
+        md_wd = wd;
+        apr_pool_cleanup_register(wd->p, NULL, cleanup_md_wd, apr_pool_cleanup_null);
+    }
     return rv;
 }
  
@@ -996,6 +1824,9 @@ static apr_status_t md_post_config(apr_pool_t *p, apr_pool_t *plog,
     }
     
     init_ssl();
+    cha_table_init(p, s);
+    /* mod_ssl asks for the credentials of each server, look them up once per MD */
+    mc->cred_files = apr_hash_make(p);
     
     /* If there are MDs to drive, start a watchdog to check on them regularly */
     if (drive_names->nelts > 0) {
@@ -1060,14 +1891,75 @@ static int fexists(const char *fname, apr_pool_t *p)
     return (*fname && APR_SUCCESS == md_util_is_file(fname, p));
 }
 
+/* The credential files and state of an MD, as seen by all servers it is assigned to.
+ * Computed on first use after post_config and then shared by all servers that reference
+ * the same MD, so that the registry is consulted only once per MD. */
+typedef struct {
+    const md_t *md;
+    const char *pkeyfile;
+    const char *certfile;
+    int fallback;
+    apr_status_t rv;
+} md_cred_files_t;
+
+static apr_status_t calc_cred_files(md_cred_files_t *files, md_reg_t *reg, 
+                                    const char *name, apr_pool_t *p, server_rec *s)
+{
+    md_store_t *store;
+    const md_t *md;
+    apr_status_t rv;
+    
+    store = md_reg_store_get(reg);
+    assert(store);
+    
+    if (NULL == (files->md = md = md_reg_get(reg, name, p))) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, APR_ENOENT, s, APLOGNO() 
+                     "MD %s not found in registry", name);
+        return APR_ENOENT;
+    }
+        
+    if (APR_SUCCESS != (rv = md_reg_get_cred_files(reg, md, p, 
+                                                   &files->pkeyfile, &files->certfile))) {
+        ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO() 
+                     "retrieving credentials for MD %s", md->name);
+        return rv;
+    }
+
+    if (!fexists(files->pkeyfile, p) || !fexists(files->certfile, p)) { 
+        /* Provide temporary, self-signed certificate as fallback, so that
+         * clients do not get obscure TLS handshake errors or will see a fallback
+         * virtual host that is not intended to be served here. */
+         
+        md_store_get_fname(&files->pkeyfile, store, MD_SG_DOMAINS, 
+                           md->name, MD_FN_FALLBACK_PKEY, p);
+        md_store_get_fname(&files->certfile, store, MD_SG_DOMAINS, 
+                           md->name, MD_FN_FALLBACK_CERT, p);
+        if (!fexists(files->pkeyfile, p) || !fexists(files->certfile, p)) { 
+            if (APR_SUCCESS != (rv = setup_fallback_cert(store, md, p))) {
+                ap_log_error(APLOG_MARK, APLOG_TRACE1, rv, s,  
+                             "%s: setup fallback certificate", md->name);
+                return rv;
+            }
+        }
+        files->fallback = 1;
+        return APR_EAGAIN;
+    }
+
+    /* We have key and cert files, but they might no longer be valid or not
+     * match all domain names. Still use these files for now, but indicate that 
+     * resources should no longer be served until we have a new certificate again. */
+    if (md->state != MD_S_COMPLETE) {
+        return APR_EAGAIN;
+    }
+    return APR_SUCCESS;
+}
+
 static apr_status_t md_get_certificate(server_rec *s, apr_pool_t *p,
                                        const char **pkeyfile, const char **pcertfile)
 {
     apr_status_t rv = APR_ENOENT;    
     md_srv_conf_t *sc;
-    md_reg_t *reg;
-    md_store_t *store;
-    const md_t *md;
+    md_cred_files_t *files;
     
     *pkeyfile = NULL;
     *pcertfile = NULL;
@@ -1076,54 +1968,174 @@ static apr_status_t md_get_certificate(server_rec *s, apr_pool_t *p,
     
     if (sc && sc->assigned) {
         assert(sc->mc);
-        reg = sc->mc->reg;
-        assert(reg);
-        store = md_reg_store_get(reg);
-        assert(store);
+        assert(sc->mc->reg);
 
-        md = md_reg_get(reg, sc->assigned->name, p);
+        files = sc->mc->cred_files? 
+            apr_hash_get(sc->mc->cred_files, sc->assigned->name, APR_HASH_KEY_STRING) : NULL;
+        if (!files) {
+            apr_pool_t *pfiles = sc->mc->cred_files? 
+                apr_hash_pool_get(sc->mc->cred_files) : p;
             
-        if (APR_SUCCESS != (rv = md_reg_get_cred_files(reg, md, p, pkeyfile, pcertfile))) {
-            ap_log_error(APLOG_MARK, APLOG_ERR, rv, s, APLOGNO() 
-                         "retrieving credentials for MD %s", md->name);
-            return rv;
-        }
-
-        if (!fexists(*pkeyfile, p) || !fexists(*pcertfile, p)) { 
-            /* Provide temporary, self-signed certificate as fallback, so that
-             * clients do not get obscure TLS handshake errors or will see a fallback
-             * virtual host that is not intended to be served here. */
-             
-            md_store_get_fname(pkeyfile, store, MD_SG_DOMAINS, 
-                               md->name, MD_FN_FALLBACK_PKEY, p);
-            md_store_get_fname(pcertfile, store, MD_SG_DOMAINS, 
-                               md->name, MD_FN_FALLBACK_CERT, p);
-            if (!fexists(*pkeyfile, p) || !fexists(*pcertfile, p)) { 
-                if (APR_SUCCESS != (rv = setup_fallback_cert(store, md, p))) {
-                    ap_log_error(APLOG_MARK, APLOG_TRACE1, rv, s,  
-                                 "%s: setup fallback certificate", md->name);
-                    return rv;
-                }
+            files = apr_pcalloc(pfiles, sizeof(*files));
+            files->rv = calc_cred_files(files, sc->mc->reg, sc->assigned->name, pfiles, s);
+            if (sc->mc->cred_files) {
+                apr_hash_set(sc->mc->cred_files, apr_pstrdup(pfiles, sc->assigned->name),
+                             APR_HASH_KEY_STRING, files);
             }
-            
+        }
+        
+        rv = files->rv;
+        if (APR_SUCCESS == rv || APR_STATUS_IS_EAGAIN(rv)) {
+            *pkeyfile = files->pkeyfile;
+            *pcertfile = files->certfile;
+        }
+        if (files->fallback) {
             ap_log_error(APLOG_MARK, APLOG_TRACE1, 0, s,  
                          "%s: providing fallback certificate for server %s", 
-                         md->name, s->server_hostname);
-            return APR_EAGAIN;
+                         files->md->name, s->server_hostname);
+        }
+        else if (APR_SUCCESS == rv) {
+            ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10077) 
+                         "%s: providing certificate for server %s", 
+                         files->md->name, s->server_hostname);
+        }
+    }
+    return rv;
+}
+
+/* tls-sni-01 challenge credentials are looked up inside the TLS handshake. Each child
+ * keeps the decoded certificate and key per servername, for as long as the generation
+ * of challenges in the shared table stays the same. The watchdog changes it when it
+ * writes new challenges or finds the ones of completed authorizations purged. The
+ * handshake then only compares the generation and does a hash lookup. */
+typedef struct {
+    apr_pool_t *p;
+    const char *servername;
+    md_cert_t *cert;
+    md_pkey_t *pkey;
+} md_sni_cha_t;
+
+static apr_pool_t *sni_cha_pool;
+static apr_hash_t *sni_chas;
+static volatile apr_uint32_t sni_cha_loaded_gen;
+#if APR_HAS_THREADS
+static apr_thread_mutex_t *sni_cha_mutex;
+#endif
+
+static void sni_cha_cache_init(apr_pool_t *pchild, server_rec *s)
+{
+    apr_status_t rv;
+    
+    if (!sni_cha_gen) {
+        /* without the shared generation, we would not know when to forget anything */
+        return;
+    }
+    if (APR_SUCCESS != (rv = apr_pool_create(&sni_cha_pool, pchild))) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO() 
+                     "creating tls-sni-01 challenge cache");
+        sni_cha_pool = NULL;
+        return;
+    }
+    apr_pool_tag(sni_cha_pool, "md_sni_cha");
+    sni_chas = apr_hash_make(sni_cha_pool);
+    apr_atomic_set32(&sni_cha_loaded_gen, apr_atomic_read32(sni_cha_gen));
+#if APR_HAS_THREADS
+    if (APR_SUCCESS != (rv = apr_thread_mutex_create(&sni_cha_mutex, 
+                                                     APR_THREAD_MUTEX_DEFAULT, sni_cha_pool))) {
+        ap_log_error(APLOG_MARK, APLOG_WARNING, rv, s, APLOGNO() 
+                     "creating tls-sni-01 challenge cache mutex");
+        apr_pool_destroy(sni_cha_pool);
+        sni_cha_pool = NULL;
+        sni_chas = NULL;
+    }
+#endif
+}
+
+static int sni_cha_is_stale(void)
+{
+    return apr_atomic_read32(sni_cha_gen) != apr_atomic_read32(&sni_cha_loaded_gen);
+}
+
+/* Forget all entries when the challenges have changed since they were loaded. 
+ * Call with the mutex held. */
+static void sni_cha_sweep(apr_pool_t *ptemp)
+{
+    apr_hash_index_t *hi;
+    apr_uint32_t gen;
+    void *val;
+    md_sni_cha_t *cha;
+    
+    gen = apr_atomic_read32(sni_cha_gen);
+    if (gen != apr_atomic_read32(&sni_cha_loaded_gen)) {
+        for (hi = apr_hash_first(ptemp, sni_chas); hi; hi = apr_hash_next(hi)) {
+            apr_hash_this(hi, NULL, NULL, &val);
+            cha = val;
+            apr_hash_set(sni_chas, cha->servername, APR_HASH_KEY_STRING, NULL);
+            apr_pool_destroy(cha->p);
         }
+        /* before loading anything, a change while we do so is seen next time */
+        apr_atomic_set32(&sni_cha_loaded_gen, gen);
+    }
+}
 
-        /* We have key and cert files, but they might no longer be valid or not
-         * match all domain names. Still use these files for now, but indicate that 
-         * resources should no longer be served until we have a new certificate again. */
-        if (md->state != MD_S_COMPLETE) {
-            return APR_EAGAIN;
+static apr_status_t sni_cha_load(md_sni_cha_t **pcha, md_store_t *store, 
+                                 const char *servername)
+{
+    md_sni_cha_t *cha;
+    apr_pool_t *p;
+    apr_status_t rv;
+    
+    *pcha = NULL;
+    if (APR_SUCCESS != (rv = apr_pool_create(&p, sni_cha_pool))) {
+        return rv;
+    }
+    cha = apr_pcalloc(p, sizeof(*cha));
+    cha->p = p;
+    cha->servername = apr_pstrdup(p, servername);
+    
+    if (APR_SUCCESS == (rv = md_store_load(store, MD_SG_CHALLENGES, servername, 
+                                           MD_FN_TLSSNI01_CERT, MD_SV_CERT, 
+                                           (void**)&cha->cert, p))
+        && APR_SUCCESS == (rv = md_store_load(store, MD_SG_CHALLENGES, servername, 
+                                              MD_FN_TLSSNI01_PKEY, MD_SV_PKEY, 
+                                              (void**)&cha->pkey, p))) {
+        if (md_cert_get_X509(cha->cert) && md_pkey_get_EVP_PKEY(cha->pkey)) {
+            *pcha = cha;
+            return APR_SUCCESS;
         }
-        ap_log_error(APLOG_MARK, APLOG_DEBUG, 0, s, APLOGNO(10077) 
-                     "%s: providing certificate for server %s", md->name, s->server_hostname);
+        rv = APR_EINVAL;
     }
+    apr_pool_destroy(p);
     return rv;
 }
 
+static apr_status_t sni_cha_get(md_sni_cha_t **pcha, md_store_t *store, 
+                                const char *servername, apr_pool_t *ptemp)
+{
+    md_sni_cha_t *cha;
+    apr_status_t rv = APR_SUCCESS;
+    
+    sni_cha_sweep(ptemp);
+    cha = apr_hash_get(sni_chas, servername, APR_HASH_KEY_STRING);
+    if (!cha && APR_SUCCESS == (rv = sni_cha_load(&cha, store, servername))) {
+        apr_hash_set(sni_chas, cha->servername, APR_HASH_KEY_STRING, cha);
+    }
+    *pcha = cha;
+    return rv;
+}
+
+static apr_status_t free_X509(void *data)
+{
+    X509_free(data);
+    return APR_SUCCESS;
+}
+
+static apr_status_t free_EVP_PKEY(void *data)
+{
+    EVP_PKEY_free(data);
+    return APR_SUCCESS;
+}
+
 static int md_is_challenge(conn_rec *c, const char *servername,
                            X509 **pcert, EVP_PKEY **pkey)
 {
@@ -1131,6 +2143,17 @@ static int md_is_challenge(conn_rec *c, const char *servername,
     apr_size_t slen, sufflen = sizeof(MD_TLSSNI01_DNS_SUFFIX) - 1;
     apr_status_t rv;
 
+    if (sni_chas && sni_cha_is_stale()) {
+        /* free what completed authorizations left behind, challenge or not */
+#if APR_HAS_THREADS
+        apr_thread_mutex_lock(sni_cha_mutex);
+#endif
+        sni_cha_sweep(c->pool);
+#if APR_HAS_THREADS
+        apr_thread_mutex_unlock(sni_cha_mutex);
+#endif
+    }
+    
     slen = strlen(servername);
     if (slen <= sufflen 
         || apr_strnatcasecmp(MD_TLSSNI01_DNS_SUFFIX, servername + slen - sufflen)) {
@@ -1140,9 +2163,42 @@ static int md_is_challenge(conn_rec *c, const char *servername,
     sc = md_config_get(c->base_server);
     if (sc && sc->mc->reg) {
         md_store_t *store = md_reg_store_get(sc->mc->reg);
+        md_sni_cha_t *cha;
         md_cert_t *mdcert;
         md_pkey_t *mdpkey;
         
+        if (sni_chas) {
+#if APR_HAS_THREADS
+            apr_thread_mutex_lock(sni_cha_mutex);
+#endif
+            rv = sni_cha_get(&cha, store, servername, c->pool);
+            if (APR_SUCCESS == rv) {
+                /* hand out our own references, the cache may drop its entry anytime */
+                *pcert = md_cert_get_X509(cha->cert);
+                *pkey = md_pkey_get_EVP_PKEY(cha->pkey);
+#if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
+                CRYPTO_add(&(*pcert)->references, 1, CRYPTO_LOCK_X509);
+                CRYPTO_add(&(*pkey)->references, 1, CRYPTO_LOCK_EVP_PKEY);
+#else
+                X509_up_ref(*pcert);
+                EVP_PKEY_up_ref(*pkey);
+#endif
+                apr_pool_cleanup_register(c->pool, *pcert, free_X509, apr_pool_cleanup_null);
+                apr_pool_cleanup_register(c->pool, *pkey, free_EVP_PKEY, apr_pool_cleanup_null);
+            }
+#if APR_HAS_THREADS
+            apr_thread_mutex_unlock(sni_cha_mutex);
+#endif
+            if (APR_SUCCESS == rv) {
+                ap_log_cerror(APLOG_MARK, APLOG_INFO, 0, c, APLOGNO(10078)
+                              "%s: is a tls-sni-01 challenge host", servername);
+                return 1;
+            }
+            ap_log_cerror(APLOG_MARK, APLOG_INFO, rv, c, APLOGNO(10080)
+                          "%s: unknown TLS SNI challenge host", servername);
+            goto out;
+        }
+        
         rv = md_store_load(store, MD_SG_CHALLENGES, servername, 
                            MD_FN_TLSSNI01_CERT, MD_SV_CERT, (void**)&mdcert, c->pool);
         if (APR_SUCCESS == rv && (*pcert = md_cert_get_X509(mdcert))) {
@@ -1161,6 +2217,7 @@ static int md_is_challenge(conn_rec *c, const char *servername,
                           "%s: unknown TLS SNI challenge host", servername);
         }
     }
+out:
     *pcert = NULL;
     *pkey = NULL;
     return 0;
@@ -1193,8 +2250,13 @@ static int md_http_challenge_pr(request_rec *r)
                 ap_log_rerror(APLOG_MARK, APLOG_DEBUG, 0, r, 
                               "Challenge for %s (%s)", r->hostname, r->uri);
 
-                rv = md_store_load(store, MD_SG_CHALLENGES, r->hostname, 
-                                   MD_FN_HTTP01, MD_SV_TEXT, (void**)&data, r->pool);
+                if (NULL != (data = cha_table_get(r->hostname, name, r->pool))) {
+                    rv = APR_SUCCESS;
+                }
+                else {
+                    rv = md_store_load(store, MD_SG_CHALLENGES, r->hostname, 
+                                       MD_FN_HTTP01, MD_SV_TEXT, (void**)&data, r->pool);
+                }
                 if (APR_SUCCESS == rv) {
                     apr_size_t len = strlen(data);
                     
@@ -1284,8 +2346,7 @@ static int md_require_https_maybe(request_rec *r)
  */
 static void md_child_init(apr_pool_t *pool, server_rec *s)
 {
-    (void)pool;
-    (void)s;
+    sni_cha_cache_init(pool, s);
 }
 
 /* Install this module into the apache2 infrastructure.
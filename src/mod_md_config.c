@@ -46,7 +46,10 @@
 #define MD_CMD_RENEWWINDOW    "MDRenewWindow"
 #define MD_CMD_REQUIREHTTPS   "MDRequireHttps"
 #define MD_CMD_STOREDIR       "MDStoreDir"
+#define MD_CMD_STOREWATCH     "MDStoreWatch"
 #define MD_CMD_NOTIFYCMD      "MDNotifyCmd"
+#define MD_CMD_MAXPARALLEL    "MDMaxParallelRenewals"
+#define MD_CMD_MAXREQUESTS    "MDMaxParallelRequests"
 
 #define DEF_VAL     (-1)
 
@@ -64,6 +67,10 @@ static md_mod_conf_t defmc = {
     NULL,
     NULL,
     NULL,
+    1,
+    MD_MAX_REQUESTS_DEF,
+    1,
+    NULL,
 };
 
 /* Default server specific setting */
@@ -744,6 +751,27 @@ static const char *md_config_set_pkeys(cmd_parms *cmd, void *dc,
         config->pkey_spec->params.rsa.bits = (unsigned int)bits;
         return NULL;
     }
+    else if (!apr_strnatcasecmp("EC", ptype)) {
+        const char *curve = MD_PKEY_EC_CURVE_DEF;
+        
+        if (argc == 2) {
+            curve = md_pkey_ec_curve_name(argv[1]);
+            if (!curve) {
+                return apr_psprintf(cmd->pool, "unsupported curve '%s', use P-256 or P-384", 
+                                    argv[1]);
+            }
+        }
+        else if (argc > 2) {
+            return "key type 'EC' has only one optional parameter, the curve name";
+        }
+
+        if (!config->pkey_spec) {
+            config->pkey_spec = apr_pcalloc(cmd->pool, sizeof(*config->pkey_spec));
+        }
+        config->pkey_spec->type = MD_PKEY_TYPE_EC;
+        config->pkey_spec->params.ec.curve = curve;
+        return NULL;
+    }
     return apr_pstrcat(cmd->pool, "unsupported private key type \"", ptype, "\"", NULL);
 }
 
@@ -760,6 +788,64 @@ static const char *md_config_set_notify_cmd(cmd_parms *cmd, void *arg, const cha
     return NULL;
 }
 
+static const char *md_config_set_max_parallel(cmd_parms *cmd, void *arg, const char *value)
+{
+    md_srv_conf_t *sc = md_config_get(cmd->server);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    int n;
+
+    (void)arg;
+    if (err) {
+        return err;
+    }
+    n = (int)apr_atoi64(value);
+    if (n <= 0) {
+        return "number of parallel renewals must be a positive number";
+    }
+    sc->mc->max_parallel_renewals = n;
+    return NULL;
+}
+
+static const char *md_config_set_max_requests(cmd_parms *cmd, void *arg, const char *value)
+{
+    md_srv_conf_t *sc = md_config_get(cmd->server);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+    int n;
+
+    (void)arg;
+    if (err) {
+        return err;
+    }
+    n = (int)apr_atoi64(value);
+    if (n <= 0) {
+        return "number of parallel requests must be a positive number";
+    }
+    sc->mc->max_parallel_requests = n;
+    return NULL;
+}
+
+static const char *md_config_set_store_watch(cmd_parms *cmd, void *arg, const char *value)
+{
+    md_srv_conf_t *sc = md_config_get(cmd->server);
+    const char *err = ap_check_cmd_context(cmd, GLOBAL_ONLY);
+
+    (void)arg;
+    if (err) {
+        return err;
+    }
+    if (!apr_strnatcasecmp("off", value)) {
+        sc->mc->store_watch = 0;
+    }
+    else if (!apr_strnatcasecmp("on", value)) {
+        sc->mc->store_watch = 1;
+    }
+    else {
+        return apr_pstrcat(cmd->pool, "unknown '", value, 
+                           "', supported parameter values are 'on' and 'off'", NULL);
+    }
+    return NULL;
+}
+
 const command_rec md_cmds[] = {
     AP_INIT_TAKE1(     MD_CMD_CA, md_config_set_ca, NULL, RSRC_CONF, 
                   "URL of CA issueing the certificates"),
@@ -794,12 +880,18 @@ const command_rec md_cmds[] = {
                   "URL of a HTTP(S) proxy to use for outgoing connections"),
     AP_INIT_TAKE1(     MD_CMD_STOREDIR, md_config_set_store_dir, NULL, RSRC_CONF, 
                   "the directory for file system storage of managed domain data."),
+    AP_INIT_TAKE1(     MD_CMD_STOREWATCH, md_config_set_store_watch, NULL, RSRC_CONF, 
+                  "Watch the store directories for changes, where the system supports it."),
     AP_INIT_TAKE1(     MD_CMD_RENEWWINDOW, md_config_set_renew_window, NULL, RSRC_CONF, 
                   "Time length for renewal before certificate expires (defaults to days)"),
     AP_INIT_TAKE1(     MD_CMD_REQUIREHTTPS, md_config_set_require_https, NULL, RSRC_CONF, 
                   "Redirect non-secure requests to the https: equivalent."),
     AP_INIT_TAKE1(     MD_CMD_NOTIFYCMD, md_config_set_notify_cmd, NULL, RSRC_CONF, 
                   "set the command to run when signup/renew of domain is complete."),
+    AP_INIT_TAKE1(     MD_CMD_MAXPARALLEL, md_config_set_max_parallel, NULL, RSRC_CONF, 
+                  "the maximum number of managed domains renewed at the same time."),
+    AP_INIT_TAKE1(     MD_CMD_MAXREQUESTS, md_config_set_max_requests, NULL, RSRC_CONF, 
+                  "the maximum number of requests a renewal has open at the CA at the same time."),
     AP_INIT_TAKE1(NULL, NULL, NULL, RSRC_CONF, NULL)
 };
 
@@ -52,6 +52,10 @@ typedef struct {
     apr_array_header_t *unused_names;  /* post config, names of all MDs not assigned to a vhost */
 
     const char *notify_cmd;            /* notification command to execute on signup/renew */
+    int max_parallel_renewals;         /* max number of MDs renewed by the watchdog at a time */
+    int max_parallel_requests;         /* max number of requests to the CA in flight per MD */
+    int store_watch;                   /* != 0 iff store changes are watched for (where supported) */
+    struct apr_hash_t *cred_files;     /* post config, MD name -> credential files, computed once */
 } md_mod_conf_t;
 
 typedef struct md_srv_conf_t {
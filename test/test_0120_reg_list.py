@@ -111,6 +111,17 @@ class TestRegAdd :
         copyfile(self._path_conf_ssl("valid_cert.req"), TestEnv.path_domain_privkey(name))
         assert TestEnv.a2md([ "list", name ])['jout']['output'][0]['state'] == TestEnv.MD_S_ERROR
 
+    def test_120_005(self):
+        # test case: find mds by domain name, a wildcard covers a single label only
+        assert TestEnv.a2md( [ "store", "add", "example.org", "*.example.org" ] )['rv'] == 0
+        assert TestEnv.a2md( [ "store", "add", "test120-005.org", "www.test120-005.org" ] )['rv'] == 0
+        for dns in [ "example.org", "www.example.org", "WWW.Example.org" ]:
+            assert TestEnv.a2md( [ "list", dns ] )['jout']['output'][0]['name'] == "example.org"
+        assert TestEnv.a2md( [ "list", "www.test120-005.org" ] )['jout']['output'][0]['name'] == "test120-005.org"
+        for dns in [ "a.www.example.org", ".example.org", "*x.example.org", "www.example.org.", 
+                     "mail.test120-005.org" ]:
+            assert TestEnv.a2md( [ "list", dns ] )['rv'] != 0
+
     # --------- _utils_ ---------
 
     def _path_conf_ssl(self, name):
@@ -193,3 +193,9 @@ class TestConf:
         TestEnv.install_test_conf(confFile);
         assert TestEnv.apache_restart() == 1, "Server accepted test config {}".format(confFile)
         assert expErrMsg in TestEnv.apachectl_stderr
+
+    def test_300_021(self):
+        # vhost matches one MD by name and another by a wildcard alias
+        assert TestEnv.apache_stop() == 0
+        TestEnv.install_test_conf("test_021");
+        assert TestEnv.apache_fail() == 0
@@ -243,6 +243,16 @@ class TestConf:
 
     # --------- remove from store ---------
 
+    def test_310_123(self):
+        # test case: auto member setting survives the sync of an existing md
+        TestEnv.install_test_conf("member_auto");
+        assert TestEnv.apache_restart() == 0
+        assert TestEnv.a2md(["list"])['jout']['output'][0]['transitive'] == 1
+        assert TestEnv.apache_restart() == 0
+        md = TestEnv.a2md(["list"])['jout']['output'][0]
+        assert md['transitive'] == 1
+        assert md['domains'] == [ 'testdomain.org', 'test.testdomain.org', 'mail.testdomain.org' ]
+
     def test_310_200(self):
         # test case: remove managed domain from config
         dnsList = ["testdomain.org", "www.testdomain.org", "mail.testdomain.org"]
@@ -411,6 +421,19 @@ class TestConf:
         self._check_md_names("testdomain.org", ["testdomain.org", "www.testdomain.org", "mail.testdomain.org"], 1, 2)
         self._check_md_names("testdomain2.org", ["testdomain2.org", "www.testdomain2.org", "mail.testdomain2.org"], 1, 2)
 
+    def test_310_301a(self):
+        # test case: move DNS names along a chain of mds in one sync
+        TestEnv.a2md([ "add", "testdomain.org", "www.testdomain.org", "mail.testdomain.org" ])
+        TestEnv.a2md([ "add", "testdomain2.org", "www.testdomain2.org", "mail.testdomain2.org" ])
+        TestEnv.a2md([ "add", "testdomain3.org" ])
+        self._check_md_names("testdomain3.org", ["testdomain3.org"], 1, 3)
+        
+        TestEnv.install_test_conf("chained_mds");
+        assert TestEnv.apache_restart() == 0
+        self._check_md_names("testdomain3.org", ["testdomain3.org", "mail.testdomain.org"], 1, 3)
+        self._check_md_names("testdomain.org", ["testdomain.org", "www.testdomain.org", "mail.testdomain2.org"], 1, 3)
+        self._check_md_names("testdomain2.org", ["testdomain2.org", "www.testdomain2.org"], 1, 3)
+
     def test_310_302(self):
         # test case: change ca info
         # setup: add md with ca info
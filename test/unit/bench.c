@@ -0,0 +1,50 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "test_common.h"
+
+#include <apr_general.h>
+
+static Suite *bench_suite(void)
+{
+    Suite *suite = suite_create("bench");
+
+    suite_add_tcase(suite, md_json_bench_case());
+    suite_add_tcase(suite, md_util_bench_case());
+
+    return suite;
+}
+
+int main(int argc, const char * const argv[])
+{
+    SRunner *runner;
+    int failed;
+
+    /* Initialize APR and create our benchmark runner. */
+    apr_app_initialize(&argc, &argv, NULL);
+    runner = srunner_create(bench_suite());
+
+    /* Log TAP to stdout, the timings go to stderr. */
+    srunner_set_tap(runner, "-");
+
+    /* Run the benchmarks and collect failures. */
+    srunner_run_all(runner, CK_SILENT /* output only TAP */);
+    failed = srunner_ntests_failed(runner);
+
+    /* Clean up. */
+    srunner_free(runner);
+    apr_terminate();
+
+    return failed ? 1 : 0;
+}
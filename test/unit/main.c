@@ -20,7 +20,12 @@ static Suite *main_test_suite(void)
 {
     Suite *suite = suite_create("main");
 
+    suite_add_tcase(suite, md_crypt_test_case());
     suite_add_tcase(suite, md_json_test_case());
+    suite_add_tcase(suite, md_jws_test_case());
+    suite_add_tcase(suite, md_store_cache_test_case());
+    suite_add_tcase(suite, md_store_db_test_case());
+    suite_add_tcase(suite, md_store_fs_test_case());
     suite_add_tcase(suite, md_util_test_case());
 
     return suite;
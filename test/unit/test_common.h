@@ -17,6 +17,7 @@
  */
 
 #include <apr.h>   /* for pid_t on Windows, needed by Check */
+#include <apr_pools.h>
 #include <check.h>
 
 /*
@@ -32,13 +33,39 @@
               ck_assert(!memcmp((a), (b), (len)))
 #  define ck_assert_ptr_nonnull(p) \
               ck_assert((p) != NULL)
+#  define ck_assert_ptr_null(p) \
+              ck_assert((p) == NULL)
 #endif
 
+/*
+ * Fixture helpers, see test_util.c.
+ *
+ * test_tmp_dir_setup() creates a pool and returns the path of a temporary directory
+ * for this process, named after the test case. Anything left there by an earlier
+ * run is removed, the directory itself is not created. Exits on failure.
+ * test_tmp_dir_teardown() removes the directory again and destroys the pool.
+ */
+const char *test_tmp_dir_setup(apr_pool_t **ppool, const char *name);
+void test_tmp_dir_teardown(apr_pool_t *pool, const char *dir);
+
 /*
  * A list of Check test case declarations, usually one per source file. Add your
  * test case here when adding a new source file, then add it to the
  * main_test_suite() in main.c.
  */
 
+TCase *md_crypt_test_case(void);
 TCase *md_json_test_case(void);
+TCase *md_jws_test_case(void);
+TCase *md_store_cache_test_case(void);
+TCase *md_store_db_test_case(void);
+TCase *md_store_fs_test_case(void);
 TCase *md_util_test_case(void);
+
+/*
+ * Benchmarks, run by bench.c only and not part of the unit tests. They report
+ * their timings on stderr. Build and run them with "make bench".
+ */
+
+TCase *md_json_bench_case(void);
+TCase *md_util_bench_case(void);
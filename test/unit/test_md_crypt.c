@@ -0,0 +1,198 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <openssl/bn.h>
+#include <openssl/ec.h>
+#include <openssl/ecdsa.h>
+#include <openssl/evp.h>
+#include <openssl/obj_mac.h>
+
+#include <apr_strings.h>
+
+#include "test_common.h"
+#include "md.h"
+#include "md_crypt.h"
+#include "md_json.h"
+#include "md_util.h"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+
+static void md_crypt_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS
+        || md_crypt_init(g_pool) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void md_crypt_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+static md_pkey_t *gen_ec_key(const char *curve)
+{
+    md_pkey_spec_t spec;
+    md_pkey_t *pkey;
+
+    spec.type = MD_PKEY_TYPE_EC;
+    spec.params.ec.curve = curve;
+    ck_assert_int_eq(APR_SUCCESS, md_pkey_gen(&pkey, g_pool, &spec));
+    ck_assert_ptr_nonnull(pkey);
+    return pkey;
+}
+
+static BIGNUM *bn_from64(const char *s64, apr_size_t expected_len)
+{
+    const char *bin;
+    apr_size_t len;
+
+    len = md_util_base64url_decode(&bin, s64, g_pool);
+    ck_assert_int_eq(expected_len, len);
+    return BN_bin2bn((const unsigned char *)bin, (int)len, NULL);
+}
+
+/* The public key as a verifier sees it, made from the JWK alone */
+static EC_KEY *ec_from_jwk(md_json_t *jwk, int nid, apr_size_t flen)
+{
+    EC_KEY *ec;
+    BIGNUM *x, *y;
+
+    ck_assert_ptr_nonnull(ec = EC_KEY_new_by_curve_name(nid));
+    x = bn_from64(md_json_gets(jwk, "x", NULL), flen);
+    y = bn_from64(md_json_gets(jwk, "y", NULL), flen);
+    ck_assert_int_eq(1, EC_KEY_set_public_key_affine_coordinates(ec, x, y));
+    BN_free(x);
+    BN_free(y);
+    return ec;
+}
+
+/* Verify a JWS ES256/ES384 signature, which is r||s of flen bytes each */
+static int ec_verify(EC_KEY *ec, const EVP_MD *md, apr_size_t flen,
+                     const char *data, const char *sig64)
+{
+    unsigned char digest[EVP_MAX_MD_SIZE];
+    unsigned int dlen;
+    ECDSA_SIG *sig;
+    BIGNUM *r, *s;
+    const char *bin;
+    apr_size_t len;
+    int ok;
+
+    len = md_util_base64url_decode(&bin, sig64, g_pool);
+    ck_assert_int_eq(2 * flen, len);
+    r = BN_bin2bn((const unsigned char *)bin, (int)flen, NULL);
+    s = BN_bin2bn((const unsigned char *)bin + flen, (int)flen, NULL);
+    sig = ECDSA_SIG_new();
+#if OPENSSL_VERSION_NUMBER < 0x10100000L || defined(LIBRESSL_VERSION_NUMBER)
+    BN_free(sig->r);
+    BN_free(sig->s);
+    sig->r = r;
+    sig->s = s;
+#else
+    ECDSA_SIG_set0(sig, r, s);
+#endif
+    ck_assert_int_eq(1, EVP_Digest(data, strlen(data), digest, &dlen, md, NULL));
+    ok = ECDSA_do_verify(digest, (int)dlen, sig, ec);
+    ECDSA_SIG_free(sig);
+    return ok;
+}
+
+static void ec_sign_verify(const char *curve, int nid, const EVP_MD *md,
+                           const char *alg, apr_size_t flen)
+{
+    md_pkey_t *pkey = gen_ec_key(curve);
+    md_json_t *jwk;
+    EC_KEY *ec;
+    const char *sig;
+
+    ck_assert_str_eq(alg, md_pkey_get_jws_alg(pkey));
+    ck_assert_ptr_nonnull(jwk = md_pkey_get_jwk(pkey));
+    ec = ec_from_jwk(jwk, nid, flen);
+
+    ck_assert_int_eq(APR_SUCCESS, md_crypt_sign64(&sig, pkey, g_pool, "hello", 5));
+    ck_assert_int_eq(1, ec_verify(ec, md, flen, "hello", sig));
+    /* and again, with the reused signing context */
+    ck_assert_int_eq(APR_SUCCESS, md_crypt_sign64(&sig, pkey, g_pool, "world", 5));
+    ck_assert_int_eq(1, ec_verify(ec, md, flen, "world", sig));
+    ck_assert_int_ne(1, ec_verify(ec, md, flen, "hello", sig));
+    EC_KEY_free(ec);
+}
+
+/*
+ * Tests
+ */
+
+START_TEST(md_crypt_ec_gen)
+{
+    md_pkey_t *pkey;
+    md_json_t *jwk;
+    EC_KEY *ec, *pub;
+
+    pkey = gen_ec_key("P-256");
+    ck_assert_int_eq(MD_PKEY_TYPE_EC, md_pkey_get_type(pkey));
+    ck_assert_str_eq("P-256", md_pkey_get_ec_crv(pkey));
+
+    ck_assert_ptr_nonnull(ec = EVP_PKEY_get1_EC_KEY(md_pkey_get_EVP_PKEY(pkey)));
+    ck_assert_int_eq(NID_X9_62_prime256v1, EC_GROUP_get_curve_name(EC_KEY_get0_group(ec)));
+    ck_assert_int_eq(1, EC_KEY_check_key(ec));
+    /* clients refuse keys with explicit curve parameters */
+    ck_assert_int_eq(OPENSSL_EC_NAMED_CURVE,
+                     EC_GROUP_get_asn1_flag(EC_KEY_get0_group(ec)) & OPENSSL_EC_NAMED_CURVE);
+
+    /* the JWK carries the public point of the generated key */
+    jwk = md_pkey_get_jwk(pkey);
+    ck_assert_str_eq("EC", md_json_gets(jwk, "kty", NULL));
+    ck_assert_str_eq("P-256", md_json_gets(jwk, "crv", NULL));
+    ck_assert_str_eq(md_pkey_get_ec_x64(pkey, g_pool), md_json_gets(jwk, "x", NULL));
+    ck_assert_str_eq(md_pkey_get_ec_y64(pkey, g_pool), md_json_gets(jwk, "y", NULL));
+    pub = ec_from_jwk(jwk, NID_X9_62_prime256v1, 32);
+    ck_assert_int_eq(0, EC_POINT_cmp(EC_KEY_get0_group(ec), EC_KEY_get0_public_key(ec),
+                                     EC_KEY_get0_public_key(pub), NULL));
+    EC_KEY_free(pub);
+    EC_KEY_free(ec);
+
+    pkey = gen_ec_key("secp384r1");
+    ck_assert_str_eq("P-384", md_pkey_get_ec_crv(pkey));
+    jwk = md_pkey_get_jwk(pkey);
+    ck_assert_str_eq("P-384", md_json_gets(jwk, "crv", NULL));
+    EC_KEY_free(ec_from_jwk(jwk, NID_secp384r1, 48));
+}
+END_TEST
+
+START_TEST(md_crypt_ec_sign)
+{
+    ec_sign_verify("P-256", NID_X9_62_prime256v1, EVP_sha256(), "ES256", 32);
+    ec_sign_verify("P-384", NID_secp384r1, EVP_sha384(), "ES384", 48);
+}
+END_TEST
+
+TCase *md_crypt_test_case(void)
+{
+    TCase *testcase = tcase_create("md_crypt");
+
+    tcase_add_checked_fixture(testcase, md_crypt_setup, md_crypt_teardown);
+
+    tcase_add_test(testcase, md_crypt_ec_gen);
+    tcase_add_test(testcase, md_crypt_ec_sign);
+
+    return testcase;
+}
@@ -12,10 +12,21 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <apr_buckets.h>
+#include <apr_date.h>
+#include <apr_file_io.h>
+#include <apr_strings.h>
+#include <apr_time.h>
 
 #include "test_common.h"
+#include "md.h"
+#include "md_crypt.h"
 #include "md_json.h"
+#include "md_util.h"
 
 /*
  * XXX To inspect pieces of the md_json_t struct, we need to include the jansson
@@ -317,6 +328,283 @@ START_TEST(json_writep_returns_NULL_for_corrupted_json_struct)
 }
 END_TEST
 
+START_TEST(json_write_streams)
+{
+    md_json_t *json = md_json_create(g_pool);
+    apr_bucket_alloc_t *ba;
+    apr_bucket_brigade *bb;
+    apr_file_t *f;
+    apr_off_t off = 0;
+    apr_size_t len;
+    char fname[] = "/tmp/md_json_XXXXXX", *buf;
+    const char *s;
+    int i;
+    
+    /* large enough to need several buffer flushes */
+    for (i = 0; i < 2000; ++i) {
+        md_json_sets(apr_psprintf(g_pool, "value-%d", i), json, 
+                     apr_psprintf(g_pool, "key-%d", i), NULL);
+    }
+    s = md_json_writep(json, g_pool, MD_JSON_FMT_INDENT);
+    ck_assert_ptr_nonnull(s);
+    ck_assert_int_gt(strlen(s), 16 * 1024);
+    
+    ck_assert_int_eq(apr_file_mktemp(&f, fname, 0, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_json_writef(json, g_pool, MD_JSON_FMT_INDENT, f), APR_SUCCESS);
+    ck_assert_int_eq(apr_file_seek(f, APR_SET, &off), APR_SUCCESS);
+    len = strlen(s) + 1;
+    buf = apr_pcalloc(g_pool, len);
+    ck_assert_int_eq(apr_file_read_full(f, buf, len, &len), APR_EOF);
+    ck_assert_int_eq(len, strlen(s));
+    ck_assert_str_eq(buf, s);
+    apr_file_close(f);
+    
+    s = md_json_writep(json, g_pool, MD_JSON_FMT_COMPACT);
+    ba = apr_bucket_alloc_create(g_pool);
+    bb = apr_brigade_create(g_pool, ba);
+    ck_assert_int_eq(md_json_writeb(json, MD_JSON_FMT_COMPACT, bb), APR_SUCCESS);
+    ck_assert_int_eq(apr_brigade_pflatten(bb, &buf, &len, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(len, strlen(s));
+    ck_assert_int_eq(memcmp(buf, s, len), 0);
+}
+END_TEST
+
+static md_json_t *write_read(md_json_t *json, md_json_fmt_t fmt, apr_size_t truncate)
+{
+    md_json_t *jread = NULL;
+    apr_file_t *f;
+    apr_finfo_t finfo;
+    char fname[] = "/tmp/md_json_XXXXXX";
+    
+    ck_assert_int_eq(apr_file_mktemp(&f, fname, 0, g_pool), APR_SUCCESS);
+    ck_assert_int_eq(md_json_writef(json, g_pool, fmt, f), APR_SUCCESS);
+    if (truncate) {
+        ck_assert_int_eq(apr_file_info_get(&finfo, APR_FINFO_SIZE, f), APR_SUCCESS);
+        ck_assert_int_eq(apr_file_trunc(f, finfo.size - (apr_off_t)truncate), APR_SUCCESS);
+    }
+    apr_file_flush(f);
+    if (APR_SUCCESS != md_json_readf(&jread, g_pool, fname)) {
+        jread = NULL;
+    }
+    apr_file_close(f);
+    return jread;
+}
+
+START_TEST(json_msgpack)
+{
+    md_json_t *jread, *json = md_json_create(g_pool);
+    apr_array_header_t *a;
+    const char *s;
+    long values[] = { 0, 1, 127, 128, 255, 256, 65535, 65536, 4294967295L, 4294967296L,
+                      -1, -32, -33, -128, -129, -32768, -32769, -2147483648L, -2147483649L };
+    int i;
+    
+    for (i = 0; i < (int)(sizeof(values)/sizeof(values[0])); ++i) {
+        md_json_setl(values[i], json, "longs", apr_itoa(g_pool, i), NULL);
+    }
+    md_json_setn(3.25, json, "double", NULL);
+    md_json_setb(1, json, "yes", NULL);
+    md_json_setb(0, json, "no", NULL);
+    md_json_sets("", json, "strings", "empty", NULL);
+    md_json_sets("0123456789012345678901234567890123456789", json, "strings", "str8", NULL);
+    md_json_sets(apr_psprintf(g_pool, "%0300d", 1), json, "strings", "str16", NULL);
+    a = apr_array_make(g_pool, 20, sizeof(const char *));
+    for (i = 0; i < 20; ++i) {
+        APR_ARRAY_PUSH(a, const char *) = apr_itoa(g_pool, i);
+    }
+    md_json_setsa(a, json, "array16", NULL);
+    
+    s = md_json_writep(json, g_pool, MD_JSON_FMT_COMPACT);
+    ck_assert_ptr_null(md_json_writep(json, g_pool, MD_JSON_FMT_MSGPACK));
+
+    jread = write_read(json, MD_JSON_FMT_MSGPACK, 0);
+    ck_assert_ptr_nonnull(jread);
+    ck_assert_str_eq(md_json_writep(jread, g_pool, MD_JSON_FMT_COMPACT), s);
+    /* text formats still read the same */
+    jread = write_read(json, MD_JSON_FMT_INDENT, 0);
+    ck_assert_ptr_nonnull(jread);
+    ck_assert_str_eq(md_json_writep(jread, g_pool, MD_JSON_FMT_COMPACT), s);
+    /* incomplete data is refused */
+    ck_assert_ptr_null(write_read(json, MD_JSON_FMT_MSGPACK, 1));
+}
+END_TEST
+
+START_TEST(paths)
+{
+    static const md_json_path_t P_A_B = { 2, { "a", "b" } };
+    md_json_path_t *p_a_c;
+    md_json_t *json = md_json_create(g_pool);
+    const char *s;
+    
+    p_a_c = md_json_path_make(g_pool, "a", "c", NULL);
+    ck_assert_int_eq(p_a_c->nkeys, 2);
+    
+    ck_assert_int_eq( md_json_path_has(json, &P_A_B), 0 );
+    ck_assert_int_eq( md_json_path_sets("text", json, &P_A_B), 0 );
+    ck_assert_int_eq( md_json_path_setl(42, json, p_a_c), 0 );
+    ck_assert_int_eq( md_json_path_has(json, &P_A_B), 1 );
+    ck_assert_str_eq( md_json_path_gets(json, &P_A_B), "text" );
+    ck_assert_int_eq( md_json_path_getl(json, p_a_c), 42 );
+    ck_assert_str_eq( md_json_gets(json, "a", "b", NULL), "text" );
+
+    s = md_json_writep(json, g_pool, MD_JSON_FMT_COMPACT);
+    ck_assert_str_eq(s, "{\"a\":{\"b\":\"text\",\"c\":42}}");
+}
+END_TEST
+
+/* md_from_json() as it was before the bulk decoder, walking every member with varargs */
+static md_t *md_from_json_varargs(md_json_t *json, apr_pool_t *p)
+{
+    md_t *md = md_create_empty(p);
+    const char *s;
+    
+    md->name = md_json_dups(p, json, MD_KEY_NAME, NULL);            
+    md_json_dupsa(md->domains, p, json, MD_KEY_DOMAINS, NULL);
+    md_json_dupsa(md->contacts, p, json, MD_KEY_CONTACTS, NULL);
+    md->ca_account = md_json_dups(p, json, MD_KEY_CA, MD_KEY_ACCOUNT, NULL);
+    md->ca_proto = md_json_dups(p, json, MD_KEY_CA, MD_KEY_PROTO, NULL);
+    md->ca_url = md_json_dups(p, json, MD_KEY_CA, MD_KEY_URL, NULL);
+    md->ca_agreement = md_json_dups(p, json, MD_KEY_CA, MD_KEY_AGREEMENT, NULL);
+    md->cert_url = md_json_dups(p, json, MD_KEY_CERT, MD_KEY_URL, NULL);
+    if (md_json_has_key(json, MD_KEY_PKEY, MD_KEY_TYPE, NULL)) {
+        md->pkey_spec = md_pkey_spec_from_json(md_json_getj(json, MD_KEY_PKEY, NULL), p);
+    }
+    md->state = (md_state_t)md_json_getl(json, MD_KEY_STATE, NULL);
+    md->drive_mode = (int)md_json_getl(json, MD_KEY_DRIVE_MODE, NULL);
+    md->transitive = (int)md_json_getl(json, MD_KEY_TRANSITIVE, NULL);
+    s = md_json_dups(p, json, MD_KEY_CERT, MD_KEY_EXPIRES, NULL);
+    if (s && *s) {
+        md->expires = apr_date_parse_rfc(s);
+    }
+    md->renew_window = apr_time_from_sec(md_json_getl(json, MD_KEY_RENEW_WINDOW, NULL));
+    if (md_json_has_key(json, MD_KEY_CA, MD_KEY_CHALLENGES, NULL)) {
+        md->ca_challenges = apr_array_make(p, 5, sizeof(const char*));
+        md_json_dupsa(md->ca_challenges, p, json, MD_KEY_CA, MD_KEY_CHALLENGES, NULL);
+    }
+    md->require_https = MD_REQUIRE_OFF;
+    s = md_json_gets(json, MD_KEY_REQUIRE_HTTPS, NULL);
+    if (s && !strcmp(MD_KEY_TEMPORARY, s)) {
+        md->require_https = MD_REQUIRE_TEMPORARY;
+    }
+    else if (s && !strcmp(MD_KEY_PERMANENT, s)) {
+        md->require_https = MD_REQUIRE_PERMANENT;
+    }
+    md->must_staple = (int)md_json_getb(json, MD_KEY_MUST_STAPLE, NULL);
+    return md;
+}
+
+static md_json_t *make_md_json(apr_pool_t *p, int full)
+{
+    md_t *md = md_create_empty(p);
+    
+    md->name = "example.org";
+    APR_ARRAY_PUSH(md->domains, const char *) = "example.org";
+    if (!full) {
+        return md_to_json(md, p);
+    }
+    APR_ARRAY_PUSH(md->domains, const char *) = "www.example.org";
+    APR_ARRAY_PUSH(md->contacts, const char *) = "mailto:admin@example.org";
+    md->ca_url = "https://acme.example.org/directory";
+    md->ca_proto = "ACME";
+    md->ca_account = "ACME-acme.example.org-0000";
+    md->ca_agreement = "https://acme.example.org/terms";
+    md->ca_challenges = apr_array_make(p, 2, sizeof(const char *));
+    APR_ARRAY_PUSH(md->ca_challenges, const char *) = "http-01";
+    APR_ARRAY_PUSH(md->ca_challenges, const char *) = "tls-sni-01";
+    md->cert_url = "https://acme.example.org/cert/1";
+    md->pkey_spec = apr_pcalloc(p, sizeof(*md->pkey_spec));
+    md->pkey_spec->type = MD_PKEY_TYPE_EC;
+    md->pkey_spec->params.ec.curve = "P-384";
+    md->expires = apr_time_from_sec(1500000000);
+    md->state = MD_S_COMPLETE;
+    md->drive_mode = MD_DRIVE_AUTO;
+    md->transitive = 1;
+    md->require_https = MD_REQUIRE_PERMANENT;
+    md->must_staple = 1;
+    md->renew_window = apr_time_from_sec(14 * MD_SECS_PER_DAY);
+    return md_to_json(md, p);
+}
+
+static void check_decode(md_json_t *json)
+{
+    md_t *md, *ref;
+    
+    md = md_from_json(json, g_pool);
+    ref = md_from_json_varargs(json, g_pool);
+    ck_assert_ptr_nonnull(md);
+    ck_assert_str_eq(md->name, ref->name);
+    ck_assert_int_eq(md_equal_domains(md, ref, 1), 1);
+    ck_assert_int_eq(md->contacts->nelts, ref->contacts->nelts);
+    ck_assert(md_array_str_eq(md->contacts, ref->contacts, 1));
+    ck_assert_pstr_eq(md->ca_url, ref->ca_url);
+    ck_assert_pstr_eq(md->ca_proto, ref->ca_proto);
+    ck_assert_pstr_eq(md->ca_account, ref->ca_account);
+    ck_assert_pstr_eq(md->ca_agreement, ref->ca_agreement);
+    ck_assert_int_eq(md->ca_challenges != NULL, ref->ca_challenges != NULL);
+    if (ref->ca_challenges) {
+        ck_assert(md_array_str_eq(md->ca_challenges, ref->ca_challenges, 1));
+    }
+    ck_assert_pstr_eq(md->cert_url, ref->cert_url);
+    ck_assert(md_pkey_spec_eq(md->pkey_spec, ref->pkey_spec));
+    ck_assert(md->expires == ref->expires);
+    ck_assert(md->renew_window == ref->renew_window);
+    ck_assert_int_eq(md->state, ref->state);
+    ck_assert_int_eq(md->drive_mode, ref->drive_mode);
+    ck_assert_int_eq(md->transitive, ref->transitive);
+    ck_assert_int_eq(md->require_https, ref->require_https);
+    ck_assert_int_eq(md->must_staple, ref->must_staple);
+}
+
+START_TEST(md_decode)
+{
+    md_t *md;
+    
+    check_decode(make_md_json(g_pool, 1));
+    check_decode(make_md_json(g_pool, 0));
+
+    md = md_from_json(make_md_json(g_pool, 1), g_pool);
+    ck_assert_int_eq(md->ca_challenges->nelts, 2);
+    ck_assert_str_eq(APR_ARRAY_IDX(md->ca_challenges, 1, const char *), "tls-sni-01");
+    ck_assert_int_eq(md->require_https, MD_REQUIRE_PERMANENT);
+    ck_assert_str_eq(md->pkey_spec->params.ec.curve, "P-384");
+    /* absent means off, not unset as for a freshly configured md */
+    md = md_from_json(make_md_json(g_pool, 0), g_pool);
+    ck_assert_int_eq(md->require_https, MD_REQUIRE_OFF);
+    ck_assert_ptr_null(md->pkey_spec);
+}
+END_TEST
+
+/*
+ * Benchmarks
+ */
+START_TEST(md_decode_bench)
+{
+    md_json_t *json = make_md_json(g_pool, 1);
+    apr_pool_t *ptemp;
+    apr_time_t start, t_varargs, t_bulk;
+    int i, n = 20000;
+    
+    apr_pool_create(&ptemp, g_pool);
+    start = apr_time_now();
+    for (i = 0; i < n; ++i) {
+        md_from_json_varargs(json, ptemp);
+        apr_pool_clear(ptemp);
+    }
+    t_varargs = apr_time_now() - start;
+    
+    start = apr_time_now();
+    for (i = 0; i < n; ++i) {
+        md_from_json(json, ptemp);
+        apr_pool_clear(ptemp);
+    }
+    t_bulk = apr_time_now() - start;
+    apr_pool_destroy(ptemp);
+    
+    fprintf(stderr, "md_from_json: %.2f usec/md with varargs, %.2f usec/md bulk\n",
+            (double)t_varargs / n, (double)t_bulk / n);
+}
+END_TEST
+
 TCase *md_json_test_case(void)
 {
     TCase *testcase = tcase_create("md_json");
@@ -334,8 +622,23 @@ TCase *md_json_test_case(void)
     tcase_add_test(testcase, string_arrays);
     tcase_add_test(testcase, json_arrays);
     tcase_add_test(testcase, objects);
+    tcase_add_test(testcase, json_write_streams);
+    tcase_add_test(testcase, json_msgpack);
+    tcase_add_test(testcase, paths);
+    tcase_add_test(testcase, md_decode);
 
     tcase_add_test(testcase, json_writep_returns_NULL_for_corrupted_json_struct);
 
     return testcase;
 }
+
+TCase *md_json_bench_case(void)
+{
+    TCase *testcase = tcase_create("md_json_bench");
+
+    tcase_add_checked_fixture(testcase, md_json_setup, md_json_teardown);
+
+    tcase_add_test(testcase, md_decode_bench);
+
+    return testcase;
+}
@@ -0,0 +1,141 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <apr_strings.h>
+#include <apr_tables.h>
+
+#include "test_common.h"
+#include "md.h"
+#include "md_crypt.h"
+#include "md_json.h"
+#include "md_jws.h"
+#include "md_util.h"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+
+static void md_jws_setup(void)
+{
+    if (apr_pool_create(&g_pool, NULL) != APR_SUCCESS
+        || md_crypt_init(g_pool) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void md_jws_teardown(void)
+{
+    apr_pool_destroy(g_pool);
+}
+
+static md_pkey_t *gen_key(md_pkey_type_t type)
+{
+    md_pkey_spec_t spec;
+    md_pkey_t *pkey;
+    
+    spec.type = type;
+    if (type == MD_PKEY_TYPE_EC) {
+        spec.params.ec.curve = "P-384";
+    }
+    else {
+        spec.params.rsa.bits = 2048;
+    }
+    ck_assert_int_eq(APR_SUCCESS, md_pkey_gen(&pkey, g_pool, &spec));
+    return pkey;
+}
+
+/*
+ * Tests
+ */
+
+START_TEST(md_jws_rsa_thumb)
+{
+    md_pkey_t *pkey = gen_key(MD_PKEY_TYPE_RSA);
+    const char *s, *expected, *thumb;
+    
+    s = apr_psprintf(g_pool, "{\"e\":\"%s\",\"kty\":\"RSA\",\"n\":\"%s\"}", 
+                     md_pkey_get_rsa_e64(pkey, g_pool), md_pkey_get_rsa_n64(pkey, g_pool));
+    ck_assert_int_eq(APR_SUCCESS, md_crypt_sha256_digest64(&expected, g_pool, s, strlen(s)));
+    ck_assert_int_eq(APR_SUCCESS, md_jws_pkey_thumb(&thumb, g_pool, pkey));
+    ck_assert_str_eq(expected, thumb);
+    /* memoized */
+    ck_assert_ptr_eq(md_pkey_get_jwk_thumb64(pkey), md_pkey_get_jwk_thumb64(pkey));
+    ck_assert_ptr_eq(md_pkey_get_jwk(pkey), md_pkey_get_jwk(pkey));
+    ck_assert_str_eq("RS256", md_pkey_get_jws_alg(pkey));
+}
+END_TEST
+
+START_TEST(md_jws_ec_thumb)
+{
+    md_pkey_t *pkey = gen_key(MD_PKEY_TYPE_EC);
+    const char *s, *expected, *thumb;
+    
+    s = apr_psprintf(g_pool, "{\"crv\":\"P-384\",\"kty\":\"EC\",\"x\":\"%s\",\"y\":\"%s\"}", 
+                     md_pkey_get_ec_x64(pkey, g_pool), md_pkey_get_ec_y64(pkey, g_pool));
+    ck_assert_int_eq(APR_SUCCESS, md_crypt_sha256_digest64(&expected, g_pool, s, strlen(s)));
+    ck_assert_int_eq(APR_SUCCESS, md_jws_pkey_thumb(&thumb, g_pool, pkey));
+    ck_assert_str_eq(expected, thumb);
+    ck_assert_str_eq("ES384", md_pkey_get_jws_alg(pkey));
+}
+END_TEST
+
+START_TEST(md_jws_sign_repeated)
+{
+    md_pkey_t *pkey = gen_key(MD_PKEY_TYPE_RSA);
+    md_pkey_t *eckey = gen_key(MD_PKEY_TYPE_EC);
+    apr_table_t *hdrs = apr_table_make(g_pool, 5);
+    md_json_t *msg1, *msg2, *prot;
+    const char *s, *sig, *dec;
+    apr_size_t len;
+    int i;
+    
+    apr_table_set(hdrs, "nonce", "abc");
+    apr_table_set(hdrs, "url", "https://acme.example.org/new-authz");
+    ck_assert_int_eq(APR_SUCCESS, md_jws_sign(&msg1, g_pool, "{}", 2, hdrs, pkey, NULL));
+    ck_assert_int_eq(APR_SUCCESS, md_jws_sign(&msg2, g_pool, "{}", 2, hdrs, pkey, NULL));
+    /* PKCS#1 v1.5 is deterministic, a reused digest context must not change that */
+    ck_assert_str_eq(md_json_gets(msg1, "signature", NULL), md_json_gets(msg2, "signature", NULL));
+    
+    len = md_util_base64url_decode(&dec, 
+                                   md_json_gets(msg1, "protected", NULL), g_pool);
+    ck_assert_int_eq(APR_SUCCESS, md_json_readd(&prot, g_pool, dec, len));
+    ck_assert_str_eq("RS256", md_json_gets(prot, "alg", NULL));
+    ck_assert_str_eq("RSA", md_json_gets(prot, "jwk", "kty", NULL));
+    ck_assert_str_eq("abc", md_json_gets(prot, "nonce", NULL));
+    
+    /* ES384 signatures are r||s, 2 * 48 bytes */
+    for (i = 0; i < 10; ++i) {
+        ck_assert_int_eq(APR_SUCCESS, md_crypt_sign64(&sig, eckey, g_pool, "data", 4));
+        ck_assert_int_eq(96, md_util_base64url_decode(&s, sig, g_pool));
+    }
+}
+END_TEST
+
+TCase *md_jws_test_case(void)
+{
+    TCase *testcase = tcase_create("md_jws");
+
+    tcase_add_checked_fixture(testcase, md_jws_setup, md_jws_teardown);
+
+    tcase_add_test(testcase, md_jws_rsa_thumb);
+    tcase_add_test(testcase, md_jws_ec_thumb);
+    tcase_add_test(testcase, md_jws_sign_repeated);
+
+    return testcase;
+}
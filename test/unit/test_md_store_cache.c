@@ -0,0 +1,184 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <apr_file_info.h>
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "test_common.h"
+#include "md.h"
+#include "md_json.h"
+#include "md_store.h"
+#include "md_store_cache.h"
+#include "md_store_fs.h"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+static const char *g_dir;
+static md_store_t *g_fs;
+static md_store_t *g_store;
+
+static void md_store_cache_setup(void)
+{
+    g_dir = test_tmp_dir_setup(&g_pool, "md_store_cache");
+    if (md_store_fs_init(&g_fs, g_pool, g_dir) != APR_SUCCESS
+        || md_store_cache_init(&g_store, g_pool, g_fs, 2) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void md_store_cache_teardown(void)
+{
+    test_tmp_dir_teardown(g_pool, g_dir);
+}
+
+static void save_text(md_store_t *store, const char *name, const char *text)
+{
+    ck_assert_int_eq(APR_SUCCESS, md_store_save(store, g_pool, MD_SG_DOMAINS, name,
+                                                "test.txt", MD_SV_TEXT, (void*)text, 0));
+}
+
+static const char *load_text(const char *name)
+{
+    const char *text = NULL;
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_load(g_store, MD_SG_DOMAINS, name, "test.txt",
+                                                MD_SV_TEXT, (void**)&text, g_pool));
+    return text;
+}
+
+static md_store_cache_stats_t get_stats(void)
+{
+    md_store_cache_stats_t stats;
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_cache_stats_get(&stats, g_store));
+    return stats;
+}
+
+/*
+ * Tests
+ */
+START_TEST(md_store_cache_hit)
+{
+    md_store_cache_stats_t stats;
+
+    save_text(g_store, "a", "one");
+    ck_assert_str_eq("one", load_text("a"));
+    ck_assert_str_eq("one", load_text("a"));
+
+    stats = get_stats();
+    ck_assert_int_eq(1, (int)stats.misses);
+    ck_assert_int_eq(1, (int)stats.hits);
+    ck_assert_int_eq(1, (int)stats.entries);
+}
+END_TEST
+
+START_TEST(md_store_cache_invalidate_on_save)
+{
+    save_text(g_store, "a", "one");
+    ck_assert_str_eq("one", load_text("a"));
+    save_text(g_store, "a", "two");
+    ck_assert_str_eq("two", load_text("a"));
+
+    ck_assert_int_eq(1, (int)get_stats().invalidated);
+}
+END_TEST
+
+START_TEST(md_store_cache_stale_on_backend_change)
+{
+    save_text(g_store, "a", "one");
+    ck_assert_str_eq("one", load_text("a"));
+    /* a change the cache does not see, as done by another process */
+    save_text(g_fs, "a", "second");
+    ck_assert_str_eq("second", load_text("a"));
+
+    ck_assert_int_eq(1, (int)get_stats().stale);
+}
+END_TEST
+
+START_TEST(md_store_cache_evict)
+{
+    save_text(g_store, "a", "one");
+    save_text(g_store, "b", "two");
+    save_text(g_store, "c", "three");
+    load_text("a");
+    load_text("b");
+    load_text("a");
+    load_text("c");
+
+    /* b was least recently used */
+    ck_assert_int_eq(1, (int)get_stats().evicted);
+    ck_assert_int_eq(2, (int)get_stats().entries);
+    load_text("a");
+    ck_assert_int_eq(2, (int)get_stats().hits);
+}
+END_TEST
+
+START_TEST(md_store_cache_json_copy)
+{
+    md_json_t *json, *loaded;
+
+    json = md_json_create(g_pool);
+    md_json_sets("v1", json, "k", NULL);
+    ck_assert_int_eq(APR_SUCCESS, md_store_save_json(g_store, g_pool, MD_SG_DOMAINS, "a",
+                                                     "test.json", json, 0));
+    ck_assert_int_eq(APR_SUCCESS, md_store_load_json(g_store, MD_SG_DOMAINS, "a",
+                                                     "test.json", &loaded, g_pool));
+    /* changing what we got must not change the cached value */
+    md_json_sets("v2", loaded, "k", NULL);
+    ck_assert_int_eq(APR_SUCCESS, md_store_load_json(g_store, MD_SG_DOMAINS, "a",
+                                                     "test.json", &loaded, g_pool));
+    ck_assert_str_eq("v1", md_json_gets(loaded, "k", NULL));
+}
+END_TEST
+
+START_TEST(md_store_cache_commit)
+{
+    md_store_txn_t *txn;
+    const char *text;
+
+    save_text(g_store, "a", "one");
+    ck_assert_str_eq("one", load_text("a"));
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_begin(&txn, g_store, g_pool, MD_SG_DOMAINS, "a"));
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_put(txn, "test.txt", MD_SV_TEXT, "two"));
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_commit(txn, 1));
+    ck_assert_str_eq("two", load_text("a"));
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_load(g_fs, MD_SG_ARCHIVE, "a.1", "test.txt",
+                                                MD_SV_TEXT, (void**)&text, g_pool));
+    ck_assert_str_eq("one", text);
+}
+END_TEST
+
+TCase *md_store_cache_test_case(void)
+{
+    TCase *testcase = tcase_create("md_store_cache");
+
+    tcase_add_checked_fixture(testcase, md_store_cache_setup, md_store_cache_teardown);
+
+    tcase_add_test(testcase, md_store_cache_hit);
+    tcase_add_test(testcase, md_store_cache_invalidate_on_save);
+    tcase_add_test(testcase, md_store_cache_stale_on_backend_change);
+    tcase_add_test(testcase, md_store_cache_evict);
+    tcase_add_test(testcase, md_store_cache_json_copy);
+    tcase_add_test(testcase, md_store_cache_commit);
+
+    return testcase;
+}
@@ -0,0 +1,258 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <apr_file_info.h>
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "test_common.h"
+#include "md.h"
+#include "md_crypt.h"
+#include "md_json.h"
+#include "md_store.h"
+#include "md_store_db.h"
+#include "md_store_fs.h"
+#include "md_util.h"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+static const char *g_dir;
+static const char *g_fname;
+static md_store_t *g_store;
+
+static void md_store_db_setup(void)
+{
+    g_dir = test_tmp_dir_setup(&g_pool, "md_store_db");
+    if (apr_dir_make_recursive(g_dir, MD_FPROT_D_UONLY, g_pool) != APR_SUCCESS) {
+        exit(1);
+    }
+    g_fname = apr_pstrcat(g_pool, g_dir, "/store.db", NULL);
+    if (md_store_db_init(&g_store, g_pool, g_fname) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void md_store_db_teardown(void)
+{
+    test_tmp_dir_teardown(g_pool, g_dir);
+}
+
+static void save_text(md_store_t *store, md_store_group_t group, const char *name,
+                      const char *text)
+{
+    ck_assert_int_eq(APR_SUCCESS, md_store_save(store, g_pool, group, name,
+                                                "test.txt", MD_SV_TEXT, (void*)text, 0));
+}
+
+static apr_status_t load_text(const char **ptext, md_store_t *store,
+                              md_store_group_t group, const char *name)
+{
+    return md_store_load(store, group, name, "test.txt", MD_SV_TEXT, (void**)ptext, g_pool);
+}
+
+static md_store_t *reopen(void)
+{
+    md_store_t *store;
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_db_init(&store, g_pool, g_fname));
+    return store;
+}
+
+/*
+ * Tests
+ */
+START_TEST(md_store_db_text)
+{
+    const char *text;
+
+    ck_assert_int_eq(APR_ENOENT, load_text(&text, g_store, MD_SG_DOMAINS, "a"));
+    save_text(g_store, MD_SG_DOMAINS, "a", "one");
+    save_text(g_store, MD_SG_DOMAINS, "a", "two");
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("two", text);
+    ck_assert_int_eq(APR_EEXIST, md_store_save(g_store, g_pool, MD_SG_DOMAINS, "a", "test.txt",
+                                               MD_SV_TEXT, "three", 1));
+
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, reopen(), MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("two", text);
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_remove(g_store, MD_SG_DOMAINS, "a", "test.txt",
+                                                  g_pool, 0));
+    ck_assert_int_eq(APR_ENOENT, load_text(&text, g_store, MD_SG_DOMAINS, "a"));
+    ck_assert_int_eq(APR_ENOENT, md_store_remove(g_store, MD_SG_DOMAINS, "a", "test.txt",
+                                                 g_pool, 0));
+}
+END_TEST
+
+START_TEST(md_store_db_json_pkey)
+{
+    md_json_t *json, *loaded;
+    md_pkey_spec_t spec;
+    md_pkey_t *pkey, *lkey;
+
+    json = md_json_create(g_pool);
+    md_json_sets("v1", json, "k", NULL);
+    ck_assert_int_eq(APR_SUCCESS, md_store_save_json(g_store, g_pool, MD_SG_ACCOUNTS, "a",
+                                                     "account.json", json, 0));
+
+    spec.type = MD_PKEY_TYPE_EC;
+    spec.params.ec.curve = "P-256";
+    ck_assert_int_eq(APR_SUCCESS, md_pkey_gen(&pkey, g_pool, &spec));
+    ck_assert_int_eq(APR_SUCCESS, md_store_save(g_store, g_pool, MD_SG_ACCOUNTS, "a",
+                                                "account.pem", MD_SV_PKEY, pkey, 0));
+
+    g_store = reopen();
+    ck_assert_int_eq(APR_SUCCESS, md_store_load_json(g_store, MD_SG_ACCOUNTS, "a",
+                                                     "account.json", &loaded, g_pool));
+    ck_assert_str_eq("v1", md_json_gets(loaded, "k", NULL));
+    ck_assert_int_eq(APR_SUCCESS, md_store_load(g_store, MD_SG_ACCOUNTS, "a", "account.pem",
+                                                MD_SV_PKEY, (void**)&lkey, g_pool));
+    ck_assert_str_eq(md_pkey_get_ec_x64(pkey, g_pool), md_pkey_get_ec_x64(lkey, g_pool));
+}
+END_TEST
+
+START_TEST(md_store_db_move_archive)
+{
+    const char *text;
+
+    save_text(g_store, MD_SG_DOMAINS, "a", "old");
+    save_text(g_store, MD_SG_STAGING, "a", "new");
+    ck_assert_int_eq(APR_EEXIST, md_store_move(g_store, g_pool, MD_SG_STAGING,
+                                               MD_SG_DOMAINS, "a", 0));
+    ck_assert_int_eq(APR_SUCCESS, md_store_move(g_store, g_pool, MD_SG_STAGING,
+                                                MD_SG_DOMAINS, "a", 1));
+
+    ck_assert_int_eq(APR_ENOENT, load_text(&text, g_store, MD_SG_STAGING, "a"));
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("new", text);
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, reopen(), MD_SG_ARCHIVE, "a.1"));
+    ck_assert_str_eq("old", text);
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_purge(g_store, g_pool, MD_SG_ARCHIVE, "a.1"));
+    ck_assert_int_eq(APR_ENOENT, load_text(&text, g_store, MD_SG_ARCHIVE, "a.1"));
+}
+END_TEST
+
+START_TEST(md_store_db_commit)
+{
+    md_store_txn_t *txn;
+    const char *text;
+
+    save_text(g_store, MD_SG_DOMAINS, "a", "old");
+    ck_assert_int_eq(APR_SUCCESS, md_store_save(g_store, g_pool, MD_SG_DOMAINS, "a",
+                                                "other.txt", MD_SV_TEXT, "gone", 0));
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_begin(&txn, g_store, g_pool, MD_SG_DOMAINS, "a"));
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_put(txn, "test.txt", MD_SV_TEXT, "new"));
+    ck_assert_int_eq(APR_EEXIST, md_store_txn_commit(txn, 0));
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_commit(txn, 1));
+
+    g_store = reopen();
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("new", text);
+    ck_assert_int_eq(APR_ENOENT, md_store_load(g_store, MD_SG_DOMAINS, "a", "other.txt",
+                                               MD_SV_TEXT, (void**)&text, g_pool));
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_ARCHIVE, "a.1"));
+    ck_assert_str_eq("old", text);
+    ck_assert_int_eq(APR_ENOENT, load_text(&text, g_store, MD_SG_TMP, "a"));
+}
+END_TEST
+
+START_TEST(md_store_db_torn_tail)
+{
+    apr_file_t *f;
+    const char *text;
+
+    save_text(g_store, MD_SG_DOMAINS, "a", "one");
+    /* as if a writer crashed half way */
+    ck_assert_int_eq(APR_SUCCESS, apr_file_open(&f, g_fname, APR_FOPEN_WRITE|APR_FOPEN_APPEND,
+                                                APR_OS_DEFAULT, g_pool));
+    ck_assert_int_eq(APR_SUCCESS, apr_file_write_full(f, "\001\004\000\000garbage", 11, NULL));
+    apr_file_close(f);
+
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, reopen(), MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("one", text);
+    save_text(g_store, MD_SG_DOMAINS, "b", "two");
+    g_store = reopen();
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("one", text);
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "b"));
+    ck_assert_str_eq("two", text);
+}
+END_TEST
+
+START_TEST(md_store_db_compact)
+{
+    const char *text;
+    int i;
+
+    for (i = 0; i < 10; ++i) {
+        save_text(g_store, MD_SG_DOMAINS, "a", apr_itoa(g_pool, i));
+    }
+    save_text(g_store, MD_SG_DOMAINS, "b", "two");
+    ck_assert_int_eq(APR_SUCCESS, md_store_db_compact(g_store, g_pool));
+
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, reopen(), MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("9", text);
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "b"));
+    ck_assert_str_eq("two", text);
+}
+END_TEST
+
+START_TEST(md_store_db_migrate)
+{
+    md_store_t *fs, *fs2;
+    const char *text;
+
+    save_text(g_store, MD_SG_DOMAINS, "a", "one");
+    save_text(g_store, MD_SG_STAGING, "b", "two");
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_fs_init(&fs, g_pool,
+                                                   apr_pstrcat(g_pool, g_dir, "/fs", NULL)));
+    ck_assert_int_eq(APR_SUCCESS, md_store_copy(fs, g_store, g_pool));
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, fs, MD_SG_STAGING, "b"));
+    ck_assert_str_eq("two", text);
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_fs_init(&fs2, g_pool,
+                                                   apr_pstrcat(g_pool, g_dir, "/fs2", NULL)));
+    ck_assert_int_eq(APR_SUCCESS, md_store_db_init(&g_store, g_pool,
+                                                   apr_pstrcat(g_pool, g_dir, "/2.db", NULL)));
+    ck_assert_int_eq(APR_SUCCESS, md_store_copy(g_store, fs, g_pool));
+    ck_assert_int_eq(APR_SUCCESS, md_store_copy(fs2, g_store, g_pool));
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, fs2, MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("one", text);
+}
+END_TEST
+
+TCase *md_store_db_test_case(void)
+{
+    TCase *testcase = tcase_create("md_store_db");
+
+    tcase_add_checked_fixture(testcase, md_store_db_setup, md_store_db_teardown);
+
+    tcase_add_test(testcase, md_store_db_text);
+    tcase_add_test(testcase, md_store_db_json_pkey);
+    tcase_add_test(testcase, md_store_db_move_archive);
+    tcase_add_test(testcase, md_store_db_commit);
+    tcase_add_test(testcase, md_store_db_torn_tail);
+    tcase_add_test(testcase, md_store_db_compact);
+    tcase_add_test(testcase, md_store_db_migrate);
+
+    return testcase;
+}
@@ -0,0 +1,180 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+
+#include <apr_file_info.h>
+#include <apr_file_io.h>
+#include <apr_strings.h>
+
+#include "test_common.h"
+#include "md.h"
+#include "md_json.h"
+#include "md_store.h"
+#include "md_store_db.h"
+#include "md_store_fs.h"
+#include "md_util.h"
+
+/*
+ * Test Fixture -- runs once per test
+ */
+
+static apr_pool_t *g_pool;
+static const char *g_dir;
+static md_store_t *g_store;
+
+static void md_store_fs_setup(void)
+{
+    g_dir = test_tmp_dir_setup(&g_pool, "md_store_fs");
+    if (md_store_fs_init(&g_store, g_pool, g_dir) != APR_SUCCESS) {
+        exit(1);
+    }
+}
+
+static void md_store_fs_teardown(void)
+{
+    test_tmp_dir_teardown(g_pool, g_dir);
+}
+
+static void save_text(md_store_t *store, md_store_group_t group, const char *name,
+                      const char *text)
+{
+    ck_assert_int_eq(APR_SUCCESS, md_store_save(store, g_pool, group, name,
+                                                "test.txt", MD_SV_TEXT, (void*)text, 0));
+}
+
+static apr_status_t load_text(const char **ptext, md_store_t *store,
+                              md_store_group_t group, const char *name)
+{
+    return md_store_load(store, group, name, "test.txt", MD_SV_TEXT, (void**)ptext, g_pool);
+}
+
+static const char *dir_of(md_store_group_t group, const char *name)
+{
+    const char *dir;
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_get_fname(&dir, g_store, group, name, NULL, g_pool));
+    return dir;
+}
+
+/* Leave things as a crash between the two renames of a commit of name does */
+static void commit_torn(const char *name, int renamed)
+{
+    apr_file_t *f;
+    const char *mark;
+
+    save_text(g_store, MD_SG_TMP, name, "new");
+    mark = apr_pstrcat(g_pool, dir_of(MD_SG_TMP, NULL), "/_commit.domains.", name, NULL);
+    ck_assert_int_eq(APR_SUCCESS, apr_file_open(&f, mark, APR_FOPEN_WRITE|APR_FOPEN_CREATE,
+                                                MD_FPROT_F_UONLY, g_pool));
+    apr_file_close(f);
+    if (renamed) {
+        ck_assert_int_eq(APR_SUCCESS, apr_dir_make_recursive(dir_of(MD_SG_ARCHIVE, NULL),
+                                                             MD_FPROT_D_UONLY, g_pool));
+        ck_assert_int_eq(APR_SUCCESS,
+                         apr_file_rename(dir_of(MD_SG_DOMAINS, name),
+                                         apr_pstrcat(g_pool, dir_of(MD_SG_ARCHIVE, name),
+                                                     ".1", NULL), g_pool));
+    }
+}
+
+/*
+ * Tests
+ */
+START_TEST(md_store_fs_commit)
+{
+    md_store_txn_t *txn;
+    const char *text;
+
+    save_text(g_store, MD_SG_DOMAINS, "a", "old");
+    ck_assert_int_eq(APR_SUCCESS, md_store_save(g_store, g_pool, MD_SG_DOMAINS, "a",
+                                                "other.txt", MD_SV_TEXT, "gone", 0));
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_begin(&txn, g_store, g_pool, MD_SG_DOMAINS, "a"));
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_put(txn, "test.txt", MD_SV_TEXT, "new"));
+    ck_assert_int_eq(APR_EEXIST, md_store_txn_commit(txn, 0));
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_commit(txn, 1));
+
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("new", text);
+    ck_assert_int_eq(APR_ENOENT, md_store_load(g_store, MD_SG_DOMAINS, "a", "other.txt",
+                                               MD_SV_TEXT, (void**)&text, g_pool));
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_ARCHIVE, "a.1"));
+    ck_assert_str_eq("old", text);
+    ck_assert_int_eq(APR_ENOENT, load_text(&text, g_store, MD_SG_TMP, "a"));
+
+    /* again, into a fresh name */
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_begin(&txn, g_store, g_pool, MD_SG_DOMAINS, "b"));
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_put(txn, "test.txt", MD_SV_TEXT, "first"));
+    ck_assert_int_eq(APR_SUCCESS, md_store_txn_commit(txn, 0));
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "b"));
+    ck_assert_str_eq("first", text);
+}
+END_TEST
+
+START_TEST(md_store_fs_commit_recover)
+{
+    const char *text;
+
+    save_text(g_store, MD_SG_DOMAINS, "a", "old");
+    save_text(g_store, MD_SG_DOMAINS, "b", "old");
+    /* a crashed between the renames, b before the first one */
+    commit_torn("a", 1);
+    commit_torn("b", 0);
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_fs_init(&g_store, g_pool, g_dir));
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "a"));
+    ck_assert_str_eq("new", text);
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_ARCHIVE, "a.1"));
+    ck_assert_str_eq("old", text);
+    ck_assert_int_eq(APR_SUCCESS, load_text(&text, g_store, MD_SG_DOMAINS, "b"));
+    ck_assert_str_eq("old", text);
+
+    ck_assert_int_eq(APR_ENOENT, md_util_is_file(apr_pstrcat(g_pool, dir_of(MD_SG_TMP, NULL),
+                                                             "/_commit.domains.a", NULL),
+                                                 g_pool));
+    ck_assert_int_eq(APR_ENOENT, md_util_is_file(apr_pstrcat(g_pool, dir_of(MD_SG_TMP, NULL),
+                                                             "/_commit.domains.b", NULL),
+                                                 g_pool));
+}
+END_TEST
+
+START_TEST(md_store_fs_not_fs)
+{
+    md_store_t *db;
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_fs_convert(g_store, g_pool, MD_JSON_FMT_COMPACT));
+    ck_assert_int_eq(MD_JSON_FMT_COMPACT, md_store_fs_json_fmt_get(g_store));
+
+    ck_assert_int_eq(APR_SUCCESS, md_store_db_init(&db, g_pool,
+                                                   apr_pstrcat(g_pool, g_dir, ".db", NULL)));
+    ck_assert_int_eq(APR_ENOTIMPL, md_store_fs_convert(db, g_pool, MD_JSON_FMT_COMPACT));
+    ck_assert_int_eq(MD_JSON_FMT_INDENT, md_store_fs_json_fmt_get(db));
+    ck_assert_int_eq(APR_ENOTIMPL, md_store_fs_watch_start(db, g_pool));
+    apr_file_remove(apr_pstrcat(g_pool, g_dir, ".db", NULL), g_pool);
+}
+END_TEST
+
+TCase *md_store_fs_test_case(void)
+{
+    TCase *testcase = tcase_create("md_store_fs");
+
+    tcase_add_checked_fixture(testcase, md_store_fs_setup, md_store_fs_teardown);
+
+    tcase_add_test(testcase, md_store_fs_commit);
+    tcase_add_test(testcase, md_store_fs_commit_recover);
+    tcase_add_test(testcase, md_store_fs_not_fs);
+
+    return testcase;
+}
@@ -12,7 +12,11 @@
  * limitations under the License.
  */
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+
+#include <apr_time.h>
 
 #include "test_common.h"
 #include "md_util.h"
@@ -97,6 +101,61 @@ START_TEST(base64_md_util_largetrip)
 }
 END_TEST
 
+/* encode and decode with the scalar and the selected implementation, compare */
+static void base64_compare(const char *buf_in, size_t buf_len, const char *impl)
+{
+    char enc[MD_BASE64URL_ENC_LEN(512) + 1], ref_enc[MD_BASE64URL_ENC_LEN(512) + 1];
+    char orig[MD_BASE64URL_ENC_LEN(512) + 1];
+    char dec[MD_BASE64URL_DEC_LEN(MD_BASE64URL_ENC_LEN(512))];
+    char ref_dec[MD_BASE64URL_DEC_LEN(MD_BASE64URL_ENC_LEN(512))];
+    apr_size_t len, ref_len, i;
+    
+    md_util_base64url_impl(0);
+    ref_len = md_util_base64url_encode_to(ref_enc, buf_in, buf_len);
+    md_util_base64url_impl(1);
+    len = md_util_base64url_encode_to(enc, buf_in, buf_len);
+    ck_assert_msg(len == ref_len && !strcmp(enc, ref_enc), 
+                  "%s encoding of %d bytes differs", impl, (int)buf_len);
+    strcpy(orig, enc);
+    
+    /* a char outside the alphabet ends the decoding, wherever it appears */
+    for (i = 0; i <= len; i += (len > 64)? 7 : 1) {
+        if (i < len) {
+            enc[i] = "=+/. \x80"[i % 6];
+        }
+        strcpy(ref_enc, enc);
+        md_util_base64url_impl(0);
+        ref_len = md_util_base64url_decode_to(ref_dec, ref_enc, len);
+        md_util_base64url_impl(1);
+        ck_assert_int_eq(ref_len, md_util_base64url_decode_to(dec, enc, len));
+        ck_assert_mem_eq(dec, ref_dec, ref_len);
+        if (i == len) {
+            ck_assert_int_eq(buf_len, ref_len);
+            ck_assert_mem_eq(dec, buf_in, buf_len);
+        }
+        else {
+            enc[i] = orig[i];
+        }
+    }
+}
+
+START_TEST(base64_md_util_simd)
+{
+    char buffer[512];
+    const char *impl;
+    int len, i;
+    
+    impl = md_util_base64url_impl(1);
+    srand(4711);
+    for (len = 0; len < 512; ++len) {
+        for (i = 0; i < len; ++i) {
+            buffer[i] = (char)rand();
+        }
+        base64_compare(buffer, (size_t)len, impl);
+    }
+}
+END_TEST
+
 TCase *md_util_test_case(void)
 {
     TCase *testcase = tcase_create("md_util");
@@ -105,6 +164,69 @@ TCase *md_util_test_case(void)
 
     tcase_add_test(testcase, base64_md_util_roundtrip);
     tcase_add_test(testcase, base64_md_util_largetrip);
+    tcase_add_test(testcase, base64_md_util_simd);
+
+    return testcase;
+}
+
+/*
+ * Benchmarks
+ */
+static double base64_mbs(int simd, int encode, const char *data, apr_size_t len, 
+                         char *buf, int n)
+{
+    apr_time_t start, t;
+    int i;
+    
+    md_util_base64url_impl(simd);
+    start = apr_time_now();
+    for (i = 0; i < n; ++i) {
+        if (encode) {
+            md_util_base64url_encode_to(buf, data, len);
+        }
+        else {
+            md_util_base64url_decode_to(buf, data, len);
+        }
+    }
+    t = apr_time_now() - start;
+    return (double)len * n / (t > 0? (double)t : 1.0);
+}
+
+START_TEST(base64_md_util_throughput)
+{
+    apr_size_t i, len = 64 * 1024;
+    char *data, *enc, *dec;
+    const char *impl;
+    double scalar, simd;
+    int n = 200;
+    
+    data = apr_palloc(g_pool, len);
+    enc = apr_palloc(g_pool, MD_BASE64URL_ENC_LEN(len) + 1);
+    dec = apr_palloc(g_pool, MD_BASE64URL_DEC_LEN(MD_BASE64URL_ENC_LEN(len)));
+    for (i = 0; i < len; ++i) {
+        data[i] = (char)(i * 7 + (i >> 8));
+    }
+    impl = md_util_base64url_impl(1);
+    md_util_base64url_encode_to(enc, data, len);
+    
+    scalar = base64_mbs(0, 1, data, len, enc, n);
+    simd = base64_mbs(1, 1, data, len, enc, n);
+    fprintf(stderr, "base64url encode: %.0f MB/s scalar, %.0f MB/s %s\n", scalar, simd, impl);
+    
+    len = MD_BASE64URL_ENC_LEN(len);
+    scalar = base64_mbs(0, 0, enc, len, dec, n);
+    simd = base64_mbs(1, 0, enc, len, dec, n);
+    fprintf(stderr, "base64url decode: %.0f MB/s scalar, %.0f MB/s %s\n", scalar, simd, impl);
+}
+END_TEST
+
+TCase *md_util_bench_case(void)
+{
+    TCase *testcase = tcase_create("md_util_bench");
+
+    tcase_add_checked_fixture(testcase, md_util_setup, md_util_teardown);
+
+    tcase_add_test(testcase, base64_md_util_throughput);
 
     return testcase;
 }
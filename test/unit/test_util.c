@@ -0,0 +1,43 @@
+/*
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ * http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <apr_file_info.h>
+#include <apr_strings.h>
+
+#include "test_common.h"
+#include "md_crypt.h"
+#include "md_util.h"
+
+const char *test_tmp_dir_setup(apr_pool_t **ppool, const char *name)
+{
+    const char *tmp, *dir;
+
+    if (apr_pool_create(ppool, NULL) != APR_SUCCESS
+        || md_crypt_init(*ppool) != APR_SUCCESS
+        || apr_temp_dir_get(&tmp, *ppool) != APR_SUCCESS) {
+        exit(1);
+    }
+    dir = apr_psprintf(*ppool, "%s/%s_test_%d", tmp, name, (int)getpid());
+    md_util_rm_recursive(dir, *ppool, 5);
+    return dir;
+}
+
+void test_tmp_dir_teardown(apr_pool_t *pool, const char *dir)
+{
+    md_util_rm_recursive(dir, pool, 5);
+    apr_pool_destroy(pool);
+}